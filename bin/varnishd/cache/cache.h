@@ -118,11 +118,14 @@ struct busyobj;
 struct cli;
 struct cli_proto;
 struct director;
+struct gzc;
+struct hsh_vspec;
 struct iovec;
 struct mempool;
 struct objcore;
 struct object;
 struct objhead;
+struct ofl;
 struct pool;
 struct poolparam;
 struct sess;
@@ -134,6 +137,7 @@ struct vsb;
 struct waitinglist;
 struct worker;
 struct wrw;
+struct wrw_hold;
 
 #define DIGEST_LEN		32
 
@@ -281,6 +285,15 @@ struct vsl_log {
 	unsigned		wid;
 };
 
+/*--------------------------------------------------------------------
+ * VCL profile counters, in VSM, see VRT_prof_count()
+ */
+
+struct vrt_prof {
+	uint64_t		count;
+	uint64_t		ticks;
+};
+
 /*--------------------------------------------------------------------*/
 
 struct vxid_pool {
@@ -335,10 +348,13 @@ struct worker {
 	double			lastused;
 
 	struct wrw		*wrw;
+	struct wrw_hold		*wrw_hold;
 
 	pthread_cond_t		cond;
 
-	struct VCL_conf		*vcl;
+	/* Which VCLs we may be using, see cache_vcl.c */
+	volatile unsigned	vcl_qgen;
+	VTAILQ_ENTRY(worker)	vcl_list;
 
 	struct ws		aws[1];
 
@@ -414,6 +430,12 @@ struct objcore {
 	VTAILQ_ENTRY(objcore)	lru_list;
 	VTAILQ_ENTRY(objcore)	ban_list;
 	struct ban		*ban;
+	struct gzc		*gzc;		/* Gunzip'ed variant */
+
+	/* Objhead variant index, see cache_hash.c */
+	VTAILQ_ENTRY(objcore)	vary_list;
+	struct hsh_vspec	*vary_spec;	/* NULL: not indexed */
+	uint32_t		vary_key;
 };
 
 static inline unsigned
@@ -610,6 +632,7 @@ struct req {
 	unsigned		handling;
 	unsigned char		reqbodydone;
 	unsigned char		wantbody;
+	unsigned char		vcl_held;
 
 	uint16_t		err_code;
 	const char		*err_reason;
@@ -617,6 +640,10 @@ struct req {
 	struct director		*director;
 	struct VCL_conf		*vcl;
 
+	/* VCL profiling, the ref being executed and since when */
+	unsigned		vcl_prof_ref;
+	uint64_t		vcl_prof_t;
+
 	uint64_t		req_bodybytes;
 	char			*ws_req;	/* WS above request data */
 
@@ -653,6 +680,9 @@ struct req {
 #define RES_ESI_CHILD		(1<<5)
 #define RES_GUNZIP		(1<<6)
 
+	/* Rest of the body, for the offload thread */
+	struct ofl		*ofl;
+
 	/* Transaction VSL buffer */
 	struct vsl_log		vsl[1];
 
@@ -676,6 +706,7 @@ struct sess {
 
 	enum sess_step		sess_step;
 	int			fd;
+	unsigned char		nonblock;	/* fd in O_NONBLOCK mode */
 	enum sess_close		reason;
 	uint32_t		vxid;
 
@@ -737,6 +768,12 @@ struct backend *VBE_AddBackend(struct cli *cli, const struct vrt_backend *vb);
 /* cache_backend_poll.c */
 void VBP_Init(void);
 
+/* cache_backend_warm.c */
+void VBW_Init(void);
+
+/* cache_dir_dns.c */
+void VDI_DNS_Init(void);
+
 /* cache_ban.c */
 struct ban *BAN_New(void);
 int BAN_AddTest(struct cli *, struct ban *, const char *, const char *,
@@ -745,6 +782,7 @@ void BAN_Free(struct ban *b);
 void BAN_Insert(struct ban *b);
 void BAN_Init(void);
 void BAN_NewObjCore(struct objcore *oc);
+void BAN_CopyObjCore(struct objcore *oc, const struct objcore *src);
 void BAN_DestroyObj(struct objcore *oc);
 int BAN_CheckObject(struct object *o, struct req *sp);
 void BAN_Reload(const uint8_t *ban, unsigned len);
@@ -789,7 +827,8 @@ void EXP_Inject(struct objcore *oc, struct lru *lru, double when);
 void EXP_Init(void);
 void EXP_Rearm(const struct object *o);
 int EXP_Touch(struct objcore *oc);
-int EXP_NukeOne(struct busyobj *, struct lru *lru);
+struct objcore *EXP_Evict(struct lru *lru);
+int EXP_NukeOne(struct vsl_log *, struct dstat *, struct lru *lru);
 
 /* cache_fetch.c */
 struct storage *FetchStorage(struct busyobj *, ssize_t sz);
@@ -828,6 +867,12 @@ enum vgzret_e VGZ_WrwGunzip(struct req *, struct vgz *, const void *ibuf,
     ssize_t ibufl);
 void VGZ_WrwFlush(struct req *, struct vgz *vg);
 
+/* cache_gzcache.c */
+void GZC_Init(void);
+int GZC_Deliver(struct req *, struct gzc **);
+void GZC_Rel(struct gzc **);
+void GZC_Drop(struct objcore *);
+
 /* cache_http.c */
 unsigned HTTP_estimate(unsigned nhttp);
 void HTTP_Copy(struct http *to, const struct http * const fm);
@@ -880,8 +925,10 @@ void HTC_Init(struct http_conn *htc, struct ws *ws, int fd, struct vsl_log *,
     unsigned maxbytes, unsigned maxhdr);
 enum htc_status_e HTC_Reinit(struct http_conn *htc);
 enum htc_status_e HTC_Rx(struct http_conn *htc);
+enum htc_status_e HTC_RxNoWait(struct http_conn *htc);
 ssize_t HTC_Read(struct http_conn *htc, void *d, size_t len);
 enum htc_status_e HTC_Complete(struct http_conn *htc);
+int HTC_Pipelined(const struct http_conn *htc);
 
 #define HTTPH(a, b, c) extern char b[];
 #include "tbl/http_headers.h"
@@ -927,6 +974,14 @@ void MPL_Destroy(struct mempool **mpp);
 void *MPL_Get(struct mempool *mpl, unsigned *size);
 void MPL_Free(struct mempool *mpl, void *item);
 
+/* cache_offload.c */
+void OFL_Init(void);
+struct ofl *OFL_New(struct req *req, ssize_t low, ssize_t high);
+void OFL_TakeObj(struct ofl *ofl, struct object **oo);
+void OFL_Abandon(struct worker *wrk, struct ofl **pofl);
+void OFL_Start(struct worker *wrk, struct ofl **pofl, struct sess *sp,
+    enum sess_close doclose);
+
 /* cache_panic.c */
 void PAN_Init(void);
 
@@ -945,6 +1000,9 @@ void WRW_EndChunk(const struct worker *w);
 void WRW_Reserve(struct worker *w, int *fd, struct vsl_log *, double t0);
 unsigned WRW_Flush(const struct worker *w);
 unsigned WRW_FlushRelease(struct worker *w);
+unsigned WRW_HoldRelease(struct worker *w, unsigned limit);
+unsigned WRW_FlushHold(struct worker *w);
+void WRW_FreeHold(struct worker *w);
 unsigned WRW_Write(const struct worker *w, const void *ptr, int len);
 unsigned WRW_WriteH(const struct worker *w, const txt *hh, const char *suf);
 
@@ -991,13 +1049,22 @@ void RES_WriteObj(struct req *);
 /* cache_vary.c */
 struct vsb *VRY_Create(struct req *sp, const struct http *hp);
 int VRY_Match(struct req *, const uint8_t *vary);
+uint32_t VRY_Hash(const uint8_t *vary);
+int VRY_Key(struct req *, const uint8_t *vary, uint32_t *key);
+unsigned VRY_Len(const uint8_t *vary);
+int VRY_SameSpec(const uint8_t *v1, const uint8_t *v2);
 void VRY_Validate(const uint8_t *vary);
 void VRY_Prep(struct req *);
 
 /* cache_vcl.c */
 void VCL_Init(void);
-void VCL_Refresh(struct VCL_conf **vcc);
-void VCL_Rel(struct VCL_conf **vcc);
+void VCL_Ref(struct req *);
+void VCL_Hold(struct req *);
+void VCL_Rel(struct req *);
+void VCL_AddWorker(struct worker *);
+void VCL_DelWorker(struct worker *);
+void VCL_Quiesce(struct worker *);
+void VCL_Idle(struct worker *);
 void VCL_Poll(void);
 const char *VCL_Return_Name(unsigned method);
 
@@ -1013,6 +1080,9 @@ char *VRT_StringList(char *d, unsigned dl, const char *p, va_list ap);
 void ESI_Deliver(struct req *);
 void ESI_DeliverChild(struct req *);
 
+/* cache_vrt_re.c */
+void VRT_re_Init(void);
+
 /* cache_vrt_vmod.c */
 void VMOD_Init(void);
 
@@ -1058,6 +1128,9 @@ void STV_open(void);
 void STV_close(void);
 void STV_Freestore(struct object *o);
 
+/* stevedore_tier.c */
+void STV_Hit(struct objcore *, struct object *);
+
 /* storage_synth.c */
 struct vsb *SMS_Makesynth(struct object *obj);
 void SMS_Finish(struct object *obj);
@@ -189,8 +189,17 @@ VCA_Accept(struct listen_sock *ls, struct wrk_accept *wa)
 
 	wa->acceptaddrlen = sizeof wa->acceptaddr;
 	do {
+#ifdef HAVE_ACCEPT4
+		/*
+		 * No SOCK_NONBLOCK, sessions start out in blocking mode,
+		 * see HTTP1_Session().
+		 */
+		i = accept4(ls->sock, (void*)&wa->acceptaddr,
+			   &wa->acceptaddrlen, SOCK_CLOEXEC);
+#else
 		i = accept(ls->sock, (void*)&wa->acceptaddr,
 			   &wa->acceptaddrlen);
+#endif
 	} while (i < 0 && errno == EAGAIN);
 
 	if (i < 0) {
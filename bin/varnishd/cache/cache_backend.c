@@ -32,7 +32,6 @@
 
 #include "config.h"
 
-#include <poll.h>
 #include <stdlib.h>
 #include <stddef.h>
 #include <stdio.h>
@@ -42,6 +41,7 @@
 #include "cache_backend.h"
 #include "vrt.h"
 #include "vtcp.h"
+#include "vtim.h"
 
 static struct mempool	*vbcpool;
 
@@ -84,7 +84,10 @@ VBE_ReleaseConn(struct vbc *vc)
 	CHECK_OBJ_NOTNULL(vc, VBC_MAGIC);
 	assert(vc->backend == NULL);
 	assert(vc->fd < 0);
-	MPL_Free(vbcpool, vc);
+	if (vc->watched)
+		VBW_Release(vc);
+	else
+		MPL_Free(vbcpool, vc);
 }
 
 #define FIND_TMO(tmx, dst, req, be)					\
@@ -143,8 +146,10 @@ bes_conn_try(struct req *req, struct vbc *vc, const struct vdi_simple *vs)
 	struct backend *bp = vs->backend;
 	char abuf1[VTCP_ADDRBUFSIZE];
 	char pbuf1[VTCP_PORTBUFSIZE];
+	double t0;
 
 	CHECK_OBJ_NOTNULL(vs, VDI_SIMPLE_MAGIC);
+	t0 = VTIM_real();
 
 	Lck_Lock(&bp->mtx);
 	bp->refcount++;
@@ -181,6 +186,10 @@ bes_conn_try(struct req *req, struct vbc *vc, const struct vdi_simple *vs)
 		vc->addr = NULL;
 		vc->addrlen = 0;
 	} else {
+		Lck_Lock(&bp->mtx);
+		bp->vsc->connects++;
+		bp->vsc->connect_usec += (uint64_t)(1e6 * (VTIM_real() - t0));
+		Lck_Unlock(&bp->mtx);
 		VTCP_myname(s, abuf1, sizeof abuf1, pbuf1, sizeof pbuf1);
 		VSLb(req->vsl, SLT_BackendOpen, "%d %s %s %s ",
 		    vc->fd, vs->backend->display_name, abuf1, pbuf1);
@@ -188,31 +197,14 @@ bes_conn_try(struct req *req, struct vbc *vc, const struct vdi_simple *vs)
 
 }
 
-/*--------------------------------------------------------------------
- * Check that there is still something at the far end of a given socket.
- * We poll the fd with instant timeout, if there are any events we can't
- * use it (backends are not allowed to pipeline).
- */
-
-static int
-vbe_CheckFd(int fd)
-{
-	struct pollfd pfd;
-
-	pfd.fd = fd;
-	pfd.events = POLLIN;
-	pfd.revents = 0;
-	return(poll(&pfd, 1, 0) == 0);
-}
-
 /*--------------------------------------------------------------------
  * Manage a pool of vbc structures.
  * XXX: as an experiment, make this caching controled by a parameter
  * XXX: so we can see if it has any effect.
  */
 
-static struct vbc *
-vbe_NewConn(void)
+struct vbc *
+VBE_NewConn(void)
 {
 	struct vbc *vc;
 
@@ -316,6 +308,8 @@ vbe_GetVbe(struct req *req, struct vdi_simple *vs)
 {
 	struct vbc *vc;
 	struct backend *bp;
+	char abuf[VTCP_ADDRBUFSIZE];
+	char pbuf[VTCP_PORTBUFSIZE];
 
 	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
 	CHECK_OBJ_NOTNULL(vs, VDI_SIMPLE_MAGIC);
@@ -332,11 +326,12 @@ vbe_GetVbe(struct req *req, struct vdi_simple *vs)
 			assert(vc->fd >= 0);
 			AN(vc->addr);
 			VTAILQ_REMOVE(&bp->connlist, vc, list);
+			vc->idle = 0;
 		}
 		Lck_Unlock(&bp->mtx);
 		if (vc == NULL)
 			break;
-		if (vbe_CheckFd(vc->fd)) {
+		if (!VBW_Stale(vc)) {
 			/* XXX locking of stats */
 			VSC_C_main->backend_reuse += 1;
 			VSLb(req->vsl, SLT_Backend, "%d %s %s",
@@ -365,13 +360,55 @@ vbe_GetVbe(struct req *req, struct vdi_simple *vs)
 		return (NULL);
 	}
 
+	/* then for connections the warm-up thread opened for us */
+	while (1) {
+		Lck_Lock(&bp->mtx);
+		vc = VTAILQ_FIRST(&bp->warmlist);
+		if (vc != NULL) {
+			bp->refcount++;
+			assert(vc->backend == bp);
+			assert(vc->fd >= 0);
+			AN(vc->addr);
+			VTAILQ_REMOVE(&bp->warmlist, vc, list);
+			vc->idle = 0;
+			bp->n_warm--;
+			bp->vsc->warm = bp->n_warm;
+			bp->vsc->warm_hit++;
+		} else if (cache_param->backend_warm > 0)
+			bp->vsc->warm_miss++;
+		Lck_Unlock(&bp->mtx);
+		if (cache_param->backend_warm > 0)
+			VBW_Kick();
+		if (vc == NULL)
+			break;
+		if (!VBW_Stale(vc)) {
+			VSC_C_main->backend_conn++;
+			VTCP_myname(vc->fd, abuf, sizeof abuf,
+			    pbuf, sizeof pbuf);
+			VSLb(req->vsl, SLT_BackendOpen, "%d %s %s %s ",
+			    vc->fd, bp->display_name, abuf, pbuf);
+			VSLb(req->vsl, SLT_Backend, "%d %s %s",
+			    vc->fd, req->director->vcl_name,
+			    bp->display_name);
+			vc->vdis = vs;
+			/* It may have gone stale while idle, allow retry */
+			vc->recycled = 1;
+			return (vc);
+		}
+		VSC_C_main->backend_toolate++;
+		VTCP_close(&vc->fd);
+		VBE_DropRefConn(bp);
+		vc->backend = NULL;
+		VBE_ReleaseConn(vc);
+	}
+
 	if (vs->vrt->max_connections > 0 &&
 	    bp->n_conn >= vs->vrt->max_connections) {
 		VSC_C_main->backend_busy++;
 		return (NULL);
 	}
 
-	vc = vbe_NewConn();
+	vc = VBE_NewConn();
 	assert(vc->fd == -1);
 	AZ(vc->backend);
 	bes_conn_try(req, vc, vs);
@@ -408,6 +445,83 @@ vdi_get_backend_if_simple(const struct director *d)
 	return (vs->backend);
 }
 
+/*--------------------------------------------------------------------
+ * Fetches in progress on the backend behind a simple director.
+ * Every connection in use holds a reference, so do the VCLs.
+ * Directors should call this once per backend and pick.
+ */
+
+unsigned
+VBE_Busy(const struct director *d)
+{
+	struct backend *b;
+	int i;
+
+	b = vdi_get_backend_if_simple(d);
+	if (b == NULL)
+		return (0);
+	Lck_Lock(&b->mtx);
+	i = b->refcount - (int)b->vsc->vcls;
+	Lck_Unlock(&b->mtx);
+	return (i > 0 ? i : 0);
+}
+
+/*--------------------------------------------------------------------
+ * Time to first byte, as an exponentially weighted moving average.
+ *
+ * A fetch which fails before the first byte arrives counts as taking
+ * the first_byte_timeout, so that a backend which never answers does
+ * not look like one which was never measured.
+ */
+
+#define VBE_TTFB_WEIGHT	8
+
+void
+VBE_Ttfb(const struct vbc *vc, double t)
+{
+	struct backend *b;
+
+	CHECK_OBJ_NOTNULL(vc, VBC_MAGIC);
+	b = vc->backend;
+	CHECK_OBJ_NOTNULL(b, BACKEND_MAGIC);
+	if (t < 0.)
+		t = 0.;
+	Lck_Lock(&b->mtx);
+	if (!b->ttfb_valid)
+		b->ttfb = t;
+	else
+		b->ttfb += (t - b->ttfb) / VBE_TTFB_WEIGHT;
+	b->ttfb_valid = 1;
+	b->vsc->ttfb_ewma = (uint64_t)(b->ttfb * 1e6);
+	Lck_Unlock(&b->mtx);
+}
+
+void
+VBE_TtfbFail(const struct vbc *vc)
+{
+
+	CHECK_OBJ_NOTNULL(vc, VBC_MAGIC);
+	VBE_Ttfb(vc, vc->first_byte_timeout);
+}
+
+/*
+ * Read without locking, this is a hint for the directors.
+ * Returns zero if the backend has not been measured yet.
+ */
+int
+VBE_GetTtfb(const struct director *d, double *t)
+{
+	struct backend *b;
+
+	AN(t);
+	*t = 0.;
+	b = vdi_get_backend_if_simple(d);
+	if (b == NULL || !b->ttfb_valid)
+		return (0);
+	*t = b->ttfb;
+	return (1);
+}
+
 /*--------------------------------------------------------------------
  *
  */
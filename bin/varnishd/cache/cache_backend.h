@@ -133,7 +133,21 @@ struct backend {
 	socklen_t		ipv6len;
 
 	unsigned		n_conn;
-	VTAILQ_HEAD(, vbc)	connlist;
+	VTAILQ_HEAD(vbc_head, vbc)	connlist;
+
+	/* Connections opened ahead of use, see cache_backend_warm.c */
+	VTAILQ_ENTRY(backend)	warm_list;
+	unsigned		n_warm;
+	unsigned		n_warming;
+	struct vbc_head		warmlist;
+	double			t_warmfail;
+	double			connect_timeout;
+	double			idle_timeout;
+	unsigned		max_connections;
+
+	/* EWMA of time to first byte, see VBE_Ttfb() */
+	double			ttfb;
+	unsigned		ttfb_valid;
 
 	struct vbp_target	*probe;
 	unsigned		healthy;
@@ -160,20 +174,39 @@ struct vbc {
 
 	uint8_t			recycled;
 
+	/* Idle connection tracking, see cache_backend_warm.c */
+	uint8_t			idle;
+	uint8_t			watched;
+	volatile uint8_t	stale;
+	double			t_idle;
+
 	/* Timeouts */
 	double			first_byte_timeout;
 	double			between_bytes_timeout;
 };
 
 /* cache_backend.c */
+struct vbc *VBE_NewConn(void);
 void VBE_ReleaseConn(struct vbc *vc);
 struct backend *vdi_get_backend_if_simple(const struct director *d);
+unsigned VBE_Busy(const struct director *d);
+void VBE_Ttfb(const struct vbc *vc, double t);
+void VBE_TtfbFail(const struct vbc *vc);
+int VBE_GetTtfb(const struct director *d, double *t);
 
 /* cache_backend_cfg.c */
 void VBE_DropRefConn(struct backend *);
 void VBE_DropRefVcl(struct backend *);
 void VBE_DropRefLocked(struct backend *b);
 
+/* cache_backend_warm.c */
+void VBW_Insert(struct backend *b);
+void VBW_Remove(struct backend *b);
+void VBW_Kick(void);
+void VBW_Idle(struct vbc *vc);
+int VBW_Stale(const struct vbc *vc);
+void VBW_Release(struct vbc *vc);
+
 /* cache_backend_poll.c */
 void VBP_Insert(struct backend *b, struct vrt_backend_probe const *p,
     const char *hosthdr);
@@ -186,7 +219,10 @@ typedef void dir_init_f(struct cli *, struct director **, int , const void*);
 dir_init_f VRT_init_dir_simple;
 dir_init_f VRT_init_dir_dns;
 dir_init_f VRT_init_dir_hash;
+dir_init_f VRT_init_dir_chash;
 dir_init_f VRT_init_dir_random;
 dir_init_f VRT_init_dir_round_robin;
 dir_init_f VRT_init_dir_fallback;
 dir_init_f VRT_init_dir_client;
+dir_init_f VRT_init_dir_least_conn;
+dir_init_f VRT_init_dir_least_latency;
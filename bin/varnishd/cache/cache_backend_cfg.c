@@ -57,6 +57,9 @@ VBE_Nuke(struct backend *b)
 {
 
 	ASSERT_CLI();
+	AZ(b->n_warming);
+	assert(VTAILQ_EMPTY(&b->warmlist));
+	VBW_Remove(b);
 	VTAILQ_REMOVE(&backends, b, list);
 	free(b->ipv4);
 	free(b->ipv4_addr);
@@ -83,7 +86,8 @@ VBE_Poll(void)
 			b->admin_health == ah_sick ||
 			b->admin_health == ah_probe
 		);
-		if (b->refcount == 0 && b->probe == NULL)
+		if (b->refcount == 0 && b->probe == NULL &&
+		    b->n_warming == 0)
 			VBE_Nuke(b);
 	}
 }
@@ -92,33 +96,51 @@ VBE_Poll(void)
  * Drop a reference to a backend.
  * The last reference must come from the watcher in the CLI thread,
  * as only that thread is allowed to clean up the backend list.
+ *
+ * If the warm-up thread still has connects in flight, the backend
+ * is left for VBE_Poll() to clean up.
  */
 
-void
-VBE_DropRefLocked(struct backend *b)
+static unsigned
+vbe_CloseList(struct vbc_head *head)
 {
-	int i;
 	struct vbc *vbe, *vbe2;
+	unsigned n = 0;
 
-	CHECK_OBJ_NOTNULL(b, BACKEND_MAGIC);
-	assert(b->refcount > 0);
-
-	i = --b->refcount;
-	Lck_Unlock(&b->mtx);
-	if (i > 0)
-		return;
-
-	ASSERT_CLI();
-	VTAILQ_FOREACH_SAFE(vbe, &b->connlist, list, vbe2) {
-		VTAILQ_REMOVE(&b->connlist, vbe, list);
+	VTAILQ_FOREACH_SAFE(vbe, head, list, vbe2) {
+		VTAILQ_REMOVE(head, vbe, list);
 		if (vbe->fd >= 0) {
 			AZ(close(vbe->fd));
 			vbe->fd = -1;
 		}
 		vbe->backend = NULL;
 		VBE_ReleaseConn(vbe);
+		n++;
 	}
-	VBE_Nuke(b);
+	return (n);
+}
+
+void
+VBE_DropRefLocked(struct backend *b)
+{
+	int i;
+	unsigned w;
+
+	CHECK_OBJ_NOTNULL(b, BACKEND_MAGIC);
+	assert(b->refcount > 0);
+
+	i = --b->refcount;
+	if (i == 0) {
+		ASSERT_CLI();
+		b->n_conn -= vbe_CloseList(&b->connlist);
+		b->n_conn -= vbe_CloseList(&b->warmlist);
+		b->n_warm = 0;
+		b->vsc->warm = 0;
+	}
+	w = b->n_warming;
+	Lck_Unlock(&b->mtx);
+	if (i == 0 && w == 0)
+		VBE_Nuke(b);
 }
 
 void
@@ -210,6 +232,10 @@ VBE_AddBackend(struct cli *cli, const struct vrt_backend *vb)
 	b->vsc->vcls++;
 
 	VTAILQ_INIT(&b->connlist);
+	VTAILQ_INIT(&b->warmlist);
+	b->connect_timeout = vb->connect_timeout;
+	b->idle_timeout = vb->idle_timeout;
+	b->max_connections = vb->max_connections;
 
 	VTAILQ_INIT(&b->troublelist);
 
@@ -237,6 +263,7 @@ VBE_AddBackend(struct cli *cli, const struct vrt_backend *vb)
 	b->admin_health = ah_probe;
 
 	VTAILQ_INSERT_TAIL(&backends, b, list);
+	VBW_Insert(b);
 	VSC_C_main->n_backend++;
 	return (b);
 }
@@ -253,6 +280,8 @@ VRT_init_dir(struct cli *cli, struct director **dir, const char *name,
 		VRT_init_dir_simple(cli, dir, idx, priv);
 	else if (!strcmp(name, "hash"))
 		VRT_init_dir_hash(cli, dir, idx, priv);
+	else if (!strcmp(name, "chash"))
+		VRT_init_dir_chash(cli, dir, idx, priv);
 	else if (!strcmp(name, "random"))
 		VRT_init_dir_random(cli, dir, idx, priv);
 	else if (!strcmp(name, "dns"))
@@ -263,6 +292,10 @@ VRT_init_dir(struct cli *cli, struct director **dir, const char *name,
 		VRT_init_dir_fallback(cli, dir, idx, priv);
 	else if (!strcmp(name, "client"))
 		VRT_init_dir_client(cli, dir, idx, priv);
+	else if (!strcmp(name, "least-conn"))
+		VRT_init_dir_least_conn(cli, dir, idx, priv);
+	else if (!strcmp(name, "least-latency"))
+		VRT_init_dir_least_latency(cli, dir, idx, priv);
 	else
 		INCOMPL();
 }
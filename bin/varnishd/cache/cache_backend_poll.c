@@ -28,22 +28,26 @@
  *
  * Poll backends for collection of health statistics
  *
- * We co-opt threads from the worker pool for probing the backends,
- * but we want to avoid a potentially messy cleanup operation when we
- * retire the backend, so the thread owns the health information, which
- * the backend references, rather than the other way around.
+ * A single thread probes all the backends, using non-blocking sockets
+ * and poll(2), with a binary heap of when each probe is to be started
+ * or times out.  The probe owns the health information, which the
+ * backend references, rather than the other way around, and it is
+ * only touched with vbp_mtx held.
  *
  */
 
 #include "config.h"
 
+#include <errno.h>
 #include <math.h>
 #include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
 
 #include "cache.h"
 
+#include "binary_heap.h"
 #include "cache_backend.h"
 #include "vcli_priv.h"
 #include "vrt.h"
@@ -71,11 +75,27 @@ struct vbp_target {
 	VTAILQ_HEAD( ,vbp_vcl)		vcls;
 
 	struct vrt_backend_probe	probe;
-	int				stop;
+	const struct vbp_vcl		*vcl;
 	struct vsb			*vsb;
 	char				*req;
 	int				req_len;
 
+	/* The probe in progress, see vbp_thread() */
+	enum {
+		VBP_IDLE,
+		VBP_CONNECT,
+		VBP_RECV,
+		VBP_STOPPED,
+	}				state;
+	int				fd;
+	unsigned			naddr;
+	unsigned			rlen;
+	double				t_start;
+	double				t_when;
+	unsigned			heap_idx;
+	VTAILQ_ENTRY(vbp_target)	active_list;
+	VTAILQ_ENTRY(vbp_target)	stop_list;
+
 	char				resp_buf[128];
 	unsigned			good;
 
@@ -89,145 +109,21 @@ struct vbp_target {
 	double				rate;
 
 	VTAILQ_ENTRY(vbp_target)	list;
-	pthread_t			thread;
 };
 
 static VTAILQ_HEAD(, vbp_target)	vbp_list =
     VTAILQ_HEAD_INITIALIZER(vbp_list);
 
 static struct lock			vbp_mtx;
-
-/*--------------------------------------------------------------------
- * Poke one backend, once, but possibly at both IPv4 and IPv6 addresses.
- *
- * We do deliberately not use the stuff in cache_backend.c, because we
- * want to measure the backends response without local distractions.
- */
-
-static int
-vbp_connect(int pf, const struct sockaddr_storage *sa, socklen_t salen, int tmo)
-{
-	int s, i;
-
-	s = socket(pf, SOCK_STREAM, 0);
-	if (s < 0)
-		return (s);
-
-	i = VTCP_connect(s, sa, salen, tmo);
-	if (i == 0)
-		return (s);
-	VTCP_close(&s);
-	return (-1);
-}
-
-static void
-vbp_poke(struct vbp_target *vt)
-{
-	int s, tmo, i;
-	double t_start, t_now, t_end;
-	unsigned rlen, resp;
-	struct backend *bp;
-	char buf[8192], *p;
-	struct pollfd pfda[1], *pfd = pfda;
-
-	bp = vt->backend;
-	CHECK_OBJ_NOTNULL(bp, BACKEND_MAGIC);
-
-	t_start = t_now = VTIM_real();
-	t_end = t_start + vt->probe.timeout;
-	tmo = (int)round((t_end - t_now) * 1e3);
-
-	s = -1;
-	if (cache_param->prefer_ipv6 && bp->ipv6 != NULL) {
-		s = vbp_connect(PF_INET6, bp->ipv6, bp->ipv6len, tmo);
-		t_now = VTIM_real();
-		tmo = (int)round((t_end - t_now) * 1e3);
-		if (s >= 0)
-			vt->good_ipv6 |= 1;
-	}
-	if (tmo > 0 && s < 0 && bp->ipv4 != NULL) {
-		s = vbp_connect(PF_INET, bp->ipv4, bp->ipv4len, tmo);
-		t_now = VTIM_real();
-		tmo = (int)round((t_end - t_now) * 1e3);
-		if (s >= 0)
-			vt->good_ipv4 |= 1;
-	}
-	if (tmo > 0 && s < 0 && bp->ipv6 != NULL) {
-		s = vbp_connect(PF_INET6, bp->ipv6, bp->ipv6len, tmo);
-		t_now = VTIM_real();
-		tmo = (int)round((t_end - t_now) * 1e3);
-		if (s >= 0)
-			vt->good_ipv6 |= 1;
-	}
-	if (s < 0) {
-		/* Got no connection: failed */
-		return;
-	}
-	if (tmo <= 0) {
-		/* Spent too long time getting it */
-		VTCP_close(&s);
-		return;
-	}
-
-	/* Send the request */
-	i = write(s, vt->req, vt->req_len);
-	if (i != vt->req_len) {
-		if (i < 0)
-			vt->err_xmit |= 1;
-		VTCP_close(&s);
-		return;
-	}
-	vt->good_xmit |= 1;
-
-	pfd->fd = s;
-	rlen = 0;
-	do {
-		pfd->events = POLLIN;
-		pfd->revents = 0;
-		tmo = (int)round((t_end - t_now) * 1e3);
-		if (tmo > 0)
-			i = poll(pfd, 1, tmo);
-		if (i == 0 || tmo <= 0) {
-			VTCP_close(&s);
-			return;
-		}
-		if (rlen < sizeof vt->resp_buf)
-			i = read(s, vt->resp_buf + rlen,
-			    sizeof vt->resp_buf - rlen);
-		else
-			i = read(s, buf, sizeof buf);
-		rlen += i;
-	} while (i > 0);
-
-	VTCP_close(&s);
-
-	if (i < 0) {
-		vt->err_recv |= 1;
-		return;
-	}
-
-	if (rlen == 0)
-		return;
-
-	/* So we have a good receive ... */
-	t_now = VTIM_real();
-	vt->last = t_now - t_start;
-	vt->good_recv |= 1;
-
-	/* Now find out if we like the response */
-	vt->resp_buf[sizeof vt->resp_buf - 1] = '\0';
-	p = strchr(vt->resp_buf, '\r');
-	if (p != NULL)
-		*p = '\0';
-	p = strchr(vt->resp_buf, '\n');
-	if (p != NULL)
-		*p = '\0';
-
-	i = sscanf(vt->resp_buf, "HTTP/%*f %u %s", &resp, buf);
-
-	if (i == 2 && resp == vt->probe.exp_status)
-		vt->happy |= 1;
-}
+static pthread_cond_t			vbp_cond;
+static struct binheap			*vbp_heap;
+static VTAILQ_HEAD(, vbp_target)	vbp_active =
+    VTAILQ_HEAD_INITIALIZER(vbp_active);
+static unsigned				vbp_nactive;
+static VTAILQ_HEAD(, vbp_target)	vbp_stopping =
+    VTAILQ_HEAD_INITIALIZER(vbp_stopping);
+static int				vbp_pipe[2];
+static unsigned				vbp_kicked;
 
 /*--------------------------------------------------------------------
  * Record pokings...
@@ -322,39 +218,298 @@ vbp_build_req(struct vsb *vsb, const struct vbp_vcl *vcl)
 }
 
 /*--------------------------------------------------------------------
- * One thread per backend to be poked.
+ * The heap tells the thread which target wants attention next: the
+ * next poke when idle, the timeout while a poke is under way.
  */
 
-static void *
-vbp_wrk_poll_backend(void *priv)
+static void
+vbp_schedule(struct vbp_target *vt, double when)
 {
-	struct vbp_target *vt;
-	struct vbp_vcl *vcl = NULL;
 
-	THR_SetName("backend poll");
+	vt->t_when = when;
+	if (vt->heap_idx == BINHEAP_NOIDX)
+		binheap_insert(vbp_heap, vt);
+	else
+		binheap_reorder(vbp_heap, vt->heap_idx);
+}
 
-	CAST_OBJ_NOTNULL(vt, priv, VBP_TARGET_MAGIC);
+static void
+vbp_close(struct vbp_target *vt)
+{
 
-	while (!vt->stop) {
-		Lck_Lock(&vbp_mtx);
-		if (VTAILQ_FIRST(&vt->vcls) != vcl) {
-			vcl = VTAILQ_FIRST(&vt->vcls);
-			vbp_build_req(vt->vsb, vcl);
-			vt->probe = vcl->probe;
+	if (vt->fd < 0)
+		return;
+	VTCP_close(&vt->fd);
+	VTAILQ_REMOVE(&vbp_active, vt, active_list);
+	vbp_nactive--;
+}
+
+/* The poke is over, one way or another */
+static void
+vbp_done(struct vbp_target *vt, double now)
+{
+	char buf[128], *p;
+	unsigned resp;
+	int i;
+
+	vbp_close(vt);
+	if (vt->state == VBP_RECV && vt->rlen > 0) {
+		/* So we have a good receive ... */
+		vt->last = now - vt->t_start;
+		vt->good_recv |= 1;
+
+		/* Now find out if we like the response */
+		vt->resp_buf[sizeof vt->resp_buf - 1] = '\0';
+		p = strchr(vt->resp_buf, '\r');
+		if (p != NULL)
+			*p = '\0';
+		p = strchr(vt->resp_buf, '\n');
+		if (p != NULL)
+			*p = '\0';
+
+		i = sscanf(vt->resp_buf, "HTTP/%*f %u %s", &resp, buf);
+
+		if (i == 2 && resp == vt->probe.exp_status)
+			vt->happy |= 1;
+	}
+	vt->state = VBP_IDLE;
+	vbp_has_poked(vt);
+	vbp_schedule(vt, now + vt->probe.interval);
+}
+
+/* Connected, send the request */
+static void
+vbp_send(struct vbp_target *vt, double now)
+{
+	int i;
+
+	i = write(vt->fd, vt->req, vt->req_len);
+	if (i != vt->req_len) {
+		if (i < 0)
+			vt->err_xmit |= 1;
+		vbp_done(vt, now);
+		return;
+	}
+	vt->good_xmit |= 1;
+	vt->state = VBP_RECV;
+	vt->rlen = 0;
+}
+
+/*
+ * Start connecting to the next address, in the order the blocking
+ * version always used: IPv6 first if preferred, then IPv4, then IPv6.
+ */
+static void
+vbp_connect(struct vbp_target *vt, double now)
+{
+	const struct backend *bp;
+	const struct sockaddr_storage *sa;
+	socklen_t salen;
+	int pf, s;
+
+	bp = vt->backend;
+	CHECK_OBJ_NOTNULL(bp, BACKEND_MAGIC);
+	while (vt->naddr < 3) {
+		switch (vt->naddr++) {
+		case 0:
+			if (!cache_param->prefer_ipv6)
+				continue;
+			/* FALLTHROUGH */
+		case 2:
+			pf = PF_INET6;
+			sa = bp->ipv6;
+			salen = bp->ipv6len;
+			break;
+		default:
+			pf = PF_INET;
+			sa = bp->ipv4;
+			salen = bp->ipv4len;
+			break;
+		}
+		if (sa == NULL)
+			continue;
+		s = socket(pf, SOCK_STREAM, 0);
+		if (s < 0)
+			continue;
+		(void)VTCP_nonblocking(s);
+		if (connect(s, (const void *)sa, salen) != 0 &&
+		    errno != EINPROGRESS) {
+			VTCP_close(&s);
+			continue;
+		}
+		vt->fd = s;
+		vt->state = VBP_CONNECT;
+		VTAILQ_INSERT_TAIL(&vbp_active, vt, active_list);
+		vbp_nactive++;
+		return;
+	}
+	/* Got no connection: failed */
+	vbp_done(vt, now);
+}
+
+/*--------------------------------------------------------------------
+ * Poke one backend, once, but possibly at both IPv4 and IPv6 addresses.
+ *
+ * We do deliberately not use the stuff in cache_backend.c, because we
+ * want to measure the backends response without local distractions.
+ */
+
+static void
+vbp_start(struct vbp_target *vt, double now)
+{
+
+	if (VTAILQ_FIRST(&vt->vcls) != vt->vcl) {
+		vt->vcl = VTAILQ_FIRST(&vt->vcls);
+		vbp_build_req(vt->vsb, vt->vcl);
+		vt->probe = vt->vcl->probe;
+	}
+	vt->req = VSB_data(vt->vsb);
+	vt->req_len = VSB_len(vt->vsb);
+
+	vbp_start_poke(vt);
+	vt->t_start = now;
+	vt->naddr = 0;
+	vbp_schedule(vt, now + vt->probe.timeout);
+	vbp_connect(vt, now);
+}
+
+static void
+vbp_event(struct vbp_target *vt, double now)
+{
+	char buf[8192];
+	socklen_t l;
+	int i, k;
+
+	if (vt->state == VBP_CONNECT) {
+		l = sizeof k;
+		if (getsockopt(vt->fd, SOL_SOCKET, SO_ERROR, &k, &l) ||
+		    k != 0) {
+			vbp_close(vt);
+			vbp_connect(vt, now);
+			return;
+		}
+		if (vt->naddr == 2)
+			vt->good_ipv4 |= 1;
+		else
+			vt->good_ipv6 |= 1;
+		vbp_send(vt, now);
+		return;
+	}
+	assert(vt->state == VBP_RECV);
+	do {
+		if (vt->rlen < sizeof vt->resp_buf)
+			i = read(vt->fd, vt->resp_buf + vt->rlen,
+			    sizeof vt->resp_buf - vt->rlen);
+		else
+			i = read(vt->fd, buf, sizeof buf);
+		if (i > 0)
+			vt->rlen += i;
+	} while (i > 0);
+	if (i < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		return;
+	if (i < 0) {
+		vt->err_recv |= 1;
+		vt->rlen = 0;
+	}
+	vbp_done(vt, now);
+}
+
+/*--------------------------------------------------------------------
+ * The thread which pokes all the backends.
+ */
+
+static void
+vbp_kick(void)
+{
+
+	Lck_AssertHeld(&vbp_mtx);
+	if (vbp_kicked)
+		return;
+	vbp_kicked = 1;
+	assert(write(vbp_pipe[1], "", 1) == 1);
+}
+
+static void * __match_proto__(bgthread_t)
+vbp_thread(struct worker *wrk, void *priv)
+{
+	struct vbp_target *vt, **vts = NULL;
+	struct pollfd *pfd = NULL;
+	unsigned u, n, npfd = 0;
+	double now, tmo;
+	char c;
+	int i;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	(void)priv;
+	Lck_Lock(&vbp_mtx);
+	while (1) {
+		/* Start the probes which are due, fail the overdue ones */
+		now = VTIM_real();
+		while (1) {
+			vt = binheap_root(vbp_heap);
+			if (vt == NULL || vt->t_when > now)
+				break;
+			CHECK_OBJ_NOTNULL(vt, VBP_TARGET_MAGIC);
+			if (vt->state == VBP_IDLE) {
+				vbp_start(vt, now);
+			} else {
+				/* Spent too long time on it */
+				vt->rlen = 0;
+				vbp_done(vt, now);
+			}
 		}
-		Lck_Unlock(&vbp_mtx);
 
-		vt->req = VSB_data(vt->vsb);
-		vt->req_len = VSB_len(vt->vsb);
+		if (npfd < vbp_nactive + 1) {
+			npfd = vbp_nactive + 64;
+			pfd = realloc(pfd, npfd * sizeof *pfd);
+			XXXAN(pfd);
+			vts = realloc(vts, npfd * sizeof *vts);
+			XXXAN(vts);
+		}
+		pfd[0].fd = vbp_pipe[0];
+		pfd[0].events = POLLIN;
+		n = 1;
+		VTAILQ_FOREACH(vt, &vbp_active, active_list) {
+			pfd[n].fd = vt->fd;
+			pfd[n].events =
+			    vt->state == VBP_CONNECT ? POLLOUT : POLLIN;
+			vts[n++] = vt;
+		}
+		for (u = 0; u < n; u++)
+			pfd[u].revents = 0;
+		vt = binheap_root(vbp_heap);
+		tmo = vt == NULL ? 60. : vt->t_when - now;
+		if (tmo < 0.)
+			tmo = 0.;
+		Lck_Unlock(&vbp_mtx);
 
-		vbp_start_poke(vt);
-		vbp_poke(vt);
-		vbp_has_poked(vt);
+		i = poll(pfd, n, (int)ceil(tmo * 1e3));
+		assert(i >= 0 || errno == EINTR);
 
-		if (!vt->stop)
-			VTIM_sleep(vt->probe.interval);
+		Lck_Lock(&vbp_mtx);
+		if (pfd[0].revents != 0) {
+			assert(read(vbp_pipe[0], &c, 1) == 1);
+			vbp_kicked = 0;
+		}
+		now = VTIM_real();
+		/* Targets are not freed until we have seen them stop */
+		for (u = 1; u < n; u++) {
+			vt = vts[u];
+			CHECK_OBJ_NOTNULL(vt, VBP_TARGET_MAGIC);
+			if (pfd[u].revents != 0 && vt->fd == pfd[u].fd)
+				vbp_event(vt, now);
+		}
+		while (!VTAILQ_EMPTY(&vbp_stopping)) {
+			vt = VTAILQ_FIRST(&vbp_stopping);
+			VTAILQ_REMOVE(&vbp_stopping, vt, stop_list);
+			vbp_close(vt);
+			if (vt->heap_idx != BINHEAP_NOIDX)
+				binheap_delete(vbp_heap, vt->heap_idx);
+			vt->state = VBP_STOPPED;
+			AZ(pthread_cond_broadcast(&vbp_cond));
+		}
 	}
-	return (NULL);
+	NEEDLESS_RETURN(NULL);
 }
 
 /*--------------------------------------------------------------------
@@ -479,7 +634,7 @@ VBP_Insert(struct backend *b, const struct vrt_backend_probe *p,
 {
 	struct vbp_target *vt;
 	struct vbp_vcl *vcl;
-	int startthread = 0;
+	int startpoll = 0;
 	unsigned u;
 
 	ASSERT_CLI();
@@ -490,10 +645,11 @@ VBP_Insert(struct backend *b, const struct vrt_backend_probe *p,
 		XXXAN(vt);
 		VTAILQ_INIT(&vt->vcls);
 		vt->backend = b;
+		vt->fd = -1;
 		vt->vsb = VSB_new_auto();
 		XXXAN(vt->vsb);
 		b->probe = vt;
-		startthread = 1;
+		startpoll = 1;
 		VTAILQ_INSERT_TAIL(&vbp_list, vt, list);
 	} else {
 		vt = b->probe;
@@ -507,13 +663,16 @@ VBP_Insert(struct backend *b, const struct vrt_backend_probe *p,
 	VTAILQ_INSERT_TAIL(&vt->vcls, vcl, list);
 	Lck_Unlock(&vbp_mtx);
 
-	if (startthread) {
+	if (startpoll) {
 		for (u = 0; u < vcl->probe.initial; u++) {
 			vbp_start_poke(vt);
 			vt->happy |= 1;
 			vbp_has_poked(vt);
 		}
-		AZ(pthread_create(&vt->thread, NULL, vbp_wrk_poll_backend, vt));
+		Lck_Lock(&vbp_mtx);
+		vbp_schedule(vt, VTIM_real());
+		vbp_kick();
+		Lck_Unlock(&vbp_mtx);
 	}
 }
 
@@ -546,7 +705,6 @@ VBP_Remove(struct backend *b, struct vrt_backend_probe const *p)
 {
 	struct vbp_target *vt;
 	struct vbp_vcl *vcl;
-	void *ret;
 
 	ASSERT_CLI();
 	AN(p);
@@ -562,20 +720,20 @@ VBP_Remove(struct backend *b, struct vrt_backend_probe const *p)
 
 	Lck_Lock(&vbp_mtx);
 	VTAILQ_REMOVE(&vt->vcls, vcl, list);
-	Lck_Unlock(&vbp_mtx);
-
-	FREE_OBJ(vcl);
-
-	if (!VTAILQ_EMPTY(&vt->vcls))
+	if (!VTAILQ_EMPTY(&vt->vcls)) {
+		Lck_Unlock(&vbp_mtx);
+		FREE_OBJ(vcl);
 		return;
+	}
 
 	/* No more polling for this backend */
 
-	b->healthy = 1;
-
-	vt->stop = 1;
-	AZ(pthread_cancel(vt->thread));
-	AZ(pthread_join(vt->thread, &ret));
+	VTAILQ_INSERT_TAIL(&vbp_stopping, vt, stop_list);
+	vbp_kick();
+	while (vt->state != VBP_STOPPED)
+		(void)Lck_CondWait(&vbp_cond, &vbp_mtx, NULL);
+	Lck_Unlock(&vbp_mtx);
+	FREE_OBJ(vcl);
 
 	b->healthy = 1;
 
@@ -589,10 +747,38 @@ VBP_Remove(struct backend *b, struct vrt_backend_probe const *p)
  * Initialize the backend probe subsystem
  */
 
+static int
+vbp_cmp(void *priv, void *a, void *b)
+{
+	struct vbp_target *aa, *bb;
+
+	(void)priv;
+	CAST_OBJ_NOTNULL(aa, a, VBP_TARGET_MAGIC);
+	CAST_OBJ_NOTNULL(bb, b, VBP_TARGET_MAGIC);
+	return (aa->t_when < bb->t_when);
+}
+
+static void
+vbp_update(void *priv, void *p, unsigned u)
+{
+	struct vbp_target *vt;
+
+	(void)priv;
+	CAST_OBJ_NOTNULL(vt, p, VBP_TARGET_MAGIC);
+	vt->heap_idx = u;
+}
+
 void
 VBP_Init(void)
 {
 
+	pthread_t pt;
+
 	Lck_New(&vbp_mtx, lck_vbp);
+	AZ(pthread_cond_init(&vbp_cond, NULL));
+	vbp_heap = binheap_new(NULL, vbp_cmp, vbp_update);
+	XXXAN(vbp_heap);
+	AZ(pipe(vbp_pipe));
+	WRK_BgThread(&pt, "backend-poll", vbp_thread, NULL);
 	CLI_AddFuncs(debug_cmds);
 }
@@ -0,0 +1,620 @@
+/*-
+ * Copyright (c) 2013 Varnish Software AS
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Keep a number of connections to each backend open ahead of use,
+ * and keep an eye on the idle ones.
+ *
+ * A single thread runs non-blocking connects to all backends which
+ * have fewer than 'backend_warm' idle warm connections, and polls them
+ * for completion, so a slow or blackholed backend only costs us a
+ * file descriptor until connect_timeout expires.
+ *
+ * Connects in flight are counted in backend->n_warming and hold no
+ * reference to the backend.  Instead the backend is not nuked until
+ * n_warming drops to zero, see VBE_DropRefLocked() and VBE_Poll().
+ *
+ * Idle connections, recycled or warm, are registered (ONESHOT) with an
+ * epoll instance.  Anything happening on an idle connection means the
+ * backend closed it (or is talking out of turn), so the thread marks
+ * it stale, and evicts it along with connections which have been idle
+ * for longer than the backend's .idle_timeout, which defaults to
+ * 'backend_idle_timeout'.  Taking a connection for reuse is then just
+ * a matter of checking the stale flag, instead of a poll(2) call.
+ *
+ * A FIN arriving after that check is not caught here.  The request
+ * then fails on the connection, and as it was idle before, goes down
+ * the retry path for recycled connections, just like without the
+ * watcher.
+ *
+ * The watcher may still hold an event for a connection which has been
+ * closed and released, so released connections which were ever
+ * registered are parked, and only freed by the thread itself between
+ * two rounds of events.
+ *
+ * Without epoll, VBW_Stale() falls back to poll(2).
+ *
+ * The thread only walks the backends when there is something to do:
+ * 'backend_warm' is set, idle connections went stale, or one of them
+ * or a backed off backend is due.  Otherwise it sleeps on the epoll
+ * instance, the connects in flight and a control pipe, without a
+ * timeout.  VBW_Kick() wakes it through the pipe, and makes it walk.
+ */
+
+#include "config.h"
+
+#include <sys/socket.h>
+#if defined(HAVE_EPOLL_CTL)
+#  include <sys/epoll.h>
+#endif
+
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+
+#include "cache.h"
+
+#include "cache_backend.h"
+#include "vtcp.h"
+#include "vtim.h"
+
+/* Connects we will have in flight at any one time */
+#define VBW_MAXPEND		256
+
+/* How long to wait before trying again after a failed connect */
+#define VBW_BACKOFF		1.0
+
+/* Poll slots ahead of the connects in flight */
+#define VBW_NCTL		2
+
+struct vbw_pend {
+	struct backend		*backend;
+	struct sockaddr_storage	*addr;
+	socklen_t		addrlen;
+	double			t_start;
+	double			t_end;
+};
+
+static struct lock		vbw_mtx;
+static VTAILQ_HEAD(, backend)	vbw_backends =
+    VTAILQ_HEAD_INITIALIZER(vbw_backends);
+
+static struct vbw_pend		vbw_pend[VBW_MAXPEND];
+static unsigned			vbw_npend;
+
+/*
+ * Slot zero is the epoll fd, slot one the control pipe, the rest are
+ * in step with vbw_pend[]
+ */
+static struct pollfd		vbw_pfd[VBW_NCTL + VBW_MAXPEND];
+
+static volatile double		vbw_t_next;	/* Zero: not due */
+
+/* The thread's mailbox */
+static struct lock		vbw_dead_mtx;
+static VTAILQ_HEAD(, vbc)	vbw_dead = VTAILQ_HEAD_INITIALIZER(vbw_dead);
+static int			vbw_pipe[2];
+static unsigned			vbw_asleep;
+static unsigned			vbw_walk;
+
+#if defined(HAVE_EPOLL_CTL)
+#  ifndef EPOLLRDHUP
+#    define EPOLLRDHUP 0
+#  endif
+#  define VBW_NEVENT		128
+static int			vbw_epfd = -1;
+#endif
+
+/*--------------------------------------------------------------------*/
+
+void
+VBW_Insert(struct backend *b)
+{
+
+	CHECK_OBJ_NOTNULL(b, BACKEND_MAGIC);
+	Lck_Lock(&vbw_mtx);
+	VTAILQ_INSERT_TAIL(&vbw_backends, b, warm_list);
+	Lck_Unlock(&vbw_mtx);
+	VBW_Kick();
+}
+
+void
+VBW_Remove(struct backend *b)
+{
+
+	CHECK_OBJ_NOTNULL(b, BACKEND_MAGIC);
+	Lck_Lock(&vbw_mtx);
+	VTAILQ_REMOVE(&vbw_backends, b, warm_list);
+	Lck_Unlock(&vbw_mtx);
+}
+
+/*--------------------------------------------------------------------*/
+
+static double
+vbw_idle_timeout(const struct backend *b)
+{
+
+	CHECK_OBJ_NOTNULL(b, BACKEND_MAGIC);
+	if (b->idle_timeout > 0.)
+		return (b->idle_timeout);
+	return (cache_param->backend_idle_timeout);
+}
+
+/*--------------------------------------------------------------------
+ * Wake the thread up, if it went to sleep since it last looked at its
+ * mailbox.  Called with vbw_dead_mtx held.
+ */
+
+static void
+vbw_poke(void)
+{
+
+	Lck_AssertHeld(&vbw_dead_mtx);
+	if (!vbw_asleep)
+		return;
+	vbw_asleep = 0;
+	assert(write(vbw_pipe[1], "", 1) == 1);
+}
+
+/*--------------------------------------------------------------------
+ * Something changed which needs the thread to walk the backends.
+ */
+
+void
+VBW_Kick(void)
+{
+
+	Lck_Lock(&vbw_dead_mtx);
+	vbw_walk = 1;
+	vbw_poke();
+	Lck_Unlock(&vbw_dead_mtx);
+}
+
+/*--------------------------------------------------------------------
+ * A connection is about to go on one of the idle lists.
+ */
+
+void
+VBW_Idle(struct vbc *vc)
+{
+#if defined(HAVE_EPOLL_CTL)
+	struct epoll_event ev;
+#endif
+
+	CHECK_OBJ_NOTNULL(vc, VBC_MAGIC);
+	assert(vc->fd >= 0);
+	/* Before registering, the event may fire right away */
+	vc->idle = 1;
+	vc->stale = 0;
+	vc->t_idle = VTIM_real();
+#if defined(HAVE_EPOLL_CTL)
+	ev.events = EPOLLIN | EPOLLPRI | EPOLLONESHOT | EPOLLRDHUP;
+	ev.data.ptr = vc;
+	if (!epoll_ctl(vbw_epfd, vc->watched ? EPOLL_CTL_MOD : EPOLL_CTL_ADD,
+	    vc->fd, &ev))
+		vc->watched = 1;
+#endif
+	/* Make sure the thread comes back to time it out */
+	if (vbw_t_next == 0. && vbw_idle_timeout(vc->backend) > 0.)
+		VBW_Kick();
+}
+
+/*--------------------------------------------------------------------
+ * Check a connection just taken off an idle list.
+ */
+
+int
+VBW_Stale(const struct vbc *vc)
+{
+	struct pollfd pfd;
+
+	CHECK_OBJ_NOTNULL(vc, VBC_MAGIC);
+#if defined(HAVE_EPOLL_CTL)
+	if (vc->watched)
+		return (vc->stale);
+#endif
+
+	/* Backends are not allowed to pipeline, any event is bad news */
+	pfd.fd = vc->fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	return (poll(&pfd, 1, 0) != 0);
+}
+
+/*--------------------------------------------------------------------
+ * Park a released connection the watcher may still hold events for.
+ */
+
+void
+VBW_Release(struct vbc *vc)
+{
+
+	CHECK_OBJ_NOTNULL(vc, VBC_MAGIC);
+	AN(vc->watched);
+	Lck_Lock(&vbw_dead_mtx);
+	VTAILQ_INSERT_TAIL(&vbw_dead, vc, list);
+	vbw_poke();
+	Lck_Unlock(&vbw_dead_mtx);
+}
+
+/*--------------------------------------------------------------------
+ * A connect finished, one way or the other.
+ */
+
+static void
+vbw_done(const struct vbw_pend *vp, int fd, double now)
+{
+	struct backend *b;
+	struct vbc *vc = NULL;
+
+	b = vp->backend;
+	CHECK_OBJ_NOTNULL(b, BACKEND_MAGIC);
+	if (fd >= 0) {
+		(void)VTCP_blocking(fd);
+		vc = VBE_NewConn();
+		vc->fd = fd;
+		vc->addr = vp->addr;
+		vc->addrlen = vp->addrlen;
+		vc->backend = b;
+	}
+
+	if (vc != NULL)
+		VBW_Idle(vc);
+
+	Lck_Lock(&b->mtx);
+	assert(b->n_warming > 0);
+	b->n_warming--;
+	if (vc == NULL) {
+		b->n_conn--;
+		b->t_warmfail = now + VBW_BACKOFF;
+		b->vsc->warm_fail++;
+	} else {
+		b->vsc->connects++;
+		b->vsc->connect_usec += (uint64_t)(1e6 * (now - vp->t_start));
+		if (b->refcount > 0) {
+			VTAILQ_INSERT_HEAD(&b->warmlist, vc, list);
+			b->n_warm++;
+			b->vsc->warm = b->n_warm;
+			vc = NULL;
+		} else
+			b->n_conn--;
+	}
+	Lck_Unlock(&b->mtx);
+	/* NB: b may be gone by now */
+
+	if (vc != NULL) {
+		vc->idle = 0;
+		VTCP_close(&vc->fd);
+		vc->backend = NULL;
+		VBE_ReleaseConn(vc);
+	}
+}
+
+/*--------------------------------------------------------------------
+ * Start a connect, which has already been counted in n_warming.
+ */
+
+static void
+vbw_start(struct backend *b, double now)
+{
+	struct vbw_pend *vp;
+	int s, i, pf;
+
+	vp = &vbw_pend[vbw_npend];
+	memset(vp, 0, sizeof *vp);
+	vp->backend = b;
+	vp->t_start = now;
+	vp->t_end = now + (b->connect_timeout > 0. ?
+	    b->connect_timeout : cache_param->connect_timeout);
+	if (b->ipv6 != NULL && (b->ipv4 == NULL || cache_param->prefer_ipv6)) {
+		pf = PF_INET6;
+		vp->addr = b->ipv6;
+		vp->addrlen = b->ipv6len;
+	} else {
+		pf = PF_INET;
+		vp->addr = b->ipv4;
+		vp->addrlen = b->ipv4len;
+	}
+
+	s = socket(pf, SOCK_STREAM, 0);
+	if (s < 0) {
+		vbw_done(vp, -1, now);
+		return;
+	}
+	(void)VTCP_nonblocking(s);
+	i = connect(s, (const void *)vp->addr, vp->addrlen);
+	if (i == 0) {
+		vbw_done(vp, s, now);
+		return;
+	}
+	if (errno != EINPROGRESS) {
+		AZ(close(s));
+		vbw_done(vp, -1, now);
+		return;
+	}
+	vbw_pfd[VBW_NCTL + vbw_npend].fd = s;
+	vbw_pfd[VBW_NCTL + vbw_npend].events = POLLWRNORM;
+	vbw_pfd[VBW_NCTL + vbw_npend].revents = 0;
+	vbw_npend++;
+}
+
+/*--------------------------------------------------------------------
+ * Take stale and timed out connections off an idle list, and note
+ * when the next one times out.  Called with the backend locked.
+ */
+
+static void
+vbw_due(double *t_next, double t)
+{
+
+	if (*t_next == 0. || t < *t_next)
+		*t_next = t;
+}
+
+static unsigned
+vbw_evict(struct backend *b, struct vbc_head *head, struct vbc_head *dead,
+    double now, double *t_next)
+{
+	struct vbc *vc, *vc2;
+	double tmo;
+	unsigned n = 0;
+
+	tmo = vbw_idle_timeout(b);
+	VTAILQ_FOREACH_SAFE(vc, head, list, vc2) {
+		CHECK_OBJ_NOTNULL(vc, VBC_MAGIC);
+		if (vc->stale)
+			b->vsc->idle_stale++;
+		else if (tmo > 0. && now - vc->t_idle > tmo)
+			b->vsc->idle_timeout++;
+		else {
+			if (tmo > 0.)
+				vbw_due(t_next, vc->t_idle + tmo);
+			continue;
+		}
+		VTAILQ_REMOVE(head, vc, list);
+		vc->idle = 0;
+		VTAILQ_INSERT_TAIL(dead, vc, list);
+		n++;
+	}
+	return (n);
+}
+
+/*--------------------------------------------------------------------
+ * Visit all backends, evict dead idle connections and start connects
+ * for those short of warm ones.
+ *
+ * Returns when we need to come back, zero if not before something
+ * wakes us.  Connections going idle later are caught by coming back
+ * every .idle_timeout of the backends which have one.
+ */
+
+static double
+vbw_refill(double now)
+{
+	struct backend *b;
+	struct vbc_head dead;
+	struct vbc *vc;
+	unsigned n, u;
+	double t_next = 0., tmo;
+
+	VTAILQ_INIT(&dead);
+	Lck_Lock(&vbw_mtx);
+	VTAILQ_FOREACH(b, &vbw_backends, warm_list) {
+		CHECK_OBJ_NOTNULL(b, BACKEND_MAGIC);
+		Lck_Lock(&b->mtx);
+		if (b->refcount > 0) {
+			tmo = vbw_idle_timeout(b);
+			if (tmo > 0.)
+				vbw_due(&t_next, now + tmo);
+			b->n_conn -= vbw_evict(b, &b->connlist, &dead, now,
+			    &t_next);
+			n = vbw_evict(b, &b->warmlist, &dead, now, &t_next);
+			b->n_conn -= n;
+			b->n_warm -= n;
+			b->vsc->warm = b->n_warm;
+		}
+		n = 0;
+		if (b->refcount > 0 && b->t_warmfail < now &&
+		    b->admin_health != ah_sick &&
+		    (b->admin_health != ah_probe || b->healthy)) {
+			while (b->n_warm + b->n_warming + n <
+			    cache_param->backend_warm &&
+			    vbw_npend + n < VBW_MAXPEND &&
+			    (b->max_connections == 0 ||
+			    b->n_conn + n < b->max_connections))
+				n++;
+			b->n_warming += n;
+			b->n_conn += n;
+		}
+		if (b->refcount > 0 &&
+		    b->n_warm + b->n_warming < cache_param->backend_warm)
+			/* Still short, backed off, sick or at max */
+			vbw_due(&t_next, b->t_warmfail > now ?
+			    b->t_warmfail : now + VBW_BACKOFF);
+		Lck_Unlock(&b->mtx);
+		for (u = 0; u < n; u++)
+			vbw_start(b, now);
+	}
+	Lck_Unlock(&vbw_mtx);
+
+	while (!VTAILQ_EMPTY(&dead)) {
+		vc = VTAILQ_FIRST(&dead);
+		VTAILQ_REMOVE(&dead, vc, list);
+		VTCP_close(&vc->fd);
+		vc->backend = NULL;
+		VBE_ReleaseConn(vc);
+	}
+	return (t_next);
+}
+
+/*--------------------------------------------------------------------
+ * Mark idle connections with events on them stale, the next
+ * vbw_refill() evicts them.  Returns how many.
+ */
+
+static unsigned
+vbw_events(void)
+{
+	unsigned u = 0;
+#if defined(HAVE_EPOLL_CTL)
+	struct epoll_event ev[VBW_NEVENT];
+	struct vbc *vc;
+	int i, n;
+
+	n = epoll_wait(vbw_epfd, ev, VBW_NEVENT, 0);
+	for (i = 0; i < n; i++) {
+		CAST_OBJ_NOTNULL(vc, ev[i].data.ptr, VBC_MAGIC);
+		/* Events on connections in use are not our business */
+		if (vc->idle) {
+			vc->stale = 1;
+			u++;
+		}
+	}
+#endif
+	return (u);
+}
+
+/*--------------------------------------------------------------------
+ * Empty the mailbox before going to sleep: free released connections,
+ * the events for them have been seen, and return if we were asked to
+ * walk the backends.
+ */
+
+static unsigned
+vbw_reap(void)
+{
+	struct vbc_head dead;
+	struct vbc *vc;
+	unsigned walk;
+
+	Lck_Lock(&vbw_dead_mtx);
+	VTAILQ_INIT(&dead);
+	VTAILQ_CONCAT(&dead, &vbw_dead, list);
+	vbw_asleep = 1;
+	walk = vbw_walk;
+	vbw_walk = 0;
+	Lck_Unlock(&vbw_dead_mtx);
+	while (!VTAILQ_EMPTY(&dead)) {
+		vc = VTAILQ_FIRST(&dead);
+		VTAILQ_REMOVE(&dead, vc, list);
+		vc->watched = 0;
+		VBE_ReleaseConn(vc);
+	}
+	return (walk);
+}
+
+/*--------------------------------------------------------------------*/
+
+static void * __match_proto__(bgthread_t)
+vbw_thread(struct worker *wrk, void *priv)
+{
+	struct pollfd *pfd;
+	double now, t_next, tmo;
+	unsigned u, walk = 1;
+	int i, k;
+	socklen_t l;
+	char buf[64];
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	(void)priv;
+	while (1) {
+		/* Before looking at the backends, see VBW_Kick() */
+		if (vbw_reap())
+			walk = 1;
+
+		now = VTIM_real();
+		t_next = vbw_t_next;
+		if (cache_param->backend_warm > 0 || walk ||
+		    (t_next > 0. && t_next <= now) ||
+		    (t_next == 0. && cache_param->backend_idle_timeout > 0.)) {
+			t_next = vbw_refill(now);
+			vbw_t_next = t_next;
+			walk = 0;
+		}
+
+		tmo = t_next > 0. ? t_next - now : -1.;
+		for (u = 0; u < vbw_npend; u++)
+			if (tmo < 0. || vbw_pend[u].t_end - now < tmo)
+				tmo = vbw_pend[u].t_end - now;
+		if (t_next > 0. || vbw_npend > 0) {
+			if (tmo < 0.)
+				tmo = 0.;
+			i = (int)(tmo * 1e3);
+		} else
+			i = -1;
+		vbw_pfd[0].revents = 0;
+		vbw_pfd[1].revents = 0;
+		i = poll(vbw_pfd, VBW_NCTL + vbw_npend, i);
+		assert(i >= 0 || errno == EINTR);
+
+		if (vbw_pfd[0].revents != 0)
+			walk += vbw_events();
+		if (vbw_pfd[1].revents != 0)
+			(void)read(vbw_pipe[0], buf, sizeof buf);
+
+		now = VTIM_real();
+		u = 0;
+		while (u < vbw_npend) {
+			pfd = &vbw_pfd[VBW_NCTL + u];
+			if (pfd->revents != 0) {
+				l = sizeof k;
+				if (getsockopt(pfd->fd, SOL_SOCKET,
+				    SO_ERROR, &k, &l) || k != 0)
+					VTCP_close(&pfd->fd);
+			} else if (vbw_pend[u].t_end <= now) {
+				VTCP_close(&pfd->fd);
+			} else {
+				u++;
+				continue;
+			}
+			vbw_done(&vbw_pend[u], pfd->fd, now);
+			vbw_npend--;
+			vbw_pend[u] = vbw_pend[vbw_npend];
+			*pfd = vbw_pfd[VBW_NCTL + vbw_npend];
+		}
+	}
+	NEEDLESS_RETURN(NULL);
+}
+
+/*--------------------------------------------------------------------*/
+
+void
+VBW_Init(void)
+{
+	pthread_t pt;
+
+	Lck_New(&vbw_mtx, lck_vbw);
+	Lck_New(&vbw_dead_mtx, lck_vbw);
+	vbw_pfd[0].fd = -1;
+#if defined(HAVE_EPOLL_CTL)
+	vbw_epfd = epoll_create(1);
+	assert(vbw_epfd >= 0);
+	vbw_pfd[0].fd = vbw_epfd;
+	vbw_pfd[0].events = POLLIN;
+#endif
+	AZ(pipe(vbw_pipe));
+	vbw_pfd[1].fd = vbw_pipe[0];
+	vbw_pfd[1].events = POLLIN;
+	WRK_BgThread(&pt, "backend-warm", vbw_thread, NULL);
+}
@@ -455,6 +455,26 @@ BAN_NewObjCore(struct objcore *oc)
 	Lck_Unlock(&ban_mtx);
 }
 
+/*--------------------------------------------------------------------
+ * A copy of an object has been made in another stevedore, it has seen
+ * exactly the same bans as the original.
+ */
+
+void
+BAN_CopyObjCore(struct objcore *oc, const struct objcore *src)
+{
+
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+	CHECK_OBJ_NOTNULL(src, OBJCORE_MAGIC);
+	AZ(oc->ban);
+	Lck_Lock(&ban_mtx);
+	CHECK_OBJ_NOTNULL(src->ban, BAN_MAGIC);
+	oc->ban = src->ban;
+	oc->ban->refcount++;
+	VTAILQ_INSERT_TAIL(&oc->ban->objcore, oc, ban_list);
+	Lck_Unlock(&ban_mtx);
+}
+
 /*--------------------------------------------------------------------
  * An object is destroyed, release its ban reference
  */
@@ -76,6 +76,7 @@ VDI_RecycleFd(struct vbc **vbp)
 {
 	struct backend *bp;
 	struct vbc *vc;
+	unsigned stale;
 
 	AN(vbp);
 	vc = *vbp;
@@ -92,13 +93,23 @@ VDI_RecycleFd(struct vbc **vbp)
 	VSL_Flush(vc->vsl, 0);
 	vc->vsl = NULL;
 
+	VBW_Idle(vc);
+
 	Lck_Lock(&bp->mtx);
 	VSC_C_main->backend_recycle++;
 	VTAILQ_INSERT_HEAD(&bp->connlist, vc, list);
+	/* The watcher may have found it stale before it got here */
+	stale = vc->stale;
 	VBE_DropRefLocked(bp);
+	if (stale)
+		VBW_Kick();
 }
 
-/* Get a connection --------------------------------------------------*/
+/* Get a connection --------------------------------------------------
+ *
+ * Directors may take their time, and so may the connect, so a response
+ * held back for the next pipelined one goes out before we start.
+ */
 
 struct vbc *
 VDI_GetFd(const struct director *d, struct req *req)
@@ -106,6 +117,7 @@ VDI_GetFd(const struct director *d, struct req *req)
 	struct vbc *vc;
 
 	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
+	(void)WRW_FlushHold(req->wrk);
 	if (d == NULL)
 		d = req->director;
 	CHECK_OBJ_NOTNULL(d, DIRECTOR_MAGIC);
@@ -0,0 +1,306 @@
+/*-
+ * Copyright (c) 2013 Varnish Software AS
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * The consistent hashing director.
+ *
+ * Each backend is given .vnodes points on a 32 bit ring per unit of
+ * .weight, placed by hashing its name, and the first 32 bits of the
+ * hash from vcl_hash{} select the first point at or after it.  Since
+ * the points of a backend only depend on its own name, adding or
+ * removing a backend only moves the keys landing on its points, 1/N
+ * of the keyspace, and a sick backend only sheds its own keys, to the
+ * next backend clockwise on the ring.
+ *
+ * With .load_factor (in percent) set, a backend is skipped if it has
+ * more than load_factor/100 times the average number of fetches in
+ * progress across the healthy backends ("bounded loads").  If they
+ * all do, the plain ring order is used.
+ *
+ * The health and load of each backend are looked at once per pick, and
+ * kept in a per-host array the size of the director, on the workspace,
+ * rather than once per point the ring walk passes.
+ *
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "cache.h"
+
+#include "cache_backend.h"
+#include "vend.h"
+#include "vrt.h"
+#include "vsha256.h"
+
+/* Default number of points per unit of weight */
+#define VDI_CHASH_VNODES	160
+
+/*--------------------------------------------------------------------*/
+
+struct vdi_chash_host {
+	struct director		*backend;
+	unsigned		weight;
+};
+
+/* What one pick knows about a host */
+struct vdi_chash_state {
+	unsigned		skip;
+	unsigned		busy;
+};
+
+struct vdi_chash_point {
+	uint32_t		point;
+	unsigned		host;
+};
+
+struct vdi_chash {
+	unsigned		magic;
+#define VDI_CHASH_MAGIC		0x2c8a51e7
+	struct director		dir;
+
+	unsigned		retries;
+	unsigned		load_factor;
+	struct vdi_chash_host	*hosts;
+	unsigned		nhosts;
+	struct vdi_chash_point	*ring;
+	unsigned		npoints;
+};
+
+static int
+vdi_chash_cmp(const void *a, const void *b)
+{
+	const struct vdi_chash_point *pa = a, *pb = b;
+
+	if (pa->point != pb->point)
+		return (pa->point < pb->point ? -1 : 1);
+	if (pa->host != pb->host)
+		return (pa->host < pb->host ? -1 : 1);
+	return (0);
+}
+
+/*
+ * Walk the ring from 'start' for the first host not tried yet, which
+ * is healthy and, if 'cap' is non-zero, not loaded to the cap.
+ */
+static int
+vdi_chash_walk(const struct vdi_chash *vs, unsigned start,
+    const struct vdi_chash_state *st, unsigned cap)
+{
+	unsigned u, h;
+
+	for (u = 0; u < vs->npoints; u++) {
+		h = vs->ring[(start + u) % vs->npoints].host;
+		if (st[h].skip)
+			continue;
+		if (cap > 0 && st[h].busy >= cap)
+			continue;
+		return (h);
+	}
+	return (-1);
+}
+
+static struct vbc *
+vdi_chash_pick(struct req *req, const struct vdi_chash *vs)
+{
+	struct vdi_chash_state *st;
+	uint32_t key;
+	unsigned lo, hi, mid, u, n, nh, tot, cap;
+	struct vbc *vbc;
+	int h;
+
+	AN(req->digest);
+	key = vbe32dec(req->digest);
+
+	/* First point at or after the key, wrapping around */
+	lo = 0;
+	hi = vs->npoints;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (vs->ring[mid].point < key)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo == vs->npoints)
+		lo = 0;
+
+	st = (void*)WS_Alloc(req->ws, vs->nhosts * sizeof *st);
+	if (st == NULL)
+		return (NULL);
+	nh = 0;
+	tot = 0;
+	for (u = 0; u < vs->nhosts; u++) {
+		st[u].skip = !VDI_Healthy(vs->hosts[u].backend, req);
+		st[u].busy = 0;
+		if (st[u].skip)
+			continue;
+		nh++;
+		if (vs->load_factor > 0)
+			st[u].busy = VBE_Busy(vs->hosts[u].backend);
+		tot += st[u].busy;
+	}
+	if (nh == 0)
+		return (NULL);
+
+	cap = 0;
+	if (vs->load_factor > 0) {
+		/* Count this fetch in, and round up */
+		cap = ((tot + 1) * vs->load_factor + 100 * nh - 1) /
+		    (100 * nh);
+		if (cap == 0)
+			cap = 1;
+	}
+
+	for (n = 0; n < vs->retries; n++) {
+		h = vdi_chash_walk(vs, lo, st, cap);
+		if (h < 0 && cap > 0)
+			h = vdi_chash_walk(vs, lo, st, 0);
+		if (h < 0)
+			break;
+		st[h].skip = 1;
+		vbc = VDI_GetFd(vs->hosts[h].backend, req);
+		if (vbc != NULL)
+			return (vbc);
+	}
+	return (NULL);
+}
+
+static struct vbc *
+vdi_chash_getfd(const struct director *d, struct req *req)
+{
+	struct vdi_chash *vs;
+
+	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
+	CHECK_OBJ_NOTNULL(d, DIRECTOR_MAGIC);
+	CAST_OBJ_NOTNULL(vs, d->priv, VDI_CHASH_MAGIC);
+
+	return (vdi_chash_pick(req, vs));
+}
+
+/*
+ * Healthy if just a single backend is...
+ */
+static unsigned
+vdi_chash_healthy(const struct director *d, const struct req *req)
+{
+	struct vdi_chash *vs;
+	unsigned u;
+
+	CHECK_OBJ_NOTNULL(d, DIRECTOR_MAGIC);
+	CAST_OBJ_NOTNULL(vs, d->priv, VDI_CHASH_MAGIC);
+
+	for (u = 0; u < vs->nhosts; u++) {
+		if (VDI_Healthy(vs->hosts[u].backend, req))
+			return (1);
+	}
+	return (0);
+}
+
+static void
+vdi_chash_fini(const struct director *d)
+{
+	struct vdi_chash *vs;
+
+	CHECK_OBJ_NOTNULL(d, DIRECTOR_MAGIC);
+	CAST_OBJ_NOTNULL(vs, d->priv, VDI_CHASH_MAGIC);
+
+	free(vs->ring);
+	free(vs->hosts);
+	free(vs->dir.vcl_name);
+	vs->dir.magic = 0;
+	FREE_OBJ(vs);
+}
+
+void
+VRT_init_dir_chash(struct cli *cli, struct director **bp, int idx,
+    const void *priv)
+{
+	const struct vrt_dir_chash *t;
+	struct vdi_chash *vs;
+	const struct vrt_dir_chash_entry *te;
+	struct vdi_chash_host *vh;
+	struct vdi_chash_point *vp;
+	struct SHA256Context ctx;
+	uint8_t sign[SHA256_LEN];
+	char buf[32];
+	unsigned u, v, vnodes;
+
+	ASSERT_CLI();
+	(void)cli;
+	t = priv;
+
+	ALLOC_OBJ(vs, VDI_CHASH_MAGIC);
+	XXXAN(vs);
+	vs->hosts = calloc(sizeof *vh, t->nmember);
+	XXXAN(vs->hosts);
+
+	vs->dir.magic = DIRECTOR_MAGIC;
+	vs->dir.priv = vs;
+	vs->dir.name = "chash";
+	REPLACE(vs->dir.vcl_name, t->name);
+	vs->dir.getfd = vdi_chash_getfd;
+	vs->dir.fini = vdi_chash_fini;
+	vs->dir.healthy = vdi_chash_healthy;
+
+	vs->retries = t->retries;
+	if (vs->retries == 0)
+		vs->retries = t->nmember;
+	vs->load_factor = t->load_factor;
+	vnodes = t->vnodes;
+	if (vnodes == 0)
+		vnodes = VDI_CHASH_VNODES;
+
+	vh = vs->hosts;
+	te = t->members;
+	for (u = 0; u < t->nmember; u++, vh++, te++) {
+		vh->weight = te->weight > 0 ? te->weight : 1;
+		vh->backend = bp[te->host];
+		AN(vh->backend);
+		vs->npoints += vnodes * vh->weight;
+	}
+	vs->nhosts = t->nmember;
+
+	vs->ring = calloc(sizeof *vs->ring, vs->npoints);
+	XXXAN(vs->ring);
+	vp = vs->ring;
+	for (u = 0; u < vs->nhosts; u++) {
+		for (v = 0; v < vnodes * vs->hosts[u].weight; v++, vp++) {
+			bprintf(buf, "-%u", v);
+			SHA256_Init(&ctx);
+			SHA256_Update(&ctx, vs->hosts[u].backend->vcl_name,
+			    strlen(vs->hosts[u].backend->vcl_name));
+			SHA256_Update(&ctx, buf, strlen(buf));
+			SHA256_Final(sign, &ctx);
+			vp->point = vbe32dec(sign);
+			vp->host = u;
+		}
+	}
+	assert(vp == vs->ring + vs->npoints);
+	qsort(vs->ring, vs->npoints, sizeof *vs->ring, vdi_chash_cmp);
+
+	bp[idx] = &vs->dir;
+}
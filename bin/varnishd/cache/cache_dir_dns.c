@@ -25,6 +25,27 @@
  * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
  * SUCH DAMAGE.
  *
+ * The DNS director.
+ *
+ * The Host: header (plus .suffix) is looked up in DNS, and the backends
+ * with a matching address are used.
+ *
+ * The lookups are never done by the request threads, each runs in a
+ * short-lived thread of its own, so one slow name holds up nobody else.
+ * A request for a name not yet in the cache adds an entry, starts the
+ * lookup and fails at once.  A request for an expired name starts the
+ * lookup again, and uses the previous result meanwhile.
+ *
+ * The dns-lookup thread starts lookups of names again when three
+ * quarters of the .ttl has passed, if they have been used within the
+ * last .ttl, and drops those which have not been for a .ttl past their
+ * expiry.  Should a lookup fail, the previous result is used until a
+ * later one succeeds.
+ *
+ * For testing, the 'debug.dns_stub' CLI command replaces the resolver
+ * with a table of names and numeric addresses, optionally taking their
+ * time to answer.
+ *
  */
 
 #include "config.h"
@@ -40,13 +61,21 @@
 #include "cache.h"
 
 #include "cache_backend.h"
+#include "vcli_priv.h"
 #include "vrt.h"
+#include "vtim.h"
 
 /*--------------------------------------------------------------------*/
 
 /* FIXME: Should eventually be a configurable variable. */
 #define VDI_DNS_MAX_CACHE		1024
 #define VDI_DNS_GROUP_MAX_BACKENDS	1024
+#define VDI_DNS_HASH_SIZE		256
+
+/* Minimum time between lookups of the same name */
+#define VDI_DNS_RETRY			1.0
+/* Lookups in flight, for all directors */
+#define VDI_DNS_MAX_LOOKUPS		32
 
 /* DNS Cache entry
  */
@@ -54,26 +83,75 @@ struct vdi_dns_hostgroup {
 	unsigned			magic;
 #define VDI_DNSDIR_MAGIC		0x1bacab21
 	char				*hostname;
+	unsigned			hash;
 	struct director			*hosts[VDI_DNS_GROUP_MAX_BACKENDS];
 	unsigned			nhosts;
 	unsigned			next_host; /* Next to use...*/
-	double				ttl;
+	unsigned			resolved;
+	unsigned			lookup;	/* Lookup in flight */
+	double				ttl;	/* Expiry time */
+	double				t_used;
+	double				t_retry;
 	VTAILQ_ENTRY(vdi_dns_hostgroup)	list;
+	VTAILQ_ENTRY(vdi_dns_hostgroup)	hlist;
 };
 
+VTAILQ_HEAD(vdi_dns_head, vdi_dns_hostgroup);
+
 struct vdi_dns {
 	unsigned			magic;
 #define VDI_DNS_MAGIC			0x1337a178
 	struct director			dir;
 	struct director			**hosts;
 	unsigned			nhosts;
-	VTAILQ_HEAD(_cachelist,vdi_dns_hostgroup)	cachelist;
+	struct vdi_dns_head		cachelist;	/* LRU order */
+	struct vdi_dns_head		hash[VDI_DNS_HASH_SIZE];
 	unsigned			ncachelist;
-	pthread_rwlock_t		rwlock;
+	unsigned			nlookup;	/* In flight */
+	struct lock			mtx;
+	pthread_cond_t			cond;		/* nlookup drops */
 	const char			*suffix;
 	double			ttl;
+	VTAILQ_ENTRY(vdi_dns)		list;
+};
+
+/*
+ * The directors the lookup thread looks after, and the stub resolver.
+ * Lock order is vdi_dns->mtx before dns_mtx.  The lookup thread never
+ * holds dns_mtx while looking at a director, and 'dns_busy' keeps the
+ * director it is working on from going away under it.  Lookups in
+ * flight are counted in vdi_dns->nlookup, which keeps their director
+ * around, and in dns_nlookup.
+ */
+
+struct vdi_dns_job {
+	unsigned			magic;
+#define VDI_DNS_JOB_MAGIC		0x4e1d0c3b
+	struct vdi_dns			*vs;
+	char				*hostname;
+	unsigned			hash;
+	double				t;
+};
+
+struct vdi_dns_stub {
+	unsigned			magic;
+#define VDI_DNS_STUB_MAGIC		0x7e10c5a2
+	char				*name;
+	char				*addr;
+	double				delay;
+	VTAILQ_ENTRY(vdi_dns_stub)	list;
 };
 
+static struct lock			dns_mtx;
+static pthread_cond_t			dns_cond;
+static pthread_cond_t			dns_idle;
+static VTAILQ_HEAD(, vdi_dns)		dns_dirs =
+    VTAILQ_HEAD_INITIALIZER(dns_dirs);
+static const struct vdi_dns		*dns_busy;
+static unsigned				dns_nlookup;
+static VTAILQ_HEAD(, vdi_dns_stub)	dns_stubs =
+    VTAILQ_HEAD_INITIALIZER(dns_stubs);
+
 /* Compare an IPv4 backend to a IPv4 addr/len */
 static int
 vdi_dns_comp_addrinfo4(const struct backend *bp,
@@ -161,147 +239,78 @@ vdi_dns_pick_host(const struct req *req, struct vdi_dns_hostgroup *group)
 	return (NULL);
 }
 
-/* Remove an item from the dns cache.
- * If *group is NULL, the head is popped.
- * Remember locking.
- */
-static void
-vdi_dns_pop_cache(struct vdi_dns *vs,
-		  struct vdi_dns_hostgroup *group)
+/* FNV-1a */
+static unsigned
+vdi_dns_hash(const char *hostname)
 {
-	if (group == NULL)
-		group = VTAILQ_LAST( &vs->cachelist, _cachelist );
-	assert(group != NULL);
-	free(group->hostname);
-	VTAILQ_REMOVE(&vs->cachelist, group, list);
-	FREE_OBJ(group);
-	vs->ncachelist--;
-}
+	unsigned h = 2166136261U;
 
-/* Dummy in case someone feels like optimizing it? meh...
- */
-static inline int
-vdi_dns_groupmatch(const struct vdi_dns_hostgroup *group, const char *hostname)
-{
-	return (!strcmp(group->hostname, hostname));
+	for (; *hostname != '\0'; hostname++) {
+		h ^= (unsigned char)*hostname;
+		h *= 16777619U;
+	}
+	return (h);
 }
 
-/* Search the cache for 'hostname' and put a backend-pointer as necessary,
- * return true for cache hit. This could still be a NULL backend if we did
- * a lookup earlier and didn't find a host (ie: cache failed too)
- *
- * if rwlock is true, the first timed out object found (if any) is popped
- * and freed.
- */
-static int
-vdi_dns_cache_has(const struct req *req, struct vdi_dns *vs,
-    const char *hostname, struct director **backend, int rwlock)
+static struct vdi_dns_hostgroup *
+vdi_dns_lookup(struct vdi_dns *vs, const char *hostname, unsigned h)
 {
-	struct director *ret;
 	struct vdi_dns_hostgroup *hostgr;
-	struct vdi_dns_hostgroup *hostgr2;
 
-	VTAILQ_FOREACH_SAFE(hostgr, &vs->cachelist, list, hostgr2) {
+	Lck_AssertHeld(&vs->mtx);
+	VTAILQ_FOREACH(hostgr, &vs->hash[h % VDI_DNS_HASH_SIZE], hlist) {
 		CHECK_OBJ_NOTNULL(hostgr, VDI_DNSDIR_MAGIC);
-		if (hostgr->ttl <= req->t_req) {
-			if (rwlock)
-				vdi_dns_pop_cache(vs, hostgr);
-			return (0);
-		}
-		if (vdi_dns_groupmatch(hostgr, hostname)) {
-			ret = (vdi_dns_pick_host(req, hostgr));
-			*backend = ret;
-			if (*backend != NULL)
-				CHECK_OBJ_NOTNULL(*backend, DIRECTOR_MAGIC);
-			return (1);
-		}
+		if (hostgr->hash == h && !strcmp(hostgr->hostname, hostname))
+			return (hostgr);
 	}
-	return (0);
+	return (NULL);
 }
 
-/* Add a newly cached item to the dns cache list.
- * (Sorry for the list_add/_add confusion...)
+/* Remove an item from the dns cache.
+ * If group is NULL, the least recently used one is popped.
  */
 static void
-vdi_dns_cache_list_add(const struct req *req, struct vdi_dns *vs,
-    struct vdi_dns_hostgroup *new)
+vdi_dns_pop_cache(struct vdi_dns *vs,
+		  struct vdi_dns_hostgroup *group)
 {
-
-	if (vs->ncachelist >= VDI_DNS_MAX_CACHE) {
-		VSC_C_main->dir_dns_cache_full++;
-		vdi_dns_pop_cache(vs, NULL);
-	}
-	CHECK_OBJ_NOTNULL(new, VDI_DNSDIR_MAGIC);
-	assert(new->hostname != 0);
-	new->ttl = req->t_req + vs->ttl;
-	VTAILQ_INSERT_HEAD(&vs->cachelist, new, list);
-	vs->ncachelist++;
+	if (group == NULL)
+		group = VTAILQ_LAST(&vs->cachelist, vdi_dns_head);
+	CHECK_OBJ_NOTNULL(group, VDI_DNSDIR_MAGIC);
+	free(group->hostname);
+	VTAILQ_REMOVE(&vs->cachelist, group, list);
+	VTAILQ_REMOVE(&vs->hash[group->hash % VDI_DNS_HASH_SIZE],
+	    group, hlist);
+	FREE_OBJ(group);
+	vs->ncachelist--;
 }
 
-/* Add an item to the dns cache.
- * XXX: Might want to factor the getaddrinfo() out of the lock and do the
- * cache_has() afterwards to do multiple dns lookups in parallel...
- */
-static int
-vdi_dns_cache_add(const struct req *req, struct vdi_dns *vs,
-    const char *hostname, struct director **backend)
+/* Add an empty entry for the lookup thread to fill in */
+static struct vdi_dns_hostgroup *
+vdi_dns_cache_add(struct vdi_dns *vs, const char *hostname, unsigned h)
 {
-	int error, i, host = 0;
-	struct addrinfo *res0, *res, hint;
 	struct vdi_dns_hostgroup *new;
 
-	/* Due to possible race while upgrading the lock, we have to
-	 * recheck if the result is already looked up. The overhead for
-	 * this is insignificant unless dns isn't cached properly (all
-	 * unique names or something equally troublesome).
-	 */
-
-	if (vdi_dns_cache_has(req, vs, hostname, backend, 1))
-		return (1);
-
-	memset(&hint, 0, sizeof hint);
-	hint.ai_family = PF_UNSPEC;
-	hint.ai_socktype = SOCK_STREAM;
-
+	Lck_AssertHeld(&vs->mtx);
+	if (vs->ncachelist >= VDI_DNS_MAX_CACHE) {
+		VSC_C_main->dir_dns_cache_full++;
+		vdi_dns_pop_cache(vs, NULL);
+	}
 	ALLOC_OBJ(new, VDI_DNSDIR_MAGIC);
 	XXXAN(new);
-
 	REPLACE(new->hostname, hostname);
-
-	error = getaddrinfo(hostname, "80", &hint, &res0);
-	VSC_C_main->dir_dns_lookups++;
-	if (error) {
-		vdi_dns_cache_list_add(req, vs, new);
-		VSC_C_main->dir_dns_failed++;
-		return (0);
-	}
-
-	for (res = res0; res; res = res->ai_next) {
-		if (res->ai_family != PF_INET && res->ai_family != PF_INET6)
-			continue;
-
-		for (i = 0; i < vs->nhosts; i++) {
-			struct sockaddr_storage ss_hack;
-			memcpy(&ss_hack, res->ai_addr, res->ai_addrlen);
-			if (vdi_dns_comp_addrinfo(vs->hosts[i],
-			    &ss_hack, res->ai_addrlen)) {
-				new->hosts[host] = vs->hosts[i];
-				CHECK_OBJ_NOTNULL(new->hosts[host],
-				    DIRECTOR_MAGIC);
-				host++;
-			}
-		}
-	}
-	freeaddrinfo(res0);
-
-	new->nhosts = host;
-	vdi_dns_cache_list_add(req, vs, new);
-	*backend = vdi_dns_pick_host(req, new);
-	return (1);
+	new->hash = h;
+	VTAILQ_INSERT_HEAD(&vs->cachelist, new, list);
+	VTAILQ_INSERT_HEAD(&vs->hash[h % VDI_DNS_HASH_SIZE], new, hlist);
+	vs->ncachelist++;
+	return (new);
 }
 
-/* Walk through the cached lookups looking for the relevant host, add one
- * if it isn't already cached.
+static void vdi_dns_start(struct vdi_dns *, struct vdi_dns_hostgroup *,
+    double);
+
+/* Find the relevant host in the cache, never waiting for a lookup:
+ * If the name isn't there yet, the lookup is started and we fail, if it
+ * has expired, the lookup is started again and the old result used.
  *
  * Returns a backend or NULL.
  */
@@ -310,22 +319,36 @@ vdi_dns_walk_cache(const struct req *req, struct vdi_dns *vs,
     const char *hostname)
 {
 	struct director *backend = NULL;
-	int ret;
-
-	AZ(pthread_rwlock_rdlock(&vs->rwlock));
-	ret = vdi_dns_cache_has(req, vs, hostname, &backend, 0);
-	AZ(pthread_rwlock_unlock(&vs->rwlock));
-	if (!ret) {
-		/*
-		 * XXX: Isn't there a race here where another thread
-		 * XXX: could grab the lock and add it before we do ?
-		 * XXX: Should 'ret' be checked for that ?
-		 */
-		AZ(pthread_rwlock_wrlock(&vs->rwlock));
-		ret = vdi_dns_cache_add(req, vs, hostname, &backend);
-		AZ(pthread_rwlock_unlock(&vs->rwlock));
-	} else
+	struct vdi_dns_hostgroup *hostgr;
+	double now;
+	unsigned h;
+
+	h = vdi_dns_hash(hostname);
+	now = VTIM_real();
+	Lck_Lock(&vs->mtx);
+	hostgr = vdi_dns_lookup(vs, hostname, h);
+	if (hostgr == NULL)
+		hostgr = vdi_dns_cache_add(vs, hostname, h);
+	hostgr->t_used = now;
+	if (!hostgr->resolved) {
+		VSC_C_main->dir_dns_pending++;
+		vdi_dns_start(vs, hostgr, now);
+		Lck_Unlock(&vs->mtx);
+		return (NULL);
+	}
+	if (hostgr->ttl > now) {
 		VSC_C_main->dir_dns_hit++;
+	} else {
+		VSC_C_main->dir_dns_stale++;
+		if (hostgr->t_retry <= now)
+			vdi_dns_start(vs, hostgr, now);
+	}
+	if (hostgr != VTAILQ_FIRST(&vs->cachelist)) {
+		VTAILQ_REMOVE(&vs->cachelist, hostgr, list);
+		VTAILQ_INSERT_HEAD(&vs->cachelist, hostgr, list);
+	}
+	backend = vdi_dns_pick_host(req, hostgr);
+	Lck_Unlock(&vs->mtx);
 
 	/* Bank backend == cached a failure, so to speak */
 	if (backend != NULL)
@@ -413,6 +436,217 @@ vdi_dns_healthy(const struct director *dir, const struct req *req)
 	*/
 }
 
+/*--------------------------------------------------------------------
+ * The lookup thread
+ */
+
+static int
+vdi_dns_getaddrinfo(const char *hostname, struct addrinfo **res0)
+{
+	struct addrinfo hint;
+	struct vdi_dns_stub *st;
+	char addr[NI_MAXHOST];
+	double delay = 0.;
+
+	memset(&hint, 0, sizeof hint);
+	hint.ai_family = PF_UNSPEC;
+	hint.ai_socktype = SOCK_STREAM;
+
+	Lck_Lock(&dns_mtx);
+	if (VTAILQ_EMPTY(&dns_stubs)) {
+		Lck_Unlock(&dns_mtx);
+		return (getaddrinfo(hostname, "80", &hint, res0));
+	}
+	VTAILQ_FOREACH(st, &dns_stubs, list)
+		if (!strcmp(st->name, hostname))
+			break;
+	if (st != NULL) {
+		bprintf(addr, "%s", st->addr);
+		delay = st->delay;
+	}
+	Lck_Unlock(&dns_mtx);
+	if (delay > 0.)
+		VTIM_sleep(delay);
+	if (st == NULL)
+		return (EAI_NONAME);
+	hint.ai_flags = AI_NUMERICHOST;
+	return (getaddrinfo(addr, "80", &hint, res0));
+}
+
+/* Look up a name, and put the result in the cache, if it is still
+ * there.  This runs in a thread of its own.
+ */
+static void *
+vdi_dns_job_thread(void *priv)
+{
+	struct vdi_dns_job *job;
+	struct vdi_dns *vs;
+	struct vdi_dns_hostgroup *hostgr;
+	struct director *hosts[VDI_DNS_GROUP_MAX_BACKENDS];
+	struct addrinfo *res0, *res;
+	int error, i;
+	unsigned host = 0;
+
+	CAST_OBJ_NOTNULL(job, priv, VDI_DNS_JOB_MAGIC);
+	vs = job->vs;
+	CHECK_OBJ_NOTNULL(vs, VDI_DNS_MAGIC);
+
+	error = vdi_dns_getaddrinfo(job->hostname, &res0);
+	VSC_C_main->dir_dns_lookups++;
+	if (error) {
+		VSC_C_main->dir_dns_failed++;
+	} else {
+		for (res = res0; res; res = res->ai_next) {
+			if (res->ai_family != PF_INET &&
+			    res->ai_family != PF_INET6)
+				continue;
+
+			for (i = 0; i < vs->nhosts; i++) {
+				struct sockaddr_storage ss_hack;
+				memcpy(&ss_hack, res->ai_addr, res->ai_addrlen);
+				if (host < VDI_DNS_GROUP_MAX_BACKENDS &&
+				    vdi_dns_comp_addrinfo(vs->hosts[i],
+				    &ss_hack, res->ai_addrlen)) {
+					hosts[host] = vs->hosts[i];
+					CHECK_OBJ_NOTNULL(hosts[host],
+					    DIRECTOR_MAGIC);
+					host++;
+				}
+			}
+		}
+		freeaddrinfo(res0);
+	}
+
+	Lck_Lock(&vs->mtx);
+	/* It may have been evicted meanwhile */
+	hostgr = vdi_dns_lookup(vs, job->hostname, job->hash);
+	if (hostgr != NULL) {
+		if (!error) {
+			memcpy(hostgr->hosts, hosts, host * sizeof hosts[0]);
+			hostgr->nhosts = host;
+			hostgr->ttl = job->t + vs->ttl;
+		} else if (!hostgr->resolved) {
+			/* Nothing to fall back on, cache the failure */
+			hostgr->nhosts = 0;
+			hostgr->ttl = job->t + vs->ttl;
+		}
+		hostgr->resolved = 1;
+		hostgr->lookup = 0;
+	}
+	assert(vs->nlookup > 0);
+	if (--vs->nlookup == 0)
+		AZ(pthread_cond_broadcast(&vs->cond));
+	/* vdi_dns_fini() may free vs as soon as we let go */
+	Lck_Unlock(&vs->mtx);
+
+	Lck_Lock(&dns_mtx);
+	dns_nlookup--;
+	Lck_Unlock(&dns_mtx);
+	free(job->hostname);
+	FREE_OBJ(job);
+	return (NULL);
+}
+
+/* Start looking a name up, unless that is already happening, or too
+ * many lookups are.  In that case, the dns-lookup thread tries again.
+ */
+static void
+vdi_dns_start(struct vdi_dns *vs, struct vdi_dns_hostgroup *hostgr,
+    double now)
+{
+	struct vdi_dns_job *job;
+	pthread_t thr;
+
+	Lck_AssertHeld(&vs->mtx);
+	if (hostgr->lookup)
+		return;
+	Lck_Lock(&dns_mtx);
+	if (dns_nlookup >= VDI_DNS_MAX_LOOKUPS) {
+		Lck_Unlock(&dns_mtx);
+		return;
+	}
+	dns_nlookup++;
+	Lck_Unlock(&dns_mtx);
+
+	ALLOC_OBJ(job, VDI_DNS_JOB_MAGIC);
+	XXXAN(job);
+	REPLACE(job->hostname, hostgr->hostname);
+	job->hash = hostgr->hash;
+	job->vs = vs;
+	job->t = now;
+	hostgr->t_retry = now + VDI_DNS_RETRY;
+	if (pthread_create(&thr, NULL, vdi_dns_job_thread, job)) {
+		free(job->hostname);
+		FREE_OBJ(job);
+		Lck_Lock(&dns_mtx);
+		dns_nlookup--;
+		Lck_Unlock(&dns_mtx);
+		return;
+	}
+	AZ(pthread_detach(thr));
+	hostgr->lookup = 1;
+	vs->nlookup++;
+}
+
+/* Start lookups of the names which are about to expire, or which could
+ * not be started before, and drop those nobody wants.
+ */
+static void
+vdi_dns_refresh(struct vdi_dns *vs)
+{
+	struct vdi_dns_hostgroup *hostgr, *hostgr2;
+	double now;
+
+	Lck_Lock(&vs->mtx);
+	now = VTIM_real();
+	VTAILQ_FOREACH_SAFE(hostgr, &vs->cachelist, list, hostgr2) {
+		CHECK_OBJ_NOTNULL(hostgr, VDI_DNSDIR_MAGIC);
+		if (hostgr->lookup || now < hostgr->t_retry)
+			continue;
+		if (!hostgr->resolved) {
+			vdi_dns_start(vs, hostgr, now);
+			continue;
+		}
+		if (hostgr->t_used + vs->ttl <= now &&
+		    hostgr->ttl + vs->ttl <= now) {
+			/* Nobody has wanted it for a while */
+			vdi_dns_pop_cache(vs, hostgr);
+			continue;
+		}
+		if (hostgr->ttl - vs->ttl * 0.25 <= now &&
+		    hostgr->t_used + vs->ttl > now)
+			vdi_dns_start(vs, hostgr, now);
+	}
+	Lck_Unlock(&vs->mtx);
+}
+
+static void * __match_proto__(bgthread_t)
+vdi_dns_thread(struct worker *wrk, void *priv)
+{
+	struct vdi_dns *vs;
+	struct timespec ts;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	(void)priv;
+	Lck_Lock(&dns_mtx);
+	while (1) {
+		VTAILQ_FOREACH(vs, &dns_dirs, list) {
+			CHECK_OBJ_NOTNULL(vs, VDI_DNS_MAGIC);
+			dns_busy = vs;
+			Lck_Unlock(&dns_mtx);
+			vdi_dns_refresh(vs);
+			Lck_Lock(&dns_mtx);
+			dns_busy = NULL;
+			AZ(pthread_cond_broadcast(&dns_idle));
+		}
+		ts = VTIM_timespec(VTIM_real() + VDI_DNS_RETRY);
+		(void)Lck_CondWait(&dns_cond, &dns_mtx, &ts);
+	}
+	NEEDLESS_RETURN(NULL);
+}
+
+/*--------------------------------------------------------------------*/
+
 static void
 vdi_dns_fini(const struct director *d)
 {
@@ -421,11 +655,24 @@ vdi_dns_fini(const struct director *d)
 	CHECK_OBJ_NOTNULL(d, DIRECTOR_MAGIC);
 	CAST_OBJ_NOTNULL(vs, d->priv, VDI_DNS_MAGIC);
 
+	Lck_Lock(&dns_mtx);
+	while (dns_busy == vs)
+		(void)Lck_CondWait(&dns_idle, &dns_mtx, NULL);
+	VTAILQ_REMOVE(&dns_dirs, vs, list);
+	Lck_Unlock(&dns_mtx);
+
+	Lck_Lock(&vs->mtx);
+	while (vs->nlookup > 0)
+		(void)Lck_CondWait(&vs->cond, &vs->mtx, NULL);
+	while (!VTAILQ_EMPTY(&vs->cachelist))
+		vdi_dns_pop_cache(vs, NULL);
+	Lck_Unlock(&vs->mtx);
+
 	free(vs->hosts);
 	free(vs->dir.vcl_name);
 	vs->dir.magic = 0;
-	/* FIXME: Free the cache */
-	AZ(pthread_rwlock_destroy(&vs->rwlock));
+	Lck_Delete(&vs->mtx);
+	AZ(pthread_cond_destroy(&vs->cond));
 	FREE_OBJ(vs);
 }
 
@@ -463,6 +710,65 @@ VRT_init_dir_dns(struct cli *cli, struct director **bp, int idx,
 	vs->nhosts = t->nmember;
 	vs->ttl = t->ttl;
 	VTAILQ_INIT(&vs->cachelist);
-	AZ(pthread_rwlock_init(&vs->rwlock, NULL));
+	for (i = 0; i < VDI_DNS_HASH_SIZE; i++)
+		VTAILQ_INIT(&vs->hash[i]);
+	Lck_New(&vs->mtx, lck_dns);
+	AZ(pthread_cond_init(&vs->cond, NULL));
 	bp[idx] = &vs->dir;
+
+	Lck_Lock(&dns_mtx);
+	VTAILQ_INSERT_TAIL(&dns_dirs, vs, list);
+	Lck_Unlock(&dns_mtx);
+}
+
+/*--------------------------------------------------------------------
+ * Debugging aids
+ */
+
+static void
+debug_dns_stub(struct cli *cli, const char * const *av, void *priv)
+{
+	struct vdi_dns_stub *st;
+
+	(void)cli;
+	(void)priv;
+	Lck_Lock(&dns_mtx);
+	VTAILQ_FOREACH(st, &dns_stubs, list)
+		if (!strcmp(st->name, av[2]))
+			break;
+	if (st == NULL && av[3] != NULL) {
+		ALLOC_OBJ(st, VDI_DNS_STUB_MAGIC);
+		AN(st);
+		REPLACE(st->name, av[2]);
+		VTAILQ_INSERT_TAIL(&dns_stubs, st, list);
+	}
+	if (st != NULL && av[3] != NULL) {
+		REPLACE(st->addr, av[3]);
+		st->delay = av[4] != NULL ? strtod(av[4], NULL) : 0.;
+	} else if (st != NULL) {
+		/* Keep the stub in place, failing the name */
+		REPLACE(st->addr, "");
+	}
+	Lck_Unlock(&dns_mtx);
+}
+
+static struct cli_proto debug_cmds[] = {
+	{ "debug.dns_stub", "debug.dns_stub <name> [<address> [<delay>]]",
+		"\tResolve <name> to <address> in the DNS director,\n"
+		"\tafter <delay> seconds, or fail it, instead of using\n"
+		"\tthe system resolver.\n",
+		1, 3, "d", debug_dns_stub },
+	{ NULL }
+};
+
+void
+VDI_DNS_Init(void)
+{
+	pthread_t pt;
+
+	Lck_New(&dns_mtx, lck_dns);
+	AZ(pthread_cond_init(&dns_cond, NULL));
+	AZ(pthread_cond_init(&dns_idle, NULL));
+	WRK_BgThread(&pt, "dns-lookup", vdi_dns_thread, NULL);
+	CLI_AddFuncs(debug_cmds);
 }
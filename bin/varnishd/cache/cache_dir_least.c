@@ -0,0 +1,208 @@
+/*-
+ * Copyright (c) 2013 Varnish Software AS
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * The least-conn and least-latency directors.
+ *
+ * Both sample two healthy backends at random and use the better of
+ * the two ("power of two choices"), rather than the best of them all,
+ * so that a burst of requests does not all pile onto the one backend
+ * which looked best a moment ago.
+ *
+ * least-conn compares the number of fetches in progress, least-latency
+ * compares the moving average of the time to first byte, with the
+ * number of fetches in progress as tie-breaker.  A backend without a
+ * measurement yet is preferred, so that it gets one.  Fetches which fail
+ * before the first byte count as taking the first_byte_timeout.
+ *
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache.h"
+
+#include "cache_backend.h"
+#include "vrt.h"
+
+/*--------------------------------------------------------------------*/
+
+enum crit_e { c_conn, c_latency };
+
+struct vdi_least {
+	unsigned		magic;
+#define VDI_LEAST_MAGIC		0x4d1f3c92
+	struct director		dir;
+	enum crit_e		criteria;
+	struct director		**hosts;
+	unsigned		nhosts;
+};
+
+/*
+ * Is backend 'a' a better choice than backend 'b' ?
+ */
+static int
+vdi_least_better(const struct vdi_least *vs, const struct director *a,
+    const struct director *b)
+{
+	double ta, tb;
+	int va, vb;
+
+	if (vs->criteria == c_latency) {
+		va = VBE_GetTtfb(a, &ta);
+		vb = VBE_GetTtfb(b, &tb);
+		if (va != vb)
+			return (!va);
+		if (ta != tb)
+			return (ta < tb);
+	}
+	return (VBE_Busy(a) < VBE_Busy(b));
+}
+
+static struct vbc *
+vdi_least_pick(struct req *req, const struct vdi_least *vs)
+{
+	uint8_t tried[vs->nhosts];
+	unsigned cand[vs->nhosts];
+	unsigned u, n, a, b;
+	struct vbc *vbe;
+
+	memset(tried, 0, sizeof tried);
+	while (1) {
+		n = 0;
+		for (u = 0; u < vs->nhosts; u++)
+			if (!tried[u] && VDI_Healthy(vs->hosts[u], req))
+				cand[n++] = u;
+		if (n == 0)
+			return (NULL);
+		a = cand[random() % n];
+		if (n > 1) {
+			/* A second one, different from the first */
+			b = cand[random() % (n - 1)];
+			if (b == a)
+				b = cand[n - 1];
+			if (vdi_least_better(vs, vs->hosts[b], vs->hosts[a]))
+				a = b;
+		}
+		tried[a] = 1;
+		vbe = VDI_GetFd(vs->hosts[a], req);
+		if (vbe != NULL)
+			return (vbe);
+	}
+}
+
+static struct vbc *
+vdi_least_getfd(const struct director *d, struct req *req)
+{
+	struct vdi_least *vs;
+
+	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
+	CHECK_OBJ_NOTNULL(d, DIRECTOR_MAGIC);
+	CAST_OBJ_NOTNULL(vs, d->priv, VDI_LEAST_MAGIC);
+
+	return (vdi_least_pick(req, vs));
+}
+
+static unsigned
+vdi_least_healthy(const struct director *d, const struct req *req)
+{
+	struct vdi_least *vs;
+	unsigned u;
+
+	CHECK_OBJ_NOTNULL(d, DIRECTOR_MAGIC);
+	CAST_OBJ_NOTNULL(vs, d->priv, VDI_LEAST_MAGIC);
+
+	for (u = 0; u < vs->nhosts; u++) {
+		if (VDI_Healthy(vs->hosts[u], req))
+			return (1);
+	}
+	return (0);
+}
+
+static void
+vdi_least_fini(const struct director *d)
+{
+	struct vdi_least *vs;
+
+	CHECK_OBJ_NOTNULL(d, DIRECTOR_MAGIC);
+	CAST_OBJ_NOTNULL(vs, d->priv, VDI_LEAST_MAGIC);
+
+	free(vs->hosts);
+	free(vs->dir.vcl_name);
+	vs->dir.magic = 0;
+	FREE_OBJ(vs);
+}
+
+static void
+vrt_init_dir(struct cli *cli, struct director **bp, int idx,
+    const void *priv, enum crit_e criteria)
+{
+	const struct vrt_dir_round_robin *t;
+	struct vdi_least *vs;
+	const struct vrt_dir_round_robin_entry *te;
+	int i;
+
+	ASSERT_CLI();
+	(void)cli;
+	t = priv;
+
+	ALLOC_OBJ(vs, VDI_LEAST_MAGIC);
+	XXXAN(vs);
+	vs->hosts = calloc(sizeof *vs->hosts, t->nmember);
+	XXXAN(vs->hosts);
+
+	vs->dir.magic = DIRECTOR_MAGIC;
+	vs->dir.priv = vs;
+	vs->dir.name = criteria == c_conn ? "least-conn" : "least-latency";
+	REPLACE(vs->dir.vcl_name, t->name);
+	vs->dir.getfd = vdi_least_getfd;
+	vs->dir.fini = vdi_least_fini;
+	vs->dir.healthy = vdi_least_healthy;
+
+	vs->criteria = criteria;
+	te = t->members;
+	for (i = 0; i < t->nmember; i++, te++) {
+		vs->hosts[i] = bp[te->host];
+		AN(vs->hosts[i]);
+	}
+	vs->nhosts = t->nmember;
+
+	bp[idx] = &vs->dir;
+}
+
+void
+VRT_init_dir_least_conn(struct cli *cli, struct director **bp, int idx,
+    const void *priv)
+{
+	vrt_init_dir(cli, bp, idx, priv, c_conn);
+}
+
+void
+VRT_init_dir_least_latency(struct cli *cli, struct director **bp, int idx,
+    const void *priv)
+{
+	vrt_init_dir(cli, bp, idx, priv, c_latency);
+}
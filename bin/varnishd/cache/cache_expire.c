@@ -416,13 +416,12 @@ exp_timer(struct worker *wrk, void *priv)
 }
 
 /*--------------------------------------------------------------------
- * Attempt to make space by nuking the oldest object on the LRU list
- * which isn't in use.
- * Returns: 1: did, 0: didn't, -1: can't
+ * Take the oldest object on the LRU list which isn't in use off the LRU
+ * and the timer.  The caller inherits the timer's reference.
  */
 
-int
-EXP_NukeOne(struct busyobj *bo, struct lru *lru)
+struct objcore *
+EXP_Evict(struct lru *lru)
 {
 	struct objcore *oc;
 
@@ -449,13 +448,27 @@ EXP_NukeOne(struct busyobj *bo, struct lru *lru)
 	}
 	Lck_Unlock(&exp_mtx);
 	Lck_Unlock(&lru->mtx);
+	return (oc);
+}
+
+/*--------------------------------------------------------------------
+ * Attempt to make space by nuking the oldest object on the LRU list
+ * which isn't in use.
+ * Returns: 1: did, 0: didn't, -1: can't
+ */
+
+int
+EXP_NukeOne(struct vsl_log *vsl, struct dstat *ds, struct lru *lru)
+{
+	struct objcore *oc;
 
+	oc = EXP_Evict(lru);
 	if (oc == NULL)
 		return (-1);
 
 	/* XXX: bad idea for -spersistent */
-	VSLb(bo->vsl, SLT_ExpKill, "%u LRU", oc_getxid(bo->stats, oc));
-	(void)HSH_Deref(bo->stats, oc, NULL);
+	VSLb(vsl, SLT_ExpKill, "%u LRU", oc_getxid(ds, oc));
+	(void)HSH_Deref(ds, oc, NULL);
 	return (1);
 }
 
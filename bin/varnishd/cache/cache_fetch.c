@@ -41,6 +41,7 @@
 #include "vcli_priv.h"
 #include "vct.h"
 #include "vtcp.h"
+#include "vtim.h"
 
 static unsigned fetchfrag;
 
@@ -440,6 +441,7 @@ FetchHdr(struct req *req, int need_host_hdr, int sendbody)
 	enum htc_status_e hs;
 	int retry = -1;
 	int i, first;
+	double t_sent;
 	struct http_conn *htc;
 
 	wrk = req->wrk;
@@ -486,6 +488,7 @@ FetchHdr(struct req *req, int need_host_hdr, int sendbody)
 		VSLb(req->vsl, SLT_FetchError,
 		    "backend write error: %d (%s)",
 		    errno, strerror(errno));
+		VBE_TtfbFail(vc);
 		VDI_CloseFd(&bo->vbc);
 		/* XXX: other cleanup ? */
 		return (retry);
@@ -493,6 +496,7 @@ FetchHdr(struct req *req, int need_host_hdr, int sendbody)
 
 	/* XXX is this the right place? */
 	VSC_C_main->backend_req++;
+	t_sent = VTIM_mono();
 
 	/* Receive response */
 
@@ -517,6 +521,8 @@ FetchHdr(struct req *req, int need_host_hdr, int sendbody)
 			VSLb(req->vsl, SLT_FetchError,
 			    "http %sread error: EOF",
 			    first ? "first " : "");
+			if (first)
+				VBE_TtfbFail(vc);
 			VDI_CloseFd(&bo->vbc);
 			/* XXX: other cleanup ? */
 			return (retry);
@@ -524,6 +530,7 @@ FetchHdr(struct req *req, int need_host_hdr, int sendbody)
 		if (first) {
 			retry = -1;
 			first = 0;
+			VBE_Ttfb(vc, VTIM_mono() - t_sent);
 			VTCP_set_read_timeout(vc->fd,
 			    vc->between_bytes_timeout);
 		}
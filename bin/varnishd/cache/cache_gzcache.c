@@ -0,0 +1,410 @@
+/*-
+ * Copyright (c) 2013 Varnish Software AS
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Cache of gunzip'ed variants of gzip'ed objects.
+ *
+ * Clients which do not accept gzip get the stored object gunzip'ed on
+ * the fly, on every single delivery.  For popular objects that is a lot
+ * of redundant inflate work, so when the parameter 'gunzip_cache' is
+ * non-zero, the first such delivery keeps the gunzip'ed output around
+ * as a variant hanging off the objcore, and later deliveries just
+ * write it out.
+ *
+ * Variants live in malloc'ed chunks outside the stevedores, on their own
+ * LRU list, and the total size is kept below 'gunzip_cache' by evicting
+ * from the cold end of that list.  A variant never outlives the grace
+ * period of its object, and is dropped when the objcore is freed.
+ *
+ * The objcore's pointer to its variant, the LRU list and the counters
+ * are all protected by gzc_mtx.  Delivery holds a reference on the
+ * variant until the WRW has been flushed, since the iovecs point into
+ * the chunks.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+
+#include "cache.h"
+
+struct gzc_chunk {
+	unsigned		magic;
+#define GZC_CHUNK_MAGIC		0x5d0fa3e1
+	VTAILQ_ENTRY(gzc_chunk)	list;
+	unsigned char		*ptr;
+	ssize_t			len;
+	ssize_t			space;
+};
+
+struct gzc {
+	unsigned		magic;
+#define GZC_MAGIC		0x1c8e0b27
+	int			refcnt;
+	struct objcore		*oc;
+	ssize_t			len;
+	double			expires;
+	VTAILQ_ENTRY(gzc)	lru_list;
+	VTAILQ_HEAD(gzc_chunkhead,gzc_chunk) chunks;
+};
+
+static struct lock		gzc_mtx;
+static VTAILQ_HEAD(,gzc)	gzc_lru = VTAILQ_HEAD_INITIALIZER(gzc_lru);
+static ssize_t			gzc_bytes;
+
+/*--------------------------------------------------------------------*/
+
+static struct gzc_chunk *
+gzc_newchunk(void)
+{
+	struct gzc_chunk *c;
+	ssize_t sz;
+
+	sz = cache_param->gzip_buffer;
+	c = malloc(sizeof *c + sz);
+	if (c == NULL)
+		return (NULL);
+	memset(c, 0, sizeof *c);
+	c->magic = GZC_CHUNK_MAGIC;
+	c->ptr = (void*)(c + 1);
+	c->space = sz;
+	return (c);
+}
+
+static void
+gzc_free(struct gzc *g)
+{
+	struct gzc_chunk *c;
+
+	CHECK_OBJ_NOTNULL(g, GZC_MAGIC);
+	AZ(g->refcnt);
+	AZ(g->oc);
+	while (!VTAILQ_EMPTY(&g->chunks)) {
+		c = VTAILQ_FIRST(&g->chunks);
+		CHECK_OBJ_NOTNULL(c, GZC_CHUNK_MAGIC);
+		VTAILQ_REMOVE(&g->chunks, c, list);
+		free(c);
+	}
+	FREE_OBJ(g);
+}
+
+/*--------------------------------------------------------------------
+ * Detach a variant from its objcore and the LRU.  The variant is freed
+ * when the last delivery using it lets go.
+ */
+
+static struct gzc *
+gzc_detach(struct gzc *g)
+{
+
+	Lck_AssertHeld(&gzc_mtx);
+	CHECK_OBJ_NOTNULL(g, GZC_MAGIC);
+	CHECK_OBJ_NOTNULL(g->oc, OBJCORE_MAGIC);
+	assert(g->oc->gzc == g);
+	g->oc->gzc = NULL;
+	g->oc = NULL;
+	VTAILQ_REMOVE(&gzc_lru, g, lru_list);
+	assert(gzc_bytes >= g->len);
+	gzc_bytes -= g->len;
+	VSC_C_main->gunzip_cache_bytes = gzc_bytes;
+	VSC_C_main->gunzip_cache_objs--;
+	if (g->refcnt > 0)
+		return (NULL);
+	return (g);
+}
+
+/*--------------------------------------------------------------------
+ * Find the cached variant of the object we are about to deliver,
+ * and take a reference on it.
+ */
+
+static struct gzc *
+gzc_get(const struct req *req)
+{
+	struct objcore *oc;
+	struct gzc *g, *gf = NULL;
+
+	oc = req->obj->objcore;
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+	if (oc->gzc == NULL)
+		return (NULL);
+	Lck_Lock(&gzc_mtx);
+	g = oc->gzc;
+	if (g != NULL) {
+		CHECK_OBJ_NOTNULL(g, GZC_MAGIC);
+		if (g->expires < req->t_resp) {
+			gf = gzc_detach(g);
+			g = NULL;
+		} else {
+			g->refcnt++;
+			VTAILQ_REMOVE(&gzc_lru, g, lru_list);
+			VTAILQ_INSERT_TAIL(&gzc_lru, g, lru_list);
+			VSC_C_main->gunzip_cache_hit++;
+		}
+	}
+	Lck_Unlock(&gzc_mtx);
+	if (gf != NULL)
+		gzc_free(gf);
+	return (g);
+}
+
+/*--------------------------------------------------------------------
+ * Hang a freshly built variant on the objcore, making room for it
+ * under the budget by evicting variants from the cold end of the LRU.
+ */
+
+static void
+gzc_insert(const struct req *req, struct gzc *g)
+{
+	struct objcore *oc;
+	struct gzc *g2;
+	VTAILQ_HEAD(,gzc) kill = VTAILQ_HEAD_INITIALIZER(kill);
+
+	CHECK_OBJ_NOTNULL(g, GZC_MAGIC);
+	oc = req->obj->objcore;
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+
+	/* Grace'd hits still use the same body, so keep it that long */
+	g->expires = EXP_Grace(NULL, req->obj);
+
+	Lck_Lock(&gzc_mtx);
+	if (oc->gzc != NULL || g->len > cache_param->gunzip_cache) {
+		/* Somebody beat us to it, or budget shrunk meanwhile */
+		Lck_Unlock(&gzc_mtx);
+		gzc_free(g);
+		return;
+	}
+	while (gzc_bytes + g->len > cache_param->gunzip_cache) {
+		g2 = VTAILQ_FIRST(&gzc_lru);
+		AN(g2);
+		g2 = gzc_detach(g2);
+		VSC_C_main->gunzip_cache_nuked++;
+		if (g2 != NULL)
+			VTAILQ_INSERT_TAIL(&kill, g2, lru_list);
+	}
+	g->oc = oc;
+	oc->gzc = g;
+	VTAILQ_INSERT_TAIL(&gzc_lru, g, lru_list);
+	gzc_bytes += g->len;
+	VSC_C_main->gunzip_cache_bytes = gzc_bytes;
+	VSC_C_main->gunzip_cache_objs++;
+	VSC_C_main->gunzip_cache_insert++;
+	Lck_Unlock(&gzc_mtx);
+
+	while (!VTAILQ_EMPTY(&kill)) {
+		g2 = VTAILQ_FIRST(&kill);
+		VTAILQ_REMOVE(&kill, g2, lru_list);
+		gzc_free(g2);
+	}
+}
+
+/*--------------------------------------------------------------------
+ * Gunzip the object into chunks and send them to the client as they
+ * fill up.  As long as the result fits in the budget, the chunks are
+ * kept for the variant, otherwise we just recycle one chunk.
+ *
+ * Returns zero if nothing could be sent, otherwise *gp is set to the
+ * completed variant, if there is one to insert.
+ */
+
+static int
+gzc_build(struct req *req, struct gzc **gp)
+{
+	struct storage *st;
+	struct gzc *g;
+	struct gzc_chunk *c;
+	struct vgz *vg;
+	struct worker *wrk;
+	enum vgzret_e vr = VGZ_OK;
+	const void *dp;
+	size_t dl;
+
+	wrk = req->wrk;
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+
+	c = gzc_newchunk();
+	if (c == NULL)
+		return (0);
+	ALLOC_OBJ(g, GZC_MAGIC);
+	if (g == NULL) {
+		free(c);
+		return (0);
+	}
+	VTAILQ_INIT(&g->chunks);
+
+	vg = VGZ_NewUngzip(req->vsl, "U D C");
+	VGZ_Obuf(vg, c->ptr, c->space);
+
+	VTAILQ_FOREACH(st, &req->obj->store, list) {
+		CHECK_OBJ_NOTNULL(st, STORAGE_MAGIC);
+		VGZ_Ibuf(vg, st->ptr, st->len);
+		while (!VGZ_IbufEmpty(vg) && vr == VGZ_OK) {
+			vr = VGZ_Gunzip(vg, &dp, &dl);
+			c->len += dl;
+			if (c->len < c->space)
+				continue;
+			req->acct_req.bodybytes += c->len;
+			(void)WRW_Write(wrk, c->ptr, c->len);
+			(void)WRW_Flush(wrk);
+			if (g != NULL &&
+			    g->len + c->len > cache_param->gunzip_cache) {
+				gzc_free(g);
+				g = NULL;
+			}
+			if (g != NULL) {
+				g->len += c->len;
+				VTAILQ_INSERT_TAIL(&g->chunks, c, list);
+				c = gzc_newchunk();
+				if (c == NULL) {
+					/* Finish with the last chunk */
+					c = VTAILQ_LAST(&g->chunks,
+					    gzc_chunkhead);
+					VTAILQ_REMOVE(&g->chunks, c, list);
+					g->len -= c->len;
+					gzc_free(g);
+					g = NULL;
+				}
+			}
+			c->len = 0;
+			VGZ_Obuf(vg, c->ptr, c->space);
+		}
+		if (vr != VGZ_OK)
+			break;
+	}
+	if (c->len > 0) {
+		req->acct_req.bodybytes += c->len;
+		(void)WRW_Write(wrk, c->ptr, c->len);
+		(void)WRW_Flush(wrk);
+	}
+	if (VGZ_Destroy(&vg) != VGZ_END || vr != VGZ_END) {
+		/* XXX: handle invalid gzip data better (how ?) */
+		if (g != NULL)
+			gzc_free(g);
+		free(c);
+		return (1);
+	}
+	if (g == NULL || g->len + c->len > cache_param->gunzip_cache) {
+		if (g != NULL)
+			gzc_free(g);
+		free(c);
+		return (1);
+	}
+	if (c->len > 0) {
+		g->len += c->len;
+		VTAILQ_INSERT_TAIL(&g->chunks, c, list);
+	} else
+		free(c);
+	*gp = g;
+	return (1);
+}
+
+/*--------------------------------------------------------------------
+ * Deliver the gunzip'ed body of req->obj, from the variant cache if
+ * possible.  If the WRW was left pointing into a cached variant, *gp is
+ * set and the caller must GZC_Rel() it once the WRW has been flushed.
+ *
+ * Returns zero without sending anything if the object is not eligible
+ * for caching, in which case the caller must gunzip it itself.
+ */
+
+int
+GZC_Deliver(struct req *req, struct gzc **gp)
+{
+	struct gzc *g;
+	struct gzc_chunk *c;
+
+	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
+	CHECK_OBJ_NOTNULL(req->obj, OBJECT_MAGIC);
+	AN(gp);
+	AZ(*gp);
+
+	if (cache_param->gunzip_cache == 0 ||
+	    req->obj->objcore->objhead == NULL ||
+	    req->obj->objcore->flags & OC_F_PASS)
+		return (0);
+
+	g = gzc_get(req);
+	if (g != NULL) {
+		VTAILQ_FOREACH(c, &g->chunks, list) {
+			CHECK_OBJ_NOTNULL(c, GZC_CHUNK_MAGIC);
+			req->acct_req.bodybytes += c->len;
+			(void)WRW_Write(req->wrk, c->ptr, c->len);
+		}
+		*gp = g;
+		return (1);
+	}
+
+	if (!gzc_build(req, &g))
+		return (0);
+	if (g != NULL)
+		gzc_insert(req, g);
+	return (1);
+}
+
+void
+GZC_Rel(struct gzc **gp)
+{
+	struct gzc *g;
+
+	AN(gp);
+	g = *gp;
+	*gp = NULL;
+	CHECK_OBJ_NOTNULL(g, GZC_MAGIC);
+	Lck_Lock(&gzc_mtx);
+	assert(g->refcnt > 0);
+	if (--g->refcnt > 0 || g->oc != NULL)
+		g = NULL;
+	Lck_Unlock(&gzc_mtx);
+	if (g != NULL)
+		gzc_free(g);
+}
+
+/*--------------------------------------------------------------------
+ * The objcore is going away, take any variant with it.
+ */
+
+void
+GZC_Drop(struct objcore *oc)
+{
+	struct gzc *g = NULL;
+
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+	if (oc->gzc == NULL)
+		return;
+	Lck_Lock(&gzc_mtx);
+	if (oc->gzc != NULL)
+		g = gzc_detach(oc->gzc);
+	Lck_Unlock(&gzc_mtx);
+	if (g != NULL)
+		gzc_free(g);
+}
+
+/*--------------------------------------------------------------------*/
+
+void
+GZC_Init(void)
+{
+
+	Lck_New(&gzc_mtx, lck_gzc);
+}
@@ -48,6 +48,9 @@
  *
  * New objects are always marked busy, and they can go from busy to
  * not busy only once.
+ *
+ * Once an objecthead has had an object with a Vary: header, it gets a
+ * variant index, so that lookups need not VRY_Match() every variant.
  */
 
 #include "config.h"
@@ -144,12 +147,224 @@ HSH_Cleanup(struct worker *wrk)
 	}
 }
 
+/*---------------------------------------------------------------------
+ * The variant index.
+ *
+ * Unbusied objects with a Vary: header are hashed on their vary string
+ * with VRY_Hash(), everything else (busy objects, objects without Vary:
+ * and vampires) goes on the "other" list.  The objcs list still has
+ * them all, for everybody but HSH_Lookup().
+ *
+ * For each set of headers the variants vary on, a copy of one of their
+ * vary strings is kept, so that HSH_Lookup() can find the key of the
+ * request with VRY_Key().  Normally there is only one such spec.
+ *
+ * All of it is protected by the objhead mutex.
+ */
+
+struct hsh_vspec {
+	unsigned		magic;
+#define HSH_VSPEC_MAGIC		0x5c1e9a07
+	unsigned		n;
+	uint8_t			*vary;
+	VTAILQ_ENTRY(hsh_vspec)	list;
+};
+
+VTAILQ_HEAD(hsh_ochead, objcore);
+
+struct hsh_vary {
+	unsigned		magic;
+#define HSH_VARY_MAGIC		0x2d0b7f43
+	unsigned		nvariant;
+	unsigned		nbucket;	/* Power of two */
+	VTAILQ_HEAD(, hsh_vspec) specs;
+	struct hsh_ochead	other;
+	struct hsh_ochead	*bucket;
+};
+
+#define HSH_VARY_NBUCKET	8
+
+static struct hsh_ochead *
+hsh_vary_bucket(const struct hsh_vary *hv, uint32_t key)
+{
+
+	return (&hv->bucket[key & (hv->nbucket - 1)]);
+}
+
+static struct hsh_ochead *
+hsh_vary_alloc(unsigned n)
+{
+	struct hsh_ochead *b;
+	unsigned u;
+
+	b = calloc(n, sizeof *b);
+	XXXAN(b);
+	for (u = 0; u < n; u++)
+		VTAILQ_INIT(&b[u]);
+	return (b);
+}
+
+static void
+hsh_vary_new(struct objhead *oh)
+{
+	struct hsh_vary *hv;
+	struct objcore *oc;
+
+	AZ(oh->vary);
+	ALLOC_OBJ(hv, HSH_VARY_MAGIC);
+	XXXAN(hv);
+	hv->nbucket = HSH_VARY_NBUCKET;
+	hv->bucket = hsh_vary_alloc(hv->nbucket);
+	VTAILQ_INIT(&hv->specs);
+	VTAILQ_INIT(&hv->other);
+	VTAILQ_FOREACH(oc, &oh->objcs, list) {
+		AZ(oc->vary_spec);
+		VTAILQ_INSERT_TAIL(&hv->other, oc, vary_list);
+	}
+	oh->vary = hv;
+}
+
+static void
+hsh_vary_rehash(struct hsh_vary *hv)
+{
+	struct hsh_ochead *ob;
+	struct objcore *oc;
+	unsigned u, n;
+
+	ob = hv->bucket;
+	n = hv->nbucket;
+	hv->nbucket *= 2;
+	hv->bucket = hsh_vary_alloc(hv->nbucket);
+	/* Keep the order within each bucket, newest first */
+	for (u = 0; u < n; u++) {
+		while ((oc = VTAILQ_LAST(&ob[u], hsh_ochead)) != NULL) {
+			VTAILQ_REMOVE(&ob[u], oc, vary_list);
+			VTAILQ_INSERT_HEAD(hsh_vary_bucket(hv, oc->vary_key),
+			    oc, vary_list);
+		}
+	}
+	free(ob);
+}
+
+/* Move the objhead between the VSC histogram counters */
+
+static uint64_t *
+hsh_vary_class(struct dstat *ds, unsigned n)
+{
+
+	if (n == 0)
+		return (NULL);
+	if (n == 1)
+		return (&ds->n_vary_1);
+	if (n < 8)
+		return (&ds->n_vary_2);
+	if (n < 64)
+		return (&ds->n_vary_8);
+	return (&ds->n_vary_64);
+}
+
+static void
+hsh_vary_count(struct dstat *ds, struct hsh_vary *hv, int d)
+{
+	uint64_t *c;
+
+	c = hsh_vary_class(ds, hv->nvariant);
+	if (c != NULL)
+		(*c)--;
+	hv->nvariant += d;
+	c = hsh_vary_class(ds, hv->nvariant);
+	if (c != NULL)
+		(*c)++;
+}
+
+/* Hash an objcore which is on no list of the index */
+
+static void
+hsh_vary_insert(struct dstat *ds, struct hsh_vary *hv, struct objcore *oc,
+    const uint8_t *vary)
+{
+	struct hsh_vspec *vs;
+	unsigned l;
+
+	CHECK_OBJ_NOTNULL(hv, HSH_VARY_MAGIC);
+	AZ(oc->vary_spec);
+	VTAILQ_FOREACH(vs, &hv->specs, list)
+		if (VRY_SameSpec(vs->vary, vary))
+			break;
+	if (vs == NULL) {
+		ALLOC_OBJ(vs, HSH_VSPEC_MAGIC);
+		XXXAN(vs);
+		l = VRY_Len(vary);
+		vs->vary = malloc(l);
+		XXXAN(vs->vary);
+		memcpy(vs->vary, vary, l);
+		VTAILQ_INSERT_TAIL(&hv->specs, vs, list);
+	}
+	vs->n++;
+	oc->vary_spec = vs;
+	oc->vary_key = VRY_Hash(vary);
+	hsh_vary_count(ds, hv, 1);
+	if (hv->nvariant > 2 * hv->nbucket)
+		hsh_vary_rehash(hv);
+	VTAILQ_INSERT_HEAD(hsh_vary_bucket(hv, oc->vary_key), oc, vary_list);
+}
+
+/* Take an objcore off the index */
+
+static void
+hsh_vary_remove(struct dstat *ds, const struct objhead *oh,
+    struct objcore *oc)
+{
+	struct hsh_vary *hv;
+	struct hsh_vspec *vs;
+
+	hv = oh->vary;
+	if (hv == NULL)
+		return;
+	CHECK_OBJ_NOTNULL(hv, HSH_VARY_MAGIC);
+	vs = oc->vary_spec;
+	if (vs == NULL) {
+		VTAILQ_REMOVE(&hv->other, oc, vary_list);
+		return;
+	}
+	CHECK_OBJ_NOTNULL(vs, HSH_VSPEC_MAGIC);
+	VTAILQ_REMOVE(hsh_vary_bucket(hv, oc->vary_key), oc, vary_list);
+	oc->vary_spec = NULL;
+	hsh_vary_count(ds, hv, -1);
+	assert(vs->n > 0);
+	if (--vs->n == 0) {
+		VTAILQ_REMOVE(&hv->specs, vs, list);
+		free(vs->vary);
+		FREE_OBJ(vs);
+	}
+}
+
+static void
+hsh_vary_delete(struct objhead *oh)
+{
+	struct hsh_vary *hv;
+
+	hv = oh->vary;
+	oh->vary = NULL;
+	if (hv == NULL)
+		return;
+	CHECK_OBJ_NOTNULL(hv, HSH_VARY_MAGIC);
+	AZ(hv->nvariant);
+	assert(VTAILQ_EMPTY(&hv->specs));
+	assert(VTAILQ_EMPTY(&hv->other));
+	free(hv->bucket);
+	FREE_OBJ(hv);
+}
+
+/*---------------------------------------------------------------------*/
+
 void
 HSH_DeleteObjHead(struct dstat *ds, struct objhead *oh)
 {
 
 	AZ(oh->refcnt);
 	assert(VTAILQ_EMPTY(&oh->objcs));
+	hsh_vary_delete(oh);
 	Lck_Delete(&oh->mtx);
 	ds->n_objecthead--;
 	FREE_OBJ(oh);
@@ -276,7 +491,13 @@ HSH_Insert(struct worker *wrk, const void *digest, struct objcore *oc)
 	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
 	AZ(oc->flags & OC_F_BUSY);
 
-	VTAILQ_INSERT_HEAD(&oh->objcs, oc, list);
+	/*
+	 * The silo loaders insert the newest copies first, and anything
+	 * fetched since startup is newer still, so append.
+	 */
+	VTAILQ_INSERT_TAIL(&oh->objcs, oc, list);
+	if (oh->vary != NULL)
+		VTAILQ_INSERT_TAIL(&oh->vary->other, oc, vary_list);
 	/* NB: do not deref objhead the new object inherits our reference */
 	oc->objhead = oh;
 	Lck_Unlock(&oh->mtx);
@@ -284,6 +505,149 @@ HSH_Insert(struct worker *wrk, const void *digest, struct objcore *oc)
 	wrk->stats.n_vampireobject++;
 }
 
+/*---------------------------------------------------------------------
+ * Insert the objcore of a copy of an object, made in another stevedore,
+ * in front of the original so lookups find the copy first.
+ * Return it with a reference held.
+ */
+
+void
+HSH_InsertCopy(struct dstat *ds, struct objcore *oc,
+    struct objcore *noc)
+{
+	struct objhead *oh;
+
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+	CHECK_OBJ_NOTNULL(noc, OBJCORE_MAGIC);
+	AZ(noc->objhead);
+	oh = oc->objhead;
+	CHECK_OBJ_NOTNULL(oh, OBJHEAD_MAGIC);
+
+	Lck_Lock(&oh->mtx);
+	assert(oh->refcnt > 0);
+	assert(oc->refcnt > 0);
+	oh->refcnt++;
+	noc->refcnt = 1;
+	noc->objhead = oh;
+	VTAILQ_INSERT_BEFORE(oc, noc, list);
+	if (oc->vary_spec != NULL) {
+		/* Same vary string, same place in the index */
+		CHECK_OBJ_NOTNULL(oc->vary_spec, HSH_VSPEC_MAGIC);
+		noc->vary_spec = oc->vary_spec;
+		noc->vary_spec->n++;
+		noc->vary_key = oc->vary_key;
+		hsh_vary_count(ds, oh->vary, 1);
+		VTAILQ_INSERT_BEFORE(oc, noc, vary_list);
+	} else if (oh->vary != NULL)
+		VTAILQ_INSERT_BEFORE(oc, noc, vary_list);
+	Lck_Unlock(&oh->mtx);
+	ds->n_objectcore++;
+}
+
+/*---------------------------------------------------------------------
+ * Look at one objcore for HSH_Lookup(), return non-zero if it is a
+ * fresh object we can use.
+ */
+
+struct hsh_lookup {
+	int			busy_found;
+	struct objcore		*grace_oc;
+	double			grace_ttl;
+};
+
+static int
+hsh_consider(struct req *req, const struct objhead *oh, struct objcore *oc,
+    struct hsh_lookup *hl)
+{
+	struct object *o;
+
+	/* Must be at least our own ref + the objcore we examine */
+	assert(oh->refcnt > 1);
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+	assert(oc->objhead == oh);
+
+	if (oc->flags & OC_F_BUSY || oc->busyobj != NULL) {
+		CHECK_OBJ_ORNULL(oc->busyobj, BUSYOBJ_MAGIC);
+		if (req->hash_ignore_busy || req->hash_always_miss)
+			return (0);
+
+		if (oc->busyobj != NULL &&
+		    oc->busyobj->vary != NULL &&
+		    !VRY_Match(req, oc->busyobj->vary))
+			return (0);
+
+		hl->busy_found = 1;
+		return (0);
+	}
+
+	o = oc_getobj(&req->wrk->stats, oc);
+	CHECK_OBJ_NOTNULL(o, OBJECT_MAGIC);
+
+	if (o->exp.ttl <= 0.)
+		return (0);
+	if (BAN_CheckObject(o, req))
+		return (0);
+	if (o->vary != NULL && !VRY_Match(req, o->vary))
+		return (0);
+
+	/* If still valid, use it */
+	if (EXP_Ttl(req, o) >= req->t_req)
+		return (1);
+
+	/*
+	 * Remember any matching objects inside their grace period
+	 * and if there are several, use the least expired one.
+	 */
+	if (EXP_Grace(req, o) >= req->t_req) {
+		if (hl->grace_oc == NULL ||
+		    hl->grace_ttl < o->exp.entered + o->exp.ttl) {
+			hl->grace_oc = oc;
+			hl->grace_ttl = o->exp.entered + o->exp.ttl;
+		}
+	}
+	return (0);
+}
+
+/*---------------------------------------------------------------------
+ * Look only at the variants in the request's bucket(s) and the rest.
+ * Return non-zero if the request's vary string could not be built,
+ * and the caller must look at them all.
+ */
+
+static int
+hsh_vary_lookup(struct req *req, const struct objhead *oh,
+    struct hsh_lookup *hl, struct objcore **ocp)
+{
+	struct hsh_vary *hv;
+	struct hsh_vspec *vs;
+	struct objcore *oc;
+	uint32_t key;
+
+	hv = oh->vary;
+	CHECK_OBJ_NOTNULL(hv, HSH_VARY_MAGIC);
+	VTAILQ_FOREACH(vs, &hv->specs, list) {
+		CHECK_OBJ_NOTNULL(vs, HSH_VSPEC_MAGIC);
+		if (VRY_Key(req, vs->vary, &key))
+			return (1);
+		VTAILQ_FOREACH(oc, hsh_vary_bucket(hv, key), vary_list) {
+			if (oc->vary_key != key)
+				continue;
+			if (hsh_consider(req, oh, oc, hl)) {
+				*ocp = oc;
+				return (0);
+			}
+		}
+	}
+	VTAILQ_FOREACH(oc, &hv->other, vary_list) {
+		if (hsh_consider(req, oh, oc, hl)) {
+			*ocp = oc;
+			return (0);
+		}
+	}
+	*ocp = NULL;
+	return (0);
+}
+
 /*---------------------------------------------------------------------
  */
 
@@ -295,7 +659,7 @@ HSH_Lookup(struct req *req)
 	struct objcore *oc;
 	struct objcore *grace_oc;
 	struct object *o;
-	double grace_ttl;
+	struct hsh_lookup hl;
 	int busy_found;
 
 	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
@@ -327,55 +691,16 @@ HSH_Lookup(struct req *req)
 	Lck_AssertHeld(&oh->mtx);
 
 	assert(oh->refcnt > 0);
-	busy_found = 0;
-	grace_oc = NULL;
-	grace_ttl = NAN;
-	VTAILQ_FOREACH(oc, &oh->objcs, list) {
-		/* Must be at least our own ref + the objcore we examine */
-		assert(oh->refcnt > 1);
-		CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
-		assert(oc->objhead == oh);
-
-		if (oc->flags & OC_F_BUSY || oc->busyobj != NULL) {
-			CHECK_OBJ_ORNULL(oc->busyobj, BUSYOBJ_MAGIC);
-			if (req->hash_ignore_busy || req->hash_always_miss)
-				continue;
-
-			if (oc->busyobj != NULL &&
-			    oc->busyobj->vary != NULL &&
-			    !VRY_Match(req, oc->busyobj->vary))
-				continue;
-
-			busy_found = 1;
-			continue;
-		}
-
-		o = oc_getobj(&wrk->stats, oc);
-		CHECK_OBJ_NOTNULL(o, OBJECT_MAGIC);
-
-		if (o->exp.ttl <= 0.)
-			continue;
-		if (BAN_CheckObject(o, req))
-			continue;
-		if (o->vary != NULL && !VRY_Match(req, o->vary))
-			continue;
-
-		/* If still valid, use it */
-		if (EXP_Ttl(req, o) >= req->t_req)
-			break;
-
-		/*
-		 * Remember any matching objects inside their grace period
-		 * and if there are several, use the least expired one.
-		 */
-		if (EXP_Grace(req, o) >= req->t_req) {
-			if (grace_oc == NULL ||
-			    grace_ttl < o->exp.entered + o->exp.ttl) {
-				grace_oc = oc;
-				grace_ttl = o->exp.entered + o->exp.ttl;
-			}
-		}
+	hl.busy_found = 0;
+	hl.grace_oc = NULL;
+	hl.grace_ttl = NAN;
+	if (oh->vary == NULL || hsh_vary_lookup(req, oh, &hl, &oc)) {
+		VTAILQ_FOREACH(oc, &oh->objcs, list)
+			if (hsh_consider(req, oh, oc, &hl))
+				break;
 	}
+	busy_found = hl.busy_found;
+	grace_oc = hl.grace_oc;
 
 	/*
 	 * If we have seen a busy object or the backend is unhealthy, and
@@ -412,6 +737,8 @@ HSH_Lookup(struct req *req)
 	if (busy_found) {
 		/* There are one or more busy objects, wait for them */
 		if (req->esi_level == 0) {
+			/* We are leaving the worker thread, pin the VCL */
+			VCL_Hold(req);
 			CHECK_OBJ_NOTNULL(wrk->nwaitinglist,
 			    WAITINGLIST_MAGIC);
 			if (oh->waitinglist == NULL) {
@@ -444,6 +771,8 @@ HSH_Lookup(struct req *req)
 	oc->refcnt = 1;		/* Owned by busyobj */
 	oc->objhead = oh;
 	VTAILQ_INSERT_TAIL(&oh->objcs, oc, list);
+	if (oh->vary != NULL)
+		VTAILQ_INSERT_TAIL(&oh->vary->other, oc, vary_list);
 	/* NB: do not deref objhead the new object inherits our reference */
 	Lck_Unlock(&oh->mtx);
 
@@ -600,10 +929,14 @@ HSH_Complete(struct objcore *oc)
  */
 
 void
-HSH_Unbusy(struct dstat *ds, struct objcore *oc)
+HSH_Unbusy(struct dstat *ds, const struct object *o)
 {
+	struct objcore *oc;
 	struct objhead *oh;
+	const uint8_t *vary;
 
+	CHECK_OBJ_NOTNULL(o, OBJECT_MAGIC);
+	oc = o->objcore;
 	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
 	oh = oc->objhead;
 	CHECK_OBJ(oh, OBJHEAD_MAGIC);
@@ -611,6 +944,7 @@ HSH_Unbusy(struct dstat *ds, struct objcore *oc)
 	AN(oc->flags & OC_F_BUSY);
 	AN(oc->ban);
 	assert(oh->refcnt > 0);
+	vary = o->vary;
 
 	/* XXX: pretouch neighbors on oh->objcs to prevent page-on under mtx */
 	Lck_Lock(&oh->mtx);
@@ -618,6 +952,15 @@ HSH_Unbusy(struct dstat *ds, struct objcore *oc)
 	/* XXX: strictly speaking, we should sort in Date: order. */
 	VTAILQ_REMOVE(&oh->objcs, oc, list);
 	VTAILQ_INSERT_HEAD(&oh->objcs, oc, list);
+	if (vary != NULL && oh->vary == NULL)
+		hsh_vary_new(oh);
+	if (oh->vary != NULL) {
+		VTAILQ_REMOVE(&oh->vary->other, oc, vary_list);
+		if (vary != NULL)
+			hsh_vary_insert(ds, oh->vary, oc, vary);
+		else
+			VTAILQ_INSERT_HEAD(&oh->vary->other, oc, vary_list);
+	}
 	oc->flags &= ~OC_F_BUSY;
 	if (oh->waitinglist != NULL)
 		hsh_rush(ds, oh);
@@ -683,9 +1026,10 @@ HSH_Deref(struct dstat *ds, struct objcore *oc, struct object **oo)
 		assert(oh->refcnt > 0);
 		assert(oc->refcnt > 0);
 		r = --oc->refcnt;
-		if (!r)
+		if (!r) {
 			VTAILQ_REMOVE(&oh->objcs, oc, list);
-		else {
+			hsh_vary_remove(ds, oh, oc);
+		} else {
 			/* Must have an object */
 			AN(oc->methods);
 		}
@@ -699,6 +1043,7 @@ HSH_Deref(struct dstat *ds, struct objcore *oc, struct object **oo)
 		AZ(oc->ban);
 	}
 
+	GZC_Drop(oc);
 	if (oc->methods != NULL) {
 		oc_freeobj(oc);
 		ds->n_object--;
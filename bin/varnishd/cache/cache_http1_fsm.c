@@ -104,18 +104,16 @@ http1_wait(struct sess *sp, struct worker *wrk, struct req *req)
 	assert(isnan(req->t_req));
 	assert(isnan(req->t_resp));
 
-	tmo = (int)(1e3 * cache_param->timeout_linger);
+	/*
+	 * The request is usually there already, in particular when we come
+	 * from the waiter or a deferred accept, so try to read it before we
+	 * spend a poll(2) on waiting for it.
+	 */
+	hs = HTC_RxNoWait(req->htc);
+	now = VTIM_real();
+	if (hs == HTC_COMPLETE)
+		wrk->stats.sess_fastread++;
 	while (1) {
-		pfd[0].fd = sp->fd;
-		pfd[0].events = POLLIN;
-		pfd[0].revents = 0;
-		j = poll(pfd, 1, tmo);
-		assert(j >= 0);
-		now = VTIM_real();
-		if (j != 0)
-			hs = HTC_Rx(req->htc);
-		else
-			hs = HTC_Complete(req->htc);
 		if (hs == HTC_COMPLETE) {
 			/* Got it, run with it */
 			req->t_req = now;
@@ -153,6 +151,16 @@ http1_wait(struct sess *sp, struct worker *wrk, struct req *req)
 				break;
 			}
 		}
+		pfd[0].fd = sp->fd;
+		pfd[0].events = POLLIN;
+		pfd[0].revents = 0;
+		j = poll(pfd, 1, tmo);
+		assert(j >= 0);
+		now = VTIM_real();
+		if (j != 0)
+			hs = HTC_Rx(req->htc);
+		else
+			hs = HTC_Complete(req->htc);
 	}
 	SES_ReleaseReq(req);
 	assert(why != SC_NULL);
@@ -174,6 +182,8 @@ enum http1_cleanup_ret {
 static enum http1_cleanup_ret
 http1_cleanup(struct sess *sp, struct worker *wrk, struct req *req)
 {
+	struct ofl *ofl;
+	enum sess_close why;
 
 	CHECK_OBJ_NOTNULL(sp, SESS_MAGIC);
 	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
@@ -188,10 +198,9 @@ http1_cleanup(struct sess *sp, struct worker *wrk, struct req *req)
 	AZ(req->esi_level);
 
 	if (req->vcl != NULL) {
-		if (wrk->vcl != NULL)
-			VCL_Rel(&wrk->vcl);
-		wrk->vcl = req->vcl;
-		req->vcl = NULL;
+		VCL_Rel(req);
+		/* We have no VCL now, let it be reclaimed */
+		VCL_Quiesce(wrk);
 	}
 
 	sp->t_idle = W_TIM_real(wrk);
@@ -205,8 +214,24 @@ http1_cleanup(struct sess *sp, struct worker *wrk, struct req *req)
 	req->hash_always_miss = 0;
 	req->hash_ignore_busy = 0;
 
-	if (sp->fd >= 0 && req->doclose != SC_NULL)
+	if (req->ofl != NULL) {
+		/* The rest of the body goes out from the offload thread */
+		ofl = req->ofl;
+		req->ofl = NULL;
+		if (sp->fd >= 0) {
+			(void)WRW_FlushHold(wrk);
+			why = req->doclose;
+			SES_ReleaseReq(req);
+			OFL_Start(wrk, &ofl, sp, why);
+			return (SESS_DONE_RET_GONE);
+		}
+		OFL_Abandon(wrk, &ofl);
+	}
+
+	if (sp->fd >= 0 && req->doclose != SC_NULL) {
+		(void)WRW_FlushHold(wrk);
 		SES_Close(sp, req->doclose);
+	}
 
 	if (sp->fd < 0) {
 		wrk->stats.sess_closed++;
@@ -227,6 +252,8 @@ http1_cleanup(struct sess *sp, struct worker *wrk, struct req *req)
 		wrk->stats.sess_pipeline++;
 		return (SESS_DONE_RET_START);
 	} else {
+		/* Nothing more to go with what we held back */
+		(void)WRW_FlushHold(wrk);
 		if (Tlen(req->htc->rxbuf))
 			wrk->stats.sess_readahead++;
 		return (SESS_DONE_RET_WAIT);
@@ -252,16 +279,14 @@ http1_dissect(struct worker *wrk, struct req *req)
 	if (req->vsl->wid == 0)
 		req->vsl->wid = VXID_Get(&wrk->vxid_pool) | VSL_CLIENTMARKER;
 
-	/* Borrow VCL reference from worker thread */
-	VCL_Refresh(&wrk->vcl);
-	req->vcl = wrk->vcl;
-	wrk->vcl = NULL;
+	VCL_Ref(req);
 
 	HTTP_Setup(req->http, req->ws, req->vsl, HTTP_Req);
 	req->err_code = http_DissectRequest(req);
 
 	/* If we could not even parse the request, just close */
 	if (req->err_code == 400) {
+		(void)WRW_FlushHold(wrk);
 		SES_Close(req->sp, SC_RX_JUNK);
 		return (1);
 	}
@@ -276,7 +301,8 @@ http1_dissect(struct worker *wrk, struct req *req)
 	if (req->err_code == 0 && http_GetHdr(req->http, H_Expect, &p)) {
 		if (strcasecmp(p, "100-continue")) {
 			req->err_code = 417;
-		} else if (strlen(r) != write(req->sp->fd, r, strlen(r))) {
+		} else if (WRW_FlushHold(wrk) ||
+		    strlen(r) != write(req->sp->fd, r, strlen(r))) {
 			SES_Close(req->sp, SC_REM_CLOSE);
 			return (1);
 		}
@@ -306,21 +332,25 @@ HTTP1_Session(struct worker *wrk, struct req *req)
 	CHECK_OBJ_NOTNULL(sp, SESS_MAGIC);
 
 	/*
-	 * Whenever we come in from the acceptor or waiter, we need to set
-	 * blocking mode, but there is no point in setting it when we come from
-	 * ESI or when a parked sessions returns.
-	 * It would be simpler to do this in the acceptor or waiter, but we'd
+	 * Whenever we come in from the waiter, we need to set blocking
+	 * mode, but there is no point in setting it when we come from
+	 * ESI or when a parked sessions returns, and sockets fresh from
+	 * the acceptor are blocking already.
+	 * It would be simpler to do this in the waiter, but we'd
 	 * rather do the syscall in the worker thread.
 	 * On systems which return errors for ioctl, we close early
 	 */
-	if (sp->sess_step == S_STP_NEWREQ && VTCP_blocking(sp->fd)) {
-		if (errno == ECONNRESET)
-			SES_Close(sp, SC_REM_CLOSE);
-		else
-			SES_Close(sp, SC_TX_ERROR);
-		sdr = http1_cleanup(sp, wrk, req);
-		assert(sdr == SESS_DONE_RET_GONE);
-		return;
+	if (sp->sess_step == S_STP_NEWREQ && sp->nonblock) {
+		if (VTCP_blocking(sp->fd)) {
+			if (errno == ECONNRESET)
+				SES_Close(sp, SC_REM_CLOSE);
+			else
+				SES_Close(sp, SC_TX_ERROR);
+			sdr = http1_cleanup(sp, wrk, req);
+			assert(sdr == SESS_DONE_RET_GONE);
+			return;
+		}
+		sp->nonblock = 0;
 	}
 
 	if (sp->sess_step == S_STP_NEWREQ) {
@@ -340,8 +370,11 @@ HTTP1_Session(struct worker *wrk, struct req *req)
 				done = http1_dissect(wrk, req);
 			if (done == 0)
 				done = CNT_Request(wrk, req);
-			if (done == 2)
+			if (done == 2) {
+				/* The request is parked, let go of the fd */
+				(void)WRW_FlushHold(wrk);
 				return;
+			}
 			assert(done == 1);
 			sdr = http1_cleanup(sp, wrk, req);
 			switch (sdr) {
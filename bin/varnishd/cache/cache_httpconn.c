@@ -145,6 +145,38 @@ HTC_Complete(struct http_conn *htc)
 	return (HTC_COMPLETE);
 }
 
+/*--------------------------------------------------------------------
+ * Is there a complete request in the pipelined input already ?
+ *
+ * The pipelined input is not NUL terminated once the workspace has
+ * been used, so we cannot use strchr() like HTC_Complete() does.
+ */
+
+int
+HTC_Pipelined(const struct http_conn *htc)
+{
+	const char *p, *e;
+
+	CHECK_OBJ_NOTNULL(htc, HTTP_CONN_MAGIC);
+	if (htc->pipeline.b == NULL)
+		return (0);
+	e = htc->pipeline.e;
+	for (p = htc->pipeline.b; p < e && vct_islws(*p); p++)
+		continue;
+	if (p == e)
+		return (0);
+	while (1) {
+		p = memchr(p, '\n', e - p);
+		if (p == NULL)
+			return (0);
+		p++;
+		if (p < e && *p == '\r')
+			p++;
+		if (p < e && *p == '\n')
+			return (1);
+	}
+}
+
 /*--------------------------------------------------------------------
  * Receive more HTTP protocol bytes
  */
@@ -175,6 +207,35 @@ HTC_Rx(struct http_conn *htc)
 	return (HTC_Complete(htc));
 }
 
+/*--------------------------------------------------------------------
+ * Receive whatever HTTP protocol bytes are there, without waiting.
+ * If there are none, report on what we have already.
+ */
+
+enum htc_status_e
+HTC_RxNoWait(struct http_conn *htc)
+{
+	int i;
+
+	CHECK_OBJ_NOTNULL(htc, HTTP_CONN_MAGIC);
+	AN(htc->ws->r);
+	i = (htc->ws->r - htc->rxbuf.e) - 1;	/* space for NUL */
+	if (i <= 0) {
+		WS_ReleaseP(htc->ws, htc->rxbuf.b);
+		return (HTC_OVERFLOW);
+	}
+	i = recv(htc->fd, htc->rxbuf.e, i, MSG_DONTWAIT);
+	if (i < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		return (HTC_Complete(htc));
+	if (i <= 0) {
+		WS_ReleaseP(htc->ws, htc->rxbuf.b);
+		return (HTC_ERROR_EOF);
+	}
+	htc->rxbuf.e += i;
+	*htc->rxbuf.e = '\0';
+	return (HTC_Complete(htc));
+}
+
 /*--------------------------------------------------------------------
  * Read up to len bytes, returning pipelined data first.
  */
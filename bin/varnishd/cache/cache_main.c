@@ -194,6 +194,7 @@ child_main(void)
 	PAN_Init();
 	CLI_Init();
 	Fetch_Init();
+	GZC_Init();
 
 	VCL_Init();
 
@@ -205,6 +206,9 @@ child_main(void)
 	VBP_Init();
 	WRK_Init();
 	Pool_Init();
+	VBW_Init();
+	OFL_Init();
+	VDI_DNS_Init();
 
 	EXP_Init();
 	HSH_Init(heritage.hash);
@@ -217,6 +221,7 @@ child_main(void)
 	STV_open();
 
 	VMOD_Init();
+	VRT_re_Init();
 
 	BAN_Compile();
 
@@ -0,0 +1,393 @@
+/*-
+ * Copyright (c) 2013 Varnish Software AS
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Offloaded delivery of large bodies.
+ *
+ * A worker thread delivering a large object to a slow client spends
+ * most of its time blocked in writev(2).  Instead, RES_WriteObj() sends
+ * the headers and the first offload_threshold bytes of the body, and
+ * leaves the rest in a struct ofl hanging off the request.  The object
+ * reference is handed over in cnt_deliver(), and once the request is
+ * done with, http1_cleanup() hands over the session too.
+ *
+ * A single thread then sends the rest of the storage segments with
+ * non-blocking writev(2) and poll(2), applying send_timeout and
+ * idle_send_timeout like WRW_Flush() and SO_SNDTIMEO would have.  When
+ * done, it drops the object and passes the session on to the waiter,
+ * or closes it.
+ *
+ */
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "cache.h"
+
+#include "hash/hash_slinger.h"
+#include "vtcp.h"
+#include "vtim.h"
+
+/* Segments per writev(2) */
+#define OFL_NIOV		64
+
+struct ofl {
+	unsigned		magic;
+#define OFL_MAGIC		0x61b0c27d
+	struct sess		*sp;
+	struct object		*obj;
+	struct storage		*st;		/* Next to send */
+	size_t			st_off;
+	ssize_t			left;
+	enum sess_close		doclose;
+	double			t0;		/* For send_timeout */
+	double			t_last;		/* For idle_send_timeout */
+	VTAILQ_ENTRY(ofl)	list;
+};
+
+static VTAILQ_HEAD(, ofl)	ofl_new = VTAILQ_HEAD_INITIALIZER(ofl_new);
+static struct lock		ofl_mtx;
+static int			ofl_pipe[2];
+
+/*--------------------------------------------------------------------
+ * Called from RES_WriteObj() when [low, high] of the body is left.
+ * The object reference is attached with OFL_TakeObj().
+ */
+
+struct ofl *
+OFL_New(struct req *req, ssize_t low, ssize_t high)
+{
+	struct ofl *ofl;
+	struct storage *st;
+	ssize_t ptr = 0;
+
+	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
+	CHECK_OBJ_NOTNULL(req->obj, OBJECT_MAGIC);
+	assert(low <= high);
+
+	ALLOC_OBJ(ofl, OFL_MAGIC);
+	AN(ofl);
+	VTAILQ_FOREACH(st, &req->obj->store, list) {
+		CHECK_OBJ_NOTNULL(st, STORAGE_MAGIC);
+		if (ptr + (ssize_t)st->len > low)
+			break;
+		ptr += st->len;
+	}
+	AN(st);
+	ofl->st = st;
+	ofl->st_off = low - ptr;
+	ofl->left = 1 + high - low;
+	ofl->t0 = req->t_resp;
+	req->acct_req.bodybytes += ofl->left;
+	return (ofl);
+}
+
+void
+OFL_TakeObj(struct ofl *ofl, struct object **oo)
+{
+
+	CHECK_OBJ_NOTNULL(ofl, OFL_MAGIC);
+	AZ(ofl->obj);
+	AN(oo);
+	CHECK_OBJ_NOTNULL(*oo, OBJECT_MAGIC);
+	ofl->obj = *oo;
+	*oo = NULL;
+}
+
+static void
+ofl_free(struct dstat *ds, struct ofl *ofl)
+{
+
+	CHECK_OBJ_NOTNULL(ofl, OFL_MAGIC);
+	if (ofl->obj != NULL) {
+		/* No point in saving the body if it is hit-for-pass */
+		if (ofl->obj->objcore->flags & OC_F_PASS)
+			STV_Freestore(ofl->obj);
+		(void)HSH_Deref(ds, NULL, &ofl->obj);
+	}
+	FREE_OBJ(ofl);
+}
+
+/*--------------------------------------------------------------------
+ * The session could not be handed over after all.
+ */
+
+void
+OFL_Abandon(struct worker *wrk, struct ofl **pofl)
+{
+	struct ofl *ofl;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	AN(pofl);
+	ofl = *pofl;
+	*pofl = NULL;
+	ofl_free(&wrk->stats, ofl);
+}
+
+/*--------------------------------------------------------------------
+ * Hand the session over.  The caller must not touch it afterwards.
+ */
+
+void
+OFL_Start(struct worker *wrk, struct ofl **pofl, struct sess *sp,
+    enum sess_close doclose)
+{
+	struct ofl *ofl;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CHECK_OBJ_NOTNULL(sp, SESS_MAGIC);
+	AN(pofl);
+	ofl = *pofl;
+	*pofl = NULL;
+	CHECK_OBJ_NOTNULL(ofl, OFL_MAGIC);
+	CHECK_OBJ_NOTNULL(ofl->obj, OBJECT_MAGIC);
+	assert(sp->fd >= 0);
+
+	if (VTCP_nonblocking(sp->fd)) {
+		ofl_free(&wrk->stats, ofl);
+		SES_Delete(sp, SC_REM_CLOSE, NAN);
+		return;
+	}
+	ofl->sp = sp;
+	ofl->doclose = doclose;
+	Lck_Lock(&ofl_mtx);
+	VTAILQ_INSERT_TAIL(&ofl_new, ofl, list);
+	Lck_Unlock(&ofl_mtx);
+	assert(write(ofl_pipe[1], "", 1) == 1);
+}
+
+/*--------------------------------------------------------------------
+ * Send what the socket will take.
+ *
+ * Return:
+ *	-1: write error
+ *	 0: all sent
+ *	 1: more to send
+ */
+
+static int
+ofl_send(struct worker *wrk, struct ofl *ofl, double now)
+{
+	struct iovec iov[OFL_NIOV];
+	struct storage *st;
+	size_t off, l;
+	ssize_t i, n;
+	int niov;
+
+	CHECK_OBJ_NOTNULL(ofl, OFL_MAGIC);
+	while (ofl->left > 0) {
+		n = 0;
+		off = ofl->st_off;
+		for (niov = 0, st = ofl->st;
+		    niov < OFL_NIOV && st != NULL && n < ofl->left;
+		    niov++, st = VTAILQ_NEXT(st, list)) {
+			CHECK_OBJ_NOTNULL(st, STORAGE_MAGIC);
+			l = st->len - off;
+			if ((ssize_t)l > ofl->left - n)
+				l = ofl->left - n;
+			iov[niov].iov_base = st->ptr + off;
+			iov[niov].iov_len = l;
+			n += l;
+			off = 0;
+		}
+		assert(n > 0);
+
+		i = writev(ofl->sp->fd, iov, niov);
+		if (i < 0 && (errno == EAGAIN || errno == EWOULDBLOCK ||
+		    errno == EINTR))
+			return (1);
+		if (i <= 0)
+			return (-1);
+		ofl->t_last = now;
+		wrk->stats.sess_offload_bytes += i;
+		ofl->left -= i;
+		if (ofl->left == 0)
+			break;
+
+		/* Move past what was sent */
+		for (l = i; l > 0; ) {
+			st = ofl->st;
+			CHECK_OBJ_NOTNULL(st, STORAGE_MAGIC);
+			if (st->len - ofl->st_off > l) {
+				ofl->st_off += l;
+				break;
+			}
+			l -= st->len - ofl->st_off;
+			ofl->st = VTAILQ_NEXT(st, list);
+			ofl->st_off = 0;
+		}
+		if (i < n)
+			return (1);	/* Socket buffer full */
+	}
+	return (0);
+}
+
+/*--------------------------------------------------------------------
+ * Done with this one, one way or another.
+ */
+
+static void
+ofl_done(struct worker *wrk, struct ofl *ofl, enum sess_close why, double now)
+{
+	struct sess *sp;
+
+	sp = ofl->sp;
+	CHECK_OBJ_NOTNULL(sp, SESS_MAGIC);
+	if (why == SC_NULL)
+		why = ofl->doclose;
+	ofl_free(&wrk->stats, ofl);
+	if (why == SC_NULL && VTCP_blocking(sp->fd))
+		why = SC_REM_CLOSE;
+	if (why != SC_NULL) {
+		wrk->stats.sess_closed++;
+		SES_Delete(sp, why, now);
+		return;
+	}
+	sp->t_idle = now;
+	wrk->stats.sess_herd++;
+	WAIT_Enter(sp);
+}
+
+/*--------------------------------------------------------------------*/
+
+static void * __match_proto__(bgthread_t)
+ofl_thread(struct worker *wrk, void *priv)
+{
+	VTAILQ_HEAD(, ofl) new;
+	struct ofl **act, *ofl;
+	struct pollfd *pfd;
+	unsigned nact = 0, sact = 16, u;
+	double now, tmo, t;
+	char buf[64];
+	int i;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	(void)priv;
+	act = calloc(sact, sizeof *act);
+	AN(act);
+	pfd = calloc(sact + 1, sizeof *pfd);
+	AN(pfd);
+	pfd[0].fd = ofl_pipe[0];
+	pfd[0].events = POLLIN;
+	tmo = 1.0;
+	while (1) {
+		i = poll(pfd, nact + 1, (int)ceil(tmo * 1e3));
+		assert(i >= 0 || errno == EINTR);
+		now = VTIM_real();
+		if (pfd[0].revents != 0)
+			while (read(ofl_pipe[0], buf, sizeof buf) > 0)
+				continue;
+
+		/* Send what we can, retire the finished and the too slow */
+		u = 0;
+		while (u < nact) {
+			ofl = act[u];
+			i = 1;
+			if (pfd[u + 1].revents != 0)
+				i = ofl_send(wrk, ofl, now);
+			if (i == 1 &&
+			    now - ofl->t0 <= cache_param->send_timeout &&
+			    now - ofl->t_last <=
+			    cache_param->idle_send_timeout) {
+				u++;
+				continue;
+			}
+			if (i == 1)
+				VSL(SLT_Debug, ofl->sp->vxid,
+				    "Offloaded delivery timed out, %zd left",
+				    ofl->left);
+			ofl_done(wrk, ofl, i == 0 ? SC_NULL :
+			    i < 0 ? SC_REM_CLOSE : SC_TX_ERROR, now);
+			nact--;
+			act[u] = act[nact];
+			pfd[u + 1] = pfd[nact + 1];
+		}
+
+		/* Take on the new ones, the socket may take it all now */
+		VTAILQ_INIT(&new);
+		Lck_Lock(&ofl_mtx);
+		VTAILQ_CONCAT(&new, &ofl_new, list);
+		Lck_Unlock(&ofl_mtx);
+		while ((ofl = VTAILQ_FIRST(&new)) != NULL) {
+			VTAILQ_REMOVE(&new, ofl, list);
+			wrk->stats.sess_offload++;
+			ofl->t_last = now;
+			i = ofl_send(wrk, ofl, now);
+			if (i <= 0) {
+				ofl_done(wrk, ofl,
+				    i == 0 ? SC_NULL : SC_REM_CLOSE, now);
+				continue;
+			}
+			if (nact == sact) {
+				sact *= 2;
+				act = realloc(act, sact * sizeof *act);
+				AN(act);
+				pfd = realloc(pfd, (sact + 1) * sizeof *pfd);
+				AN(pfd);
+			}
+			act[nact] = ofl;
+			pfd[nact + 1].fd = ofl->sp->fd;
+			pfd[nact + 1].events = POLLOUT;
+			nact++;
+		}
+		VSC_C_main->n_offload = nact;
+		WRK_SumStat(wrk);
+
+		tmo = 1.0;
+		pfd[0].revents = 0;
+		for (u = 0; u < nact; u++) {
+			ofl = act[u];
+			t = fmin(ofl->t0 + cache_param->send_timeout,
+			    ofl->t_last + cache_param->idle_send_timeout);
+			if (t - now < tmo)
+				tmo = t - now;
+			pfd[u + 1].revents = 0;
+		}
+		if (tmo < 0.)
+			tmo = 0.;
+	}
+	NEEDLESS_RETURN(NULL);
+}
+
+/*--------------------------------------------------------------------*/
+
+void
+OFL_Init(void)
+{
+	pthread_t pt;
+
+	Lck_New(&ofl_mtx, lck_ofl);
+	AZ(pipe(ofl_pipe));
+	AZ(VTCP_nonblocking(ofl_pipe[0]));
+	WRK_BgThread(&pt, "offload-writer", ofl_thread, NULL);
+}
@@ -128,6 +128,8 @@ pool_accept(struct worker *wrk, void *arg)
 	CHECK_OBJ_NOTNULL(ps->lsock, LISTEN_SOCK_MAGIC);
 	assert(sizeof *wa == WS_Reserve(wrk->aws, sizeof *wa));
 	wa = (void*)wrk->aws->f;
+	/* We never touch VCL, don't hold up its reclamation */
+	VCL_Idle(wrk);
 	while (1) {
 		memset(wa, 0, sizeof *wa);
 		wa->magic = WRK_ACCEPT_MAGIC;
@@ -263,6 +265,7 @@ Pool_Work_Thread(void *priv, struct worker *wrk)
 			VTAILQ_INSERT_HEAD(&pp->idle_queue, &wrk->task, list);
 			if (!stats_clean)
 				WRK_SumStat(wrk);
+			VCL_Idle(wrk);
 			(void)Lck_CondWait(&wrk->cond, &pp->mtx, NULL);
 			tp = &wrk->task;
 		}
@@ -272,6 +275,7 @@ Pool_Work_Thread(void *priv, struct worker *wrk)
 			break;
 
 		assert(wrk->pool == pp);
+		VCL_Quiesce(wrk);
 		tp->func(wrk, tp->priv);
 		stats_clean = WRK_TrySumStat(wrk);
 	}
@@ -231,12 +231,16 @@ cnt_deliver(struct worker *wrk, struct req *req)
 
 	RES_WriteObj(req);
 
-	/* No point in saving the body if it is hit-for-pass */
-	if (req->obj->objcore->flags & OC_F_PASS)
-		STV_Freestore(req->obj);
-
 	assert(WRW_IsReleased(wrk));
-	(void)HSH_Deref(&wrk->stats, NULL, &req->obj);
+	if (req->ofl != NULL) {
+		/* The offload thread still needs the body */
+		OFL_TakeObj(req->ofl, &req->obj);
+	} else {
+		/* No point in saving the body if it is hit-for-pass */
+		if (req->obj->objcore->flags & OC_F_PASS)
+			STV_Freestore(req->obj);
+		(void)HSH_Deref(&wrk->stats, NULL, &req->obj);
+	}
 	http_Teardown(req->resp);
 	return (1);
 }
@@ -666,7 +670,7 @@ cnt_fetchbody(struct worker *wrk, struct req *req)
 		EXP_Insert(req->obj);
 		AN(req->obj->objcore->ban);
 		AZ(req->obj->ws_o->overflow);
-		HSH_Unbusy(&wrk->stats, req->obj->objcore);
+		HSH_Unbusy(&wrk->stats, req->obj);
 	}
 
 	if (!bo->do_stream ||
@@ -850,6 +854,7 @@ cnt_lookup(struct worker *wrk, struct req *req)
 
 	wrk->stats.cache_hit++;
 	VSLb(req->vsl, SLT_Hit, "%u", req->obj->vxid);
+	STV_Hit(oc, o);
 	req->req_step = R_STP_HIT;
 	return (0);
 }
@@ -223,6 +223,25 @@ res_WriteDirObj(struct req *req, ssize_t low, ssize_t high)
 	assert(u == req->obj->len);
 }
 
+/*--------------------------------------------------------------------
+ * How far should the worker thread write a plain body?  Past
+ * offload_threshold bytes, the offload thread gets the rest.  If
+ * there are pipelined requests, the session must stay with us.
+ */
+
+static ssize_t
+res_offload_point(const struct req *req, ssize_t low, ssize_t high)
+{
+
+	if (cache_param->offload_threshold == 0 ||
+	    1 + high - low <= cache_param->offload_threshold ||
+	    req->esi_level > 0 ||
+	    (req->res_mode & RES_CHUNKED) ||
+	    req->htc->pipeline.b != NULL)
+		return (high);
+	return (low + cache_param->offload_threshold - 1);
+}
+
 /*--------------------------------------------------------------------
  * Deliver an object.
  * Attempt optimizations like 304 and 206 here.
@@ -232,7 +251,9 @@ void
 RES_WriteObj(struct req *req)
 {
 	char *r;
-	ssize_t low, high;
+	ssize_t low, high, mid;
+	struct gzc *gzc = NULL;
+	unsigned i;
 
 	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
 
@@ -241,6 +262,7 @@ RES_WriteObj(struct req *req)
 	 */
 	low = 0;
 	high = req->obj->len - 1;
+	mid = high;
 	if (
 	    req->wantbody &&
 	    (req->res_mode & RES_LEN) &&
@@ -277,15 +299,29 @@ RES_WriteObj(struct req *req)
 	    !req->gzip_resp && req->obj->gziped) {
 		res_WriteGunzipObj(req);
 	} else if (req->res_mode & RES_GUNZIP) {
-		res_WriteGunzipObj(req);
+		if (!GZC_Deliver(req, &gzc))
+			res_WriteGunzipObj(req);
 	} else {
-		res_WriteDirObj(req, low, high);
+		mid = res_offload_point(req, low, high);
+		res_WriteDirObj(req, low, mid);
 	}
 
 	if (req->res_mode & RES_CHUNKED &&
 	    !(req->res_mode & RES_ESI_CHILD))
 		WRW_EndChunk(req->wrk);
 
-	if (WRW_FlushRelease(req->wrk) && req->sp->fd >= 0)
-		SES_Close(req->sp, SC_REM_CLOSE);
+	if (req->esi_level == 0 && req->doclose == SC_NULL && mid == high &&
+	    HTC_Pipelined(req->htc))
+		i = WRW_HoldRelease(req->wrk, cache_param->pipeline_coalesce);
+	else
+		i = WRW_FlushRelease(req->wrk);
+	if (i) {
+		if (req->sp->fd >= 0)
+			SES_Close(req->sp, SC_REM_CLOSE);
+	} else if (mid < high)
+		req->ofl = OFL_New(req, mid + 1, high);
+
+	/* The WRW is done with the gunzip'ed copy */
+	if (gzc != NULL)
+		GZC_Rel(&gzc);
 }
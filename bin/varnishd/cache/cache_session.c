@@ -140,10 +140,6 @@ ses_req_pool_task(struct worker *wrk, void *arg)
 	HTTP1_Session(wrk, req);
 	WS_Assert(wrk->aws);
 	AZ(wrk->wrw);
-	if (cache_param->diag_bitmap & 0x00040000) {
-		if (wrk->vcl != NULL)
-			VCL_Rel(&wrk->vcl);
-	}
 	THR_SetRequest(NULL);
 }
 
@@ -261,7 +257,7 @@ SES_ScheduleReq(struct req *req)
 	if (Pool_Task(pp->pool, &sp->task, POOL_QUEUE_FRONT)) {
 		VSC_C_main->client_drop_late++;
 		AN (req->vcl);
-		VCL_Rel(&req->vcl);
+		VCL_Rel(req);
 		SES_Delete(sp, SC_OVERLOAD, NAN);
 		return (1);
 	}
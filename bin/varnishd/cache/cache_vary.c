@@ -144,6 +144,27 @@ vry_len(const uint8_t *p)
 	return (2 + p[2] + 2 + (l == 0xffff ? 0 : l));
 }
 
+/*
+ * Add a vary entry to a FNV-1a hash.  The contents of Accept-Encoding
+ * are left out, because vry_cmp() may ignore them.
+ */
+#define VRY_HASH_INIT	2166136261U
+
+static uint32_t
+vry_hash(uint32_t key, const uint8_t *p)
+{
+	unsigned u, l;
+
+	l = vry_len(p);
+	if (!strcasecmp(H_Accept_Encoding, (const char*)p + 2)) {
+		p += 2;
+		l = p[0] + 2;
+	}
+	for (u = 0; u < l; u++)
+		key = (key ^ p[u]) * 16777619U;
+	return (key);
+}
+
 /*
  * Compare two vary entries
  */
@@ -205,13 +226,13 @@ VRY_Prep(struct req *req)
  * Return non-zero if there could be a match or if we couldn't tell.
  */
 
-int
-VRY_Match(struct req *req, const uint8_t *vary)
+static int
+vry_match(struct req *req, const uint8_t *vary, uint32_t *key)
 {
 	uint8_t *vsp = req->vary_b;
 	char *h, *e;
 	unsigned lh, ln;
-	int i, oflo = 0;
+	int i, oflo = 0, retval = 1;
 
 	AN(vsp);
 	while (vary[2]) {
@@ -266,14 +287,16 @@ VRY_Match(struct req *req, const uint8_t *vary)
 			i = vry_cmp(vary, vsp);
 			assert(i == 0 || i == 2);
 		}
-		if (i == 0) {
-			/* Same header, same contents*/
-			vsp += vry_len(vsp);
-			vary += vry_len(vary);
-		} else if (i == 2) {
+		if (i == 2) {
 			/* Same header, different contents, cannot match */
-			return (0);
+			retval = 0;
+			if (key == NULL)
+				return (0);
 		}
+		if (key != NULL)
+			*key = vry_hash(*key, vsp);
+		vsp += vry_len(vsp);
+		vary += vry_len(vary);
 	}
 	if (oflo) {
 		vsp = req->vary_b;
@@ -283,10 +306,76 @@ VRY_Match(struct req *req, const uint8_t *vary)
 			vsp[1] = 0xff;
 			vsp[2] = 0;
 		}
-		return (0);
-	} else {
-		return (1);
+		return (-1);
+	}
+	return (retval);
+}
+
+int
+VRY_Match(struct req *req, const uint8_t *vary)
+{
+
+	return (vry_match(req, vary, NULL) > 0);
+}
+
+/**********************************************************************
+ * The objhead variant index finds objects by a hash of their vary
+ * string.  VRY_Hash() is the key of an object, VRY_Key() builds the
+ * request's entries for all the headers an object varies on, as
+ * VRY_Match() would, and returns the key the request would have.
+ * Return non-zero if we ran out of workspace.
+ */
+
+uint32_t
+VRY_Hash(const uint8_t *vary)
+{
+	uint32_t key = VRY_HASH_INIT;
+
+	while (vary[2]) {
+		key = vry_hash(key, vary);
+		vary += vry_len(vary);
+	}
+	return (key);
+}
+
+int
+VRY_Key(struct req *req, const uint8_t *vary, uint32_t *key)
+{
+
+	AN(key);
+	*key = VRY_HASH_INIT;
+	return (vry_match(req, vary, key) < 0);
+}
+
+/*
+ * Length of a vary string, including the terminator
+ */
+
+unsigned
+VRY_Len(const uint8_t *vary)
+{
+	const uint8_t *p = vary;
+
+	while (p[2])
+		p += vry_len(p);
+	return (p + 3 - vary);
+}
+
+/*
+ * Do two vary strings name the same headers?
+ */
+
+int
+VRY_SameSpec(const uint8_t *v1, const uint8_t *v2)
+{
+
+	while (v1[2] && v2[2]) {
+		if (memcmp(v1 + 2, v2 + 2, v1[2] + 2))
+			return (0);
+		v1 += vry_len(v1);
+		v2 += vry_len(v2);
 	}
+	return (v1[2] == v2[2]);
 }
 
 void
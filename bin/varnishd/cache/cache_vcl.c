@@ -34,6 +34,7 @@
 #include "config.h"
 
 #include <dlfcn.h>
+#include <stdio.h>
 #include <stdlib.h>
 
 #include "cache.h"
@@ -41,6 +42,8 @@
 #include "vcl.h"
 #include "vcli.h"
 #include "vcli_priv.h"
+#include "vmb.h"
+#include "vrt.h"
 
 struct vcls {
 	unsigned		magic;
@@ -48,6 +51,7 @@ struct vcls {
 	VTAILQ_ENTRY(vcls)	list;
 	char			*name;
 	void			*dlh;
+	unsigned		gen;	/* vcl_gen when last replaced */
 	struct VCL_conf		conf[1];
 };
 
@@ -60,7 +64,29 @@ static VTAILQ_HEAD(, vcls)	vcl_head =
 
 
 static struct lock		vcl_mtx;
-static struct vcls		*vcl_active; /* protected by vcl_mtx */
+static struct vcls * volatile	vcl_active;
+
+/*
+ * Worker threads do not count their references to the VCL, they pick
+ * up vcl_active for each request without any locking, and we use
+ * quiescent-state detection to find out when nobody can be using a VCL
+ * which has been replaced:
+ *
+ * vcl_gen is bumped every time vcl_active changes, and the VCL being
+ * replaced remembers the new value.  Every time a worker thread starts
+ * a task it copies vcl_gen into its vcl_qgen, or sets it to zero when
+ * it goes idle.  Once all the workers have a vcl_qgen of zero or at
+ * least the generation of a VCL, they have all been through a task
+ * boundary since it was replaced and none of them can still have it.
+ *
+ * Requests which leave their worker thread holding on to a VCL, to
+ * wait for a busy object, pin it the old-fashioned way with VCL_Hold()
+ * which counts in conf->busy, under vcl_mtx.
+ */
+
+static volatile unsigned	vcl_gen = 1;
+static VTAILQ_HEAD(, worker)	vcl_workers =	/* protected by vcl_mtx */
+    VTAILQ_HEAD_INITIALIZER(vcl_workers);
 
 /*--------------------------------------------------------------------*/
 
@@ -79,43 +105,57 @@ VCL_Return_Name(unsigned method)
 
 /*--------------------------------------------------------------------*/
 
-static void
-VCL_Get(struct VCL_conf **vcc)
+void
+VCL_Ref(struct req *req)
 {
 	static int once = 0;
+	struct vcls *vcl;
 
+	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
+	AZ(req->vcl);
+	AZ(req->vcl_held);
 	while (!once && vcl_active == NULL) {
 		(void)sleep(1);
 	}
 	once = 1;
 
-	Lck_Lock(&vcl_mtx);
-	AN(vcl_active);
-	*vcc = vcl_active->conf;
-	AN(*vcc);
-	AZ((*vcc)->discard);
-	(*vcc)->busy++;
-	Lck_Unlock(&vcl_mtx);
+	/*
+	 * We may pick up the previous VCL just as vcl.use replaces it,
+	 * and it may even be discarded before we get to look at it.
+	 * That is fine, our vcl_qgen keeps it around until this task
+	 * is over, so do not assert on conf->discard here.
+	 */
+	vcl = vcl_active;
+	CHECK_OBJ_NOTNULL(vcl, VVCLS_MAGIC);
+	req->vcl = vcl->conf;
 }
 
 void
-VCL_Refresh(struct VCL_conf **vcc)
+VCL_Hold(struct req *req)
 {
-	if (*vcc == vcl_active->conf)
+
+	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
+	CHECK_OBJ_NOTNULL(req->vcl, VCL_CONF_MAGIC);
+	if (req->vcl_held)
 		return;
-	if (*vcc != NULL)
-		VCL_Rel(vcc);	/* XXX: optimize locking */
-	VCL_Get(vcc);
+	Lck_Lock(&vcl_mtx);
+	req->vcl->busy++;
+	Lck_Unlock(&vcl_mtx);
+	req->vcl_held = 1;
 }
 
 void
-VCL_Rel(struct VCL_conf **vcc)
+VCL_Rel(struct req *req)
 {
 	struct VCL_conf *vc;
 
-	AN(*vcc);
-	vc = *vcc;
-	*vcc = NULL;
+	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
+	vc = req->vcl;
+	CHECK_OBJ_NOTNULL(vc, VCL_CONF_MAGIC);
+	req->vcl = NULL;
+	if (!req->vcl_held)
+		return;
+	req->vcl_held = 0;
 
 	Lck_Lock(&vcl_mtx);
 	assert(vc->busy > 0);
@@ -129,6 +169,80 @@ VCL_Rel(struct VCL_conf **vcc)
 
 /*--------------------------------------------------------------------*/
 
+void
+VCL_AddWorker(struct worker *wrk)
+{
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	AZ(wrk->vcl_qgen);
+	Lck_Lock(&vcl_mtx);
+	VTAILQ_INSERT_TAIL(&vcl_workers, wrk, vcl_list);
+	Lck_Unlock(&vcl_mtx);
+}
+
+void
+VCL_DelWorker(struct worker *wrk)
+{
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	Lck_Lock(&vcl_mtx);
+	VTAILQ_REMOVE(&vcl_workers, wrk, vcl_list);
+	Lck_Unlock(&vcl_mtx);
+}
+
+/*
+ * The barrier makes sure that vcl_qgen is out there before we look at
+ * vcl_active, otherwise vcl_busy() could miss us.
+ */
+
+void
+VCL_Quiesce(struct worker *wrk)
+{
+	unsigned g;
+
+	g = vcl_gen;
+	VRMB();
+	wrk->vcl_qgen = g;
+	VMB();
+}
+
+void
+VCL_Idle(struct worker *wrk)
+{
+
+	wrk->vcl_qgen = 0;
+}
+
+/*--------------------------------------------------------------------
+ * Can any worker thread still be using this VCL ?
+ */
+
+static int
+vcl_busy(const struct vcls *vcl)
+{
+	const struct worker *wrk;
+	int busy = 0;
+
+	ASSERT_CLI();
+	if (vcl->conf->busy)
+		return (1);
+	if (vcl->gen == 0)
+		return (0);	/* Never active */
+	VMB();
+	Lck_Lock(&vcl_mtx);
+	VTAILQ_FOREACH(wrk, &vcl_workers, vcl_list) {
+		if (wrk->vcl_qgen != 0 &&
+		    (int)(wrk->vcl_qgen - vcl->gen) < 0) {
+			busy = 1;
+			break;
+		}
+	}
+	Lck_Unlock(&vcl_mtx);
+	return (busy);
+}
+
+/*--------------------------------------------------------------------*/
+
 static struct vcls *
 vcl_find(const char *name)
 {
@@ -144,6 +258,25 @@ vcl_find(const char *name)
 	return (NULL);
 }
 
+/*--------------------------------------------------------------------
+ * VCL compiled with vcc_profile has its counters in VSM, one for each
+ * entry in the ref table, then one for each subroutine.
+ */
+
+static void
+vcl_prof_alloc(const struct VCL_conf *conf, const char *name)
+{
+	char ident[128];	/* XXX: match VSM_chunk.ident */
+	unsigned l;
+
+	/* VCL names can be longer than a VSM ident, the ident is a label */
+	bprintf(ident, "%.*s", (int)sizeof ident - 1, name);
+	l = (conf->nref + conf->nsub) * sizeof(struct vrt_prof);
+	*conf->prof = VSM_Alloc(l, VRT_PROF_CLASS, "", ident);
+	AN(*conf->prof);
+	memset(*conf->prof, 0, l);
+}
+
 static int
 VCL_Load(const char *fn, const char *name, struct cli *cli)
 {
@@ -182,8 +315,12 @@ VCL_Load(const char *fn, const char *name, struct cli *cli)
 		FREE_OBJ(vcl);
 		return (1);
 	}
+	if (vcl->conf->prof != NULL)
+		vcl_prof_alloc(vcl->conf, name);
 	if (vcl->conf->init_vcl(cli)) {
 		VCLI_Out(cli, "VCL \"%s\" Failed to initialize", name);
+		if (vcl->conf->prof != NULL)
+			VSM_Free(*vcl->conf->prof);
 		(void)dlclose(vcl->dlh);
 		FREE_OBJ(vcl);
 		return (1);
@@ -213,10 +350,12 @@ VCL_Nuke(struct vcls *vcl)
 	ASSERT_CLI();
 	assert(vcl != vcl_active);
 	assert(vcl->conf->discard);
-	assert(vcl->conf->busy == 0);
+	AZ(vcl_busy(vcl));
 	VTAILQ_REMOVE(&vcl_head, vcl, list);
 	(void)vcl->conf->fini_func(NULL);
 	vcl->conf->fini_vcl(NULL);
+	if (vcl->conf->prof != NULL)
+		VSM_Free(*vcl->conf->prof);
 	free(vcl->name);
 	(void)dlclose(vcl->dlh);
 	FREE_OBJ(vcl);
@@ -233,7 +372,7 @@ VCL_Poll(void)
 
 	ASSERT_CLI();
 	VTAILQ_FOREACH_SAFE(vcl, &vcl_head, list, vcl2)
-		if (vcl->conf->discard && vcl->conf->busy == 0)
+		if (vcl->conf->discard && !vcl_busy(vcl))
 			VCL_Nuke(vcl);
 }
 
@@ -304,14 +443,14 @@ ccf_config_discard(struct cli *cli, const char * const *av, void *priv)
 	for(i = 1; i < vcl->conf->ndirector; i++)
 		VBE_DiscardHealth(vcl->conf->director[i]);
 
-	if (vcl->conf->busy == 0)
+	if (!vcl_busy(vcl))
 		VCL_Nuke(vcl);
 }
 
 static void
 ccf_config_use(struct cli *cli, const char * const *av, void *priv)
 {
-	struct vcls *vcl;
+	struct vcls *vcl, *old;
 	int i;
 
 	(void)av;
@@ -323,7 +462,15 @@ ccf_config_use(struct cli *cli, const char * const *av, void *priv)
 		return;
 	}
 	Lck_Lock(&vcl_mtx);
-	vcl_active = vcl;
+	if (vcl != vcl_active) {
+		old = vcl_active;
+		vcl_active = vcl;
+		VWMB();
+		if (++vcl_gen == 0)
+			vcl_gen++;
+		CHECK_OBJ_NOTNULL(old, VVCLS_MAGIC);
+		old->gen = vcl_gen;
+	}
 	Lck_Unlock(&vcl_mtx);
 
 	/* Tickle this VCL's backends to take over health polling */
@@ -333,6 +480,99 @@ ccf_config_use(struct cli *cli, const char * const *av, void *priv)
 
 /*--------------------------------------------------------------------*/
 
+struct vcl_prof_ent {
+	uint64_t		ticks;
+	unsigned		idx;
+};
+
+static int
+vcl_prof_cmp(const void *a, const void *b)
+{
+	const struct vcl_prof_ent *pa = a, *pb = b;
+
+	if (pa->ticks != pb->ticks)
+		return (pa->ticks < pb->ticks ? 1 : -1);
+	return (pa->idx < pb->idx ? -1 : pa->idx > pb->idx);
+}
+
+/* Sort the counters [lo, hi) with any count, most ticks first */
+
+static unsigned
+vcl_prof_sort(const struct vrt_prof *vp, unsigned lo, unsigned hi,
+    struct vcl_prof_ent *pe)
+{
+	unsigned u, n = 0;
+
+	for (u = lo; u < hi; u++) {
+		if (vp[u].count == 0)
+			continue;
+		pe[n].ticks = vp[u].ticks;
+		pe[n].idx = u;
+		n++;
+	}
+	qsort(pe, n, sizeof *pe, vcl_prof_cmp);
+	return (n);
+}
+
+static void
+ccf_config_profile(struct cli *cli, const char * const *av, void *priv)
+{
+	struct vcls *vcl;
+	const struct VCL_conf *conf;
+	const struct vrt_prof *vp;
+	const struct vrt_ref *vr;
+	struct vcl_prof_ent *pe;
+	unsigned u, n;
+
+	(void)priv;
+	ASSERT_CLI();
+	if (av[2] != NULL)
+		vcl = vcl_find(av[2]);
+	else
+		vcl = vcl_active;
+	if (vcl == NULL) {
+		VCLI_Out(cli, "No VCL named '%s'", av[2]);
+		VCLI_SetResult(cli, CLIS_PARAM);
+		return;
+	}
+	conf = vcl->conf;
+	if (conf->prof == NULL) {
+		VCLI_Out(cli, "VCL '%s' was not compiled with vcc_profile",
+		    vcl->name);
+		VCLI_SetResult(cli, CLIS_CANT);
+		return;
+	}
+	vp = *conf->prof;
+	AN(vp);
+	pe = calloc(conf->nref + conf->nsub, sizeof *pe);
+	AN(pe);
+
+	VCLI_Out(cli, "%12s %16s %12s  %s\n",
+	    "calls", "ticks", "ticks/call", "subroutine");
+	n = vcl_prof_sort(vp, conf->nref, conf->nref + conf->nsub, pe);
+	for (u = 0; u < n; u++)
+		VCLI_Out(cli, "%12ju %16ju %12ju  %s\n",
+		    (uintmax_t)vp[pe[u].idx].count,
+		    (uintmax_t)pe[u].ticks,
+		    (uintmax_t)(pe[u].ticks / vp[pe[u].idx].count),
+		    conf->subname[pe[u].idx - conf->nref]);
+
+	VCLI_Out(cli, "\n%12s %16s %12s  %s\n",
+	    "count", "ticks", "ticks/count", "source line.pos token");
+	n = vcl_prof_sort(vp, 1, conf->nref, pe);
+	for (u = 0; u < n; u++) {
+		vr = &conf->ref[pe[u].idx];
+		VCLI_Out(cli, "%12ju %16ju %12ju  %s %u.%u %s\n",
+		    (uintmax_t)vp[pe[u].idx].count,
+		    (uintmax_t)pe[u].ticks,
+		    (uintmax_t)(pe[u].ticks / vp[pe[u].idx].count),
+		    conf->srcname[vr->source], vr->line, vr->pos, vr->token);
+	}
+	free(pe);
+}
+
+/*--------------------------------------------------------------------*/
+
 #define VCL_MET_MAC(func, upper, bitmap)				\
 void									\
 VCL_##func##_method(struct req *req)					\
@@ -362,6 +602,7 @@ static struct cli_proto vcl_cmds[] = {
 	{ CLI_VCL_LIST,         "i", ccf_config_list },
 	{ CLI_VCL_DISCARD,      "i", ccf_config_discard },
 	{ CLI_VCL_USE,          "i", ccf_config_use },
+	{ CLI_VCL_PROFILE,      "", ccf_config_profile },
 	{ NULL }
 };
 
@@ -38,6 +38,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 
 #include "cache.h"
 
@@ -80,6 +81,92 @@ VRT_count(struct req *req, unsigned u)
 		    req->vcl->ref[u].line, req->vcl->ref[u].pos);
 }
 
+/*--------------------------------------------------------------------
+ * VCL compiled with vcc_profile calls VRT_prof_count() instead of
+ * VRT_count(), and wraps every subroutine in VRT_prof_enter() and
+ * VRT_prof_leave().
+ *
+ * The ticks from one counted token to the next are charged to the
+ * first, and a subroutine gets all the ticks from when it is called
+ * until it returns.  Whatever happens in a called subroutine is not
+ * charged to the line which called it.
+ *
+ * The counters are shared by all threads, and not locked, so the odd
+ * update gets lost.
+ */
+
+static inline uint64_t
+vrt_prof_ticks(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	uint32_t lo, hi;
+
+	__asm__ __volatile__("rdtsc" : "=a" (lo), "=d" (hi));
+	return ((uint64_t)hi << 32 | lo);
+#else
+	struct timespec ts;
+
+	AZ(clock_gettime(CLOCK_MONOTONIC, &ts));
+	return (ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+#endif
+}
+
+static uint64_t
+vrt_prof_charge(struct req *req, struct vrt_prof *vp)
+{
+	uint64_t now;
+
+	now = vrt_prof_ticks();
+	if (req->vcl_prof_ref != 0 && now > req->vcl_prof_t)
+		vp[req->vcl_prof_ref].ticks += now - req->vcl_prof_t;
+	return (now);
+}
+
+void
+VRT_prof_count(struct req *req, struct vrt_prof *vp, unsigned u)
+{
+
+	VRT_count(req, u);
+	if (req == NULL)
+		return;
+	AN(vp);
+	req->vcl_prof_t = vrt_prof_charge(req, vp);
+	req->vcl_prof_ref = u;
+	vp[u].count++;
+}
+
+void
+VRT_prof_enter(struct req *req, struct vrt_prof_frame *vpf,
+    struct vrt_prof *vp)
+{
+
+	if (req == NULL)
+		return;
+	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
+	AN(vp);
+	vpf->t0 = vrt_prof_charge(req, vp);
+	vpf->ref = req->vcl_prof_ref;
+	req->vcl_prof_ref = 0;
+}
+
+void
+VRT_prof_leave(struct req *req, const struct vrt_prof_frame *vpf,
+    struct vrt_prof *vp, unsigned u)
+{
+	uint64_t now;
+
+	if (req == NULL)
+		return;
+	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
+	AN(vp);
+	now = vrt_prof_charge(req, vp);
+	vp[u].count++;
+	if (now > vpf->t0)
+		vp[u].ticks += now - vpf->t0;
+	req->vcl_prof_ref = vpf->ref;
+	req->vcl_prof_t = now;
+}
+
 /*--------------------------------------------------------------------*/
 
 void
@@ -32,52 +32,196 @@
 #include "config.h"
 
 #include <ctype.h>
+#include <stdlib.h>
 
 #include "cache.h"
 
+#include "vcli_priv.h"
 #include "vre.h"
 #include "vrt.h"
 
+/*--------------------------------------------------------------------
+ * The VCL compiler has already looked at the regexp, and if it is just
+ * a literal string, anchored or not, told us which kind and what the
+ * literal is, so we can do without VRE_exec().  For case insensitive
+ * literals, lit has already been folded to lower case.
+ *
+ * The match counters are for eyeballing with debug.regexp, and are only
+ * kept with diag_bitmap 0x00100000, so that every evaluation does not
+ * write to memory shared by all the workers.  They are not locked, the
+ * odd lost update does not matter.
+ */
+
+struct vrt_re {
+	unsigned		magic;
+#define VRT_RE_MAGIC		0x51c7a2e4
+	unsigned		kind;
+	const char		*re;
+	vre_t			*vre;
+	const char		*lit;
+	size_t			len;
+	uint64_t		ncall;
+	uint64_t		nmatch;
+	VTAILQ_ENTRY(vrt_re)	list;
+};
+
+static VTAILQ_HEAD(, vrt_re)	vrt_res = VTAILQ_HEAD_INITIALIZER(vrt_res);
+
+static const char * const vrt_re_kinds[] = {
+	[VRT_RE_PCRE] =		"pcre",
+	[VRT_RE_SUBSTR] =	"substr",
+	[VRT_RE_PREFIX] =	"prefix",
+	[VRT_RE_SUFFIX] =	"suffix",
+	[VRT_RE_EXACT] =	"exact",
+};
+
 void
-VRT_re_init(void **rep, const char *re)
+VRT_re_init(void **rep, const char *re, unsigned kind, const char *lit)
 {
-	vre_t *t;
+	struct vrt_re *rx;
 	const char *error;
 	int erroroffset;
 
-	/* This was already check-compiled by the VCL compiler */
-	t = VRE_compile(re, 0, &error, &erroroffset);
-	AN(t);
-	*rep = t;
+	ASSERT_CLI();
+	AN(re);
+	assert((kind & VRT_RE_KIND) <= VRT_RE_EXACT);
+	ALLOC_OBJ(rx, VRT_RE_MAGIC);
+	AN(rx);
+	rx->kind = kind;
+	rx->re = re;
+	if ((kind & VRT_RE_KIND) == VRT_RE_PCRE) {
+		/* This was already check-compiled by the VCL compiler */
+		rx->vre = VRE_compile(re, 0, &error, &erroroffset);
+		AN(rx->vre);
+	} else {
+		AN(lit);
+		rx->lit = lit;
+		rx->len = strlen(lit);
+	}
+	VTAILQ_INSERT_TAIL(&vrt_res, rx, list);
+	*rep = rx;
 }
 
 void
 VRT_re_fini(void *rep)
 {
-	vre_t *vv;
+	struct vrt_re *rx;
+
+	ASSERT_CLI();
+	if (rep == NULL)
+		return;
+	CAST_OBJ_NOTNULL(rx, rep, VRT_RE_MAGIC);
+	VTAILQ_REMOVE(&vrt_res, rx, list);
+	if (rx->vre != NULL)
+		VRE_free(&rx->vre);
+	FREE_OBJ(rx);
+}
+
+/* Compare with a literal already folded to lower case */
+
+static inline char
+vrt_re_lower(char c)
+{
+
+	return (c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c);
+}
+
+static int
+vrt_re_casecmp(const char *s, const char *lit, size_t len)
+{
+	size_t u;
+
+	for (u = 0; u < len; u++)
+		if (vrt_re_lower(s[u]) != lit[u])
+			return (1);
+	return (0);
+}
+
+static int
+vrt_re_cmp(const struct vrt_re *rx, const char *s)
+{
 
-	vv = rep;
-	if (rep != NULL)
-		VRE_free(&vv);
+	if (rx->kind & VRT_RE_ICASE)
+		return (vrt_re_casecmp(s, rx->lit, rx->len));
+	return (memcmp(s, rx->lit, rx->len));
+}
+
+static const char *
+vrt_re_casestr(const char *s, size_t len, const char *lit, size_t llen)
+{
+	const char *p, *e;
+
+	if (llen == 0)
+		return (s);
+	if (len < llen)
+		return (NULL);
+	e = s + len - llen;
+	for (p = s; p <= e; p++)
+		if (vrt_re_lower(*p) == lit[0] &&
+		    !vrt_re_casecmp(p + 1, lit + 1, llen - 1))
+			return (p);
+	return (NULL);
+}
+
+/*
+ * Like PCRE, let '$' match before a newline at the very end.
+ */
+
+static int
+vrt_re_exec(struct req *req, struct vrt_re *rx, const char *s, size_t len)
+{
+	int i;
+
+	CHECK_OBJ_NOTNULL(rx, VRT_RE_MAGIC);
+	switch (rx->kind & VRT_RE_KIND) {
+	case VRT_RE_SUBSTR:
+		if (rx->kind & VRT_RE_ICASE)
+			i = vrt_re_casestr(s, len, rx->lit, rx->len) != NULL;
+		else
+			i = strstr(s, rx->lit) != NULL;
+		break;
+	case VRT_RE_PREFIX:
+		i = len >= rx->len && !vrt_re_cmp(rx, s);
+		break;
+	case VRT_RE_SUFFIX:
+		if (len > 0 && s[len - 1] == '\n' &&
+		    len > rx->len && !vrt_re_cmp(rx, s + len - 1 - rx->len))
+			i = 1;
+		else
+			i = len >= rx->len &&
+			    !vrt_re_cmp(rx, s + len - rx->len);
+		break;
+	case VRT_RE_EXACT:
+		if (len == rx->len + 1 && s[rx->len] == '\n')
+			len--;
+		i = len == rx->len && !vrt_re_cmp(rx, s);
+		break;
+	default:
+		i = VRE_exec(rx->vre, s, len, 0, 0, NULL, 0,
+		    &cache_param->vre_limits);
+		if (i < VRE_ERROR_NOMATCH )
+			VSLb(req->vsl, SLT_VCL_Error,
+			    "Regexp matching returned %d", i);
+		i = i >= 0;
+		break;
+	}
+	if (cache_param->diag_bitmap & 0x00100000) {
+		rx->ncall++;
+		if (i)
+			rx->nmatch++;
+	}
+	return (i);
 }
 
 int
 VRT_re_match(struct req *req, const char *s, void *re)
 {
-	vre_t *t;
-	int i;
 
 	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
 	if (s == NULL)
 		s = "";
 	AN(re);
-	t = re;
-	i = VRE_exec(t, s, strlen(s), 0, 0, NULL, 0, &cache_param->vre_limits);
-	if (i >= 0)
-		return (1);
-	if (i < VRE_ERROR_NOMATCH )
-		VSLb(req->vsl, SLT_VCL_Error, "Regexp matching returned %d", i);
-	return (0);
+	return (vrt_re_exec(req, re, s, strlen(s)));
 }
 
 const char *
@@ -85,6 +229,7 @@ VRT_regsub(struct req *req, int all, const char *str, void *re,
     const char *sub)
 {
 	int ovector[30];
+	struct vrt_re *rx;
 	vre_t *t;
 	int i, l;
 	txt res;
@@ -100,11 +245,18 @@ VRT_regsub(struct req *req, int all, const char *str, void *re,
 		str = "";
 	if (sub == NULL)
 		sub = "";
-	t = re;
+	CAST_OBJ_NOTNULL(rx, re, VRT_RE_MAGIC);
+	t = rx->vre;
+	AN(t);
 	memset(ovector, 0, sizeof(ovector));
 	len = strlen(str);
 	i = VRE_exec(t, str, len, 0, options, ovector, 30,
 	    &cache_param->vre_limits);
+	if (cache_param->diag_bitmap & 0x00100000) {
+		rx->ncall++;
+		if (i >= 0)
+			rx->nmatch++;
+	}
 
 	/* If it didn't match, we can return the original string */
 	if (i == VRE_ERROR_NOMATCH)
@@ -164,3 +316,298 @@ VRT_regsub(struct req *req, int all, const char *str, void *re,
 	WS_ReleaseP(req->http->ws, res.b);
 	return (b0);
 }
+
+/*--------------------------------------------------------------------
+ * Regexp sets, for if/elsif chains testing one string against several
+ * regexps.  VRT_re_set_match() returns the index of the first regexp
+ * which matches, or -1.
+ *
+ * Regexps anchored with a literal prefix, like "^/static/", are put
+ * in a trie on that prefix, so one pass over the string finds the few
+ * of them which can possibly match.  If the regexp is nothing but the
+ * prefix, that is the answer, otherwise the candidates, and the regexps
+ * without a prefix, are tried with VRE_exec() in order.
+ */
+
+struct vrt_re_node {
+	unsigned		nchild;
+	unsigned char		*key;		/* Sorted */
+	struct vrt_re_node	**child;
+	unsigned		nidx;
+	unsigned		*idx;		/* Prefix ends here */
+};
+
+struct vrt_re_set {
+	unsigned		magic;
+#define VRT_RE_SET_MAGIC	0x3e5a0c91
+	unsigned		n;
+	struct vrt_re		**re;
+	uint8_t			*pure;		/* Nothing but the prefix */
+	unsigned		nother;
+	unsigned		*other;		/* No prefix */
+	struct vrt_re_node	root;
+};
+
+#define VRT_RE_SET_NCAND	64
+
+/*
+ * Find the literal prefix of an anchored regexp.  Any '|' could make
+ * the anchor and the prefix optional, so do not even try.
+ */
+
+static unsigned
+vrt_re_prefix(const char *re, char *buf, int *pure)
+{
+	const char *p, *q;
+	unsigned l = 0;
+	char c;
+
+	*pure = 0;
+	if (*re != '^')
+		return (0);
+	for (p = re; *p != '\0'; p++) {
+		if (*p == '\\' && p[1] != '\0')
+			p++;
+		else if (*p == '|')
+			return (0);
+	}
+	for (p = re + 1; *p != '\0'; p = q) {
+		if (*p == '\\') {
+			/* \d, \w, \1, \x41 etc. are not literals */
+			if (p[1] == '\0' || isalnum(p[1]))
+				break;
+			c = p[1];
+			q = p + 2;
+		} else if (strchr(".[](){}*+?^$|", *p) != NULL) {
+			break;
+		} else {
+			c = *p;
+			q = p + 1;
+		}
+		/* The character may not be there at all */
+		if (*q == '*' || *q == '?' || *q == '{')
+			break;
+		buf[l++] = c;
+		if (*q == '+')
+			return (l);
+	}
+	*pure = (*p == '\0');
+	return (l);
+}
+
+static const struct vrt_re_node *
+vrt_re_find(const struct vrt_re_node *n, unsigned char c)
+{
+	unsigned lo, hi, m;
+
+	lo = 0;
+	hi = n->nchild;
+	while (lo < hi) {
+		m = (lo + hi) / 2;
+		if (n->key[m] == c)
+			return (n->child[m]);
+		if (n->key[m] < c)
+			lo = m + 1;
+		else
+			hi = m;
+	}
+	return (NULL);
+}
+
+static struct vrt_re_node *
+vrt_re_child(struct vrt_re_node *n, unsigned char c)
+{
+	unsigned u, v;
+
+	for (u = 0; u < n->nchild && n->key[u] < c; u++)
+		continue;
+	if (u < n->nchild && n->key[u] == c)
+		return (n->child[u]);
+	n->key = realloc(n->key, n->nchild + 1L);
+	AN(n->key);
+	n->child = realloc(n->child, (n->nchild + 1L) * sizeof *n->child);
+	AN(n->child);
+	for (v = n->nchild; v > u; v--) {
+		n->key[v] = n->key[v - 1];
+		n->child[v] = n->child[v - 1];
+	}
+	n->nchild++;
+	n->key[u] = c;
+	n->child[u] = calloc(1, sizeof **n->child);
+	AN(n->child[u]);
+	return (n->child[u]);
+}
+
+static void
+vrt_re_node_free(struct vrt_re_node *n)
+{
+	unsigned u;
+
+	for (u = 0; u < n->nchild; u++) {
+		vrt_re_node_free(n->child[u]);
+		free(n->child[u]);
+	}
+	free(n->key);
+	free(n->child);
+	free(n->idx);
+}
+
+void
+VRT_re_set_init(void **rep, const char * const *re)
+{
+	struct vrt_re_set *rs;
+	struct vrt_re_node *n;
+	char *buf;
+	unsigned u, l, v;
+	int pure;
+
+	ALLOC_OBJ(rs, VRT_RE_SET_MAGIC);
+	AN(rs);
+	while (re[rs->n] != NULL)
+		rs->n++;
+	rs->re = calloc(rs->n, sizeof *rs->re);
+	AN(rs->re);
+	rs->pure = calloc(rs->n, sizeof *rs->pure);
+	AN(rs->pure);
+	rs->other = calloc(rs->n, sizeof *rs->other);
+	AN(rs->other);
+	for (u = 0; u < rs->n; u++) {
+		VRT_re_init((void **)&rs->re[u], re[u], VRT_RE_PCRE, NULL);
+		buf = malloc(strlen(re[u]) + 1L);
+		AN(buf);
+		l = vrt_re_prefix(re[u], buf, &pure);
+		if (l == 0) {
+			rs->other[rs->nother++] = u;
+		} else {
+			rs->pure[u] = pure;
+			n = &rs->root;
+			for (v = 0; v < l; v++)
+				n = vrt_re_child(n, (unsigned char)buf[v]);
+			n->idx = realloc(n->idx,
+			    (n->nidx + 1L) * sizeof *n->idx);
+			AN(n->idx);
+			n->idx[n->nidx++] = u;
+		}
+		free(buf);
+	}
+	*rep = rs;
+}
+
+void
+VRT_re_set_fini(void *rep)
+{
+	struct vrt_re_set *rs;
+	unsigned u;
+
+	if (rep == NULL)
+		return;
+	CAST_OBJ_NOTNULL(rs, rep, VRT_RE_SET_MAGIC);
+	for (u = 0; u < rs->n; u++)
+		VRT_re_fini(rs->re[u]);
+	vrt_re_node_free(&rs->root);
+	free(rs->re);
+	free(rs->pure);
+	free(rs->other);
+	FREE_OBJ(rs);
+}
+
+static int
+vrt_re_set_try(struct req *req, const struct vrt_re_set *rs, const char *s,
+    size_t len, unsigned u)
+{
+
+	if (rs->pure[u]) {
+		if (cache_param->diag_bitmap & 0x00100000) {
+			rs->re[u]->ncall++;
+			rs->re[u]->nmatch++;
+		}
+		return (1);
+	}
+	return (vrt_re_exec(req, rs->re[u], s, len));
+}
+
+int
+VRT_re_set_match(struct req *req, const char *s, void *rep)
+{
+	struct vrt_re_set *rs;
+	const struct vrt_re_node *n;
+	unsigned cand[VRT_RE_SET_NCAND];
+	unsigned nc = 0, u, v, w;
+	const char *p;
+	size_t len;
+	int oflo = 0;
+
+	CHECK_OBJ_NOTNULL(req, REQ_MAGIC);
+	CAST_OBJ_NOTNULL(rs, rep, VRT_RE_SET_MAGIC);
+	if (s == NULL)
+		s = "";
+	len = strlen(s);
+
+	/* Collect the prefixed regexps which can match, in order */
+	for (n = &rs->root, p = s; n != NULL && !oflo; ) {
+		for (u = 0; u < n->nidx; u++) {
+			if (nc == VRT_RE_SET_NCAND) {
+				oflo = 1;
+				break;
+			}
+			w = n->idx[u];
+			for (v = nc; v > 0 && cand[v - 1] > w; v--)
+				cand[v] = cand[v - 1];
+			cand[v] = w;
+			nc++;
+		}
+		if (*p == '\0')
+			break;
+		n = vrt_re_find(n, (unsigned char)*p++);
+	}
+	if (oflo) {
+		/* Too many, try them all */
+		for (u = 0; u < rs->n; u++)
+			if (vrt_re_set_try(req, rs, s, len, u))
+				return (u);
+		return (-1);
+	}
+
+	/* Merge with the ones without prefix */
+	for (u = v = 0; u < nc || v < rs->nother; ) {
+		if (v == rs->nother || (u < nc && cand[u] < rs->other[v]))
+			w = cand[u++];
+		else
+			w = rs->other[v++];
+		if (vrt_re_set_try(req, rs, s, len, w))
+			return (w);
+	}
+	return (-1);
+}
+
+/*--------------------------------------------------------------------*/
+
+static void
+ccf_debug_regexp(struct cli *cli, const char * const *av, void *priv)
+{
+	struct vrt_re *rx;
+
+	(void)av;
+	(void)priv;
+	ASSERT_CLI();
+	VTAILQ_FOREACH(rx, &vrt_res, list)
+		VCLI_Out(cli, "%12ju %12ju %-6s%s %s\n",
+		    (uintmax_t)rx->ncall, (uintmax_t)rx->nmatch,
+		    vrt_re_kinds[rx->kind & VRT_RE_KIND],
+		    rx->kind & VRT_RE_ICASE ? "/i" : "  ", rx->re);
+}
+
+static struct cli_proto vrt_re_cmds[] = {
+	{ "debug.regexp", "debug.regexp",
+		"\tShow the VCL regexps, with how often they were tried"
+		" and matched\n\t(counted with diag_bitmap 0x00100000)\n",
+		0, 0, "d", ccf_debug_regexp },
+	{ NULL }
+};
+
+void
+VRT_re_Init(void)
+{
+
+	CLI_AddFuncs(vrt_re_cmds);
+}
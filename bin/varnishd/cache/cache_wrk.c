@@ -139,16 +139,17 @@ wrk_thread_real(void *priv, unsigned thread_workspace)
 	WS_Init(w->aws, "wrk", ws, thread_workspace);
 
 	VSL(SLT_WorkThread, 0, "%p start", w);
+	VCL_AddWorker(w);
 
 	Pool_Work_Thread(priv, w);
 	AZ(w->pool);
 
+	VCL_DelWorker(w);
 	VSL(SLT_WorkThread, 0, "%p end", w);
-	if (w->vcl != NULL)
-		VCL_Rel(&w->vcl);
 	AZ(pthread_cond_destroy(&w->cond));
 	if (w->nbo != NULL)
 		VBO_Free(&w->nbo);
+	WRW_FreeHold(w);
 	HSH_Cleanup(w);
 	WRK_SumStat(w);
 	return (NULL);
@@ -39,6 +39,7 @@
 
 #include <limits.h>
 #include <stdio.h>
+#include <stdlib.h>
 
 #include "cache.h"
 #include "vtim.h"
@@ -60,6 +61,20 @@ struct wrw {
 	struct vsl_log		*vsl;
 };
 
+/*
+ * Responses to pipelined requests can be held back in a copy, and go out
+ * in the same writev(2) as the next response, see WRW_HoldRelease().
+ */
+
+struct wrw_hold {
+	unsigned		magic;
+#define WRW_HOLD_MAGIC		0x5ba1c07e
+	int			*wfd;
+	unsigned		len;
+	unsigned		space;
+	char			*buf;
+};
+
 /*--------------------------------------------------------------------
  */
 
@@ -98,6 +113,19 @@ WRW_Reserve(struct worker *wrk, int *fd, struct vsl_log *vsl, double t0)
 	wrw->t0 = t0;
 	wrw->vsl = vsl;
 	wrk->wrw = wrw;
+
+	if (wrk->wrw_hold != NULL && wrk->wrw_hold->len > 0) {
+		if (wrk->wrw_hold->wfd != fd) {
+			(void)WRW_FlushHold(wrk);
+		} else {
+			/* Held back output goes first */
+			wrw->iov[0].iov_base = wrk->wrw_hold->buf;
+			wrw->iov[0].iov_len = wrk->wrw_hold->len;
+			wrw->niov = 1;
+			wrw->liov = wrk->wrw_hold->len;
+			wrk->wrw_hold->len = 0;
+		}
+	}
 }
 
 static void
@@ -223,6 +251,101 @@ WRW_FlushRelease(struct worker *wrk)
 	return (u);
 }
 
+/*--------------------------------------------------------------------
+ * Instead of flushing, keep a copy of the output, if there is no more
+ * than limit bytes of it, so it can go out with the next WRW_Reserve()
+ * on the same fd.  Whoever lets go of the fd must WRW_FlushHold() first.
+ */
+
+unsigned
+WRW_HoldRelease(struct worker *wrk, unsigned limit)
+{
+	struct wrw *wrw;
+	struct wrw_hold *wh;
+	unsigned u, l;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	wrw = wrk->wrw;
+	CHECK_OBJ_NOTNULL(wrw, WRW_MAGIC);
+
+	if (wrw->werr || wrw->ciov < wrw->siov || wrw->liov > limit)
+		return (WRW_FlushRelease(wrk));
+
+	wh = wrk->wrw_hold;
+	if (wh == NULL) {
+		ALLOC_OBJ(wh, WRW_HOLD_MAGIC);
+		AN(wh);
+		wrk->wrw_hold = wh;
+	}
+	CHECK_OBJ_NOTNULL(wh, WRW_HOLD_MAGIC);
+	AZ(wh->len);
+	if (wh->space < wrw->liov) {
+		/* The first iov may be our own buffer, see WRW_Reserve() */
+		if (wrw->niov > 0 && wrw->iov[0].iov_base == wh->buf)
+			return (WRW_FlushRelease(wrk));
+		free(wh->buf);
+		wh->space = limit;
+		wh->buf = malloc(wh->space);
+		AN(wh->buf);
+	}
+
+	l = 0;
+	for (u = 0; u < wrw->niov; u++) {
+		memmove(wh->buf + l, wrw->iov[u].iov_base,
+		    wrw->iov[u].iov_len);
+		l += wrw->iov[u].iov_len;
+	}
+	assert(l == wrw->liov);
+	wh->len = l;
+	wh->wfd = wrw->wfd;
+	wrk->stats.sess_coalesce++;
+	WRW_Release(wrk);
+	return (0);
+}
+
+/*--------------------------------------------------------------------
+ * Send whatever WRW_HoldRelease() held back.
+ */
+
+unsigned
+WRW_FlushHold(struct worker *wrk)
+{
+	struct wrw_hold *wh;
+	ssize_t i;
+	unsigned l = 0;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	wh = wrk->wrw_hold;
+	if (wh == NULL || wh->len == 0)
+		return (0);
+	CHECK_OBJ_NOTNULL(wh, WRW_HOLD_MAGIC);
+	while (l < wh->len && *wh->wfd >= 0) {
+		i = write(*wh->wfd, wh->buf + l, wh->len - l);
+		if (i <= 0)
+			break;
+		l += i;
+	}
+	i = (l == wh->len) ? 0 : 1;
+	wh->len = 0;
+	return (i);
+}
+
+void
+WRW_FreeHold(struct worker *wrk)
+{
+	struct wrw_hold *wh;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	wh = wrk->wrw_hold;
+	wrk->wrw_hold = NULL;
+	if (wh == NULL)
+		return;
+	CHECK_OBJ_NOTNULL(wh, WRW_HOLD_MAGIC);
+	AZ(wh->len);
+	free(wh->buf);
+	FREE_OBJ(wh);
+}
+
 unsigned
 WRW_WriteH(const struct worker *wrk, const txt *hh, const char *suf)
 {
@@ -94,6 +94,8 @@ struct params {
 	unsigned		pipe_timeout;
 	unsigned		send_timeout;
 	unsigned		idle_send_timeout;
+	unsigned		offload_threshold;
+	unsigned		pipeline_coalesce;
 
 	/* Management hints */
 	unsigned		auto_restart;
@@ -138,6 +140,12 @@ struct params {
 	/* Default connection_timeout */
 	double			connect_timeout;
 
+	/* Idle connections to keep open to each backend */
+	unsigned		backend_warm;
+
+	/* Close idle backend connections after this long */
+	double			backend_idle_timeout;
+
 	/* Read timeouts for backend */
 	double			first_byte_timeout;
 	double			between_bytes_timeout;
@@ -185,13 +193,23 @@ struct params {
 	unsigned		gzip_buffer;
 	unsigned		gzip_level;
 	unsigned		gzip_memlevel;
+	ssize_t			gunzip_cache;
 
 	unsigned		obj_readonly;
 
 	double			critbit_cooloff;
 
+	unsigned		persistent_load_threads;
+
 	double			shortlived;
 
+	ssize_t			storage_route_size;
+	double			storage_route_ttl;
+
+	unsigned		storage_tiering;
+	unsigned		storage_promote_hits;
+	unsigned		storage_demote_free;
+
 	struct vre_limits	vre_limits;
 
 	unsigned		bo_cache;
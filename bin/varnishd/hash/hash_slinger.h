@@ -32,6 +32,7 @@ struct sess;
 struct req;
 struct worker;
 struct object;
+struct dstat;
 
 typedef void hash_init_f(int ac, char * const *av);
 typedef void hash_start_f(void);
@@ -59,12 +60,16 @@ void HSH_Drop(struct worker *, struct object **);
 void HSH_Init(const struct hash_slinger *slinger);
 void HSH_AddString(struct req *, const char *str);
 void HSH_Insert(struct worker *, const void *hash, struct objcore *);
+void HSH_InsertCopy(struct dstat *, struct objcore *,
+    struct objcore *);
 void HSH_Purge(struct req *, struct objhead *, double ttl, double grace);
 void HSH_config(const char *h_arg);
 struct objcore *HSH_NewObjCore(struct worker *wrk);
 
 #ifdef VARNISH_CACHE_CHILD
 
+struct hsh_vary;
+
 struct waitinglist {
 	unsigned		magic;
 #define WAITINGLIST_MAGIC	0x063a477a
@@ -80,6 +85,7 @@ struct objhead {
 	VTAILQ_HEAD(,objcore)	objcs;
 	unsigned char		digest[DIGEST_LEN];
 	struct waitinglist	*waitinglist;
+	struct hsh_vary		*vary;		/* Variant index */
 
 	/*----------------------------------------------------
 	 * The fields below are for the sole private use of
@@ -95,7 +101,7 @@ struct objhead {
 #define hoh_head _u.n.u_n_hoh_head
 };
 
-void HSH_Unbusy(struct dstat *, struct objcore *);
+void HSH_Unbusy(struct dstat *, const struct object *);
 void HSH_Complete(struct objcore *oc);
 void HSH_DeleteObjHead(struct dstat *, struct objhead *oh);
 int HSH_Deref(struct dstat *, struct objcore *oc, struct object **o);
@@ -113,6 +113,9 @@ extern const char *mgt_vmod_dir;
 extern unsigned mgt_vcc_err_unref;
 extern unsigned mgt_vcc_allow_inline_c;
 extern unsigned mgt_vcc_unsafe_path;
+extern unsigned mgt_vcc_profile;
+extern unsigned mgt_vcc_cache;
+extern unsigned mgt_vcc_cache_size;
 
 #define REPORT0(pri, fmt)				\
 	do {						\
@@ -844,6 +844,24 @@ static const struct parspec input_parspec[] = {
 		"See setsockopt(2) under SO_SNDTIMEO for more information.",
 		DELAYED_EFFECT,
 		"60", "seconds" },
+	{ "offload_threshold",
+		tweak_bytes_u, &mgt_param.offload_threshold, 0, UINT_MAX,
+		"Bodies larger than this are sent this far by the worker "
+		"thread, and the rest by a background thread, so that slow "
+		"clients do not tie up worker threads.\n"
+		"ESI, gunzip'ed, chunked and pipelined deliveries are not "
+		"offloaded.\n"
+		"Zero disables offloading.",
+		EXPERIMENTAL,
+		"0", "bytes" },
+	{ "pipeline_coalesce",
+		tweak_bytes_u, &mgt_param.pipeline_coalesce, 0, UINT_MAX,
+		"When the next pipelined request has already arrived, "
+		"responses up to this size are held back and sent together "
+		"with the response to that request, in one writev(2).\n"
+		"Zero disables this.",
+		EXPERIMENTAL,
+		"16k", "bytes" },
 	{ "auto_restart", tweak_bool, &mgt_param.auto_restart, 0, 0,
 		"Restart child process automatically if it dies.\n",
 		0,
@@ -908,7 +926,7 @@ static const struct parspec input_parspec[] = {
 		" this limit, the reponse code will be 201 instead of"
 		" 200 and the last line will indicate the truncation.",
 		0,
-		"48k", "bytes" },
+		"64k", "bytes" },
 	{ "cli_timeout", tweak_timeout, &mgt_param.cli_timeout, 0, 0,
 		"Timeout for the childs replies to CLI requests from "
 		"the mgt_param.",
@@ -966,6 +984,23 @@ static const struct parspec input_parspec[] = {
 		"backend request.",
 		0,
 		"0.7", "s" },
+	{ "backend_warm", tweak_uint, &mgt_param.backend_warm, 0, 1000,
+		"Number of idle connections to keep open to each backend, "
+		"ready for use by fetches.\n"
+		"These connections are opened by a background thread, so "
+		"that fetches only have to wait for a connect when none "
+		"are left.\n"
+		"Zero disables.",
+		EXPERIMENTAL,
+		"0", "connections" },
+	{ "backend_idle_timeout", tweak_timeout_double,
+		&mgt_param.backend_idle_timeout, 0, UINT_MAX,
+		"Idle backend connections, recycled or warm, are closed "
+		"after this long.  Zero means never, they are only closed "
+		"when the backend closes them. "
+		"VCL can override this default value for each backend.",
+		0,
+		"0", "seconds" },
 	{ "first_byte_timeout", tweak_timeout_double,
 		&mgt_param.first_byte_timeout,0, UINT_MAX,
 		"Default timeout for receiving first byte from backend. "
@@ -1071,8 +1106,8 @@ static const struct parspec input_parspec[] = {
 		"  0x00004000 - panic to stderr.\n"
 		"  0x00010000 - synchronize shmlog.\n"
 		"  0x00020000 - synchronous start of persistence.\n"
-		"  0x00040000 - release VCL early.\n"
 		"  0x00080000 - ban-lurker debugging.\n"
+		"  0x00100000 - count regexp matches for debug.regexp.\n"
 		"  0x80000000 - do edge-detection on digest.\n"
 		"\n"
 		"Use 0x notation and do the bitor in your head :-)\n"
@@ -1143,18 +1178,80 @@ static const struct parspec input_parspec[] = {
 		" just a waste of memory.",
 		EXPERIMENTAL,
 		"32k", "bytes" },
+	{ "gunzip_cache", tweak_bytes,
+		&mgt_param.gunzip_cache, 0, 0,
+		"Memory budget for caching gunzip'ed copies of gzip'ed "
+		"objects, for clients which do not accept gzip.\n"
+		"The first such delivery of an object keeps the gunzip'ed "
+		"body, later deliveries reuse it instead of running "
+		"gunzip again.  When the budget is exhausted the least "
+		"recently used copies are dropped.\n"
+		"Zero disables the cache.",
+		EXPERIMENTAL,
+		"0", "bytes" },
 	{ "shortlived", tweak_timeout_double,
 		&mgt_param.shortlived, 0, UINT_MAX,
 		"Objects created with TTL shorter than this are always "
 		"put in transient storage.\n",
 		0,
 		"10.0", "s" },
+	{ "storage_route_size", tweak_bytes,
+		&mgt_param.storage_route_size, 0, 0,
+		"When non-zero, objects are placed by the storage router "
+		"instead of round-robin over the stevedores.  The stevedores "
+		"are tiers in the order they were given with -s.\n"
+		"Objects with a Content-Length above this size start at the "
+		"second tier, others at the first.  An object which does not "
+		"fit in the free space of a tier, or fails to allocate there, "
+		"spills over to the next tier before any LRU nuking happens.\n"
+		"Zero disables the router.",
+		EXPERIMENTAL,
+		"0", "bytes" },
+	{ "storage_route_ttl", tweak_timeout_double,
+		&mgt_param.storage_route_ttl, 0, UINT_MAX,
+		"With the storage router enabled, objects with a TTL longer "
+		"than this also start at the second tier.\n"
+		"Zero means the TTL is not considered.",
+		EXPERIMENTAL,
+		"0", "s" },
+	{ "storage_tiering", tweak_bool, &mgt_param.storage_tiering, 0, 0,
+		"Use the first stevedore as a cache in front of the second.\n"
+		"The least recently used objects in the first stevedore are "
+		"moved to the second in the background, see "
+		"storage_demote_free, and popular objects in the second "
+		"stevedore are copied back to the first.\n"
+		"The second stevedore cannot be -spersistent.",
+		EXPERIMENTAL,
+		"off", "bool" },
+	{ "storage_promote_hits", tweak_uint,
+		&mgt_param.storage_promote_hits, 1, UINT_MAX,
+		"With storage_tiering, objects in the second stevedore are "
+		"promoted to the first when they have had this many hits.",
+		EXPERIMENTAL,
+		"3", "hits" },
+	{ "storage_demote_free", tweak_uint,
+		&mgt_param.storage_demote_free, 0, 100,
+		"With storage_tiering, objects are moved from the first "
+		"stevedore to the second to keep this much of the first "
+		"free.  Objects which fetches have to LRU nuke from the "
+		"first stevedore, because it was too full, are lost.\n"
+		"Zero disables demotion.",
+		EXPERIMENTAL,
+		"10", "%" },
 	{ "critbit_cooloff", tweak_timeout_double,
 		&mgt_param.critbit_cooloff, 60, 254,
 		"How long time the critbit hasher keeps deleted objheads "
 		"on the cooloff list.\n",
 		WIZARD,
 		"180.0", "s" },
+	{ "persistent_load_threads", tweak_uint,
+		&mgt_param.persistent_load_threads, 1, 64,
+		"How many threads to use for loading the objects of each "
+		"persistent silo at startup.\n"
+		"Segments are loaded newest first, and the cache serves "
+		"requests while older segments are still being loaded.",
+		EXPERIMENTAL,
+		"4", "threads" },
 	{ "vcl_dir", tweak_string, &mgt_vcl_dir, 0, 0,
 		"Directory from which relative VCL filenames (vcl.load and "
 		"include) are opened.",
@@ -1191,6 +1288,30 @@ static const struct parspec input_parspec[] = {
 		0,
 		"on", "bool" },
 
+	{ "vcc_profile", tweak_bool, &mgt_vcc_profile, 0, 0,
+		"Compile VCL with profiling, which counts the time spent"
+		" in each subroutine and on each line of the VCL.\n"
+		"See the vcl.profile CLI command.\n"
+		"Only takes effect for VCL compiled after it is changed.\n",
+		EXPERIMENTAL,
+		"off", "bool" },
+
+	{ "vcc_cache", tweak_bool, &mgt_vcc_cache, 0, 0,
+		"Keep compiled VCL programs in the working directory, and"
+		" reuse them instead of running the C-compiler when the"
+		" same VCL is loaded again.\n"
+		"Programs are found by a hash of the generated C source,"
+		" the cc_command parameter and the varnish version.\n",
+		0,
+		"on", "bool" },
+
+	{ "vcc_cache_size", tweak_uint, &mgt_vcc_cache_size, 1, UINT_MAX,
+		"How many compiled VCL programs vcc_cache keeps.  When"
+		" a new one is stored, the least recently used are removed"
+		" to make room.\n",
+		0,
+		"32", "programs" },
+
 	{ "pcre_match_limit", tweak_uint,
 		&mgt_param.vre_limits.match,
 		1, UINT_MAX,
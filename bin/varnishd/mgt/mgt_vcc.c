@@ -31,13 +31,17 @@
 
 #include "config.h"
 
+#include <dirent.h>
 #include <dlfcn.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 
 #include "common/params.h"
 #include "mgt/mgt.h"
@@ -47,7 +51,9 @@
 #include "vcli.h"
 #include "vcli_priv.h"
 #include "vfil.h"
+#include "vsha256.h"
 #include "vsub.h"
+#include "vtim.h"
 
 #include "mgt_cli.h"
 
@@ -66,9 +72,36 @@ const char *mgt_vmod_dir;
 unsigned mgt_vcc_err_unref;
 unsigned mgt_vcc_allow_inline_c;
 unsigned mgt_vcc_unsafe_path;
+unsigned mgt_vcc_profile;
+unsigned mgt_vcc_cache;
+unsigned mgt_vcc_cache_size;
 
 static struct vcc *vcc;
 
+/* How long the phases of getting a VCL program loaded took */
+struct vcc_times {
+	double			vcc;
+	double			cc;
+	double			dlopen;
+	double			load;
+	int			cached;
+};
+
+/*
+ * Compiled VCL programs are kept in this directory, named by the SHA256
+ * of the C source, the C-compiler command and the varnish version, so
+ * that loading the same VCL again does not have to run the C-compiler.
+ * The directory survives restarts, and is kept to the vcc_cache_size
+ * most recently used programs, going by their mtime.
+ *
+ * Loads can come faster than the mtime resolution, so rather than the
+ * time of use, the mtime is a stamp one higher than any other in the
+ * directory, or the current time if that is later.
+ */
+#define VCC_CACHE_DIR	"vcl_cache"
+
+static time_t vcc_cache_stamp;	/* Highest mtime seen or handed out */
+
 /*--------------------------------------------------------------------*/
 
 static const char * const default_vcl =
@@ -145,6 +178,7 @@ run_vcc(void *priv)
 	VCC_Err_Unref(vcc, mgt_vcc_err_unref);
 	VCC_Allow_InlineC(vcc, mgt_vcc_allow_inline_c);
 	VCC_Unsafe_Path(vcc, mgt_vcc_unsafe_path);
+	VCC_Profile(vcc, mgt_vcc_profile);
 	csrc = VCC_Compile(vcc, sb, vp->vcl);
 	AZ(VSB_finish(sb));
 	if (VSB_len(sb))
@@ -223,20 +257,185 @@ run_dlopen(void *priv)
 	exit(0);
 }
 
+/*--------------------------------------------------------------------
+ * The compiled VCL cache
+ */
+
+static void
+mgt_vcc_cache_name(char *buf, size_t len, const char *csrc)
+{
+	SHA256_CTX ctx;
+	unsigned char digest[SHA256_LEN];
+	char *p;
+	int i;
+
+	assert(len >= sizeof VCC_CACHE_DIR + SHA256_LEN * 2 + 4);
+	SHA256_Init(&ctx);
+	SHA256_Update(&ctx, csrc, strlen(csrc) + 1);
+	SHA256_Update(&ctx, mgt_cc_cmd, strlen(mgt_cc_cmd) + 1);
+	SHA256_Update(&ctx, VCS_version, strlen(VCS_version) + 1);
+	SHA256_Final(digest, &ctx);
+
+	p = buf;
+	p += sprintf(p, "%s/", VCC_CACHE_DIR);
+	for (i = 0; i < SHA256_LEN; i++)
+		p += sprintf(p, "%02x", digest[i]);
+	strcpy(p, ".so");
+}
+
+static int
+mgt_vcc_copy(const char *from, const char *to)
+{
+	char buf[BUFSIZ];
+	ssize_t l;
+	int ifd, ofd, retval = 0;
+
+	ifd = open(from, O_RDONLY);
+	if (ifd < 0)
+		return (-1);
+	ofd = open(to, O_WRONLY|O_CREAT|O_TRUNC, 0600);
+	if (ofd < 0) {
+		AZ(close(ifd));
+		return (-1);
+	}
+	while ((l = read(ifd, buf, sizeof buf)) > 0) {
+		if (write(ofd, buf, l) != l) {
+			retval = -1;
+			break;
+		}
+	}
+	if (l < 0)
+		retval = -1;
+	AZ(close(ifd));
+	if (close(ofd))
+		retval = -1;
+	return (retval);
+}
+
+struct vcc_cache_ent {
+	char			name[SHA256_LEN * 2 + 8];
+	time_t			mtime;
+};
+
+static int
+mgt_vcc_cache_cmp(const void *a, const void *b)
+{
+	const struct vcc_cache_ent *ea = a, *eb = b;
+
+	if (ea->mtime != eb->mtime)
+		return (ea->mtime < eb->mtime ? -1 : 1);
+	return (strcmp(ea->name, eb->name));
+}
+
+/*
+ * Remove the least recently used programs, and any leftover temporary
+ * files, until at most vcc_cache_size are left, counting the program
+ * being used, which is not a candidate.
+ */
+
+static void
+mgt_vcc_cache_prune(const char *cname)
+{
+	DIR *d;
+	struct dirent *de;
+	struct stat st;
+	struct vcc_cache_ent *ent = NULL;
+	unsigned n = 0, l = 0, u;
+	size_t len;
+	char fn[sizeof VCC_CACHE_DIR + SHA256_LEN * 2 + 8];
+	const char *keep;
+
+	keep = strrchr(cname, '/');
+	AN(keep);
+	keep++;
+	d = opendir(VCC_CACHE_DIR);
+	if (d == NULL)
+		return;
+	while ((de = readdir(d)) != NULL) {
+		if (de->d_name[0] == '.' || !strcmp(de->d_name, keep))
+			continue;
+		len = strlen(de->d_name);
+		if (len >= sizeof ent->name)
+			continue;
+		bprintf(fn, "%s/%s", VCC_CACHE_DIR, de->d_name);
+		if (len < 3 || strcmp(de->d_name + len - 3, ".so")) {
+			(void)unlink(fn);
+			continue;
+		}
+		if (stat(fn, &st))
+			continue;
+		if (n == l) {
+			l = l == 0 ? 16 : l * 2;
+			ent = realloc(ent, l * sizeof *ent);
+			XXXAN(ent);
+		}
+		strcpy(ent[n].name, de->d_name);
+		ent[n].mtime = st.st_mtime;
+		if (st.st_mtime > vcc_cache_stamp)
+			vcc_cache_stamp = st.st_mtime;
+		n++;
+	}
+	AZ(closedir(d));
+	if (n + 1 > mgt_vcc_cache_size) {
+		qsort(ent, n, sizeof *ent, mgt_vcc_cache_cmp);
+		for (u = 0; u + mgt_vcc_cache_size < n + 1; u++) {
+			bprintf(fn, "%s/%s", VCC_CACHE_DIR, ent[u].name);
+			(void)unlink(fn);
+		}
+	}
+	free(ent);
+}
+
+/* Mark a program as the most recently used */
+
+static void
+mgt_vcc_cache_use(const char *cname)
+{
+	struct timeval tv[2];
+	time_t now;
+
+	mgt_vcc_cache_prune(cname);
+	now = time(NULL);
+	if (vcc_cache_stamp < now)
+		vcc_cache_stamp = now;
+	else
+		vcc_cache_stamp++;
+	memset(tv, 0, sizeof tv);
+	tv[0].tv_sec = tv[1].tv_sec = vcc_cache_stamp;
+	(void)utimes(cname, tv);
+}
+
+static void
+mgt_vcc_cache_store(const char *cname, const char *of)
+{
+	char tname[sizeof VCC_CACHE_DIR + SHA256_LEN * 2 + 8];
+
+	if (mkdir(VCC_CACHE_DIR, 0755) && errno != EEXIST)
+		return;
+	bprintf(tname, "%s.tmp", cname);
+	if (mgt_vcc_copy(of, tname) || rename(tname, cname)) {
+		(void)unlink(tname);
+		return;
+	}
+	mgt_vcc_cache_use(cname);
+}
+
 /*--------------------------------------------------------------------
  * Compile a VCL program, return shared object, errors in sb.
  */
 
 static char *
-mgt_run_cc(const char *vcl, struct vsb *sb, int C_flag)
+mgt_run_cc(const char *vcl, struct vsb *sb, int C_flag, struct vcc_times *vt)
 {
 	char *csrc;
 	struct vsb *cmdsb;
 	char sf[] = "./vcl.########.c";
 	char of[sizeof sf + 1];
+	char cname[sizeof VCC_CACHE_DIR + SHA256_LEN * 2 + 4];
 	char *retval;
 	int sfd, i;
 	struct vcc_priv vp;
+	double t0;
 
 	/* Create temporary C source file */
 	sfd = VFIL_tmpfile(sf);
@@ -253,15 +452,21 @@ mgt_run_cc(const char *vcl, struct vsb *sb, int C_flag)
 	vp.magic = VCC_PRIV_MAGIC;
 	vp.sf = sf;
 	vp.vcl = vcl;
+	t0 = VTIM_mono();
 	if (VSUB_run(sb, run_vcc, &vp, "VCC-compiler", -1)) {
 		(void)unlink(sf);
 		return (NULL);
 	}
+	vt->vcc = VTIM_mono() - t0;
 
-	if (C_flag) {
+	cname[0] = '\0';
+	if (C_flag || mgt_vcc_cache) {
 		csrc = VFIL_readfile(NULL, sf, NULL);
 		XXXAN(csrc);
-		(void)fputs(csrc, stdout);
+		if (C_flag)
+			(void)fputs(csrc, stdout);
+		else
+			mgt_vcc_cache_name(cname, sizeof cname, csrc);
 		free(csrc);
 	}
 
@@ -282,17 +487,35 @@ mgt_run_cc(const char *vcl, struct vsb *sb, int C_flag)
 	(void)fchown(i, mgt_param.uid, mgt_param.gid);
 	AZ(close(i));
 
-	/* Build the C-compiler command line */
-	cmdsb = mgt_make_cc_cmd(sf, of);
+	/*
+	 * The child needs its own copy, dlopen(3) would hand out the
+	 * same instance for the same file to two VCLs.
+	 */
+	if (*cname != '\0' && !mgt_vcc_copy(cname, of)) {
+		(void)unlink(sf);
+		mgt_vcc_cache_use(cname);
+		vt->cached = 1;
+		i = 0;
+	} else {
+		/* Build the C-compiler command line */
+		cmdsb = mgt_make_cc_cmd(sf, of);
 
-	/* Run the C-compiler in a sub-shell */
-	i = VSUB_run(sb, run_cc, VSB_data(cmdsb), "C-compiler", 10);
+		/* Run the C-compiler in a sub-shell */
+		t0 = VTIM_mono();
+		i = VSUB_run(sb, run_cc, VSB_data(cmdsb), "C-compiler", 10);
+		vt->cc = VTIM_mono() - t0;
 
-	(void)unlink(sf);
-	VSB_delete(cmdsb);
+		(void)unlink(sf);
+		VSB_delete(cmdsb);
 
-	if (!i)
-		i = VSUB_run(sb, run_dlopen, of, "dlopen", 10);
+		if (!i) {
+			t0 = VTIM_mono();
+			i = VSUB_run(sb, run_dlopen, of, "dlopen", 10);
+			vt->dlopen = VTIM_mono() - t0;
+		}
+		if (!i && *cname != '\0')
+			mgt_vcc_cache_store(cname, of);
+	}
 
 	/* Ensure the file is readable to the unprivileged user */
 	if (!i) {
@@ -315,17 +538,31 @@ mgt_run_cc(const char *vcl, struct vsb *sb, int C_flag)
 /*--------------------------------------------------------------------*/
 
 static char *
-mgt_VccCompile(struct vsb **sb, const char *b, int C_flag)
+mgt_VccCompile(struct vsb **sb, const char *b, int C_flag,
+    struct vcc_times *vt)
 {
 	char *vf;
 
+	memset(vt, 0, sizeof *vt);
 	*sb = VSB_new_auto();
 	XXXAN(*sb);
-	vf = mgt_run_cc(b, *sb, C_flag);
+	vf = mgt_run_cc(b, *sb, C_flag, vt);
 	AZ(VSB_finish(*sb));
 	return (vf);
 }
 
+static void
+mgt_vcc_times(struct cli *cli, const struct vcc_times *vt)
+{
+
+	VCLI_Out(cli, "\nTimes: vcc %.3f", vt->vcc);
+	if (vt->cached)
+		VCLI_Out(cli, " cc cached");
+	else
+		VCLI_Out(cli, " cc %.3f dlopen %.3f", vt->cc, vt->dlopen);
+	VCLI_Out(cli, " load %.3f", vt->load);
+}
+
 /*--------------------------------------------------------------------*/
 
 static struct vclprog *
@@ -386,6 +623,7 @@ mgt_vcc_default(const char *b_arg, const char *f_arg, char *vcl, int C_flag)
 	char *vf;
 	struct vsb *sb;
 	struct vclprog *vp;
+	struct vcc_times vt;
 	char buf[BUFSIZ];
 
 	/* XXX: annotate vcl with -b/-f arg so people know where it came from */
@@ -410,7 +648,7 @@ mgt_vcc_default(const char *b_arg, const char *f_arg, char *vcl, int C_flag)
 	}
 	strcpy(buf, "boot");
 
-	vf = mgt_VccCompile(&sb, vcl, C_flag);
+	vf = mgt_VccCompile(&sb, vcl, C_flag, &vt);
 	free(vcl);
 	if (VSB_len(sb) > 0)
 		fprintf(stderr, "%s", VSB_data(sb));
@@ -500,6 +738,8 @@ mcf_config_inline(struct cli *cli, const char * const *av, void *priv)
 	struct vsb *sb;
 	unsigned status;
 	struct vclprog *vp;
+	struct vcc_times vt;
+	double t0;
 
 	(void)priv;
 
@@ -510,7 +750,7 @@ mcf_config_inline(struct cli *cli, const char * const *av, void *priv)
 		return;
 	}
 
-	vf = mgt_VccCompile(&sb, av[3], 0);
+	vf = mgt_VccCompile(&sb, av[3], 0, &vt);
 	if (VSB_len(sb) > 0)
 		VCLI_Out(cli, "%s\n", VSB_data(sb));
 	VSB_delete(sb);
@@ -520,12 +760,15 @@ mcf_config_inline(struct cli *cli, const char * const *av, void *priv)
 		return;
 	}
 	VCLI_Out(cli, "VCL compiled.");
+	t0 = VTIM_mono();
 	if (child_pid >= 0 &&
 	    mgt_cli_askchild(&status, &p, "vcl.load %s %s\n", av[2], vf)) {
 		VCLI_SetResult(cli, status);
 		VCLI_Out(cli, "%s", p);
 	} else {
+		vt.load = VTIM_mono() - t0;
 		(void)mgt_vcc_add(av[2], vf);
+		mgt_vcc_times(cli, &vt);
 	}
 	free(p);
 }
@@ -538,6 +781,8 @@ mcf_config_load(struct cli *cli, const char * const *av, void *priv)
 	unsigned status;
 	char *p = NULL;
 	struct vclprog *vp;
+	struct vcc_times vt;
+	double t0;
 
 	(void)priv;
 	vp = mgt_vcc_byname(av[2]);
@@ -554,7 +799,7 @@ mcf_config_load(struct cli *cli, const char * const *av, void *priv)
 		return;
 	}
 
-	vf = mgt_VccCompile(&sb, vcl, 0);
+	vf = mgt_VccCompile(&sb, vcl, 0, &vt);
 	free(vcl);
 
 	if (VSB_len(sb) > 0)
@@ -566,12 +811,15 @@ mcf_config_load(struct cli *cli, const char * const *av, void *priv)
 		return;
 	}
 	VCLI_Out(cli, "VCL compiled.");
+	t0 = VTIM_mono();
 	if (child_pid >= 0 &&
 	    mgt_cli_askchild(&status, &p, "vcl.load %s %s\n", av[2], vf)) {
 		VCLI_SetResult(cli, status);
 		VCLI_Out(cli, "%s", p);
 	} else {
+		vt.load = VTIM_mono() - t0;
 		(void)mgt_vcc_add(av[2], vf);
+		mgt_vcc_times(cli, &vt);
 	}
 	free(p);
 }
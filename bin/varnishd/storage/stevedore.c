@@ -33,6 +33,8 @@
 
 #include "config.h"
 
+#include <inttypes.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -44,6 +46,8 @@
 
 static const struct stevedore * volatile stv_next;
 
+static struct lock stv_mtx;
+
 /*---------------------------------------------------------------------
  * Default objcore methods
  */
@@ -146,6 +150,9 @@ stv_pick_stevedore(struct vsl_log *vsl, const char **hint)
 	}
 	if (stv_next == NULL)
 		return (stv_transient);
+	/* with tiering, new objects go to the L1 and get demoted from there */
+	if (cache_param->storage_tiering)
+		return (VTAILQ_FIRST(&stv_stevedores));
 	/* pick a stevedore and bump the head along */
 	stv = VTAILQ_NEXT(stv_next, list);
 	if (stv == NULL)
@@ -156,6 +163,93 @@ stv_pick_stevedore(struct vsl_log *vsl, const char **hint)
 	return (stv);
 }
 
+/*--------------------------------------------------------------------
+ * Storage router
+ *
+ * With storage_route_size set, the stevedores are tiers in the order
+ * they were given on the command line.  Small, short-lived objects
+ * start at the first tier, big or long-lived ones at the second, and
+ * an object which does not fit in a tier spills over to the next one
+ * before we resort to LRU nuking.
+ */
+
+static ssize_t
+stv_route_size(const struct busyobj *bo)
+{
+	uintmax_t u;
+	char *q;
+
+	if (bo->body_status != BS_LENGTH || bo->h_content_length == NULL)
+		return (-1);
+	u = strtoumax(bo->h_content_length, &q, 10);
+	if (q == NULL || *q != '\0' || u > SSIZE_MAX)
+		return (-1);
+	return ((ssize_t)u);
+}
+
+static struct stevedore *
+stv_route_first(const struct busyobj *bo, ssize_t size)
+{
+	struct stevedore *stv;
+
+	stv = VTAILQ_FIRST(&stv_stevedores);
+	AN(stv);
+	if (VTAILQ_NEXT(stv, list) == NULL)
+		return (stv);
+	if (size > cache_param->storage_route_size ||
+	    (cache_param->storage_route_ttl > 0. &&
+	    bo->exp.ttl > cache_param->storage_route_ttl))
+		stv = VTAILQ_NEXT(stv, list);
+	return (stv);
+}
+
+static int
+stv_route_fits(const struct stevedore *stv, ssize_t size, unsigned ltot)
+{
+
+	if (stv->var_free_space == NULL)
+		return (1);
+	return (stv->var_free_space(stv) >= (size > 0 ? size : 0) + ltot);
+}
+
+static struct object *
+stv_route_newobject(struct busyobj *bo, struct objcore **ocp, unsigned ltot,
+    const struct stv_objsecrets *soc, struct stevedore **pstv)
+{
+	struct stevedore *stv, *stv0, *last;
+	struct object *o = NULL;
+	ssize_t size;
+
+	size = stv_route_size(bo);
+	stv0 = stv_route_first(bo, size);
+	last = stv0;
+	for (stv = stv0; stv != NULL; stv = VTAILQ_NEXT(stv, list)) {
+		last = stv;
+		AN(stv->allocobj);
+		if (stv_route_fits(stv, size, ltot)) {
+			o = stv->allocobj(stv, bo, ocp, ltot, soc);
+			if (o != NULL)
+				break;
+		}
+		if (VTAILQ_NEXT(stv, list) == NULL)
+			break;
+		VSLb(bo->vsl, SLT_Debug, "Storage %s full, spilling over",
+		    stv->ident);
+		Lck_Lock(&stv_mtx);
+		stv->stats->c_spill++;
+		Lck_Unlock(&stv_mtx);
+	}
+	Lck_Lock(&stv_mtx);
+	stv0->stats->c_route++;
+	if (o != NULL)
+		last->stats->c_placed++;
+	Lck_Unlock(&stv_mtx);
+
+	/* If nothing had room, make room in the last tier we tried */
+	*pstv = last;
+	return (o);
+}
+
 /*-------------------------------------------------------------------*/
 
 static struct storage *
@@ -194,13 +288,14 @@ stv_alloc(struct busyobj *bo, size_t size)
 		}
 
 		/* no luck; try to free some space and keep trying */
-		if (EXP_NukeOne(bo, stv->lru) == -1)
+		if (EXP_NukeOne(bo->vsl, bo->stats, stv->lru) == -1)
 			break;
 
 		/* Enough is enough: try another if we have one */
 		if (++fail >= cache_param->nuke_limit)
 			break;
 	}
+	STV_TierPoke(stv);
 	if (st != NULL)
 		CHECK_OBJ_NOTNULL(st, STORAGE_MAGIC);
 	return (st);
@@ -305,6 +400,108 @@ stv_default_allocobj(struct stevedore *stv, struct busyobj *bo,
 	return (o);
 }
 
+/*--------------------------------------------------------------------
+ * Copy a complete object, and its body, into another stevedore.
+ * The copy is attached to the fresh objcore 'oc', which the caller
+ * must insert in the objhead.
+ */
+
+static struct storage *
+stv_copy_storage(struct stevedore *stv, const struct storage *st)
+{
+	struct storage *st2;
+
+	CHECK_OBJ_NOTNULL(st, STORAGE_MAGIC);
+	st2 = stv->alloc(stv, st->len);
+	if (st2 == NULL)
+		return (NULL);
+	if (st2->space < st->len) {
+		stv->free(st2);
+		return (NULL);
+	}
+	memcpy(st2->ptr, st->ptr, st->len);
+	st2->len = st->len;
+	return (st2);
+}
+
+/* Move pointers into the objects allocation along with the copy */
+#define STV_REBASE(ptr, lo, hi, delta)					\
+	do {								\
+		if ((const char *)(ptr) >= (lo) &&			\
+		    (const char *)(ptr) <= (hi))			\
+			(ptr) = (void *)((char *)(ptr) + (delta));	\
+	} while (0)
+
+struct object *
+STV_CopyObject(struct dstat *ds, struct stevedore *stv,
+    const struct object *o, struct objcore *oc)
+{
+	struct object *o2;
+	struct storage *st, *st2;
+	const char *lo, *hi;
+	ptrdiff_t d;
+	unsigned u;
+
+	CHECK_OBJ_NOTNULL(stv, STEVEDORE_MAGIC);
+	CHECK_OBJ_NOTNULL(o, OBJECT_MAGIC);
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+	CHECK_OBJ_NOTNULL(o->objstore, STORAGE_MAGIC);
+	assert((const void *)o == (const void *)o->objstore->ptr);
+
+	st = stv_copy_storage(stv, o->objstore);
+	if (st == NULL)
+		return (NULL);
+	o2 = (void *)st->ptr;
+	o2->objstore = st;
+	o2->objcore = oc;
+	o2->hits = 0;
+	VTAILQ_INIT(&o2->store);
+	o2->esidata = NULL;
+
+	lo = (const char *)o;
+	hi = lo + o->objstore->len;
+	d = (char *)o2 - (const char *)o;
+	STV_REBASE(o2->ws_o->s, lo, hi, d);
+	STV_REBASE(o2->ws_o->f, lo, hi, d);
+	STV_REBASE(o2->ws_o->r, lo, hi, d);
+	STV_REBASE(o2->ws_o->e, lo, hi, d);
+	STV_REBASE(o2->vary, lo, hi, d);
+	STV_REBASE(o2->http, lo, hi, d);
+	STV_REBASE(o2->http->ws, lo, hi, d);
+	STV_REBASE(o2->http->hd, lo, hi, d);
+	STV_REBASE(o2->http->hdf, lo, hi, d);
+	for (u = 0; u < o2->http->nhd; u++) {
+		STV_REBASE(o2->http->hd[u].b, lo, hi, d);
+		STV_REBASE(o2->http->hd[u].e, lo, hi, d);
+	}
+	CHECK_OBJ_NOTNULL(o2->http, HTTP_MAGIC);
+	WS_Assert(o2->ws_o);
+
+	VTAILQ_FOREACH(st, &o->store, list) {
+		st2 = stv_copy_storage(stv, st);
+		if (st2 == NULL)
+			break;
+		VTAILQ_INSERT_TAIL(&o2->store, st2, list);
+	}
+	if (st == NULL && o->esidata != NULL) {
+		o2->esidata = stv_copy_storage(stv, o->esidata);
+		if (o2->esidata == NULL)
+			st = o->esidata;
+	}
+	if (st != NULL) {
+		/* Ran out of space */
+		STV_Freestore(o2);
+		STV_free(o2->objstore);
+		return (NULL);
+	}
+
+	oc->methods = &default_oc_methods;
+	oc->priv = o2;
+	oc->priv2 = (uintptr_t)stv;
+	ds->n_object++;
+	return (o2);
+}
+
 /*-------------------------------------------------------------------
  * Allocate storage for an object, based on the header information.
  * XXX: If we know (a hint of) the length, we could allocate space
@@ -337,24 +534,30 @@ STV_NewObject(struct busyobj *bo, struct objcore **ocp, const char *hint,
 
 	ltot = sizeof *o + wsl + lhttp;
 
-	stv = stv0 = stv_pick_stevedore(bo->vsl, &hint);
-	AN(stv->allocobj);
-	o = stv->allocobj(stv, bo, ocp, ltot, &soc);
-	if (o == NULL && hint == NULL) {
-		do {
-			stv = stv_pick_stevedore(bo->vsl, &hint);
-			AN(stv->allocobj);
-			o = stv->allocobj(stv, bo, ocp, ltot, &soc);
-		} while (o == NULL && stv != stv0);
+	if (cache_param->storage_route_size > 0 &&
+	    (hint == NULL || *hint == '\0')) {
+		o = stv_route_newobject(bo, ocp, ltot, &soc, &stv);
+	} else {
+		stv = stv0 = stv_pick_stevedore(bo->vsl, &hint);
+		AN(stv->allocobj);
+		o = stv->allocobj(stv, bo, ocp, ltot, &soc);
+		if (o == NULL && hint == NULL) {
+			do {
+				stv = stv_pick_stevedore(bo->vsl, &hint);
+				AN(stv->allocobj);
+				o = stv->allocobj(stv, bo, ocp, ltot, &soc);
+			} while (o == NULL && stv != stv0);
+		}
 	}
 	if (o == NULL) {
 		/* no luck; try to free some space and keep trying */
 		for (i = 0; o == NULL && i < cache_param->nuke_limit; i++) {
-			if (EXP_NukeOne(bo, stv->lru) == -1)
+			if (EXP_NukeOne(bo->vsl, bo->stats, stv->lru) == -1)
 				break;
 			o = stv->allocobj(stv, bo, ocp, ltot, &soc);
 		}
 	}
+	STV_TierPoke(stv);
 
 	if (o == NULL) {
 		AN(*ocp);
@@ -418,8 +621,12 @@ STV_open(void)
 {
 	struct stevedore *stv;
 
+	Lck_New(&stv_mtx, lck_stv);
 	VTAILQ_FOREACH(stv, &stv_stevedores, list) {
 		stv->lru = LRU_Alloc();
+		stv->stats = VSM_Alloc(sizeof *stv->stats,
+		    VSC_CLASS, VSC_TYPE_STV, stv->ident);
+		memset(stv->stats, 0, sizeof *stv->stats);
 		if (stv->open != NULL)
 			stv->open(stv);
 	}
@@ -429,6 +636,7 @@ STV_open(void)
 		stv->open(stv);
 	}
 	stv_next = VTAILQ_FIRST(&stv_stevedores);
+	STV_TierInit();
 }
 
 void
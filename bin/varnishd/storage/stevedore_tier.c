@@ -0,0 +1,382 @@
+/*-
+ * Copyright (c) 2013 Varnish Software AS
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Hot/cold storage tiering.
+ *
+ * With the 'storage_tiering' parameter on, the first stevedore is a
+ * (small, fast) L1 in front of the second stevedore, the L2.
+ *
+ * The tier thread keeps 'storage_demote_free' percent of the L1 free
+ * by demoting objects from the tail of its LRU: they are copied to the
+ * L2 and the copy takes their place in the objhead, before the L1 copy
+ * is released.  Allocations in the L1 poke the thread when they find
+ * the L1 too full, so fetches never pay for the copying.  Objects a
+ * fetch has to LRU nuke from the L1 anyway, because the thread did not
+ * keep up, are lost.
+ *
+ * Objects in the L2 with 'storage_promote_hits' hits are queued for
+ * the tier thread, which copies them to the L1 and retires the L2 copy
+ * the same way a purge does.
+ *
+ * The L2 must be a stevedore with plain objects, so -spersistent silos
+ * cannot be used as L2.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+
+#include "cache/cache.h"
+#include "storage/storage.h"
+
+#include "hash/hash_slinger.h"
+
+struct tier_job {
+	unsigned		magic;
+#define TIER_JOB_MAGIC		0x5b0d7a31
+	struct objcore		*oc;
+	struct object		*o;
+	VTAILQ_ENTRY(tier_job)	list;
+};
+
+static struct lock		tier_mtx;
+static pthread_cond_t		tier_cond;
+static VTAILQ_HEAD(, tier_job)	tier_jobs = VTAILQ_HEAD_INITIALIZER(tier_jobs);
+static unsigned			tier_njobs;
+static volatile unsigned	tier_demoting;
+
+#define TIER_MAXJOBS		64
+
+/*--------------------------------------------------------------------
+ * Find the tiers, if tiering is possible at all.
+ */
+
+static int
+tier_get(struct stevedore **l1, struct stevedore **l2)
+{
+
+	if (!cache_param->storage_tiering)
+		return (0);
+	*l1 = VTAILQ_FIRST(&stv_stevedores);
+	if (*l1 == NULL)
+		return (0);
+	*l2 = VTAILQ_NEXT(*l1, list);
+	if (*l2 == NULL || (*l2)->allocobj != stv_default_allocobj)
+		return (0);
+	return (1);
+}
+
+/*--------------------------------------------------------------------
+ * Is there less than storage_demote_free percent of the L1 free ?
+ */
+
+static int
+tier_pressure(const struct stevedore *l1)
+{
+	double f, u;
+
+	if (l1->var_free_space == NULL || l1->var_used_space == NULL)
+		return (0);
+	f = l1->var_free_space(l1);
+	u = l1->var_used_space(l1);
+	return (f * 100. < (f + u) * cache_param->storage_demote_free);
+}
+
+/*--------------------------------------------------------------------*/
+
+static void
+tier_fail(struct stevedore *stv)
+{
+
+	Lck_Lock(&tier_mtx);
+	stv->stats->c_tier_fail++;
+	Lck_Unlock(&tier_mtx);
+}
+
+/*--------------------------------------------------------------------
+ * Copy an object into another stevedore, and put the copy in the
+ * objhead in front of the original.
+ */
+
+static int
+tier_copy(struct dstat *ds, struct objcore *oc, const struct object *o,
+    struct stevedore *stv)
+{
+	struct objcore *noc;
+	struct object *o2;
+
+	ALLOC_OBJ(noc, OBJCORE_MAGIC);
+	AN(noc);
+	noc->flags = oc->flags & OC_F_PASS;
+	o2 = STV_CopyObject(ds, stv, o, noc);
+	if (o2 == NULL) {
+		FREE_OBJ(noc);
+		return (0);
+	}
+	BAN_CopyObjCore(noc, oc);
+	HSH_InsertCopy(ds, oc, noc);
+	EXP_Insert(o2);
+	/* EXP holds the reference now */
+	(void)HSH_Deref(ds, noc, NULL);
+	return (1);
+}
+
+static int tier_demote(struct vsl_log *, struct dstat *,
+    struct stevedore *, struct stevedore *);
+
+/*--------------------------------------------------------------------
+ * Move an object to a tier, making room in it if necessary, by demoting
+ * from the L1, or by nuking from the L2 the way a fetch into it would.
+ */
+
+static int
+tier_move(struct vsl_log *vsl, struct dstat *ds, struct objcore *oc,
+    const struct object *o, struct stevedore *stv)
+{
+	struct stevedore *l1, *l2;
+	unsigned u;
+	int i;
+
+	if (!tier_get(&l1, &l2))
+		return (0);
+	for (u = 0; !tier_copy(ds, oc, o, stv); u++) {
+		if (u < cache_param->nuke_limit && stv == l1)
+			i = tier_demote(vsl, ds, l1, l2);
+		else if (u < cache_param->nuke_limit)
+			i = EXP_NukeOne(vsl, ds, stv->lru);
+		else
+			i = -1;
+		if (i == -1) {
+			tier_fail(stv);
+			return (0);
+		}
+	}
+	return (1);
+}
+
+/*--------------------------------------------------------------------
+ * Take the oldest unused object off the L1 LRU, and move it to the L2.
+ * Nuking from the L2 to make room does not come back here, as those
+ * objects are not on the L1 LRU.
+ * Returns: 1: did, 0: object lost, -1: nothing to demote
+ */
+
+static int
+tier_demote(struct vsl_log *vsl, struct dstat *ds, struct stevedore *l1,
+    struct stevedore *l2)
+{
+	struct objcore *oc;
+	struct object *o;
+	int i = 0;
+
+	oc = EXP_Evict(l1->lru);
+	if (oc == NULL)
+		return (-1);
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+	o = oc_getobj(ds, oc);
+	CHECK_OBJ_NOTNULL(o, OBJECT_MAGIC);
+	if (oc->objhead != NULL && o->exp.ttl > 0. &&
+	    tier_move(vsl, ds, oc, o, l2)) {
+		VSLb(vsl, SLT_ExpKill, "%u LRU demoted", oc_getxid(ds, oc));
+		Lck_Lock(&tier_mtx);
+		l1->stats->c_demote++;
+		Lck_Unlock(&tier_mtx);
+		i = 1;
+	} else
+		VSLb(vsl, SLT_ExpKill, "%u LRU", oc_getxid(ds, oc));
+	(void)HSH_Deref(ds, oc, NULL);
+	return (i);
+}
+
+/*--------------------------------------------------------------------
+ * Called after allocations, wake up the tier thread if the L1 needs
+ * demoting.  Cheap unless it does.
+ */
+
+void
+STV_TierPoke(const struct stevedore *stv)
+{
+	struct stevedore *l1, *l2;
+
+	if (tier_demoting || !tier_get(&l1, &l2) || stv != l1 ||
+	    !tier_pressure(l1))
+		return;
+	Lck_Lock(&tier_mtx);
+	if (!tier_demoting) {
+		tier_demoting = 1;
+		AZ(pthread_cond_signal(&tier_cond));
+	}
+	Lck_Unlock(&tier_mtx);
+}
+
+/*--------------------------------------------------------------------
+ * Called on cache hits, queue popular L2 objects for promotion.
+ */
+
+void
+STV_Hit(struct objcore *oc, struct object *o)
+{
+	struct stevedore *l1, *l2;
+	struct tier_job *tj;
+
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+	CHECK_OBJ_NOTNULL(o, OBJECT_MAGIC);
+	if (o->hits < cache_param->storage_promote_hits)
+		return;
+	if (!tier_get(&l1, &l2))
+		return;
+	if (o->objstore->stevedore != l2)
+		return;
+
+	Lck_Lock(&tier_mtx);
+	if (tier_njobs >= TIER_MAXJOBS) {
+		Lck_Unlock(&tier_mtx);
+		return;
+	}
+	VTAILQ_FOREACH(tj, &tier_jobs, list)
+		if (tj->oc == oc)
+			break;
+	if (tj != NULL) {
+		Lck_Unlock(&tier_mtx);
+		return;
+	}
+	ALLOC_OBJ(tj, TIER_JOB_MAGIC);
+	AN(tj);
+	HSH_Ref(oc);
+	tj->oc = oc;
+	tj->o = o;
+	VTAILQ_INSERT_TAIL(&tier_jobs, tj, list);
+	tier_njobs++;
+	AZ(pthread_cond_signal(&tier_cond));
+	Lck_Unlock(&tier_mtx);
+}
+
+/*--------------------------------------------------------------------
+ * Promote an object to the L1, demoting from the L1 to make room if
+ * necessary.  The job's reference on the objcore keeps
+ * the object around.
+ */
+
+static void
+tier_promote(struct worker *wrk, struct vsl_log *vsl, struct objcore *oc,
+    struct object *o)
+{
+	struct stevedore *l1, *l2;
+
+	CHECK_OBJ_NOTNULL(oc, OBJCORE_MAGIC);
+	CHECK_OBJ_NOTNULL(o, OBJECT_MAGIC);
+	assert(o->objcore == oc);
+	if (!tier_get(&l1, &l2) || o->objstore->stevedore != l2 ||
+	    oc->busyobj != NULL || o->exp.ttl <= 0.)
+		return;
+
+	if (!tier_move(vsl, &wrk->stats, oc, o, l1))
+		return;
+
+	/* The copy has taken over, retire the original */
+	o->exp.ttl = -1.;
+	o->exp.grace = -1.;
+	EXP_Rearm(o);
+	Lck_Lock(&tier_mtx);
+	l1->stats->c_promote++;
+	Lck_Unlock(&tier_mtx);
+	STV_TierPoke(l1);
+}
+
+/*--------------------------------------------------------------------
+ * Demote a batch from the L1, and stop when there is enough room, or
+ * nothing left to demote.
+ */
+
+#define TIER_BATCH		16
+
+static void
+tier_demote_batch(struct worker *wrk, struct vsl_log *vsl)
+{
+	struct stevedore *l1, *l2;
+	unsigned u;
+
+	for (u = 0; u < TIER_BATCH; u++) {
+		if (!tier_get(&l1, &l2) || !tier_pressure(l1) ||
+		    tier_demote(vsl, &wrk->stats, l1, l2) == -1) {
+			Lck_Lock(&tier_mtx);
+			tier_demoting = 0;
+			Lck_Unlock(&tier_mtx);
+			break;
+		}
+	}
+	VSL_Flush(vsl, 0);
+	WRK_SumStat(wrk);
+}
+
+static void * __match_proto__(bgthread_t)
+tier_thread(struct worker *wrk, void *priv)
+{
+	struct tier_job *tj;
+	struct vsl_log vsl;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	(void)priv;
+	VSL_Setup(&vsl, NULL, 0);
+	Lck_Lock(&tier_mtx);
+	while (1) {
+		tj = VTAILQ_FIRST(&tier_jobs);
+		if (tj == NULL && tier_demoting) {
+			Lck_Unlock(&tier_mtx);
+			tier_demote_batch(wrk, &vsl);
+			Lck_Lock(&tier_mtx);
+			continue;
+		}
+		if (tj == NULL) {
+			(void)Lck_CondWait(&tier_cond, &tier_mtx, NULL);
+			continue;
+		}
+		CHECK_OBJ_NOTNULL(tj, TIER_JOB_MAGIC);
+		VTAILQ_REMOVE(&tier_jobs, tj, list);
+		tier_njobs--;
+		Lck_Unlock(&tier_mtx);
+
+		tier_promote(wrk, &vsl, tj->oc, tj->o);
+		(void)HSH_Deref(&wrk->stats, tj->oc, NULL);
+		FREE_OBJ(tj);
+		VSL_Flush(&vsl, 0);
+		WRK_SumStat(wrk);
+
+		Lck_Lock(&tier_mtx);
+	}
+	NEEDLESS_RETURN(NULL);
+}
+
+/*--------------------------------------------------------------------*/
+
+void
+STV_TierInit(void)
+{
+	pthread_t pt;
+
+	Lck_New(&tier_mtx, lck_tier);
+	AZ(pthread_cond_init(&tier_cond, NULL));
+	WRK_BgThread(&pt, "storage-tier", tier_thread, NULL);
+}
@@ -38,6 +38,8 @@ struct busyobj;
 struct objcore;
 struct worker;
 struct lru;
+struct VSC_C_stv;
+struct dstat;
 
 typedef void storage_init_f(struct stevedore *, int ac, char * const *av);
 typedef void storage_open_f(const struct stevedore *);
@@ -71,6 +73,7 @@ struct stevedore {
 	storage_allocobj_f	*allocobj;	/* --//-- */
 
 	struct lru		*lru;
+	struct VSC_C_stv	*stats;		/* Storage router counters */
 
 #define VRTSTVVAR(nm, vtype, ctype, dval) storage_var_##ctype *var_##nm;
 #include "tbl/vrt_stv_var.h"
@@ -96,6 +99,11 @@ struct object *STV_MkObject(struct stevedore *stv, struct busyobj *bo,
     struct objcore **ocp, void *ptr, unsigned ltot,
     const struct stv_objsecrets *soc);
 
+void STV_TierInit(void);
+void STV_TierPoke(const struct stevedore *);
+struct object *STV_CopyObject(struct dstat *, struct stevedore *,
+    const struct object *, struct objcore *);
+
 struct lru *LRU_Alloc(void);
 void LRU_Free(struct lru *lru);
 
@@ -540,6 +540,26 @@ smf_free(struct storage *s)
 
 /*--------------------------------------------------------------------*/
 
+static double
+smf_used_space(const struct stevedore *st)
+{
+	struct smf_sc *sc;
+
+	CAST_OBJ_NOTNULL(sc, st->priv, SMF_SC_MAGIC);
+	return (sc->stats->g_bytes);
+}
+
+static double
+smf_free_space(const struct stevedore *st)
+{
+	struct smf_sc *sc;
+
+	CAST_OBJ_NOTNULL(sc, st->priv, SMF_SC_MAGIC);
+	return (sc->stats->g_space);
+}
+
+/*--------------------------------------------------------------------*/
+
 const struct stevedore smf_stevedore = {
 	.magic	=	STEVEDORE_MAGIC,
 	.name	=	"file",
@@ -548,6 +568,8 @@ const struct stevedore smf_stevedore = {
 	.alloc	=	smf_alloc,
 	.trim	=	smf_trim,
 	.free	=	smf_free,
+	.var_free_space =	smf_free_space,
+	.var_used_space =	smf_used_space,
 };
 
 #ifdef INCLUDE_TEST_DRIVER
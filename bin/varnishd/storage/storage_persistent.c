@@ -51,6 +51,7 @@
 #include "vcli_priv.h"
 #include "vend.h"
 #include "vsha256.h"
+#include "vtim.h"
 
 #include "persistent.h"
 #include "storage/storage_persistent.h"
@@ -263,6 +264,95 @@ smp_open_segs(struct smp_sc *sc, struct smp_signctx *ctx)
 	return (0);
 }
 
+/*--------------------------------------------------------------------
+ * Load the objects from all segments, with persistent_load_threads
+ * threads each taking their share of the digests.
+ */
+
+struct smp_loader {
+	unsigned		magic;
+#define SMP_LOADER_MAGIC	0x3c1e9b47
+	struct smp_sc		*sc;
+	struct smp_seg		**segs;
+	unsigned		nseg;
+	unsigned		part;
+	unsigned		nparts;
+	pthread_t		thread;
+};
+
+static void
+smp_load_part(struct worker *wrk, const struct smp_loader *sl)
+{
+	unsigned u;
+
+	CHECK_OBJ_NOTNULL(sl, SMP_LOADER_MAGIC);
+	for (u = 0; u < sl->nseg; u++)
+		smp_load_seg(wrk, sl->sc, sl->segs[u], sl->part, sl->nparts);
+}
+
+static void *
+smp_load_thread(void *priv)
+{
+	struct smp_loader *sl;
+	struct worker wrk;
+
+	CAST_OBJ_NOTNULL(sl, priv, SMP_LOADER_MAGIC);
+	THR_SetName("persistence-load");
+	memset(&wrk, 0, sizeof wrk);
+	wrk.magic = WORKER_MAGIC;
+	smp_load_part(&wrk, sl);
+	HSH_Cleanup(&wrk);
+	WRK_SumStat(&wrk);
+	return (NULL);
+}
+
+static void
+smp_load_silo(struct worker *wrk, struct smp_sc *sc)
+{
+	struct smp_loader *sl;
+	struct smp_seg *sg, **segs;
+	unsigned u, n, nseg, nthr;
+
+	nthr = cache_param->persistent_load_threads;
+	AN(nthr);
+
+	/* Newest segments first, they are most likely to be asked for */
+	Lck_Lock(&sc->mtx);
+	n = 0;
+	VTAILQ_FOREACH(sg, &sc->segments, list)
+		if (sg->flags & SMP_SEG_MUSTLOAD)
+			n++;
+	segs = calloc(n + 1L, sizeof *segs);
+	AN(segs);
+	nseg = 0;
+	VTAILQ_FOREACH_REVERSE(sg, &sc->segments, smp_seghead, list)
+		if ((sg->flags & SMP_SEG_MUSTLOAD) &&
+		    smp_prep_seg(sc, sg, nthr))
+			segs[nseg++] = sg;
+	assert(nseg <= n);
+	sc->stats->g_load_pending = nseg;
+	Lck_Unlock(&sc->mtx);
+
+	sl = calloc(nthr, sizeof *sl);
+	AN(sl);
+	for (u = 0; u < nthr; u++) {
+		sl[u].magic = SMP_LOADER_MAGIC;
+		sl[u].sc = sc;
+		sl[u].segs = segs;
+		sl[u].nseg = nseg;
+		sl[u].part = u;
+		sl[u].nparts = nthr;
+		if (u > 0)
+			AZ(pthread_create(&sl[u].thread, NULL,
+			    smp_load_thread, &sl[u]));
+	}
+	smp_load_part(wrk, &sl[0]);
+	for (u = 1; u < nthr; u++)
+		AZ(pthread_join(sl[u].thread, NULL));
+	free(sl);
+	free(segs);
+}
+
 /*--------------------------------------------------------------------
  * Silo worker thread
  */
@@ -278,9 +368,7 @@ smp_thread(struct worker *wrk, void *priv)
 	sc->thread = pthread_self();
 
 	/* First, load all the objects from all segments */
-	VTAILQ_FOREACH(sg, &sc->segments, list)
-		if (sg->flags & SMP_SEG_MUSTLOAD)
-			smp_load_seg(wrk, sc, sg);
+	smp_load_silo(wrk, sc);
 
 	sc->flags |= SMP_SC_LOADED;
 	BAN_TailDeref(&sc->tailban);
@@ -317,6 +405,10 @@ smp_open(const struct stevedore *st)
 
 	sc->stevedore = st;
 
+	sc->stats = VSM_Alloc(sizeof *sc->stats,
+	    VSC_CLASS, VSC_TYPE_SMP, st->ident);
+	memset(sc->stats, 0, sizeof *sc->stats);
+
 	/* We trust the parent to give us a valid silo, for good measure: */
 	AZ(smp_valid_silo(sc));
 
@@ -344,6 +436,9 @@ smp_open(const struct stevedore *st)
 
 	/* XXX: abandon early segments to make sure we have free space ? */
 
+	/* Start the writeback thread, it will sync what we dirty */
+	smp_wb_init(sc);
+
 	/* Open a new segment, so we are ready to write */
 	smp_new_seg(sc);
 
@@ -368,6 +463,7 @@ smp_close(const struct stevedore *st)
 	CAST_OBJ_NOTNULL(sc, st->priv, SMP_SC_MAGIC);
 	Lck_Lock(&sc->mtx);
 	smp_close_seg(sc, sc->cur_seg);
+	smp_wb_drain(sc);
 	Lck_Unlock(&sc->mtx);
 
 	/* XXX: reap thread */
@@ -394,6 +490,7 @@ smp_allocx(struct stevedore *st, size_t min_size, size_t max_size,
 	struct smp_seg *sg;
 	unsigned tries;
 	uint64_t left, extra;
+	double t0;
 
 	CAST_OBJ_NOTNULL(sc, st->priv, SMP_SC_MAGIC);
 	assert(min_size <= max_size);
@@ -414,8 +511,20 @@ smp_allocx(struct stevedore *st, size_t min_size, size_t max_size,
 		left = smp_spaceleft(sc, sc->cur_seg);
 		if (left >= extra + min_size)
 			break;
+		t0 = VTIM_mono();
+		if (smp_wb_throttle(sc)) {
+			/* We slept, somebody may have made room for us */
+			left = smp_spaceleft(sc, sc->cur_seg);
+			if (left >= extra + min_size) {
+				sc->stats->c_seg_close_usec +=
+				    (uint64_t)(1e6 * (VTIM_mono() - t0));
+				break;
+			}
+		}
 		smp_close_seg(sc, sc->cur_seg);
 		smp_new_seg(sc);
+		sc->stats->c_seg_close_usec +=
+		    (uint64_t)(1e6 * (VTIM_mono() - t0));
 	}
 	if (left >= extra + min_size)  {
 		if (left < extra + max_size)
@@ -612,6 +721,7 @@ debug_persistent(struct cli *cli, const char * const * av, void *priv)
 	if (!strcmp(av[3], "sync")) {
 		smp_close_seg(sc, sc->cur_seg);
 		smp_new_seg(sc);
+		smp_wb_drain(sc);
 	} else if (!strcmp(av[3], "dump")) {
 		debug_report_silo(cli, sc, 1);
 	} else {
@@ -627,7 +737,8 @@ static struct cli_proto debug_cmds[] = {
 		"\tdebug.persistent [stevedore [cmd]]\n"
 		"With no cmd arg, a summary of the silo is returned.\n"
 		"Possible commands:\n"
-		"\tsync\tClose current segment, open a new one\n"
+		"\tsync\tClose current segment, open a new one,\n"
+		"\t\tand wait for the writeback to complete\n"
 		"\tdump\tinclude objcores in silo summary\n"
 		"",
 		0, 2, "d", debug_persistent },
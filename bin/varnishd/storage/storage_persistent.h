@@ -72,10 +72,12 @@ struct smp_seg {
 	unsigned		flags;
 #define SMP_SEG_MUSTLOAD	(1 << 0)
 #define SMP_SEG_LOADED		(1 << 1)
+#define SMP_SEG_CHECKED		(1 << 2)	/* SEGHEAD verified */
 
 	uint32_t		nobj;		/* Number of objects */
 	uint32_t		nalloc;		/* Allocations */
 	uint32_t		nfixed;		/* How many fixed objects */
+	unsigned		nloader;	/* Loaders not yet done */
 
 	/* Only for open segment */
 	struct smp_object	*objs;		/* objdesc array */
@@ -84,6 +86,15 @@ struct smp_seg {
 
 VTAILQ_HEAD(smp_seghead, smp_seg);
 
+/* A byte range of the silo waiting to be msync'ed by the writeback thread */
+struct smp_wbrange {
+	unsigned		magic;
+#define SMP_WBRANGE_MAGIC	0x1e3a86d2
+	VTAILQ_ENTRY(smp_wbrange)	list;
+	uint64_t		offset;
+	uint64_t		length;
+};
+
 struct smp_sc {
 	unsigned		magic;
 #define SMP_SC_MAGIC		0x7b73af0a
@@ -136,6 +147,25 @@ struct smp_sc {
 	uint64_t		max_segl;
 
 	uint64_t		free_reserve;
+
+	/*
+	 * Writeback
+	 *
+	 * Segment closes only queue dirty ranges and snapshot the segment
+	 * list into wb_segs[0], the writeback thread swaps the buffers and
+	 * does the msync'ing and seglist writes outside the lock.
+	 */
+
+	struct VSC_C_smp	*stats;
+	pthread_t		wb_thread;
+	pthread_cond_t		wb_cond;
+	VTAILQ_HEAD(,smp_wbrange)	wb_ranges;
+	uint64_t		wb_dirty;	/* Bytes queued, not synced */
+	uint64_t		max_wb_dirty;
+	struct smp_segptr	*wb_segs[2];
+	unsigned		wb_nsegs;	/* Entries in wb_segs[0] */
+	unsigned		wb_seq;		/* Seglist snapshots taken */
+	unsigned		wb_done;	/* Seglist snapshots written */
 };
 
 /*--------------------------------------------------------------------*/
@@ -167,11 +197,17 @@ void smp_mgt_init(struct stevedore *parent, int ac, char * const *av);
 
 /* storage_persistent_silo.c */
 
-void smp_load_seg(struct worker *, const struct smp_sc *sc, struct smp_seg *sg);
+int smp_prep_seg(struct smp_sc *sc, struct smp_seg *sg, unsigned nloader);
+void smp_load_seg(struct worker *, struct smp_sc *sc, struct smp_seg *sg,
+    unsigned part, unsigned nparts);
 void smp_new_seg(struct smp_sc *sc);
 void smp_close_seg(struct smp_sc *sc, struct smp_seg *sg);
 void smp_init_oc(struct objcore *oc, struct smp_seg *sg, unsigned objidx);
 void smp_save_segs(struct smp_sc *sc);
+void smp_wb_init(struct smp_sc *sc);
+void smp_wb_queue(struct smp_sc *sc, uint64_t offset, uint64_t length);
+unsigned smp_wb_throttle(struct smp_sc *sc);
+void smp_wb_drain(struct smp_sc *sc);
 
 /* storage_persistent_subr.c */
 
@@ -181,6 +217,7 @@ int smp_chk_sign(struct smp_signctx *ctx);
 void smp_append_sign(struct smp_signctx *ctx, const void *ptr, uint32_t len);
 void smp_reset_sign(struct smp_signctx *ctx);
 void smp_sync_sign(const struct smp_signctx *ctx);
+int smp_msync(const void *ptr, uint64_t len);
 void smp_newsilo(struct smp_sc *sc);
 int smp_valid_silo(struct smp_sc *sc);
 
@@ -120,6 +120,15 @@ smp_metrics(struct smp_sc *sc)
 	sc->free_reserve = sc->aim_segl * 10;
 
 	fprintf(stderr, "free_reserve = %ju\n", (uintmax_t)sc->free_reserve);
+
+	/*
+	 * How far may the writeback thread fall behind, before allocations
+	 * have to wait for it ?  A few segments worth lets it batch the
+	 * segment list writes without risking too much unsynced data.
+	 */
+	sc->max_wb_dirty = sc->aim_segl * 4;
+
+	fprintf(stderr, "max_wb_dirty = %ju\n", (uintmax_t)sc->max_wb_dirty);
 }
 
 /*--------------------------------------------------------------------
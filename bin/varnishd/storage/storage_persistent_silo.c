@@ -36,6 +36,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "cache/cache.h"
 #include "storage/storage.h"
@@ -50,39 +51,187 @@
 /*--------------------------------------------------------------------
  * Write the segmentlist back to the silo.
  *
- * We write the first copy, sync it synchronously, then write the
- * second copy and sync it synchronously.
+ * The writeback thread writes the first copy, syncs it synchronously,
+ * then writes the second copy and syncs it synchronously.
  *
  * Provided the kernel doesn't lie, that means we will always have
  * at least one valid copy on in the silo.
  */
 
 static void
-smp_save_seg(const struct smp_sc *sc, struct smp_signctx *ctx)
+smp_save_seg(struct smp_signctx *ctx, const struct smp_segptr *sp,
+    unsigned nsegs)
 {
-	struct smp_segptr *ss;
-	struct smp_seg *sg;
 	uint64_t length;
 
-	Lck_AssertHeld(&sc->mtx);
+	length = nsegs * sizeof *sp;
 	smp_reset_sign(ctx);
-	ss = SIGN_DATA(ctx);
-	length = 0;
-	VTAILQ_FOREACH(sg, &sc->segments, list) {
-		assert(sg->p.offset < sc->mediasize);
-		assert(sg->p.offset + sg->p.length <= sc->mediasize);
-		*ss = sg->p;
-		ss++;
-		length += sizeof *ss;
-	}
+	memcpy(SIGN_DATA(ctx), sp, length);
 	smp_append_sign(ctx, SIGN_DATA(ctx), length);
 	smp_sync_sign(ctx);
 }
 
+/*--------------------------------------------------------------------
+ * Silo writeback thread
+ *
+ * Picks up the queued dirty ranges and the latest segment list snapshot
+ * in one go, and writes them out without holding the silo lock.  The
+ * ranges are synced before the segment list, so the on-media segment
+ * list never points to segments whose contents have not hit the disk.
+ */
+
+static void * __match_proto__(bgthread_t)
+smp_wb_thread(struct worker *wrk, void *priv)
+{
+	struct smp_sc *sc;
+	struct smp_wbrange *wr;
+	VTAILQ_HEAD(,smp_wbrange) ranges;
+	struct smp_segptr *sp;
+	unsigned seq, nsegs, nsync;
+	uint64_t synced;
+	double t0;
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CAST_OBJ_NOTNULL(sc, priv, SMP_SC_MAGIC);
+	sc->wb_thread = pthread_self();
+	VTAILQ_INIT(&ranges);
+
+	Lck_Lock(&sc->mtx);
+	while (1) {
+		if (VTAILQ_EMPTY(&sc->wb_ranges) &&
+		    sc->wb_seq == sc->wb_done) {
+			(void)Lck_CondWait(&sc->wb_cond, &sc->mtx, NULL);
+			continue;
+		}
+		VTAILQ_CONCAT(&ranges, &sc->wb_ranges, list);
+		seq = sc->wb_seq;
+		sp = NULL;
+		nsegs = 0;
+		if (seq != sc->wb_done) {
+			sp = sc->wb_segs[0];
+			sc->wb_segs[0] = sc->wb_segs[1];
+			sc->wb_segs[1] = sp;
+			nsegs = sc->wb_nsegs;
+		}
+		Lck_Unlock(&sc->mtx);
+
+		t0 = VTIM_mono();
+		synced = 0;
+		nsync = 0;
+		while ((wr = VTAILQ_FIRST(&ranges)) != NULL) {
+			CHECK_OBJ_NOTNULL(wr, SMP_WBRANGE_MAGIC);
+			VTAILQ_REMOVE(&ranges, wr, list);
+			(void)smp_msync(sc->base + wr->offset, wr->length);
+			synced += wr->length;
+			nsync++;
+			FREE_OBJ(wr);
+		}
+		if (sp != NULL) {
+			smp_save_seg(&sc->seg1, sp, nsegs);
+			smp_save_seg(&sc->seg2, sp, nsegs);
+		}
+
+		Lck_Lock(&sc->mtx);
+		assert(sc->wb_dirty >= synced);
+		sc->wb_dirty -= synced;
+		sc->wb_done = seq;
+		sc->stats->g_wb_dirty = sc->wb_dirty;
+		sc->stats->c_wb_sync += nsync;
+		sc->stats->c_wb_bytes += synced;
+		if (sp != NULL)
+			sc->stats->c_wb_seglist++;
+		sc->stats->c_wb_usec += (uint64_t)(1e6 * (VTIM_mono() - t0));
+		AZ(pthread_cond_broadcast(&sc->wb_cond));
+	}
+	NEEDLESS_RETURN(NULL);
+}
+
+void
+smp_wb_init(struct smp_sc *sc)
+{
+	pthread_t pt;
+	uint64_t l;
+
+	CHECK_OBJ_NOTNULL(sc, SMP_SC_MAGIC);
+	Lck_AssertHeld(&sc->mtx);
+	VTAILQ_INIT(&sc->wb_ranges);
+	AZ(pthread_cond_init(&sc->wb_cond, NULL));
+	l = smp_stuff_len(sc, SMP_SEG1_STUFF);
+	sc->wb_segs[0] = malloc(l);
+	AN(sc->wb_segs[0]);
+	sc->wb_segs[1] = malloc(l);
+	AN(sc->wb_segs[1]);
+	WRK_BgThread(&pt, "persistence-wb", smp_wb_thread, sc);
+}
+
+/*--------------------------------------------------------------------
+ * Queue a byte range of the silo for msync'ing
+ */
+
+void
+smp_wb_queue(struct smp_sc *sc, uint64_t offset, uint64_t length)
+{
+	struct smp_wbrange *wr;
+
+	Lck_AssertHeld(&sc->mtx);
+	assert(offset + length <= sc->mediasize);
+	ALLOC_OBJ(wr, SMP_WBRANGE_MAGIC);
+	AN(wr);
+	wr->offset = offset;
+	wr->length = length;
+	VTAILQ_INSERT_TAIL(&sc->wb_ranges, wr, list);
+	sc->wb_dirty += length;
+	sc->stats->g_wb_dirty = sc->wb_dirty;
+	AZ(pthread_cond_broadcast(&sc->wb_cond));
+}
+
+/*--------------------------------------------------------------------
+ * Wait for the writeback backlog to get under budget.
+ *
+ * Returns non-zero if we had to wait, in which case the silo lock
+ * was released and the caller must reexamine the state of things.
+ */
+
+unsigned
+smp_wb_throttle(struct smp_sc *sc)
+{
+	unsigned stalled = 0;
+
+	Lck_AssertHeld(&sc->mtx);
+	while (sc->wb_dirty > sc->max_wb_dirty) {
+		if (!stalled)
+			sc->stats->c_wb_stall++;
+		stalled = 1;
+		(void)Lck_CondWait(&sc->wb_cond, &sc->mtx, NULL);
+	}
+	return (stalled);
+}
+
+/*--------------------------------------------------------------------
+ * Wait for all queued writeback to complete
+ */
+
+void
+smp_wb_drain(struct smp_sc *sc)
+{
+
+	Lck_AssertHeld(&sc->mtx);
+	assert(!pthread_equal(pthread_self(), sc->wb_thread));
+	while (sc->wb_dirty > 0 || sc->wb_seq != sc->wb_done)
+		(void)Lck_CondWait(&sc->wb_cond, &sc->mtx, NULL);
+}
+
+/*--------------------------------------------------------------------
+ * Prune the segment list and hand a snapshot of it to the writeback
+ * thread.
+ */
+
 void
 smp_save_segs(struct smp_sc *sc)
 {
 	struct smp_seg *sg, *sg2;
+	struct smp_segptr *ss;
+	unsigned n;
 
 	Lck_AssertHeld(&sc->mtx);
 
@@ -99,8 +248,19 @@ smp_save_segs(struct smp_sc *sc)
 		LRU_Free(sg->lru);
 		FREE_OBJ(sg);
 	}
-	smp_save_seg(sc, &sc->seg1);
-	smp_save_seg(sc, &sc->seg2);
+
+	ss = sc->wb_segs[0];
+	n = 0;
+	VTAILQ_FOREACH(sg, &sc->segments, list) {
+		assert(sg->p.offset < sc->mediasize);
+		assert(sg->p.offset + sg->p.length <= sc->mediasize);
+		assert((n + 1) * sizeof *ss <=
+		    smp_stuff_len(sc, SMP_SEG1_STUFF));
+		ss[n++] = sg->p;
+	}
+	sc->wb_nsegs = n;
+	sc->wb_seq++;
+	AZ(pthread_cond_broadcast(&sc->wb_cond));
 }
 
 /*--------------------------------------------------------------------
@@ -115,41 +275,78 @@ smp_save_segs(struct smp_sc *sc)
  * XXX: However: the requires that the smp_objects starter further
  * XXX: into the segment than a page so that they do not get hit
  * XXX: by the protection.
+ *
+ * Several threads load a silo together.  Each of them walks all the
+ * segments, newest first, but only inserts the objects whose digest
+ * falls in its own partition.  That way all copies of a given object
+ * are inserted by the same thread, in the order they were created,
+ * and HSH_Insert() keeps them in that order behind any objects which
+ * have been fetched since we started.
  */
 
-void
-smp_load_seg(struct worker *wrk, const struct smp_sc *sc,
-    struct smp_seg *sg)
+/*
+ * Check a segment before we hand it to the loader threads.
+ * Returns non-zero if the segment should be loaded.
+ */
+
+int
+smp_prep_seg(struct smp_sc *sc, struct smp_seg *sg, unsigned nloader)
 {
-	struct smp_object *so;
-	struct objcore *oc;
-	uint32_t no;
-	double t_now = VTIM_real();
 	struct smp_signctx ctx[1];
 
-	ASSERT_SILO_THREAD(sc);
-	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	Lck_AssertHeld(&sc->mtx);
 	CHECK_OBJ_NOTNULL(sg, SMP_SEG_MAGIC);
 	CHECK_OBJ_NOTNULL(sg->lru, LRU_MAGIC);
 	assert(sg->flags & SMP_SEG_MUSTLOAD);
 	sg->flags &= ~SMP_SEG_MUSTLOAD;
 	AN(sg->p.offset);
 	if (sg->p.objlist == 0)
-		return;
+		return (0);
 	smp_def_sign(sc, ctx, sg->p.offset, "SEGHEAD");
 	if (smp_chk_sign(ctx))
-		return;
+		return (0);
 
 	/* test SEGTAIL */
 	/* test OBJIDX */
-	so = (void*)(sc->base + sg->p.objlist);
-	sg->objs = so;
+	sg->objs = (void*)(sc->base + sg->p.objlist);
+	sg->flags |= SMP_SEG_CHECKED;
+
+	/*
+	 * Objects can be looked up, and freed, as soon as they are
+	 * inserted, so start out with the bogus "hold" count plus all
+	 * the objects, and let the loaders subtract what they skip.
+	 */
+	sg->nobj += sg->p.lobjlist;
+	sg->nloader = nloader;
+	return (1);
+}
+
+void
+smp_load_seg(struct worker *wrk, struct smp_sc *sc, struct smp_seg *sg,
+    unsigned part, unsigned nparts)
+{
+	struct smp_object *so;
+	struct objcore *oc;
+	uint32_t no, n, skip;
+	double t_now = VTIM_real();
+
+	CHECK_OBJ_NOTNULL(wrk, WORKER_MAGIC);
+	CHECK_OBJ_NOTNULL(sg, SMP_SEG_MAGIC);
+	CHECK_OBJ_NOTNULL(sg->lru, LRU_MAGIC);
+	assert(sg->flags & SMP_SEG_CHECKED);
+	assert(part < nparts);
+
+	so = sg->objs;
 	no = sg->p.lobjlist;
-	/* Clear the bogus "hold" count */
-	sg->nobj = 0;
+	n = 0;
+	skip = 0;
 	for (;no > 0; so++,no--) {
-		if (so->ttl == 0 || so->ttl < t_now)
+		if (so->hash[0] % nparts != part)
+			continue;
+		if (so->ttl == 0 || so->ttl < t_now) {
+			skip++;
 			continue;
+		}
 		ALLOC_OBJ(oc, OBJCORE_MAGIC);
 		AN(oc);
 		oc->flags |= OC_F_NEEDFIXUP | OC_F_LRUDONTMOVE;
@@ -158,10 +355,24 @@ smp_load_seg(struct worker *wrk, const struct smp_sc *sc,
 		oc->ban = BAN_RefBan(oc, so->ban, sc->tailban);
 		HSH_Insert(wrk, so->hash, oc);
 		EXP_Inject(oc, sg->lru, so->ttl);
-		sg->nobj++;
+		n++;
 	}
 	WRK_SumStat(wrk);
-	sg->flags |= SMP_SEG_LOADED;
+
+	Lck_Lock(&sc->mtx);
+	assert(sg->nobj > skip);
+	sg->nobj -= skip;
+	sc->stats->c_load_obj += n;
+	AN(sg->nloader);
+	if (--sg->nloader == 0) {
+		/* Clear the bogus "hold" count */
+		sg->nobj--;
+		sg->flags |= SMP_SEG_LOADED;
+		sc->stats->c_load_seg++;
+		assert(sc->stats->g_load_pending > 0);
+		sc->stats->g_load_pending--;
+	}
+	Lck_Unlock(&sc->mtx);
 }
 
 /*--------------------------------------------------------------------
@@ -224,7 +435,7 @@ smp_new_seg(struct smp_sc *sc)
 	AN(sg->p.offset);
 	smp_def_sign(sc, sg->ctx, sg->p.offset, "SEGHEAD");
 	smp_reset_sign(sg->ctx);
-	smp_sync_sign(sg->ctx);
+	smp_wb_queue(sc, sg->p.offset, IRNUP(sc, SMP_SIGN_SPACE));
 
 	/* Set up our allocation points */
 	sc->cur_seg = sg;
@@ -287,17 +498,17 @@ smp_close_seg(struct smp_sc *sc, struct smp_seg *sg)
 	assert(sc->next_top >= sc->next_bot);
 	smp_def_sign(sc, sg->ctx, sc->next_top, "OBJIDX");
 	smp_reset_sign(sg->ctx);
-	smp_sync_sign(sg->ctx);
 
 	/* Write the (empty) SEGTAIL signature */
 	smp_def_sign(sc, sg->ctx,
 	    sg->p.offset + sg->p.length - IRNUP(sc, SMP_SIGN_SPACE), "SEGTAIL");
 	smp_reset_sign(sg->ctx);
-	smp_sync_sign(sg->ctx);
 
-	/* Save segment list */
+	/* Have the writeback thread sync the segment, then the list */
+	smp_wb_queue(sc, sg->p.offset, sg->p.length);
 	smp_save_segs(sc);
 	sc->free_offset = smp_segend(sg);
+	sc->stats->c_seg_close++;
 }
 
 
@@ -343,8 +554,8 @@ smp_loaded_st(const struct smp_sc *sc, const struct smp_seg *sg,
 			break;
 	if (sg2 == NULL)
 		return (0x04);		/* No claiming segment */
-	if (!(sg2->flags & SMP_SEG_LOADED))
-		return (0x08);		/* Claiming segment not loaded */
+	if (!(sg2->flags & SMP_SEG_CHECKED))
+		return (0x08);		/* Claiming segment not checked */
 
 	/* It is now safe to access the storage structure */
 	if (st->magic != STORAGE_MAGIC)
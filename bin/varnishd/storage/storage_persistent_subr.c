@@ -40,6 +40,7 @@
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
 
 #include "cache/cache.h"
 #include "storage/storage.h"
@@ -49,6 +50,25 @@
 #include "persistent.h"
 #include "storage/storage_persistent.h"
 
+/*--------------------------------------------------------------------
+ * Synchronously write a byte range of the silo to backing store.
+ *
+ * msync(2) insists on a page aligned address, so widen the range to
+ * cover the pages it touches.
+ */
+
+int
+smp_msync(const void *ptr, uint64_t len)
+{
+	uintptr_t pgsz, b, e;
+
+	pgsz = getpagesize();
+	assert(PWR2(pgsz));
+	b = RDN2((uintptr_t)ptr, pgsz);
+	e = RUP2((uintptr_t)ptr + len, pgsz);
+	return (msync((void*)b, e - b, MS_SYNC));
+}
+
 /*--------------------------------------------------------------------
  * SIGNATURE functions
  * The signature is SHA256 over:
@@ -158,8 +178,8 @@ smp_sync_sign(const struct smp_signctx *ctx)
 {
 	int i;
 
-	/* XXX: round to pages */
-	i = msync((void*)ctx->ss, ctx->ss->length + SHA256_LEN, MS_SYNC);
+	i = smp_msync(ctx->ss,
+	    sizeof *ctx->ss + ctx->ss->length + SHA256_LEN);
 	if (i && 0)
 		fprintf(stderr, "SyncSign(%p %s) = %d %s\n",
 		    ctx->ss, ctx->id, i, strerror(errno));
@@ -75,5 +75,7 @@ WAIT_Enter(struct sess *sp)
 	*/
 	if (VTCP_nonblocking(sp->fd))
 		SES_Close(sp, SC_REM_CLOSE);
+	else
+		sp->nonblock = 1;
 	waiter->pass(waiter_priv, sp);
 }
@@ -67,9 +67,6 @@ static unsigned nhist;
 static unsigned next_hist;
 static unsigned *bucket_miss;
 static unsigned *bucket_hit;
-static unsigned char hh[FD_SETSIZE];
-static uint64_t bitmap[FD_SETSIZE];
-static double  values[FD_SETSIZE];
 static char *format;
 static int match_tag;
 
@@ -109,7 +106,7 @@ struct profile {
 	{
 		.name = "responsetime",
 		.tag = SLT_ReqEnd,
-		.field = 5,
+		.field = 4,
 		.hist_low = -6,
 		.hist_high = 3
 	}, {
@@ -178,43 +175,37 @@ update(struct VSM_data *vd)
 }
 
 static int
-h_hist(void *priv, enum VSL_tag_e tag, unsigned fd, unsigned len,
-    unsigned spec, const char *ptr, uint64_t bm)
+h_hist(void *priv, const struct VSL_transaction *t)
 {
-	int i, j;
+	int i, j, hit, have;
 	struct VSM_data *vd = priv;
-	(void)spec;
+	uint32_t *p;
+	double value;
+	char buf[1024]; /* size? */
 
-	if (fd >= FD_SETSIZE)
-		/* oops */
+	if (!(t->spec & VSL_S_CLIENT) || !(t->flags & VSL_T_COMPLETE) ||
+	    (t->flags & VSL_T_OVERRUN))
 		return (0);
-
-	bitmap[fd] |= bm;
-
-	if (tag == SLT_Hit) {
-		hh[fd] = 1;
+	if (!VSL_Matched(vd, t->bitmap))
 		return (0);
-	}
-	if (tag == match_tag) {
-		char buf[1024]; /* size? */
-		assert(len < sizeof(buf));
-		memcpy(buf, ptr, len);
-		buf[len] = '\0';
-		i = sscanf(buf, format, &values[fd]);
-		assert(i == 1);
-	}
 
-	if (tag != SLT_ReqEnd)
-		return (0);
-
-	if (!VSL_Matched(vd, bitmap[fd])) {
-		bitmap[fd] = 0;
-		hh[fd] = 0;
-		return (0);
+	hit = have = 0;
+	value = 0.;
+	for (p = t->b; p < t->e; p = VSL_NEXT(p)) {
+		if (VSL_TAG(p) == SLT_Hit)
+			hit = 1;
+		if (VSL_TAG(p) == match_tag) {
+			assert(VSL_LEN(p) < sizeof(buf));
+			memcpy(buf, VSL_DATA(p), VSL_LEN(p));
+			buf[VSL_LEN(p)] = '\0';
+			have = (sscanf(buf, format, &value) == 1);
+		}
 	}
+	if (!have)
+		return (0);
 
 	/* select bucket */
-	i = HIST_RES * (log(values[fd]) / log_ten);
+	i = HIST_RES * (log(value) / log_ten);
 	if (i < hist_low * HIST_RES)
 		i = hist_low * HIST_RES;
 	if (i >= hist_high * HIST_RES)
@@ -239,7 +230,7 @@ h_hist(void *priv, enum VSL_tag_e tag, unsigned fd, unsigned len,
 	}
 
 	/* phase in new data */
-	if (hh[fd] || i == 0) {
+	if (hit || i == 0) {
 		bucket_hit[i]++;
 		rr_hist[next_hist] = i;
 	} else {
@@ -249,8 +240,6 @@ h_hist(void *priv, enum VSL_tag_e tag, unsigned fd, unsigned len,
 	if (++next_hist == HIST_N) {
 		next_hist = 0;
 	}
-	hh[fd] = 0;
-	bitmap[fd] = 0;
 
 	pthread_mutex_unlock(&mtx);
 
@@ -264,7 +253,7 @@ accumulate_thread(void *arg)
 	int i;
 
 	for (;;) {
-		i = VSL_Dispatch(vd, h_hist, vd);
+		i = VSL_DispatchTrans(vd, h_hist, vd);
 		if (i < 0)
 			break;
 		if (i == 0)
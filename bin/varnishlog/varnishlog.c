@@ -203,6 +203,7 @@ do_order(struct VSM_data *vd)
 /*--------------------------------------------------------------------*/
 
 static volatile sig_atomic_t reopen;
+static volatile sig_atomic_t done;
 
 static void
 sighup(int sig)
@@ -212,12 +213,21 @@ sighup(int sig)
 	reopen = 1;
 }
 
+static void
+sigterm(int sig)
+{
+
+	(void)sig;
+	done = 1;
+}
+
 static int
 open_log(const char *w_arg, int a_flag)
 {
 	int fd, flags;
 
-	flags = (a_flag ? O_APPEND : O_TRUNC) | O_WRONLY | O_CREAT;
+	/* Read access, so that appending can stick to the file's format */
+	flags = (a_flag ? O_APPEND | O_RDWR : O_TRUNC | O_WRONLY) | O_CREAT;
 #ifdef O_LARGEFILE
 	flags |= O_LARGEFILE;
 #endif
@@ -232,34 +242,63 @@ open_log(const char *w_arg, int a_flag)
 	return (fd);
 }
 
+static struct VSL_writer *
+new_writer(int fd, const char *w_arg)
+{
+	struct VSL_writer *w;
+
+	w = VSL_WriterNew(fd);
+	if (w == NULL) {
+		perror(w_arg);
+		exit(1);
+	}
+	return (w);
+}
+
 static void
 do_write(struct VSM_data *vd, const char *w_arg, int a_flag)
 {
-	int fd, i, l;
+	int fd, i;
 	uint32_t *p;
+	struct VSL_writer *w;
 
 	fd = open_log(w_arg, a_flag);
 	XXXAN(fd >= 0);
+	w = new_writer(fd, w_arg);
 	(void)signal(SIGHUP, sighup);
-	while (1) {
+	(void)signal(SIGINT, sigterm);
+	(void)signal(SIGTERM, sigterm);
+	while (!done) {
 		i = VSL_NextSLT(vd, &p, NULL);
 		if (i < 0)
 			break;
-		if (i > 0) {
-			l = VSL_LEN(p);
-			i = write(fd, p, 8L + VSL_WORDS(l) * 4L);
-			if (i < 0) {
+		if (i > 0)
+			i = VSL_Write(w, p);
+		else {
+			/* Nothing new, write out what we have and nap */
+			i = VSL_WriteFlush(w);
+			(void)usleep(10000);
+		}
+		if (i < 0) {
+			perror(w_arg);
+			exit(1);
+		}
+		if (reopen) {
+			if (VSL_WriterDelete(w)) {
 				perror(w_arg);
 				exit(1);
 			}
-		}
-		if (reopen) {
 			AZ(close(fd));
 			fd = open_log(w_arg, a_flag);
 			XXXAN(fd >= 0);
+			w = new_writer(fd, w_arg);
 			reopen = 0;
 		}
 	}
+	if (VSL_WriterDelete(w)) {
+		perror(w_arg);
+		exit(1);
+	}
 	exit(0);
 }
 
@@ -280,6 +319,7 @@ main(int argc, char * const *argv)
 	int c;
 	int a_flag = 0, D_flag = 0, O_flag = 0, u_flag = 0, m_flag = 0;
 	const char *P_arg = NULL;
+	const char *r_arg = NULL;
 	const char *w_arg = NULL;
 	struct vpf_fh *pfh = NULL;
 	struct VSM_data *vd;
@@ -319,6 +359,12 @@ main(int argc, char * const *argv)
 		case 'w':
 			w_arg = optarg;
 			break;
+		case 'r':
+			r_arg = optarg;
+			if (VSL_Arg(vd, c, optarg) > 0)
+				break;
+			fprintf(stderr, "%s\n", VSM_Error(vd));
+			exit(1);
 		case 'm':
 			m_flag = 1;
 			/* FALLTHROUGH */
@@ -335,7 +381,7 @@ main(int argc, char * const *argv)
 	if ((argc - optind) > 0)
 		usage();
 
-	if (VSM_Open(vd)) {
+	if (r_arg == NULL && VSM_Open(vd)) {
 		fprintf(stderr, "%s\n", VSM_Error(vd));
 		exit(1);
 	}
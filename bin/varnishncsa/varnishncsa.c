@@ -28,7 +28,7 @@
  * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
  * SUCH DAMAGE.
  *
- * Obtain log data from the shared memory log, order it by session ID, and
+ * Obtain log data from the shared memory log, grouped by transaction, and
  * display it in Apache / NCSA combined log format:
  *
  *	%h %l %u %t "%r" %s %b "%{Referer}i" "%{User-agent}i"
@@ -54,6 +54,11 @@
  *	%q		Query string
  *	%H		Protocol version
  *
+ * The format is compiled into a list of operations once, at startup.
+ * The fields of a transaction are kept as pointers into its records,
+ * which the log API holds on to until we return, so nothing is copied
+ * or allocated per line, and lines are written out in large batches.
+ *
  * TODO:		- Maybe rotate/compress log
  */
 
@@ -76,62 +81,185 @@
 #include "vas.h"
 #include "vcs.h"
 #include "vpf.h"
-#include "vqueue.h"
-#include "vre.h"
-#include "vsb.h"
+#include "vtim.h"
 
 #include "compat/daemon.h"
 
 static volatile sig_atomic_t reopen;
 
-struct hdr {
-	char *key;
-	char *value;
-	VTAILQ_ENTRY(hdr) list;
+/*
+ * A field is a range of bytes in a log record.  Records are not NUL
+ * terminated and may contain anything, so fields are never handed to
+ * the str*() functions.
+ */
+
+struct fld {
+	const char *b;
+	const char *e;
+};
+
+#define FLD_SET(f)	((f)->b != NULL)
+
+/* The headers and VCL_Log keys the format asks for */
+
+enum want_e { W_REQ, W_RESP, W_VCLLOG };
+
+struct want {
+	enum want_e kind;
+	char *name;
+	size_t len;
 };
 
+static struct want *want;
+static unsigned nwant;
+
 static struct logline {
-	char *df_H;			/* %H, Protocol version */
-	char *df_U;			/* %U, URL path */
-	char *df_q;			/* %q, query string */
-	char *df_b;			/* %b, Bytes */
-	char *df_h;			/* %h (host name / IP adress)*/
-	char *df_m;			/* %m, Request method*/
-	char *df_s;			/* %s, Status */
-	struct tm df_t;			/* %t, Date and time */
-	char *df_u;			/* %u, Remote user */
-	char *df_ttfb;			/* Time to first byte */
+	struct fld df_H;		/* %H, Protocol version */
+	struct fld df_U;		/* %U, URL path */
+	struct fld df_q;		/* %q, query string */
+	struct fld df_b;		/* %b, Bytes */
+	struct fld df_h;		/* %h (host name / IP adress)*/
+	struct fld df_m;		/* %m, Request method*/
+	struct fld df_s;		/* %s, Status */
+	time_t df_tt;			/* %t, from ReqEnd */
+	struct tm df_t;			/* %t, from the backend Date: */
+	int df_tm;			/* df_t is valid */
+	struct fld df_u;		/* %u, Remote user */
+	struct fld df_ttfb;		/* Time to first byte */
 	const char *df_hitmiss;		/* Whether this is a hit or miss */
 	const char *df_handling;	/* How the request was handled
 					   (hit/miss/pass/pipe) */
-	int active;			/* Is log line in an active trans */
 	int complete;			/* Is log line complete */
-	uint64_t bitmap;		/* Bitmap for regex matches */
-	VTAILQ_HEAD(, hdr) req_headers; /* Request headers */
-	VTAILQ_HEAD(, hdr) resp_headers; /* Response headers */
-	VTAILQ_HEAD(, hdr) vcl_log;     /* VLC_Log entries */
-} **ll;
+	struct fld *w;			/* [nwant], the wanted headers */
+} ll;
 
-struct VSM_data *vd;
+/* The compiled format */
 
-static size_t nll;
+enum op_e {
+	OP_LITERAL,
+	OP_b, OP_H, OP_h, OP_l, OP_m, OP_q, OP_r, OP_s, OP_t, OP_U, OP_u,
+	OP_WANT,			/* %{X}i, %{X}o, %{VCL_Log:X}x */
+	OP_STRFTIME,			/* %{X}t */
+	OP_TTFB, OP_HITMISS, OP_HANDLING
+};
+
+struct op {
+	enum op_e op;
+	char *str;			/* Literal or strftime format */
+	size_t len;
+	unsigned idx;			/* Into ll.w */
+	time_t c_t;			/* Cached time formatting */
+	char c_buf[128];
+	size_t c_len;
+};
+
+static struct op *ops;
+static unsigned nops;
+static unsigned w_host;			/* For %r */
+
+struct VSM_data *vd;
 
 static int m_flag = 0;
 
 static const char *format;
 
+/*--------------------------------------------------------------------
+ * Batched output
+ */
+
+#define OBUF_SIZE	(256 * 1024)
+
+static struct obuf {
+	int fd;
+	const char *name;
+	size_t len;
+	char buf[OBUF_SIZE];
+} ob;
+
+static uintmax_t nlines;
+
+static void
+ob_flush(void)
+{
+	size_t l;
+	ssize_t i;
+
+	for (l = 0; l < ob.len; l += i) {
+		i = write(ob.fd, ob.buf + l, ob.len - l);
+		if (i < 0 && errno == EINTR) {
+			i = 0;
+			continue;
+		}
+		if (i <= 0) {
+			perror(ob.name);
+			exit(1);
+		}
+	}
+	ob.len = 0;
+}
+
+static void
+ob_write(const char *p, size_t l)
+{
+	size_t n;
+
+	while (l > 0) {
+		if (ob.len == sizeof ob.buf)
+			ob_flush();
+		n = sizeof ob.buf - ob.len;
+		if (n > l)
+			n = l;
+		memcpy(ob.buf + ob.len, p, n);
+		ob.len += n;
+		p += n;
+		l -= n;
+	}
+}
+
+static void
+ob_putc(char c)
+{
+
+	if (ob.len == sizeof ob.buf)
+		ob_flush();
+	ob.buf[ob.len++] = c;
+}
+
+static void
+ob_cat(const char *s)
+{
+
+	ob_write(s, strlen(s));
+}
+
+static void
+ob_fld(const struct fld *f, const char *dflt)
+{
+
+	if (FLD_SET(f))
+		ob_write(f->b, f->e - f->b);
+	else
+		ob_cat(dflt);
+}
+
+/*--------------------------------------------------------------------
+ * Field helpers
+ */
+
 static int
 isprefix(const char *str, const char *prefix, const char *end,
     const char **next)
 {
 
-	while (str < end && *str && *prefix &&
+	while (str < end && *prefix &&
 	    tolower((int)*str) == tolower((int)*prefix))
 		++str, ++prefix;
-	if (*str && *str != ' ')
+	if (*prefix)
+		return (0);
+	if (str < end && *str != ' ')
 		return (0);
 	if (next) {
-		while (str < end && *str && *str == ' ')
+		while (str < end && *str == ' ')
 			++str;
 		*next = str;
 	}
@@ -139,246 +267,181 @@ isprefix(const char *str, const char *prefix, const char *end,
 }
 
 /*
- * Returns a copy of the first consecutive sequence of non-space
- * characters in the string.
+ * The first consecutive sequence of non-space characters in the string.
  */
-static char *
-trimfield(const char *str, const char *end)
+static void
+trimfield(struct fld *f, const char *str, const char *end)
 {
-	size_t len;
-	char *p;
 
 	/* skip leading space */
-	while (str < end && *str && *str == ' ')
+	while (str < end && *str == ' ')
 		++str;
+	f->b = str;
 
 	/* seek to end of field */
-	for (len = 0; &str[len] < end && str[len]; ++len)
-		if (str[len] == ' ')
-			break;
-
-	/* copy and return */
-	p = malloc(len + 1);
-	assert(p != NULL);
-	memcpy(p, str, len);
-	p[len] = '\0';
-	return (p);
+	while (str < end && *str != ' ' && *str != '\0')
+		++str;
+	f->e = str;
 }
 
 /*
- * Returns a copy of the entire string with leading and trailing spaces
- * trimmed.
+ * The entire string with leading and trailing spaces trimmed.
  */
-static char *
-trimline(const char *str, const char *end)
+static void
+trimline(struct fld *f, const char *str, const char *end)
 {
-	size_t len;
-	char *p;
 
 	/* skip leading space */
-	while (str < end && *str && *str == ' ')
+	while (str < end && *str == ' ')
 		++str;
 
-	/* seek to end of string */
-	for (len = 0; &str[len] < end && str[len]; ++len)
-		 /* nothing */ ;
+	/* trim trailing space and NULs */
+	while (end > str && (end[-1] == ' ' || end[-1] == '\0'))
+		--end;
 
-	/* trim trailing space */
-	while (len && str[len - 1] == ' ')
-		--len;
-
-	/* copy and return */
-	p = malloc(len + 1);
-	assert(p != NULL);
-	memcpy(p, str, len);
-	p[len] = '\0';
-	return (p);
+	f->b = str;
+	f->e = end;
 }
 
-static char *
-req_header(struct logline *l, const char *name)
+/*
+ * The n'th (from zero) space separated word of the string
+ */
+static int
+word(struct fld *f, const char *str, const char *end, unsigned n)
 {
-	struct hdr *h;
-	VTAILQ_FOREACH(h, &l->req_headers, list) {
-		if (strcasecmp(h->key, name) == 0) {
-			return (h->value);
-			break;
-		}
+
+	while (1) {
+		trimfield(f, str, end);
+		if (f->b == f->e)
+			return (0);
+		if (n-- == 0)
+			return (1);
+		str = f->e;
 	}
-	return (NULL);
 }
 
-static char *
-resp_header(struct logline *l, const char *name)
+static const char *
+fld_chr(const char *b, const char *e, char c)
 {
-	struct hdr *h;
-	VTAILQ_FOREACH(h, &l->resp_headers, list) {
-		if (strcasecmp(h->key, name) == 0) {
-			return (h->value);
-			break;
-		}
-	}
-	return (NULL);
+
+	return (memchr(b, c, e - b));
 }
 
-static char *
-vcl_log(struct logline *l, const char *name)
+/*
+ * A header or VCL_Log record: "name: value".  Store the value if the
+ * format wants this name.
+ */
+static void
+collect_want(enum want_e kind, const char *ptr, const char *end)
 {
-	struct hdr *h;
-	VTAILQ_FOREACH(h, &l->vcl_log, list) {
-		if (strcasecmp(h->key, name) == 0) {
-			return (h->value);
-			break;
-		}
+	const char *split;
+	unsigned u;
+	size_t l;
+
+	split = fld_chr(ptr, end, ':');
+	if (split == NULL)
+		return;
+	l = split - ptr;
+	for (u = 0; u < nwant; u++) {
+		if (want[u].kind != kind || want[u].len != l ||
+		    strncasecmp(want[u].name, ptr, l))
+			continue;
+		trimline(&ll.w[u], split + 1, end);
+		/* The last one wins */
 	}
-	return (NULL);
 }
 
 static void
 clean_logline(struct logline *lp)
 {
-	struct hdr *h, *h2;
-#define freez(x) do { if (x) free(x); x = NULL; } while (0);
-	freez(lp->df_H);
-	freez(lp->df_U);
-	freez(lp->df_q);
-	freez(lp->df_b);
-	freez(lp->df_h);
-	freez(lp->df_m);
-	freez(lp->df_s);
-	freez(lp->df_u);
-	freez(lp->df_ttfb);
-	VTAILQ_FOREACH_SAFE(h, &lp->req_headers, list, h2) {
-		VTAILQ_REMOVE(&lp->req_headers, h, list);
-		freez(h->key);
-		freez(h->value);
-		freez(h);
-	}
-	VTAILQ_FOREACH_SAFE(h, &lp->resp_headers, list, h2) {
-		VTAILQ_REMOVE(&lp->resp_headers, h, list);
-		freez(h->key);
-		freez(h->value);
-		freez(h);
-	}
-	VTAILQ_FOREACH_SAFE(h, &lp->vcl_log, list, h2) {
-		VTAILQ_REMOVE(&lp->vcl_log, h, list);
-		freez(h->key);
-		freez(h->value);
-		freez(h);
-	}
-#undef freez
+	struct fld *w;
+
+	w = lp->w;
 	memset(lp, 0, sizeof *lp);
+	memset(w, 0, nwant * sizeof *w);
+	lp->w = w;
 }
 
+/*--------------------------------------------------------------------
+ * Pick the fields out of a transaction.  Returns zero if the
+ * transaction cannot be logged.
+ */
+
 static int
 collect_backend(struct logline *lp, enum VSL_tag_e tag, unsigned spec,
     const char *ptr, unsigned len)
 {
-	const char *end, *next, *split;
+	const char *end, *next, *qs;
+	char buf[64];
 
 	assert(spec & VSL_S_BACKEND);
 	end = ptr + len;
 
 	switch (tag) {
 	case SLT_BackendOpen:
-		if (lp->active || lp->df_h != NULL) {
-			/* New start for active line,
-			   clean it and start from scratch */
-			clean_logline(lp);
-		}
-		lp->active = 1;
+		if (FLD_SET(&lp->df_h))
+			return (0);
 		if (isprefix(ptr, "default", end, &next))
-			lp->df_h = trimfield(next, end);
+			trimfield(&lp->df_h, next, end);
 		else
-			lp->df_h = trimfield(ptr, end);
+			trimfield(&lp->df_h, ptr, end);
 		break;
 
 	case SLT_BereqRequest:
-		if (!lp->active)
-			break;
-		if (lp->df_m != NULL) {
-			clean_logline(lp);
-			break;
-		}
-		lp->df_m = trimline(ptr, end);
+		if (FLD_SET(&lp->df_m))
+			return (0);
+		trimline(&lp->df_m, ptr, end);
 		break;
 
-	case SLT_BereqURL: {
-		char *qs;
-
-		if (!lp->active)
-			break;
-		if (lp->df_U != NULL || lp->df_q != NULL) {
-			clean_logline(lp);
-			break;
-		}
-		qs = index(ptr, '?');
+	case SLT_BereqURL:
+		if (FLD_SET(&lp->df_U) || FLD_SET(&lp->df_q))
+			return (0);
+		qs = fld_chr(ptr, end, '?');
 		if (qs) {
-			lp->df_U = trimline(ptr, qs);
-			lp->df_q = trimline(qs, end);
+			trimline(&lp->df_U, ptr, qs);
+			trimline(&lp->df_q, qs, end);
 		} else {
-			lp->df_U = trimline(ptr, end);
+			trimline(&lp->df_U, ptr, end);
 		}
 		break;
-	}
 
 	case SLT_BereqProtocol:
-		if (!lp->active)
-			break;
-		if (lp->df_H != NULL) {
-			clean_logline(lp);
-			break;
-		}
-		lp->df_H = trimline(ptr, end);
+		if (FLD_SET(&lp->df_H))
+			return (0);
+		trimline(&lp->df_H, ptr, end);
 		break;
 
 	case SLT_BerespStatus:
-		if (!lp->active)
-			break;
-		if (lp->df_s != NULL) {
-			clean_logline(lp);
-			break;
-		}
-		lp->df_s = trimline(ptr, end);
+		if (FLD_SET(&lp->df_s))
+			return (0);
+		trimline(&lp->df_s, ptr, end);
 		break;
 
 	case SLT_BerespHeader:
-		if (!lp->active)
-			break;
 		if (isprefix(ptr, "content-length:", end, &next))
-			lp->df_b = trimline(next, end);
-		else if (isprefix(ptr, "date:", end, &next) &&
-			 strptime(next, "%a, %d %b %Y %T", &lp->df_t) == NULL) {
-			clean_logline(lp);
+			trimline(&lp->df_b, next, end);
+		else if (isprefix(ptr, "date:", end, &next)) {
+			if (end - next >= sizeof buf)
+				return (0);
+			memcpy(buf, next, end - next);
+			buf[end - next] = '\0';
+			if (strptime(buf, "%a, %d %b %Y %T", &lp->df_t) == NULL)
+				return (0);
+			lp->df_tm = 1;
 		}
+		collect_want(W_RESP, ptr, end);
 		break;
 
 	case SLT_BereqHeader:
-		if (!lp->active)
-			break;
-		split = strchr(ptr, ':');
-		if (split == NULL)
-			break;
 		if (isprefix(ptr, "authorization:", end, &next) &&
-		    isprefix(next, "basic", end, &next)) {
-			lp->df_u = trimline(next, end);
-		} else {
-			struct hdr *h;
-			size_t l;
-			h = malloc(sizeof(struct hdr));
-			AN(h);
-			AN(split);
-			l = strlen(split);
-			h->key = trimline(ptr, split-1);
-			h->value = trimline(split+1, split+l-1);
-			VTAILQ_INSERT_HEAD(&lp->req_headers, h, list);
-		}
+		    isprefix(next, "basic", end, &next))
+			trimline(&lp->df_u, next, end);
+		else
+			collect_want(W_REQ, ptr, end);
 		break;
 
 	case SLT_BackendReuse:
 	case SLT_BackendClose:
-		if (!lp->active)
-			break;
 		/* got it all */
 		lp->complete = 1;
 		break;
@@ -394,175 +457,107 @@ static int
 collect_client(struct logline *lp, enum VSL_tag_e tag, unsigned spec,
     const char *ptr, unsigned len)
 {
-	const char *end, *next, *split;
-	long l;
-	time_t t;
+	const char *end, *next, *qs;
+	struct fld f;
+	char buf[32];
 
 	assert(spec & VSL_S_CLIENT);
 	end = ptr + len;
 
 	switch (tag) {
 	case SLT_ReqStart:
-		if (lp->active || lp->df_h != NULL) {
-			/* New start for active line,
-			   clean it and start from scratch */
-			clean_logline(lp);
-		}
-		lp->active = 1;
-		lp->df_h = trimfield(ptr, end);
+		if (FLD_SET(&lp->df_h))
+			return (0);
+		trimfield(&lp->df_h, ptr, end);
 		break;
 
 	case SLT_ReqRequest:
-		if (!lp->active)
-			break;
-		if (lp->df_m != NULL) {
-			clean_logline(lp);
-			break;
-		}
-		lp->df_m = trimline(ptr, end);
+		if (FLD_SET(&lp->df_m))
+			return (0);
+		trimline(&lp->df_m, ptr, end);
 		break;
 
-	case SLT_ReqURL: {
-		char *qs;
-
-		if (!lp->active)
-			break;
-		if (lp->df_U != NULL || lp->df_q != NULL) {
-			clean_logline(lp);
-			break;
-		}
-		qs = index(ptr, '?');
+	case SLT_ReqURL:
+		if (FLD_SET(&lp->df_U) || FLD_SET(&lp->df_q))
+			return (0);
+		qs = fld_chr(ptr, end, '?');
 		if (qs) {
-			lp->df_U = trimline(ptr, qs);
-			lp->df_q = trimline(qs, end);
+			trimline(&lp->df_U, ptr, qs);
+			trimline(&lp->df_q, qs, end);
 		} else {
-			lp->df_U = trimline(ptr, end);
+			trimline(&lp->df_U, ptr, end);
 		}
 		break;
-	}
 
 	case SLT_ReqProtocol:
-		if (!lp->active)
-			break;
-		if (lp->df_H != NULL) {
-			clean_logline(lp);
-			break;
-		}
-		lp->df_H = trimline(ptr, end);
+		if (FLD_SET(&lp->df_H))
+			return (0);
+		trimline(&lp->df_H, ptr, end);
 		break;
 
-	case SLT_ObjStatus:
-		if (!lp->active)
-			break;
-		if (lp->df_s != NULL)
-			clean_logline(lp);
-		else
-			lp->df_s = trimline(ptr, end);
+	case SLT_RespStatus:
+		if (FLD_SET(&lp->df_s))
+			return (0);
+		trimline(&lp->df_s, ptr, end);
 		break;
 
-	case SLT_ObjHeader:
 	case SLT_ReqHeader:
-		if (!lp->active)
-			break;
-		split = strchr(ptr, ':');
-		if (split == NULL)
-			break;
-		if (tag == SLT_ReqHeader &&
-		    isprefix(ptr, "authorization:", end, &next) &&
-		    isprefix(next, "basic", end, &next)) {
-			free(lp->df_u);
-			lp->df_u = trimline(next, end);
-		} else {
-			struct hdr *h;
-			h = malloc(sizeof(struct hdr));
-			AN(h);
-			AN(split);
-			h->key = trimline(ptr, split);
-			h->value = trimline(split+1, end);
-			if (tag == SLT_ReqHeader)
-				VTAILQ_INSERT_HEAD(&lp->req_headers, h, list);
-			else
-				VTAILQ_INSERT_HEAD(&lp->resp_headers, h, list);
-		}
+		if (isprefix(ptr, "authorization:", end, &next) &&
+		    isprefix(next, "basic", end, &next))
+			trimline(&lp->df_u, next, end);
+		else
+			collect_want(W_REQ, ptr, end);
 		break;
 
-	case SLT_VCL_Log:
-		if(!lp->active)
-			break;
-
-		split = strchr(ptr, ':');
-		if (split == NULL)
-			break;
-
-		struct hdr *h;
-		h = malloc(sizeof(struct hdr));
-		AN(h);
-		AN(split);
-
-		h->key = trimline(ptr, split);
-		h->value = trimline(split+1, end);
+	case SLT_RespHeader:
+		collect_want(W_RESP, ptr, end);
+		break;
 
-		VTAILQ_INSERT_HEAD(&lp->vcl_log, h, list);
+	case SLT_VCL_Log:
+		collect_want(W_VCLLOG, ptr, end);
 		break;
 
 	case SLT_VCL_call:
-		if(!lp->active)
-			break;
-		if (strncmp(ptr, "hit", len) == 0) {
+		if (isprefix(ptr, "hit", end, NULL)) {
 			lp->df_hitmiss = "hit";
 			lp->df_handling = "hit";
-		} else if (strncmp(ptr, "miss", len) == 0) {
+		} else if (isprefix(ptr, "miss", end, NULL)) {
 			lp->df_hitmiss = "miss";
 			lp->df_handling = "miss";
-		} else if (strncmp(ptr, "pass", len) == 0) {
+		} else if (isprefix(ptr, "pass", end, NULL)) {
 			lp->df_hitmiss = "miss";
 			lp->df_handling = "pass";
-		} else if (strncmp(ptr, "pipe", len) == 0) {
+		} else if (isprefix(ptr, "pipe", end, NULL)) {
 			/* Just skip piped requests, since we can't
 			 * print their status code */
-			clean_logline(lp);
-			break;
+			return (0);
 		}
 		break;
 
 	case SLT_Length:
-		if (!lp->active)
-			break;
-		if (lp->df_b != NULL) {
-			clean_logline(lp);
-			break;
-		}
-		lp->df_b = trimline(ptr, end);
+		if (FLD_SET(&lp->df_b))
+			return (0);
+		trimline(&lp->df_b, ptr, end);
 		break;
 
 	case SLT_SessClose:
-		if (!lp->active)
-			break;
-		if (strncmp(ptr, "TX_PIPE", len) == 0 ||
-		    strncmp(ptr, "TX_ERROR", len) == 0) {
-			clean_logline(lp);
-			break;
-		}
+		if (isprefix(ptr, "TX_PIPE", end, NULL) ||
+		    isprefix(ptr, "TX_ERROR", end, NULL))
+			return (0);
 		break;
 
 	case SLT_ReqEnd:
-	{
-		char ttfb[64];
-		if (!lp->active)
-			break;
-		if (lp->df_ttfb != NULL ||
-		    sscanf(ptr, "%*u %*u.%*u %ld.%*u %*u.%*u %s", &l, ttfb)
-		    != 2) {
-			clean_logline(lp);
-			break;
-		}
-		lp->df_ttfb = strdup(ttfb);
-		t = l;
-		localtime_r(&t, &lp->df_t);
+		if (FLD_SET(&lp->df_ttfb) ||
+		    !word(&f, ptr, end, 1) || !word(&lp->df_ttfb, ptr, end, 3))
+			return (0);
+		if (f.e - f.b >= sizeof buf)
+			return (0);
+		memcpy(buf, f.b, f.e - f.b);
+		buf[f.e - f.b] = '\0';
+		lp->df_tt = (time_t)strtol(buf, NULL, 10);
 		/* got it all */
 		lp->complete = 1;
 		break;
-	}
 
 	default:
 		break;
@@ -571,248 +566,341 @@ collect_client(struct logline *lp, enum VSL_tag_e tag, unsigned spec,
 	return (1);
 }
 
-static int
-h_ncsa(void *priv, enum VSL_tag_e tag, unsigned fd,
-    unsigned len, unsigned spec, const char *ptr, uint64_t bitmap)
+/*--------------------------------------------------------------------
+ * Output a line
+ */
+
+static void
+out_time(struct op *o, const char *fmt)
 {
-	struct logline *lp;
-	FILE *fo = priv;
-	char *q, tbuf[64];
-	const char *p;
-	struct vsb *os;
-
-	if (fd >= nll) {
-		struct logline **newll = ll;
-		size_t newnll = nll;
-
-		while (fd >= newnll)
-			newnll += newnll + 1;
-		newll = realloc(newll, newnll * sizeof *newll);
-		assert(newll != NULL);
-		memset(newll + nll, 0, (newnll - nll) * sizeof *newll);
-		ll = newll;
-		nll = newnll;
+	static time_t lt;
+	static struct tm ltm;
+
+	if (ll.df_tm) {
+		/* From the backend, not worth caching */
+		o->c_len = strftime(o->c_buf, sizeof o->c_buf, fmt, &ll.df_t);
+		o->c_t = 0;
+	} else if (o->c_t != ll.df_tt || o->c_t == 0) {
+		if (lt != ll.df_tt || lt == 0) {
+			lt = ll.df_tt;
+			AN(localtime_r(&lt, &ltm));
+		}
+		o->c_len = strftime(o->c_buf, sizeof o->c_buf, fmt, &ltm);
+		o->c_t = ll.df_tt;
 	}
-	if (ll[fd] == NULL) {
-		ll[fd] = calloc(sizeof *ll[fd], 1);
-		assert(ll[fd] != NULL);
+	ob_write(o->c_buf, o->c_len);
+}
+
+static void
+out_user(void)
+{
+	char ibuf[256], rubuf[256];
+	char *q;
+	size_t l;
+
+	l = ll.df_u.e - ll.df_u.b;
+	if (l >= sizeof ibuf || ((l + 3) * 4) / 3 > sizeof rubuf) {
+		ob_putc('-');
+		return;
 	}
-	lp = ll[fd];
+	memcpy(ibuf, ll.df_u.b, l);
+	ibuf[l] = '\0';
+	if (VB64_decode(rubuf, sizeof rubuf, ibuf)) {
+		ob_putc('-');
+		return;
+	}
+	q = strchr(rubuf, ':');
+	if (q != NULL)
+		*q = '\0';
+	ob_cat(rubuf);
+}
 
-	if (spec & VSL_S_BACKEND) {
-		collect_backend(lp, tag, spec, ptr, len);
-	} else if (spec & VSL_S_CLIENT) {
-		collect_client(lp, tag, spec, ptr, len);
-	} else {
-		/* huh? */
-		return (reopen);
+static void
+out_line(unsigned spec)
+{
+	struct op *o;
+	struct fld *h;
+
+	for (o = ops; o < ops + nops; o++) {
+		switch (o->op) {
+		case OP_LITERAL:
+			ob_write(o->str, o->len);
+			break;
+		case OP_b:
+			ob_fld(&ll.df_b, "-");
+			break;
+		case OP_H:
+			ob_fld(&ll.df_H, "HTTP/1.0");
+			break;
+		case OP_h:
+			if (!FLD_SET(&ll.df_h) && spec & VSL_S_BACKEND)
+				ob_cat("127.0.0.1");
+			else
+				ob_fld(&ll.df_h, "-");
+			break;
+		case OP_l:
+			ob_putc('-');
+			break;
+		case OP_m:
+			ob_fld(&ll.df_m, "-");
+			break;
+		case OP_q:
+			ob_fld(&ll.df_q, "");
+			break;
+		case OP_r:
+			/*
+			 * Fake "%r".  This would be a lot easier if Varnish
+			 * normalized the request URL.
+			 */
+			ob_fld(&ll.df_m, "-");
+			ob_putc(' ');
+			h = &ll.w[w_host];
+			if (FLD_SET(h)) {
+				if (h->e - h->b < 7 ||
+				    strncmp(h->b, "http://", 7) != 0)
+					ob_cat("http://");
+				ob_fld(h, "");
+			} else {
+				ob_cat("http://localhost");
+			}
+			ob_fld(&ll.df_U, "-");
+			ob_fld(&ll.df_q, "");
+			ob_putc(' ');
+			ob_fld(&ll.df_H, "HTTP/1.0");
+			break;
+		case OP_s:
+			ob_fld(&ll.df_s, "");
+			break;
+		case OP_t:
+			out_time(o, "[%d/%b/%Y:%T %z]");
+			break;
+		case OP_STRFTIME:
+			out_time(o, o->str);
+			break;
+		case OP_U:
+			ob_fld(&ll.df_U, "-");
+			break;
+		case OP_u:
+			/* %u: decode authorization string */
+			if (FLD_SET(&ll.df_u))
+				out_user();
+			else
+				ob_putc('-');
+			break;
+		case OP_WANT:
+			ob_fld(&ll.w[o->idx], "-");
+			break;
+		case OP_TTFB:
+			ob_fld(&ll.df_ttfb, "-");
+			break;
+		case OP_HITMISS:
+			ob_cat(ll.df_hitmiss ? ll.df_hitmiss : "-");
+			break;
+		case OP_HANDLING:
+			ob_cat(ll.df_handling ? ll.df_handling : "-");
+			break;
+		default:
+			WRONG("Bad op");
+		}
 	}
+	ob_putc('\n');
+	nlines++;
+}
 
-	lp->bitmap |= bitmap;
+static int
+h_ncsa(void *priv, const struct VSL_transaction *t)
+{
+	struct logline *lp;
+	uint32_t *r;
+	unsigned spec;
+	int i;
+
+	(void)priv;
+	if (!(t->flags & VSL_T_COMPLETE) || (t->flags & VSL_T_OVERRUN))
+		return (reopen);
+	spec = t->spec;
+	lp = &ll;
+	clean_logline(lp);
+
+	for (r = t->b; r < t->e; r = VSL_NEXT(r)) {
+		if (spec & VSL_S_BACKEND)
+			i = collect_backend(lp, (enum VSL_tag_e)VSL_TAG(r),
+			    spec, VSL_DATA(r), VSL_LEN(r));
+		else if (spec & VSL_S_CLIENT)
+			i = collect_client(lp, (enum VSL_tag_e)VSL_TAG(r),
+			    spec, VSL_DATA(r), VSL_LEN(r));
+		else
+			i = 0;
+		if (!i)
+			/* Not something we can log */
+			return (reopen);
+	}
 
 	if (!lp->complete)
 		return (reopen);
 
-	if (m_flag && !VSL_Matched(vd, lp->bitmap))
+	if (m_flag && !VSL_Matched(vd, t->bitmap))
 		/* -o is in effect matching rule failed. Don't display */
 		return (reopen);
 
-#if 0
-	/* non-optional fields */
-	if (!lp->df_m || !lp->df_U || !lp->df_H || !lp->df_s) {
-		clean_logline(lp);
-		return (reopen);
+	/* We have a complete data set - log a line */
+	out_line(spec);
+	return (reopen);
+}
+
+/*--------------------------------------------------------------------
+ * Compile the format
+ */
+
+static unsigned
+add_want(enum want_e kind, const char *name, size_t len)
+{
+	unsigned u;
+
+	for (u = 0; u < nwant; u++)
+		if (want[u].kind == kind && want[u].len == len &&
+		    !strncasecmp(want[u].name, name, len))
+			return (u);
+	want = realloc(want, (nwant + 1) * sizeof *want);
+	AN(want);
+	want[nwant].kind = kind;
+	want[nwant].name = strndup(name, len);
+	AN(want[nwant].name);
+	want[nwant].len = len;
+	return (nwant++);
+}
+
+static struct op *
+add_op(enum op_e op)
+{
+	struct op *o;
+
+	ops = realloc(ops, (nops + 1) * sizeof *ops);
+	AN(ops);
+	o = &ops[nops++];
+	memset(o, 0, sizeof *o);
+	o->op = op;
+	return (o);
+}
+
+static void
+add_literal(const char *p, size_t l)
+{
+	struct op *o;
+
+	if (nops > 0 && ops[nops - 1].op == OP_LITERAL) {
+		o = &ops[nops - 1];
+		o->str = realloc(o->str, o->len + l);
+		AN(o->str);
+	} else {
+		o = add_op(OP_LITERAL);
+		o->str = malloc(l);
+		AN(o->str);
 	}
-#endif
+	memcpy(o->str + o->len, p, l);
+	o->len += l;
+}
 
-	/* We have a complete data set - log a line */
+static void
+bad_format(const char *p)
+{
 
-	fo = priv;
-	os = VSB_new_auto();
+	fprintf(stderr, "Unknown format starting at: %s\n", p);
+	exit(1);
+}
+
+static void
+compile_format(const char *fmt)
+{
+	const char *p, *q, *name;
+	struct op *o;
+	size_t l;
 
-	for (p = format; *p != '\0'; p++) {
+	for (p = fmt; *p != '\0'; p++) {
 
 		/* allow the most essential escape sequences in format. */
 		if (*p == '\\') {
 			p++;
-			if (*p == 't') VSB_putc(os, '\t');
-			if (*p == 'n') VSB_putc(os, '\n');
+			if (*p == 't') add_literal("\t", 1);
+			if (*p == 'n') add_literal("\n", 1);
+			if (*p == '\0')
+				break;
 			continue;
 		}
 
 		if (*p != '%') {
-			VSB_putc(os, *p);
+			add_literal(p, 1);
 			continue;
 		}
 		p++;
 		switch (*p) {
-
-		case 'b':
-			/* %b */
-			VSB_cat(os, lp->df_b ? lp->df_b : "-");
-			break;
-
-		case 'H':
-			VSB_cat(os, lp->df_H ? lp->df_H : "HTTP/1.0");
-			break;
-
-		case 'h':
-			if (!lp->df_h && spec & VSL_S_BACKEND)
-				VSB_cat(os, "127.0.0.1");
-			else
-				VSB_cat(os, lp->df_h ? lp->df_h : "-");
-			break;
-		case 'l':
-			VSB_putc(os, '-');
-			break;
-
-		case 'm':
-			VSB_cat(os, lp->df_m ? lp->df_m : "-");
-			break;
-
-		case 'q':
-			VSB_cat(os, lp->df_q ? lp->df_q : "");
-			break;
-
+		case 'b': (void)add_op(OP_b); break;
+		case 'H': (void)add_op(OP_H); break;
+		case 'h': (void)add_op(OP_h); break;
+		case 'l': (void)add_op(OP_l); break;
+		case 'm': (void)add_op(OP_m); break;
+		case 'q': (void)add_op(OP_q); break;
 		case 'r':
-			/*
-			 * Fake "%r".  This would be a lot easier if Varnish
-			 * normalized the request URL.
-			 */
-			VSB_cat(os, lp->df_m ? lp->df_m : "-");
-			VSB_putc(os, ' ');
-			if (req_header(lp, "Host")) {
-				if (strncmp(req_header(lp, "Host"),
-				    "http://", 7) != 0)
-					VSB_cat(os, "http://");
-				VSB_cat(os, req_header(lp, "Host"));
-			} else {
-				VSB_cat(os, "http://localhost");
-			}
-			VSB_cat(os, lp->df_U ? lp->df_U : "-");
-			VSB_cat(os, lp->df_q ? lp->df_q : "");
-			VSB_putc(os, ' ');
-			VSB_cat(os, lp->df_H ? lp->df_H : "HTTP/1.0");
-			break;
-
-		case 's':
-			/* %s */
-			VSB_cat(os, lp->df_s ? lp->df_s : "");
-			break;
-
-		case 't':
-			/* %t */
-			strftime(tbuf, sizeof tbuf,
-			    "[%d/%b/%Y:%T %z]", &lp->df_t);
-			VSB_cat(os, tbuf);
-			break;
-
-		case 'U':
-			VSB_cat(os, lp->df_U ? lp->df_U : "-");
-			break;
-
-		case 'u':
-			/* %u: decode authorization string */
-			if (lp->df_u != NULL) {
-				char *rubuf;
-				size_t rulen;
-
-				VB64_init();
-				rulen = ((strlen(lp->df_u) + 3) * 4) / 3;
-				rubuf = malloc(rulen);
-				assert(rubuf != NULL);
-				VB64_decode(rubuf, rulen, lp->df_u);
-				q = strchr(rubuf, ':');
-				if (q != NULL)
-					*q = '\0';
-				VSB_cat(os, rubuf);
-				free(rubuf);
-			} else {
-				VSB_putc(os, '-');
-			}
+			(void)add_op(OP_r);
+			w_host = add_want(W_REQ, "Host", 4);
 			break;
-
-		case '{': {
-			const char *h, *tmp;
-			char fname[100], type;
-			tmp = p;
-			type = 0;
-			while (*tmp != '\0' && *tmp != '}')
-				tmp++;
-			if (*tmp == '}') {
-				tmp++;
-				type = *tmp;
-				memcpy(fname, p+1, tmp-p-2);
-				fname[tmp-p-2] = 0;
-			}
-
-			switch (type) {
+		case 's': (void)add_op(OP_s); break;
+		case 't': (void)add_op(OP_t); break;
+		case 'U': (void)add_op(OP_U); break;
+		case 'u': (void)add_op(OP_u); break;
+		case '{':
+			q = strchr(p, '}');
+			if (q == NULL || q[1] == '\0')
+				bad_format(p - 1);
+			name = p + 1;
+			l = q - name;
+			switch (q[1]) {
 			case 'i':
-				h = req_header(lp, fname);
-				VSB_cat(os, h ? h : "-");
-				p = tmp;
+				o = add_op(OP_WANT);
+				o->idx = add_want(W_REQ, name, l);
 				break;
 			case 'o':
-				h = resp_header(lp, fname);
-				VSB_cat(os, h ? h : "-");
-				p = tmp;
+				o = add_op(OP_WANT);
+				o->idx = add_want(W_RESP, name, l);
 				break;
 			case 't':
-				strftime(tbuf, sizeof tbuf, fname, &lp->df_t);
-				VSB_cat(os, tbuf);
-				p = tmp;
+				o = add_op(OP_STRFTIME);
+				o->str = strndup(name, l);
+				AN(o->str);
 				break;
 			case 'x':
-				if (!strcmp(fname, "Varnish:time_firstbyte")) {
-					VSB_cat(os, lp->df_ttfb);
-					p = tmp;
-					break;
-				} else if (!strcmp(fname, "Varnish:hitmiss")) {
-					VSB_cat(os, (lp->df_hitmiss ?
-					    lp->df_hitmiss : "-"));
-					p = tmp;
-					break;
-				} else if (!strcmp(fname, "Varnish:handling")) {
-					VSB_cat(os, (lp->df_handling ?
-					    lp->df_handling : "-"));
-					p = tmp;
-					break;
-				} else if (!strncmp(fname, "VCL_Log:", 8)) {
+				if (l == 22 &&
+				    !strncmp(name, "Varnish:time_firstbyte", l))
+					(void)add_op(OP_TTFB);
+				else if (l == 15 &&
+				    !strncmp(name, "Varnish:hitmiss", l))
+					(void)add_op(OP_HITMISS);
+				else if (l == 16 &&
+				    !strncmp(name, "Varnish:handling", l))
+					(void)add_op(OP_HANDLING);
+				else if (l > 8 &&
+				    !strncmp(name, "VCL_Log:", 8)) {
 					// support pulling entries logged
 					// with std.log() into output.
 					// Format: %{VCL_Log:keyname}x
 					// Logging: std.log("keyname:value")
-					h = vcl_log(lp, fname+8);
-					VSB_cat(os, h ? h : "-");
-					p = tmp;
-					break;
-				}
+					o = add_op(OP_WANT);
+					o->idx = add_want(W_VCLLOG,
+					    name + 8, l - 8);
+				} else
+					bad_format(p - 1);
+				break;
 			default:
-				fprintf(stderr,
-				    "Unknown format starting at: %s\n", --p);
-				exit(1);
+				bad_format(p - 1);
 			}
+			p = q + 1;
 			break;
-		}
-			/* Fall through if we haven't handled something */
-			/* FALLTHROUGH*/
 		default:
-			fprintf(stderr,
-			    "Unknown format starting at: %s\n", --p);
-			exit(1);
+			bad_format(p - 1);
 		}
 	}
-	VSB_putc(os, '\n');
-
-	/* flush the stream */
-	VSB_finish(os);
-	fprintf(fo, "%s", VSB_data(os));
-	fflush(fo);
-
-	/* clean up */
-	clean_logline(lp);
-	VSB_delete(os);
-	return (reopen);
+	ll.w = calloc(nwant + 1L, sizeof *ll.w);
+	AN(ll.w);
 }
 
 /*--------------------------------------------------------------------*/
@@ -830,13 +918,27 @@ open_log(const char *ofn, int append)
 {
 	FILE *of;
 
-	if ((of = fopen(ofn, append ? "a" : "w")) == NULL) {
+	if (*ofn == '|')
+		of = popen(ofn + 1, "w");
+	else
+		of = fopen(ofn, append ? "a" : "w");
+	if (of == NULL) {
 		perror(ofn);
 		exit(1);
 	}
 	return (of);
 }
 
+static void
+close_log(const char *ofn, FILE *of)
+{
+
+	if (*ofn == '|')
+		(void)pclose(of);
+	else
+		(void)fclose(of);
+}
+
 /*--------------------------------------------------------------------*/
 
 static void
@@ -844,7 +946,7 @@ usage(void)
 {
 
 	fprintf(stderr,
-	    "usage: varnishncsa %s [-aDV] [-n varnish_name] "
+	    "usage: varnishncsa %s [-aBDV] [-n varnish_name] "
 	    "[-P file] [-w file]\n", VSL_USAGE);
 	exit(1);
 }
@@ -852,21 +954,26 @@ usage(void)
 int
 main(int argc, char *argv[])
 {
-	int c;
-	int a_flag = 0, D_flag = 0, format_flag = 0;
+	int c, i;
+	int a_flag = 0, B_flag = 0, D_flag = 0, format_flag = 0;
 	const char *P_arg = NULL;
+	const char *r_arg = NULL;
 	const char *w_arg = NULL;
 	struct vpf_fh *pfh = NULL;
 	FILE *of;
+	double t0;
 	format = "%h %l %u %t \"%r\" %s %b \"%{Referer}i\" \"%{User-agent}i\"";
 
 	vd = VSM_New();
 
-	while ((c = getopt(argc, argv, VSL_ARGS "aDP:Vw:fF:")) != -1) {
+	while ((c = getopt(argc, argv, VSL_ARGS "aBDP:Vw:fF:")) != -1) {
 		switch (c) {
 		case 'a':
 			a_flag = 1;
 			break;
+		case 'B':
+			B_flag = 1;
+			break;
 		case 'f':
 			if (format_flag) {
 				fprintf(stderr,
@@ -913,6 +1020,12 @@ main(int argc, char *argv[])
 		case 'c':
 			/* XXX: Silently ignored: it's required anyway */
 			break;
+		case 'r':
+			r_arg = optarg;
+			if (VSL_Arg(vd, c, optarg) > 0)
+				break;
+			fprintf(stderr, "%s\n", VSM_Error(vd));
+			exit(1);
 		case 'm':
 			m_flag = 1; /* Fall through */
 		default:
@@ -922,9 +1035,18 @@ main(int argc, char *argv[])
 		}
 	}
 
+	if (B_flag && r_arg == NULL) {
+		fprintf(stderr, "-B requires -r\n");
+		exit(1);
+	}
+
 	VSL_Arg(vd, 'c', optarg);
 
-	if (VSM_Open(vd)) {
+	compile_format(format);
+	VB64_init();
+
+	/* With -r there is no shared memory to open */
+	if (r_arg == NULL && VSM_Open(vd)) {
 		fprintf(stderr, "%s\n", VSM_Error(vd));
 		return (-1);
 	}
@@ -951,18 +1073,32 @@ main(int argc, char *argv[])
 		w_arg = "stdout";
 		of = stdout;
 	}
+	ob.fd = fileno(of);
+	ob.name = w_arg;
 
-	while (VSL_Dispatch(vd, h_ncsa, of) >= 0) {
-		if (fflush(of) != 0) {
-			perror(w_arg);
-			exit(1);
-		}
+	t0 = VTIM_mono();
+	while (1) {
+		i = VSL_DispatchTrans(vd, h_ncsa, NULL);
+		if (i < 0)
+			break;
+		/* Out of log for now, or asked to reopen */
+		ob_flush();
 		if (reopen && of != stdout) {
-			fclose(of);
+			close_log(w_arg, of);
 			of = open_log(w_arg, a_flag);
+			ob.fd = fileno(of);
 			reopen = 0;
 		}
 	}
+	ob_flush();
+
+	if (B_flag) {
+		t0 = VTIM_mono() - t0;
+		fprintf(stderr, "%ju lines in %.3f s, %.0f lines/s\n",
+		    nlines, t0, t0 > 0. ? nlines / t0 : 0.);
+	}
+	if (of != stdout)
+		close_log(w_arg, of);
 
 	exit(0);
 }
@@ -93,9 +93,8 @@ isequal(const char *str, const char *reference, const char *end)
  */
 
 struct message {
-	enum VSL_tag_e tag;
-	size_t len;
-	char *ptr;
+	uint32_t *b;		/* The records of one request */
+	uint32_t *e;
 	VSTAILQ_ENTRY(message) list;
 };
 
@@ -125,6 +124,7 @@ mailbox_destroy(struct mailbox *mbox)
 
 	while ((msg = VSTAILQ_FIRST(&mbox->messages))) {
 		VSTAILQ_REMOVE_HEAD(&mbox->messages, list);
+		free(msg->b);
 		free(msg);
 	}
 	pthread_cond_destroy(&mbox->has_mail);
@@ -198,7 +198,7 @@ struct replay_thread {
 
 	int sock;
 
-	int fd;			/* original fd from logs */
+	int fd;			/* original client port from logs */
 
 	char *method;		/* Request method*/
 	char *proto;		/* Protocol version */
@@ -493,6 +493,58 @@ receive_response(struct replay_thread *thr)
 	return (connclose);
 }
 
+static void
+parse_record(struct replay_thread *thr, uint32_t *p)
+{
+	char *ptr = thr->temp;
+	const char *next;
+
+	if (VSL_LEN(p) >= sizeof thr->temp) {
+		thr->bogus = 1;
+		return;
+	}
+	memcpy(ptr, VSL_DATA(p), VSL_LEN(p));
+	ptr[VSL_LEN(p)] = '\0';
+
+	thread_log(2, 0, "%s(%s)", VSL_tags[VSL_TAG(p)], ptr);
+
+	switch (VSL_TAG(p)) {
+	case SLT_ReqRequest:
+		if (thr->method != NULL)
+			thr->bogus = 1;
+		else
+			thr->method = trimline(thr, ptr);
+		break;
+
+	case SLT_ReqURL:
+		if (thr->url != NULL)
+			thr->bogus = 1;
+		else
+			thr->url = trimline(thr, ptr);
+		break;
+
+	case SLT_ReqProtocol:
+		if (thr->proto != NULL)
+			thr->bogus = 1;
+		else
+			thr->proto = trimline(thr, ptr);
+		break;
+
+	case SLT_ReqHeader:
+		if (thr->nhdr >= sizeof thr->hdr / sizeof *thr->hdr) {
+			thr->bogus = 1;
+		} else {
+			thr->hdr[thr->nhdr++] = trimline(thr, ptr);
+			if (isprefix(ptr, "connection:", &next))
+				thr->conn = trimline(thr, next);
+		}
+		break;
+
+	default:
+		break;
+	}
+}
+
 static void *
 replay_thread(void *arg)
 {
@@ -500,62 +552,18 @@ replay_thread(void *arg)
 	char space[1] = " ", crlf[2] = "\r\n";
 	struct replay_thread *thr = arg;
 	struct message *msg;
-	enum VSL_tag_e tag;
-	char *ptr;
-	const char *next;
+	uint32_t *p;
 
 	int i;
 
 	int reopen = 1;
 
 	while ((msg = mailbox_get(&thr->mbox)) != NULL) {
-		tag = msg->tag;
-		ptr = msg->ptr;
-
-		thread_log(2, 0, "%s(%s)", VSL_tags[tag], msg->ptr);
-
-		switch (tag) {
-		case SLT_ReqRequest:
-			if (thr->method != NULL)
-				thr->bogus = 1;
-			else
-				thr->method = trimline(thr, ptr);
-			break;
-
-		case SLT_ReqURL:
-			if (thr->url != NULL)
-				thr->bogus = 1;
-			else
-				thr->url = trimline(thr, ptr);
-			break;
-
-		case SLT_ReqProtocol:
-			if (thr->proto != NULL)
-				thr->bogus = 1;
-			else
-				thr->proto = trimline(thr, ptr);
-			break;
-
-		case SLT_ReqHeader:
-			if (thr->nhdr >= sizeof thr->hdr / sizeof *thr->hdr) {
-				thr->bogus = 1;
-			} else {
-				thr->hdr[thr->nhdr++] = trimline(thr, ptr);
-				if (isprefix(ptr, "connection:", &next))
-					thr->conn = trimline(thr, next);
-			}
-			break;
-
-		default:
-			break;
-		}
-
-		freez(msg->ptr);
+		for (p = msg->b; p < msg->e; p = VSL_NEXT(p))
+			parse_record(thr, p);
+		freez(msg->b);
 		freez(msg);
 
-		if (tag != SLT_ReqEnd)
-			continue;
-
 		if (!thr->method || !thr->url || !thr->proto) {
 			thr->bogus = 1;
 		} else if (strcmp(thr->method, "GET") != 0 &&
@@ -639,29 +647,50 @@ clear:
 	return (0);
 }
 
+/*
+ * Requests are handed to a thread per client port, so that those which
+ * came over the same client connection are replayed in order, over one
+ * connection.
+ */
+
 static int
-gen_traffic(void *priv, enum VSL_tag_e tag, unsigned fd,
-    unsigned len, unsigned spec, const char *ptr, uint64_t bitmap)
+gen_traffic(void *priv, const struct VSL_transaction *t)
 {
 	struct replay_thread *thr;
 	struct message *msg;
+	uint32_t *p;
+	unsigned port;
+	char buf[64];
 
 	(void)priv;
-	(void)bitmap;
 
-	if (fd == 0 || !(spec & VSL_S_CLIENT))
+	if (t->vxid == 0 || !(t->spec & VSL_S_CLIENT) ||
+	    !(t->flags & VSL_T_COMPLETE) || (t->flags & VSL_T_OVERRUN))
+		return (0);
+
+	port = 0;
+	for (p = t->b; p < t->e; p = VSL_NEXT(p)) {
+		if (VSL_TAG(p) != SLT_ReqStart || VSL_LEN(p) >= sizeof buf)
+			continue;
+		memcpy(buf, VSL_DATA(p), VSL_LEN(p));
+		buf[VSL_LEN(p)] = '\0';
+		if (sscanf(buf, "%*s %u", &port) != 1)
+			port = 0;
+		break;
+	}
+	if (port == 0)
 		return (0);
 
-	thread_log(3, 0, "%d %s", fd, VSL_tags[tag]);
-	thr = thread_get(fd, replay_thread);
+	thread_log(3, 0, "%u %u", t->vxid, port);
+	thr = thread_get(port, replay_thread);
 	if (thr == NULL)
 		return (0);
 	msg = malloc(sizeof (struct message));
-	msg->tag = tag;
-	msg->len = len;
-	msg->ptr = malloc(len);
-	AN(msg->ptr);
-	memcpy(msg->ptr, ptr, len);
+	AN(msg);
+	msg->b = malloc((t->e - t->b) * sizeof *t->b);
+	AN(msg->b);
+	memcpy(msg->b, t->b, (t->e - t->b) * sizeof *t->b);
+	msg->e = msg->b + (t->e - t->b);
 	mailbox_put(&thr->mbox, msg);
 
 	return (0);
@@ -751,7 +780,7 @@ main(int argc, char *argv[])
 	 */
 	pthread_attr_setstacksize(&thread_attr, 32768);
 
-	while (VSL_Dispatch(vd, gen_traffic, NULL) == 0)
+	while (VSL_DispatchTrans(vd, gen_traffic, NULL) == 0)
 		/* nothing */ ;
 	thread_close(-1);
 	exit(0);
@@ -46,6 +46,7 @@
 #include "vapi/vsl.h"
 #include "vapi/vsm.h"
 #include "vcli.h"
+#include "vre.h"
 #include "vss.h"
 #include "vtcp.h"
 
@@ -597,6 +598,47 @@ varnish_cli(struct varnish *v, const char *cli, unsigned exp)
 		vtc_log(v->vl, 0, "FAIL CLI response %u expected %u", u, exp);
 }
 
+/**********************************************************************
+ * Send a CLI command, and check that the reply matches a regexp
+ */
+
+static void
+varnish_cliexpect(struct varnish *v, const char *re, const char *cli)
+{
+	enum VCLI_status_e u;
+	vre_t *vre;
+	const char *err;
+	int erroff, i;
+	char *r = NULL;
+
+	vre = VRE_compile(re, 0, &err, &erroff);
+	if (vre == NULL) {
+		vtc_log(v->vl, 0, "Illegal regexp: %s (@%d)", err, erroff);
+		return;
+	}
+	if (v->cli_fd < 0)
+		varnish_launch(v);
+	if (vtc_error) {
+		VRE_free(&vre);
+		return;
+	}
+	u = varnish_ask_cli(v, cli, &r);
+	vtc_log(v->vl, 2, "CLI %03u <%s>", u, cli);
+	if (u != CLIS_OK)
+		vtc_log(v->vl, 0, "FAIL CLI response %u expected %u",
+		    u, CLIS_OK);
+	else if (r != NULL) {
+		i = VRE_exec(vre, r, strlen(r), 0, 0, NULL, 0, NULL);
+		if (i < 0)
+			vtc_log(v->vl, 0, "FAIL CLI reply does not match %s",
+			    re);
+		else
+			vtc_log(v->vl, 4, "CLI reply matches %s", re);
+	}
+	free(r);
+	VRE_free(&vre);
+}
+
 /**********************************************************************
  * Load a VCL program
  */
@@ -853,6 +895,13 @@ cmd_varnish(CMD_ARGS)
 			av += 2;
 			continue;
 		}
+		if (!strcmp(*av, "-cliexpect")) {
+			AN(av[1]);
+			AN(av[2]);
+			varnish_cliexpect(v, av[1], av[2]);
+			av += 2;
+			continue;
+		}
 		if (!strcmp(*av, "-start")) {
 			varnish_start(v);
 			continue;
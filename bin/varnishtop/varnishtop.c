@@ -62,14 +62,27 @@ struct top {
 	char			*rec_data;
 	int			clen;
 	unsigned		hash;
+	unsigned		ranked;
 	VTAILQ_ENTRY(top)	list;
 	double			count;
 };
 
-static VTAILQ_HEAD(tophead, top) top_head = VTAILQ_HEAD_INITIALIZER(top_head);
+/*
+ * The records are counted in a hash table, which is grown as needed,
+ * and ranked only when the screen is updated, by picking the top
+ * entries with a min-heap.
+ */
+
+static VTAILQ_HEAD(tophead, top) *top_hash;
+static unsigned top_nhash;
+
+static struct top **top_rank;
+static unsigned top_nrank;
 
 static unsigned ntop;
 
+#define TOP_NHASH_MIN	1024
+
 /*--------------------------------------------------------------------*/
 
 static pthread_mutex_t mtx = PTHREAD_MUTEX_INITIALIZER;
@@ -78,10 +91,35 @@ static int f_flag = 0;
 
 static unsigned maxfieldlen = 0;
 
+static void
+top_rehash(unsigned nhash)
+{
+	struct tophead *oh;
+	struct top *tp;
+	unsigned u, onhash;
+
+	oh = top_hash;
+	onhash = top_nhash;
+	top_hash = calloc(sizeof *top_hash, nhash);
+	AN(top_hash);
+	top_nhash = nhash;
+	for (u = 0; u < nhash; u++)
+		VTAILQ_INIT(&top_hash[u]);
+	for (u = 0; u < onhash; u++) {
+		while ((tp = VTAILQ_FIRST(&oh[u])) != NULL) {
+			VTAILQ_REMOVE(&oh[u], tp, list);
+			VTAILQ_INSERT_TAIL(&top_hash[tp->hash & (nhash - 1)],
+			    tp, list);
+		}
+	}
+	free(oh);
+}
+
 static void
 accumulate(uint32_t * const p)
 {
-	struct top *tp, *tp2;
+	struct tophead *th;
+	struct top *tp;
 	const char *q;
 	unsigned int u, l;
 	uint8_t t;
@@ -89,19 +127,23 @@ accumulate(uint32_t * const p)
 
 	// fprintf(stderr, "%p %08x %08x\n", p, p[0], p[1]);
 
-	u = 0;
+	/* FNV-1a over the tag and the data */
 	q = VSL_DATA(p);
 	l = VSL_LEN(p);
 	t = VSL_TAG(p);
+	u = (2166136261U ^ t) * 16777619U;
 	for (i = 0; i < l; i++, q++) {
 		if (f_flag && (*q == ':' || isspace(*q))) {
 			l = q - VSL_DATA(p);
 			break;
 		}
-		u += *q;
+		u = (u ^ (uint8_t)*q) * 16777619U;
 	}
 
-	VTAILQ_FOREACH(tp, &top_head, list) {
+	if (top_hash == NULL)
+		top_rehash(TOP_NHASH_MIN);
+	th = &top_hash[u & (top_nhash - 1)];
+	VTAILQ_FOREACH(tp, th, list) {
 		if (tp->hash != u)
 			continue;
 		if (tp->tag != t)
@@ -111,36 +153,100 @@ accumulate(uint32_t * const p)
 		if (memcmp(VSL_DATA(p), tp->rec_data, l))
 			continue;
 		tp->count += 1.0;
-		break;
-	}
-	if (tp == NULL) {
-		ntop++;
-		tp = calloc(sizeof *tp, 1);
-		assert(tp != NULL);
-		tp->rec_data = calloc(l + 1, 1);
-		assert(tp->rec_data != NULL);
-		tp->hash = u;
-		tp->count = 1.0;
-		tp->clen = l;
-		tp->tag = t;
-		memcpy(tp->rec_data, VSL_DATA(p), l);
-		tp->rec_data[l] = '\0';
-		VTAILQ_INSERT_TAIL(&top_head, tp, list);
+		return;
 	}
+	ntop++;
+	tp = calloc(sizeof *tp, 1);
+	assert(tp != NULL);
+	tp->rec_data = calloc(l + 1, 1);
+	assert(tp->rec_data != NULL);
+	tp->hash = u;
+	tp->count = 1.0;
+	tp->clen = l;
+	tp->tag = t;
+	memcpy(tp->rec_data, VSL_DATA(p), l);
+	tp->rec_data[l] = '\0';
+	VTAILQ_INSERT_HEAD(th, tp, list);
+	if (ntop > top_nhash * 2)
+		top_rehash(top_nhash * 2);
+}
+
+/*--------------------------------------------------------------------
+ * Put (up to) the 'k' highest counts in top_rank[], highest first.
+ */
+
+static void
+rank_down(unsigned n, unsigned u)
+{
+	struct top *tp;
+	unsigned v;
+
 	while (1) {
-		tp2 = VTAILQ_PREV(tp, tophead, list);
-		if (tp2 == NULL || tp2->count >= tp->count)
+		v = u * 2 + 1;
+		if (v >= n)
 			break;
-		VTAILQ_REMOVE(&top_head, tp2, list);
-		VTAILQ_INSERT_AFTER(&top_head, tp, tp2, list);
-	}
-	while (1) {
-		tp2 = VTAILQ_NEXT(tp, list);
-		if (tp2 == NULL || tp2->count <= tp->count)
+		if (v + 1 < n && top_rank[v + 1]->count < top_rank[v]->count)
+			v++;
+		if (top_rank[u]->count <= top_rank[v]->count)
 			break;
-		VTAILQ_REMOVE(&top_head, tp2, list);
-		VTAILQ_INSERT_BEFORE(tp, tp2, list);
+		tp = top_rank[u];
+		top_rank[u] = top_rank[v];
+		top_rank[v] = tp;
+		u = v;
+	}
+}
+
+static int
+rank_cmp(const void *a, const void *b)
+{
+	const struct top * const *ta = a, * const *tb = b;
+
+	if ((*ta)->count > (*tb)->count)
+		return (-1);
+	return ((*ta)->count < (*tb)->count);
+}
+
+static unsigned
+rank(unsigned k)
+{
+	struct top *tp;
+	unsigned u, v, n;
+
+	if (k > ntop)
+		k = ntop;
+	if (top_nrank < k) {
+		free(top_rank);
+		top_nrank = k;
+		top_rank = calloc(sizeof *top_rank, top_nrank);
+		AN(top_rank);
+	}
+	n = 0;
+	for (u = 0; u < top_nhash; u++) {
+		VTAILQ_FOREACH(tp, &top_hash[u], list) {
+			tp->ranked = 0;
+			if (k == 0)
+				continue;
+			if (n < k) {
+				/* Fill the min-heap */
+				top_rank[n++] = tp;
+				for (v = n - 1; v > 0 &&
+				    top_rank[v]->count <
+				    top_rank[(v - 1) / 2]->count;
+				    v = (v - 1) / 2) {
+					top_rank[v] = top_rank[(v - 1) / 2];
+					top_rank[(v - 1) / 2] = tp;
+				}
+			} else if (tp->count > top_rank[0]->count) {
+				/* Bigger than the smallest, replace it */
+				top_rank[0] = tp;
+				rank_down(n, 0);
+			}
+		}
 	}
+	qsort(top_rank, n, sizeof *top_rank, rank_cmp);
+	for (u = 0; u < n; u++)
+		top_rank[u]->ranked = 1;
+	return (n);
 }
 
 static void
@@ -152,6 +258,7 @@ update(const struct VSM_data *vd, int period)
 	static time_t last = 0;
 	static unsigned n;
 	time_t now;
+	unsigned u, nrank;
 
 	now = time(NULL);
 	if (now == last)
@@ -164,23 +271,28 @@ update(const struct VSM_data *vd, int period)
 	AC(erase());
 	AC(mvprintw(0, 0, "%*s", COLS - 1, VSM_Name(vd)));
 	AC(mvprintw(0, 0, "list length %u", ntop));
-	VTAILQ_FOREACH_SAFE(tp, &top_head, list, tp2) {
-		if (++l < LINES) {
-			len = tp->clen;
-			if (len > COLS - 20)
-				len = COLS - 20;
-			AC(mvprintw(l, 0, "%9.2f %-*.*s %*.*s\n",
-			    tp->count, maxfieldlen, maxfieldlen,
-			    VSL_tags[tp->tag],
-			    len, len, tp->rec_data));
-			t = tp->count;
-		}
-		tp->count += (1.0/3.0 - tp->count) / (double)n;
-		if (tp->count * 10 < t || l > LINES * 10) {
-			VTAILQ_REMOVE(&top_head, tp, list);
-			free(tp->rec_data);
-			free(tp);
-			ntop--;
+	nrank = rank(LINES * 10);
+	for (u = 0; u < nrank && ++l < LINES; u++) {
+		tp = top_rank[u];
+		len = tp->clen;
+		if (len > COLS - 20)
+			len = COLS - 20;
+		AC(mvprintw(l, 0, "%9.2f %-*.*s %*.*s\n",
+		    tp->count, maxfieldlen, maxfieldlen,
+		    VSL_tags[tp->tag],
+		    len, len, tp->rec_data));
+		t = tp->count;
+	}
+	/* Decay, and drop what is too far down the list */
+	for (u = 0; u < top_nhash; u++) {
+		VTAILQ_FOREACH_SAFE(tp, &top_hash[u], list, tp2) {
+			tp->count += (1.0/3.0 - tp->count) / (double)n;
+			if (tp->count * 10 < t || !tp->ranked) {
+				VTAILQ_REMOVE(&top_hash[u], tp, list);
+				free(tp->rec_data);
+				free(tp);
+				ntop--;
+			}
 		}
 	}
 	AC(refresh());
@@ -276,9 +388,12 @@ do_curses(struct VSM_data *vd, int period)
 static void
 dump(void)
 {
-	struct top *tp, *tp2;
+	struct top *tp;
+	unsigned u, n;
 
-	VTAILQ_FOREACH_SAFE(tp, &top_head, list, tp2) {
+	n = rank(ntop);
+	for (u = 0; u < n; u++) {
+		tp = top_rank[u];
 		if (tp->count <= 1.0)
 			break;
 		printf("%9.2f %s %*.*s\n",
@@ -37,5 +37,6 @@ void VCC_VMOD_dir(struct vcc *, const char *str);
 void VCC_Err_Unref(struct vcc *tl, unsigned u);
 void VCC_Allow_InlineC(struct vcc *tl, unsigned u);
 void VCC_Unsafe_Path(struct vcc *tl, unsigned u);
+void VCC_Profile(struct vcc *tl, unsigned u);
 
 char *VCC_Compile(const struct vcc *, struct vsb *sb, const char *b);
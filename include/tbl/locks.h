@@ -47,9 +47,15 @@ LOCK(cli)
 LOCK(ban)
 LOCK(vbp)
 LOCK(backend)
+LOCK(vbw)
+LOCK(dns)
 LOCK(vcapace)
 LOCK(nbusyobj)
 LOCK(busyobj)
 LOCK(mempool)
 LOCK(vxid)
+LOCK(gzc)
+LOCK(stv)
+LOCK(tier)
+LOCK(ofl)
 /*lint -restore */
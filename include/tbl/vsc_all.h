@@ -51,6 +51,18 @@ VSC_DO(SMF, smf, VSC_TYPE_SMF)
 #undef VSC_DO_SMF
 VSC_DONE(SMF, smf, VSC_TYPE_SMF)
 
+VSC_DO(SMP, smp, VSC_TYPE_SMP)
+#define VSC_DO_SMP
+#include "tbl/vsc_fields.h"
+#undef VSC_DO_SMP
+VSC_DONE(SMP, smp, VSC_TYPE_SMP)
+
+VSC_DO(STV, stv, VSC_TYPE_STV)
+#define VSC_DO_STV
+#include "tbl/vsc_fields.h"
+#undef VSC_DO_STV
+VSC_DONE(STV, stv, VSC_TYPE_STV)
+
 VSC_DO(VBE, vbe, VSC_TYPE_VBE)
 #define VSC_DO_VBE
 #include "tbl/vsc_fields.h"
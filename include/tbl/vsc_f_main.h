@@ -292,6 +292,23 @@ VSC_F(n_objecthead,		uint64_t, 1, 'i',
     "N struct objecthead",
 	""
 )
+VSC_F(n_vary_1,		uint64_t, 1, 'i',
+    "N objecthead with 1 variant",
+	"Objectheads with one object with a Vary: header in the"
+	" variant index."
+)
+VSC_F(n_vary_2,		uint64_t, 1, 'i',
+    "N objecthead with 2-7 variants",
+	""
+)
+VSC_F(n_vary_8,		uint64_t, 1, 'i',
+    "N objecthead with 8-63 variants",
+	""
+)
+VSC_F(n_vary_64,		uint64_t, 1, 'i',
+    "N objecthead with 64+ variants",
+	""
+)
 VSC_F(n_waitinglist,		uint64_t, 1, 'i',
     "N struct waitinglist",
 	""
@@ -365,6 +382,33 @@ VSC_F(sess_herd,		uint64_t, 1, 'a',
     "Session herd",
 	""
 )
+VSC_F(sess_coalesce,		uint64_t, 1, 'a',
+    "Responses held for the next pipelined response",
+	"Responses which went out in the same writev(2) as the response"
+	" to the next pipelined request, see the pipeline_coalesce"
+	" parameter."
+)
+VSC_F(sess_fastread,		uint64_t, 1, 'a',
+    "Requests read without waiting",
+	"Requests which had arrived when the worker thread first tried"
+	" to read them, so that no poll(2) on the client was needed."
+)
+
+VSC_F(sess_offload,		uint64_t, 1, 'a',
+    "Offloaded deliveries",
+	"Deliveries where the rest of the body was handed to the"
+	" offload thread, see the offload_threshold parameter."
+)
+
+VSC_F(sess_offload_bytes,	uint64_t, 1, 'a',
+    "Offloaded body bytes",
+	"Body bytes sent by the offload thread."
+)
+
+VSC_F(n_offload,		uint64_t, 0, 'i',
+    "Offloaded deliveries in progress",
+	""
+)
 
 VSC_F(shm_records,		uint64_t, 0, 'a',
     "SHM records",
@@ -516,6 +560,16 @@ VSC_F(dir_dns_cache_full,	uint64_t, 0, 'a',
     "DNS director full dnscache",
 	""
 )
+VSC_F(dir_dns_stale,		uint64_t, 0, 'a',
+    "DNS director stale lookups used",
+	"Expired lookups used while the name is looked up again,"
+	" or because that failed."
+)
+VSC_F(dir_dns_pending,		uint64_t, 0, 'a',
+    "DNS director names not looked up yet",
+	"Requests failed at once because their name had not been"
+	" looked up yet.  The lookup is started in the background."
+)
 
 VSC_F(vmods,			uint64_t, 0, 'i',
     "Loaded VMODs",
@@ -530,6 +584,29 @@ VSC_F(n_gunzip,			uint64_t, 0, 'a',
     "Gunzip operations",
 	""
 )
+VSC_F(gunzip_cache_hit,		uint64_t, 0, 'c',
+    "Gunzip operations avoided",
+	"Count of deliveries to clients not accepting gzip, which used a"
+	" cached gunzip'ed copy of the object instead of gunzipping it."
+	"  See also param gunzip_cache."
+)
+VSC_F(gunzip_cache_insert,	uint64_t, 0, 'c',
+    "Gunzip cache inserts",
+	"Count of gunzip'ed copies of objects added to the gunzip cache."
+)
+VSC_F(gunzip_cache_nuked,	uint64_t, 0, 'c',
+    "Gunzip'ed copies evicted",
+	"Count of gunzip'ed copies evicted to keep the gunzip cache"
+	" within param gunzip_cache."
+)
+VSC_F(gunzip_cache_objs,	uint64_t, 0, 'g',
+    "Gunzip'ed copies cached",
+	"Number of gunzip'ed copies of objects in the gunzip cache."
+)
+VSC_F(gunzip_cache_bytes,	uint64_t, 0, 'g',
+    "Gunzip cache bytes",
+	"Number of bytes used by the gunzip cache."
+)
 
 /**********************************************************************/
 
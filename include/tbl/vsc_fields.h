@@ -141,6 +141,93 @@ VSC_F(g_smf_large,		uint64_t, 0, 'i',
 
 /**********************************************************************/
 
+#ifdef VSC_DO_SMP
+VSC_F(c_seg_close,		uint64_t, 0, 'a',
+    "Segments closed",
+	""
+)
+VSC_F(c_seg_close_usec,		uint64_t, 0, 'a',
+    "Time spent closing segments (us)",
+	"Time allocating threads spent closing and opening segments,"
+	" including stalls on the writeback budget."
+)
+VSC_F(c_wb_stall,		uint64_t, 0, 'a',
+    "Writeback budget stalls",
+	"Number of times a segment close had to wait for the writeback"
+	" thread to bring the dirty backlog under budget."
+)
+VSC_F(c_wb_sync,		uint64_t, 0, 'a',
+    "Writeback range syncs",
+	""
+)
+VSC_F(c_wb_bytes,		uint64_t, 0, 'a',
+    "Writeback bytes synced",
+	""
+)
+VSC_F(c_wb_seglist,		uint64_t, 0, 'a',
+    "Segment list writes",
+	"Number of times the writeback thread wrote both copies of"
+	" the segment list.  Several segment closes may share one write."
+)
+VSC_F(c_wb_usec,		uint64_t, 0, 'a',
+    "Time spent in writeback (us)",
+	""
+)
+VSC_F(g_wb_dirty,		uint64_t, 0, 'i',
+    "Writeback backlog bytes",
+	"Bytes queued for, but not yet synced by, the writeback thread."
+)
+VSC_F(g_load_pending,		uint64_t, 0, 'i',
+    "Segments waiting to be loaded",
+	"Segments found at startup whose objects are not yet all in the"
+	" cache.  Lookups for those objects go to the backend meanwhile."
+)
+VSC_F(c_load_seg,		uint64_t, 0, 'a',
+    "Segments loaded",
+	""
+)
+VSC_F(c_load_obj,		uint64_t, 0, 'a',
+    "Objects loaded",
+	""
+)
+#endif
+
+/**********************************************************************/
+
+#ifdef VSC_DO_STV
+VSC_F(c_route,			uint64_t, 0, 'a',
+    "Objects routed here first",
+	"Objects for which the storage router picked this stevedore as"
+	" the preferred tier."
+)
+VSC_F(c_placed,			uint64_t, 0, 'a',
+    "Objects placed by router",
+	"Objects the storage router allocated in this stevedore, either"
+	" as the preferred tier or after spilling over from an earlier one."
+)
+VSC_F(c_spill,			uint64_t, 0, 'a',
+    "Objects spilled over",
+	"Objects which did not fit in this stevedore and were passed on"
+	" to the next tier."
+)
+VSC_F(c_demote,			uint64_t, 0, 'a',
+    "Objects demoted",
+	"Objects LRU nuked from this stevedore which were copied to the"
+	" next tier instead of being discarded."
+)
+VSC_F(c_promote,		uint64_t, 0, 'a',
+    "Objects promoted",
+	"Popular objects copied into this stevedore from the next tier."
+)
+VSC_F(c_tier_fail,		uint64_t, 0, 'a',
+    "Tier copies failed",
+	"Demotions or promotions which could not get space in this"
+	" stevedore."
+)
+#endif
+
+/**********************************************************************/
+
 #ifdef VSC_DO_VBE
 
 VSC_F(vcls,			uint64_t, 0, 'i',
@@ -151,6 +238,44 @@ VSC_F(happy,			uint64_t, 0, 'b',
     "Happy health probes",
 	""
 )
+VSC_F(connects,			uint64_t, 0, 'c',
+    "Connects",
+	"Connections opened, by fetches and by the warm-up thread."
+)
+VSC_F(connect_usec,		uint64_t, 0, 'c',
+    "Connect time",
+	"Total time spent connecting, in microseconds."
+)
+VSC_F(warm,			uint64_t, 0, 'g',
+    "Warm connections",
+	"Idle connections opened ahead of use."
+)
+VSC_F(warm_hit,			uint64_t, 0, 'c',
+    "Warm connections used",
+	""
+)
+VSC_F(warm_miss,		uint64_t, 0, 'c',
+    "Warm connections missing",
+	"Fetches which had to connect because no warm connection"
+	" was available."
+)
+VSC_F(warm_fail,		uint64_t, 0, 'c',
+    "Warm connects failed",
+	""
+)
+VSC_F(idle_stale,		uint64_t, 0, 'c',
+    "Idle connections closed by backend",
+	"Idle connections evicted because the backend closed them."
+)
+VSC_F(idle_timeout,		uint64_t, 0, 'c',
+    "Idle connections timed out",
+	"Idle connections evicted after backend_idle_timeout."
+)
+VSC_F(ttfb_ewma,		uint64_t, 0, 'g',
+    "Time to first byte average (us)",
+	"Moving average of the time from sending the request to the"
+	" first bytes of the response, in microseconds."
+)
 
 #endif
 
@@ -33,6 +33,8 @@
 #define VSC_TYPE_MAIN		""
 #define VSC_TYPE_SMA		"SMA"
 #define VSC_TYPE_SMF		"SMF"
+#define VSC_TYPE_SMP		"SMP"
+#define VSC_TYPE_STV		"STV"
 #define VSC_TYPE_VBE		"VBE"
 #define VSC_TYPE_LCK		"LCK"
 #define VSC_TYPE_MEMPOOL	"MEMPOOL"
@@ -37,6 +37,9 @@
  * and once VSL_Dispatch()/VSL_NextSLT() will indicate EOF by returning -2.
  * Another file can then be opened with VSL_Arg() and processed.
  *
+ * Files can be in the old format, the raw records, or in the compressed
+ * format written with VSL_Write().
+ *
  */
 
 #ifndef VAPI_VSL_H_INCLUDED
@@ -125,6 +128,47 @@ int VSL_Dispatch(struct VSM_data *vd, VSL_handler_f *func, void *priv);
 	 *	-2:	End of file (-r) / -k arg exhausted / "done"
 	 */
 
+struct VSL_transaction {
+	unsigned		vxid;
+	unsigned		spec;	/* VSL_S_* flags */
+	unsigned		flags;
+#define VSL_T_COMPLETE	(1 << 0)	/* The end record was seen */
+#define VSL_T_EVICTED	(1 << 1)	/* Pushed out of the buffer */
+#define VSL_T_OVERRUN	(1 << 2)	/* Log overrun, records lost */
+	uint64_t		bitmap;
+	uint32_t		*b;	/* First record */
+	uint32_t		*e;	/* End of last record */
+};
+	/*
+	 * A transaction is all the records logged with one vxid, in the
+	 * order they were logged.  Walk them with:
+	 *
+	 *	for (p = t->b; p < t->e; p = VSL_NEXT(p))
+	 *
+	 * and use VSL_TAG(), VSL_LEN() and VSL_DATA() on each.
+	 *
+	 * bitmap is the union of the -m bitmaps of the records.
+	 */
+
+typedef int VSL_trans_f(void *priv, const struct VSL_transaction *t);
+
+int VSL_DispatchTrans(struct VSM_data *vd, VSL_trans_f *func, void *priv);
+	/*
+	 * Like VSL_Dispatch(), but collect the filtered records by vxid
+	 * and call func(priv, ...) once per transaction, when its end
+	 * record (ReqEnd, SessClose, BackendClose, BackendReuse) arrives.
+	 *
+	 * Records without a vxid are delivered one at a time.
+	 *
+	 * Open transactions are buffered up to a fixed total size, past
+	 * that the oldest are delivered early with VSL_T_EVICTED.  If the
+	 * log wrapped under us, or the VSL chunk was abandoned, the open
+	 * transactions get VSL_T_OVERRUN.  At end of file all of the open
+	 * transactions are delivered.
+	 *
+	 * Return values as for VSL_Dispatch()
+	 */
+
 int VSL_NextSLT(struct VSM_data *lh, uint32_t **pp, uint64_t *bitmap);
 	/*
 	 * Return raw pointer to next filtered VSL record.
@@ -150,6 +194,42 @@ int VSL_Name2Tag(const char *name, int l);
 	 *	-2:	Multiple tags match substring
 	 */
 
+struct VSL_writer;
+
+struct VSL_writer *VSL_WriterNew(int fd);
+	/*
+	 * Start writing records to fd, in the compressed format.
+	 * If fd is a file which already has records in the old
+	 * format, they will be appended in that format.
+	 *
+	 * Return NULL on failure, with errno set.
+	 */
+
+int VSL_Write(struct VSL_writer *w, const uint32_t *p);
+	/*
+	 * Add a record, as returned by VSL_NextSLT().  Records are
+	 * written out in blocks.
+	 *
+	 * Return values:
+	 *	0:	OK
+	 *	-1:	write(2) failed, errno is set.
+	 */
+
+int VSL_WriteFlush(struct VSL_writer *w);
+	/*
+	 * Write out the records added so far.  Call this when
+	 * VSL_NextSLT() runs dry, so that the file keeps up.
+	 *
+	 * Return values as for VSL_Write()
+	 */
+
+int VSL_WriterDelete(struct VSL_writer *w);
+	/*
+	 * Flush and free the writer.  fd is not closed.
+	 *
+	 * Return values as for VSL_Write()
+	 */
+
 extern const char *VSL_tags[256];
 	/*
 	 * Tag to string array.  Contains NULL for invalid tags.
@@ -114,6 +114,14 @@
 	"\tSwitch to the named configuration immediately.",		\
 	1, 1
 
+#define CLI_VCL_PROFILE							\
+	"vcl.profile",							\
+	"vcl.profile [<configname>]",					\
+	"\tShow where the time goes in the named or the active\n"	\
+	"\tconfiguration, which must have been compiled with the\n"	\
+	"\tvcc_profile parameter on.",					\
+	0, 1
+
 #define CLI_PARAM_SHOW							\
 	"param.show",							\
 	"param.show [-l] [<param>]",					\
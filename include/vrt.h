@@ -72,6 +72,7 @@ struct vrt_backend {
 	double				connect_timeout;
 	double				first_byte_timeout;
 	double				between_bytes_timeout;
+	double				idle_timeout;
 	unsigned			max_connections;
 	unsigned			saintmode_threshold;
 	const struct vrt_backend_probe	*probe;
@@ -93,6 +94,24 @@ struct vrt_dir_random {
 	const struct vrt_dir_random_entry	*members;
 };
 
+/*
+ * A director with consistent hashing selection
+ */
+
+struct vrt_dir_chash_entry {
+	int					host;
+	unsigned				weight;
+};
+
+struct vrt_dir_chash {
+	const char				*name;
+	unsigned				retries;
+	unsigned				vnodes;
+	unsigned				load_factor;
+	unsigned				nmember;
+	const struct vrt_dir_chash_entry	*members;
+};
+
 /*
  * A director with round robin selection
  */
@@ -137,15 +156,47 @@ struct vrt_ref {
 	const char	*token;
 };
 
+/*
+ * VCL profiling, only used if compiled with the vcc_profile parameter on.
+ * The VSM segment holds a struct vrt_prof for each entry in the ref
+ * table, followed by one for each subroutine.
+ */
+
+#define VRT_PROF_CLASS		"VCLprof"
+
+struct vrt_prof;
+
+struct vrt_prof_frame {
+	unsigned		ref;
+	unsigned long long	t0;
+};
+
+void VRT_prof_count(struct req *, struct vrt_prof *, unsigned);
+void VRT_prof_enter(struct req *, struct vrt_prof_frame *,
+    struct vrt_prof *);
+void VRT_prof_leave(struct req *, const struct vrt_prof_frame *,
+    struct vrt_prof *, unsigned);
+
 /* ACL related */
 #define VRT_ACL_MAXADDR		16	/* max(IPv4, IPv6) */
 
 void VRT_acl_log(struct req *, const char *msg);
 
 /* Regexp related */
-void VRT_re_init(void **, const char *);
+#define VRT_RE_PCRE		0	/* Anything else */
+#define VRT_RE_SUBSTR		1	/* "foo" */
+#define VRT_RE_PREFIX		2	/* "^foo" */
+#define VRT_RE_SUFFIX		3	/* "foo$" */
+#define VRT_RE_EXACT		4	/* "^foo$" */
+#define VRT_RE_KIND		0x7
+#define VRT_RE_ICASE		0x8	/* "(?i)..." */
+
+void VRT_re_init(void **, const char *, unsigned kind, const char *lit);
 void VRT_re_fini(void *);
 int VRT_re_match(struct req *, const char *, void *re);
+void VRT_re_set_init(void **, const char * const *);
+void VRT_re_set_fini(void *);
+int VRT_re_set_match(struct req *, const char *, void *set);
 const char *VRT_regsub(struct req *, int all, const char *,
     void *, const char *);
 
@@ -97,11 +97,10 @@ VSL_Delete(struct VSM_data *vd)
 	vd->vsl = NULL;
 	CHECK_OBJ_NOTNULL(vsl, VSL_MAGIC);
 
-	if (vsl->r_fd > STDIN_FILENO)
-		(void)close(vsl->r_fd);
+	vsl_file_close(vsl);
 	vbit_destroy(vsl->vbm_supress);
 	vbit_destroy(vsl->vbm_select);
-	free(vsl->rbuf);
+	vsl_trans_delete(vsl);
 	FREE_OBJ(vsl);
 }
 
@@ -138,6 +137,7 @@ vsl_open(struct VSM_data *vd)
 	vsl->log_start = vsl->vf.b;
 	vsl->log_end = vsl->vf.e;
 	vsl->log_ptr = vsl->log_start + 1;
+	vsl->lap_seq = vsl->log_start[0];
 	if (!vsl->d_opt) {
 		while (*vsl->log_ptr != VSL_ENDMARKER)
 			vsl->log_ptr = VSL_NEXT(vsl->log_ptr);
@@ -174,31 +174,11 @@ static int
 vsl_nextslt(struct VSM_data *vd, uint32_t **pp)
 {
 	struct vsl *vsl = vsl_Setup(vd);
-	unsigned l;
 	uint32_t t;
-	int i;
 
 	*pp = NULL;
-	if (vsl->r_fd != -1) {
-		assert(vsl->rbuflen >= 8);
-		i = read(vsl->r_fd, vsl->rbuf, 8);
-		if (i == 0)
-			return (-2);
-		if (i != 8)
-			return (-1);
-		l = 2 + VSL_WORDS(VSL_LEN(vsl->rbuf));
-		if (vsl->rbuflen < l) {
-			l += 256;
-			vsl->rbuf = realloc(vsl->rbuf, l * 4L);
-			assert(vsl->rbuf != NULL);
-			vsl->rbuflen = l;
-		}
-		i = read(vsl->r_fd, vsl->rbuf + 2, l * 4L - 8L);
-		if (i != (l * 4L - 8L))
-			return (-1);
-		*pp = vsl->rbuf;
-		return (1);
-	}
+	if (vsl->r_fd != -1)
+		return (vsl_file_next(vsl, pp));
 
 	if (vsl->log_ptr == NULL && vsl_open(vd))
 		return (0);
@@ -213,6 +193,7 @@ vsl_nextslt(struct VSM_data *vd, uint32_t **pp)
 			if (vsl->log_ptr == vsl->log_start + 1)
 				return (-1);
 			vsl->log_ptr = vsl->log_start + 1;
+			vsl->lap_seq = vsl->log_start[0];
 			continue;
 		}
 
@@ -221,6 +202,7 @@ vsl_nextslt(struct VSM_data *vd, uint32_t **pp)
 			    vsl->last_seq != vsl->log_start[0]) {
 				/* ENDMARKER not at front and seq wrapped */
 				vsl->log_ptr = vsl->log_start + 1;
+				vsl->lap_seq = vsl->log_start[0];
 				continue;
 			}
 			return (0);
@@ -234,14 +216,71 @@ vsl_nextslt(struct VSM_data *vd, uint32_t **pp)
 		if (vsl->log_ptr == vsl->log_start + 1)
 			vsl->last_seq = vsl->log_start[0];
 
+		if (vsl->log_start[0] - vsl->lap_seq > 1) {
+			/*
+			 * The writer has wrapped twice since we did, so it
+			 * has overwritten records we never got to see.
+			 */
+			vsl->overruns++;
+			vsl->lap_seq = vsl->log_start[0] - 1;
+		}
+
 		*pp = (void*)(uintptr_t)vsl->log_ptr; /* Loose volatile */
 		vsl->log_ptr = VSL_NEXT(vsl->log_ptr);
 		return (1);
 	}
 }
 
+/*--------------------------------------------------------------------
+ * Does the record get past -i, -x, -b, -c, -I and -X ?
+ */
+
+static int
+vsl_match(const struct vsl *vsl, const uint32_t *p)
+{
+	unsigned char t;
+	int i;
+
+	t = VSL_TAG(p);
+	if (vbit_test(vsl->vbm_select, t))
+		return (1);
+	if (vbit_test(vsl->vbm_supress, t))
+		return (0);
+	if (vsl->b_opt && !VSL_BACKEND(p))
+		return (0);
+	if (vsl->c_opt && !VSL_CLIENT(p))
+		return (0);
+	if (vsl->regincl != NULL) {
+		i = VRE_exec(vsl->regincl, VSL_DATA(p), VSL_LEN(p),
+		    0, 0, NULL, 0, NULL);
+		return (i != VRE_ERROR_NOMATCH);
+	}
+	if (vsl->regexcl != NULL) {
+		i = VRE_exec(vsl->regexcl, VSL_DATA(p), VSL_LEN(p),
+		    0, 0, NULL, 0, NULL);
+		return (i == VRE_ERROR_NOMATCH);
+	}
+	return (1);
+}
+
+/*--------------------------------------------------------------------*/
+
 int
 VSL_NextSLT(struct VSM_data *vd, uint32_t **pp, uint64_t *bits)
+{
+
+	return (vsl_next(vd, pp, bits, NULL, NULL));
+}
+
+/*
+ * Like VSL_NextSLT(), but records for which 'force' returns non-zero
+ * are returned even when the filters say no, with '*forced' set.
+ * They do not count for -s and -k either.
+ */
+
+int
+vsl_next(struct VSM_data *vd, uint32_t **pp, uint64_t *bits,
+    vsl_force_f *force, int *forced)
 {
 	struct vsl *vsl = vsl_Setup(vd);
 	uint32_t *p;
@@ -252,6 +291,8 @@ VSL_NextSLT(struct VSM_data *vd, uint32_t **pp, uint64_t *bits)
 
 	if (bits != NULL)
 		*bits = 0;
+	if (forced != NULL)
+		*forced = 0;
 
 	while (1) {
 		i = vsl_nextslt(vd, &p);
@@ -266,24 +307,13 @@ VSL_NextSLT(struct VSM_data *vd, uint32_t **pp, uint64_t *bits)
 		}
 
 		t = VSL_TAG(p);
-		if (vbit_test(vsl->vbm_select, t)) {
-			/* nothing */
-		} else if (vbit_test(vsl->vbm_supress, t)) {
-			continue;
-		} else if (vsl->b_opt && !VSL_BACKEND(p)) {
-			continue;
-		} else if (vsl->c_opt && !VSL_CLIENT(p)) {
-			continue;
-		} else if (vsl->regincl != NULL) {
-			i = VRE_exec(vsl->regincl, VSL_DATA(p), VSL_LEN(p),
-			    0, 0, NULL, 0, NULL);
-			if (i == VRE_ERROR_NOMATCH)
-				continue;
-		} else if (vsl->regexcl != NULL) {
-			i = VRE_exec(vsl->regexcl, VSL_DATA(p), VSL_LEN(p),
-			    0, 0, NULL, 0, NULL);
-			if (i != VRE_ERROR_NOMATCH)
+		if (!vsl_match(vsl, p)) {
+			if (force == NULL || !force(p))
 				continue;
+			AN(forced);
+			*forced = 1;
+			*pp = p;
+			return (1);
 		}
 
 		if (vsl->skip) {
@@ -55,11 +55,17 @@ struct vsl {
 	volatile uint32_t	*log_ptr;
 
 	volatile uint32_t	last_seq;
+	uint32_t		lap_seq;	/* seq when we last wrapped */
+	unsigned		overruns;	/* times we were lapped */
 
 	/* for -r option */
 	int			r_fd;
-	unsigned		rbuflen;
-	uint32_t		*rbuf;
+	char			*r_map;		/* mmap'ed file, or */
+	char			*r_ahead;	/* read-ahead buffer */
+#define VSL_R_AHEAD		(256 * 1024)
+	size_t			r_len;
+	size_t			r_off;
+	struct vsl_zr		*r_zr;		/* compressed format */
 
 	int			b_opt;
 	int			c_opt;
@@ -86,6 +92,20 @@ struct vsl {
 
 	unsigned long		skip;
 	unsigned long		keep;
+
+	/* For VSL_DispatchTrans() */
+	struct vsl_trans	*trans;
 };
 
 struct vsl *vsl_Setup(struct VSM_data *vd);
+typedef int vsl_force_f(const uint32_t *p);
+int vsl_next(struct VSM_data *vd, uint32_t **pp, uint64_t *bits,
+    vsl_force_f *force, int *forced);
+
+/* vsl_file.c */
+int vsl_file_open(struct VSM_data *vd, const char *fn);
+int vsl_file_next(struct vsl *vsl, uint32_t **pp);
+void vsl_file_close(struct vsl *vsl);
+
+/* vsl_trans.c */
+void vsl_trans_delete(struct vsl *vsl);
@@ -80,30 +80,6 @@ VSL_Name2Tag(const char *name, int l)
 }
 
 
-/*--------------------------------------------------------------------*/
-
-static int
-vsl_r_arg(struct VSM_data *vd, const char *opt)
-{
-	struct vsl *vsl = vsl_Setup(vd);
-
-	if (vsl->r_fd > STDIN_FILENO)
-		(void)close(vsl->r_fd);
-	if (!strcmp(opt, "-"))
-		vsl->r_fd = STDIN_FILENO;
-	else
-		vsl->r_fd = open(opt, O_RDONLY);
-	if (vsl->r_fd < 0)
-		return (vsm_diag(vd,
-		    "Could not open %s: %s", opt, strerror(errno)));
-	if (vsl->rbuflen == 0) {
-		vsl->rbuflen = BUFSIZ;
-		vsl->rbuf = malloc(vsl->rbuflen);
-		AN(vsl->rbuf);
-	}
-	return (1);
-}
-
 /*--------------------------------------------------------------------*/
 
 static int
@@ -268,7 +244,7 @@ VSL_Arg(struct VSM_data *vd, int arg, const char *opt)
 	case 'i': case 'x': return (vsl_ix_arg(vd, opt, arg));
 	case 'k': return (vsl_k_arg(vd, opt));
 	case 'n': return (VSM_n_Arg(vd, opt));
-	case 'r': return (vsl_r_arg(vd, opt));
+	case 'r': return (vsl_file_open(vd, opt));
 	case 's': return (vsl_s_arg(vd, opt));
 	case 'I': case 'X': return (vsl_IX_arg(vd, opt, arg));
 	case 'm': return (vsl_m_arg(vd, opt));
@@ -0,0 +1,495 @@
+/*-
+ * Copyright (c) 2013 Varnish Software AS
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Log files, as written by "varnishlog -w" and read with "-r".
+ *
+ * The old format is the records, back to back, as they were in the
+ * shared memory.
+ *
+ * The compressed format starts with the eight bytes of VSLZ_FMAGIC,
+ * followed by blocks, each of which is a struct vslz_block header and
+ * zlen bytes of raw deflate data holding rlen bytes of records.  A
+ * block which would not shrink is stored as is.  The header is an
+ * index of the block: which tags, which kinds of transaction and
+ * which range of vxids it holds, and when its records were captured.
+ * The reader uses it to skip blocks which cannot hold any record the
+ * filters would let through, without inflating them.
+ *
+ * The file header may reappear between blocks, so appending to a
+ * file and concatenating files both work.
+ *
+ * Everything is in host byte order, like the old format.
+ *
+ * Regular files are read with mmap(2), anything else through a
+ * read-ahead buffer.
+ */
+
+#include "config.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "miniobj.h"
+#include "vas.h"
+#include "vdef.h"
+
+#include "vapi/vsl.h"
+#include "vapi/vsm.h"
+#include "vbm.h"
+#include "vgz.h"
+#include "vre.h"
+#include "vsl_api.h"
+#include "vsm_api.h"
+
+#define VSLZ_FMAGIC		"VSL\0zv1\n"
+#define VSLZ_FMAGICLEN		8
+#define VSLZ_BLOCK		(128 * 1024)	/* Bytes of records */
+
+struct vslz_block {
+	uint32_t		magic;
+#define VSLZ_BMAGIC		0x5a4c5342
+	uint32_t		flags;
+#define VSLZ_F_STORED		(1 << 0)	/* Not compressed */
+	uint32_t		zlen;		/* Bytes after header */
+	uint32_t		rlen;		/* Bytes of records */
+	uint32_t		nrec;
+	uint32_t		spec;		/* VSL_S_* */
+	uint32_t		vxid_lo;
+	uint32_t		vxid_hi;
+	uint64_t		t_first;	/* time(3) of capture */
+	uint64_t		t_last;
+	uint64_t		tags[4];
+};
+
+#define VSLZ_TAG_SET(hd, t)	((hd)->tags[(t) >> 6] |= 1ULL << ((t) & 63))
+#define VSLZ_TAG_ISSET(hd, t)	((hd)->tags[(t) >> 6] & (1ULL << ((t) & 63)))
+
+struct vsl_zr {
+	unsigned		magic;
+#define VSL_ZR_MAGIC		0x3f0b9d17
+	z_stream		z;
+	uint32_t		*buf;
+	uint32_t		*ptr;
+	uint32_t		*end;
+};
+
+struct VSL_writer {
+	unsigned		magic;
+#define VSL_WRITER_MAGIC	0x1c4e7b2d
+	int			fd;
+	int			raw;		/* Old format */
+	z_stream		z;
+	struct vslz_block	hd;
+	char			*buf;
+	size_t			len;
+	char			*obuf;		/* header + data */
+};
+
+/*--------------------------------------------------------------------
+ * Get len bytes at the read position, without consuming them.
+ */
+
+static const char *
+vsl_fill(struct vsl *vsl, size_t len)
+{
+	ssize_t i;
+
+	if (vsl->r_map != NULL) {
+		if (vsl->r_len - vsl->r_off < len)
+			return (NULL);
+		return (vsl->r_map + vsl->r_off);
+	}
+	assert(len <= VSL_R_AHEAD);
+	if (vsl->r_len - vsl->r_off < len && vsl->r_off > 0) {
+		memmove(vsl->r_ahead, vsl->r_ahead + vsl->r_off,
+		    vsl->r_len - vsl->r_off);
+		vsl->r_len -= vsl->r_off;
+		vsl->r_off = 0;
+	}
+	while (vsl->r_len - vsl->r_off < len) {
+		i = read(vsl->r_fd, vsl->r_ahead + vsl->r_len,
+		    VSL_R_AHEAD - vsl->r_len);
+		if (i < 0 && errno == EINTR)
+			continue;
+		if (i <= 0)
+			return (NULL);
+		vsl->r_len += i;
+	}
+	return (vsl->r_ahead + vsl->r_off);
+}
+
+/* Out of data: clean end of file, or a truncated one ? */
+#define VSL_FILE_END(vsl)	((vsl)->r_off == (vsl)->r_len ? -2 : -1)
+
+/*--------------------------------------------------------------------*/
+
+void
+vsl_file_close(struct vsl *vsl)
+{
+	struct vsl_zr *zr;
+
+	if (vsl->r_map != NULL)
+		AZ(munmap(vsl->r_map, vsl->r_len));
+	vsl->r_map = NULL;
+	free(vsl->r_ahead);
+	vsl->r_ahead = NULL;
+	vsl->r_len = vsl->r_off = 0;
+	if (vsl->r_fd > STDIN_FILENO)
+		(void)close(vsl->r_fd);
+	vsl->r_fd = -1;
+	zr = vsl->r_zr;
+	vsl->r_zr = NULL;
+	if (zr != NULL) {
+		CHECK_OBJ_NOTNULL(zr, VSL_ZR_MAGIC);
+		(void)inflateEnd(&zr->z);
+		free(zr->buf);
+		FREE_OBJ(zr);
+	}
+}
+
+int
+vsl_file_open(struct VSM_data *vd, const char *fn)
+{
+	struct vsl *vsl = vsl_Setup(vd);
+	struct vsl_zr *zr;
+	struct stat st;
+	const char *p;
+	void *m;
+
+	vsl_file_close(vsl);
+	if (!strcmp(fn, "-"))
+		vsl->r_fd = STDIN_FILENO;
+	else
+		vsl->r_fd = open(fn, O_RDONLY);
+	if (vsl->r_fd < 0)
+		return (vsm_diag(vd,
+		    "Could not open %s: %s", fn, strerror(errno)));
+
+	if (!fstat(vsl->r_fd, &st) && S_ISREG(st.st_mode) &&
+	    st.st_size > 0 && (uintmax_t)st.st_size <= SIZE_MAX) {
+		/* Private and writable, callers may scribble on records */
+		m = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE, vsl->r_fd, 0);
+		if (m != MAP_FAILED) {
+			(void)madvise(m, st.st_size, MADV_SEQUENTIAL);
+			vsl->r_map = m;
+			vsl->r_len = st.st_size;
+		}
+	}
+	if (vsl->r_map == NULL) {
+		vsl->r_ahead = malloc(VSL_R_AHEAD);
+		AN(vsl->r_ahead);
+	}
+
+	p = vsl_fill(vsl, VSLZ_FMAGICLEN);
+	if (p != NULL && !memcmp(p, VSLZ_FMAGIC, VSLZ_FMAGICLEN)) {
+		ALLOC_OBJ(zr, VSL_ZR_MAGIC);
+		AN(zr);
+		zr->buf = malloc(VSLZ_BLOCK);
+		AN(zr->buf);
+		AZ(inflateInit2(&zr->z, -15));
+		vsl->r_zr = zr;
+	}
+	return (1);
+}
+
+/*--------------------------------------------------------------------
+ * Can this block hold a record which gets through the filters ?
+ * This is the tag part of VSL_NextSLT(), applied to the index.
+ */
+
+static int
+vsl_zr_want(const struct vsl *vsl, const struct vslz_block *hd)
+{
+	unsigned t;
+	int bc;
+
+	bc = (vsl->b_opt && !(hd->spec & VSL_S_BACKEND)) ||
+	    (vsl->c_opt && !(hd->spec & VSL_S_CLIENT));
+	for (t = 0; t < 256; t++) {
+		if (!VSLZ_TAG_ISSET(hd, t))
+			continue;
+		if (vbit_test(vsl->vbm_select, t))
+			return (1);
+		if (!bc && !vbit_test(vsl->vbm_supress, t))
+			return (1);
+	}
+	return (0);
+}
+
+static int
+vsl_zr_block(struct vsl *vsl, struct vsl_zr *zr)
+{
+	struct vslz_block hd;
+	const char *p;
+	int i;
+
+	while (1) {
+		p = vsl_fill(vsl, VSLZ_FMAGICLEN);
+		if (p == NULL)
+			return (VSL_FILE_END(vsl));
+		if (!memcmp(p, VSLZ_FMAGIC, VSLZ_FMAGICLEN)) {
+			vsl->r_off += VSLZ_FMAGICLEN;
+			continue;
+		}
+		p = vsl_fill(vsl, sizeof hd);
+		if (p == NULL)
+			return (-1);
+		memcpy(&hd, p, sizeof hd);
+		if (hd.magic != VSLZ_BMAGIC || hd.rlen > VSLZ_BLOCK ||
+		    hd.zlen > VSLZ_BLOCK || hd.rlen % 4)
+			return (-1);
+		p = vsl_fill(vsl, sizeof hd + hd.zlen);
+		if (p == NULL)
+			return (-1);
+		vsl->r_off += sizeof hd + hd.zlen;
+		p += sizeof hd;
+		if (!vsl_zr_want(vsl, &hd))
+			continue;
+
+		if (hd.flags & VSLZ_F_STORED) {
+			if (hd.zlen != hd.rlen)
+				return (-1);
+			memcpy(zr->buf, p, hd.rlen);
+		} else {
+			AZ(inflateReset(&zr->z));
+			zr->z.next_in = (void*)(uintptr_t)p;
+			zr->z.avail_in = hd.zlen;
+			zr->z.next_out = (void*)zr->buf;
+			zr->z.avail_out = VSLZ_BLOCK;
+			i = inflate(&zr->z, Z_FINISH);
+			if (i != Z_STREAM_END || zr->z.total_out != hd.rlen)
+				return (-1);
+		}
+		zr->ptr = zr->buf;
+		zr->end = zr->buf + hd.rlen / 4;
+		return (1);
+	}
+}
+
+/*--------------------------------------------------------------------
+ * Return the next record from the file
+ *
+ * Return:
+ *	-2: end of file
+ *	-1: malformed or truncated file
+ *	 1: record available at pp
+ */
+
+int
+vsl_file_next(struct vsl *vsl, uint32_t **pp)
+{
+	struct vsl_zr *zr;
+	const char *p;
+	size_t l;
+	int i;
+
+	zr = vsl->r_zr;
+	if (zr != NULL) {
+		CHECK_OBJ(zr, VSL_ZR_MAGIC);
+		while (zr->ptr >= zr->end) {
+			i = vsl_zr_block(vsl, zr);
+			if (i < 0)
+				return (i);
+		}
+		if (VSL_NEXT(zr->ptr) > zr->end)
+			return (-1);
+		*pp = zr->ptr;
+		zr->ptr = VSL_NEXT(zr->ptr);
+		return (1);
+	}
+
+	p = vsl_fill(vsl, 8);
+	if (p == NULL)
+		return (VSL_FILE_END(vsl));
+	l = 8 + VSL_WORDS(VSL_LEN((const uint32_t *)(const void *)p)) * 4L;
+	p = vsl_fill(vsl, l);
+	if (p == NULL)
+		return (-1);
+	vsl->r_off += l;
+	*pp = (void*)(uintptr_t)p;
+	return (1);
+}
+
+/*--------------------------------------------------------------------
+ * Writing
+ */
+
+static int
+vsl_write_all(int fd, const void *ptr, size_t len)
+{
+	const char *p = ptr;
+	ssize_t i;
+
+	while (len > 0) {
+		i = write(fd, p, len);
+		if (i < 0 && errno == EINTR)
+			continue;
+		if (i < 0)
+			return (-1);
+		p += i;
+		len -= i;
+	}
+	return (0);
+}
+
+struct VSL_writer *
+VSL_WriterNew(int fd)
+{
+	struct VSL_writer *w;
+	struct stat st;
+	char m[VSLZ_FMAGICLEN];
+	int fresh = 1;
+
+	ALLOC_OBJ(w, VSL_WRITER_MAGIC);
+	if (w == NULL)
+		return (NULL);
+	w->fd = fd;
+
+	if (!fstat(fd, &st) && S_ISREG(st.st_mode) && st.st_size > 0 &&
+	    pread(fd, m, sizeof m, 0) == sizeof m) {
+		/* Appending, stick to the format already there */
+		fresh = 0;
+		if (memcmp(m, VSLZ_FMAGIC, sizeof m))
+			w->raw = 1;
+	}
+	if (w->raw)
+		return (w);
+
+	w->buf = malloc(VSLZ_BLOCK);
+	w->obuf = malloc(sizeof w->hd + VSLZ_BLOCK);
+	if (w->buf == NULL || w->obuf == NULL ||
+	    deflateInit2(&w->z, Z_BEST_SPEED, Z_DEFLATED, -15, 8,
+	    Z_DEFAULT_STRATEGY) != Z_OK) {
+		free(w->buf);
+		free(w->obuf);
+		FREE_OBJ(w);
+		errno = ENOMEM;
+		return (NULL);
+	}
+	if (fresh && vsl_write_all(fd, VSLZ_FMAGIC, VSLZ_FMAGICLEN)) {
+		(void)VSL_WriterDelete(w);
+		return (NULL);
+	}
+	return (w);
+}
+
+int
+VSL_WriteFlush(struct VSL_writer *w)
+{
+	struct vslz_block *hd;
+	int i;
+
+	CHECK_OBJ_NOTNULL(w, VSL_WRITER_MAGIC);
+	if (w->raw || w->len == 0)
+		return (0);
+	hd = &w->hd;
+	hd->magic = VSLZ_BMAGIC;
+	hd->rlen = w->len;
+
+	AZ(deflateReset(&w->z));
+	w->z.next_in = (void*)w->buf;
+	w->z.avail_in = w->len;
+	w->z.next_out = (void*)(w->obuf + sizeof *hd);
+	w->z.avail_out = VSLZ_BLOCK;
+	i = deflate(&w->z, Z_FINISH);
+	if (i == Z_STREAM_END && w->z.total_out < w->len) {
+		hd->zlen = w->z.total_out;
+	} else {
+		hd->flags |= VSLZ_F_STORED;
+		hd->zlen = w->len;
+		memcpy(w->obuf + sizeof *hd, w->buf, w->len);
+	}
+	memcpy(w->obuf, hd, sizeof *hd);
+	i = vsl_write_all(w->fd, w->obuf, sizeof *hd + hd->zlen);
+	memset(hd, 0, sizeof *hd);
+	w->len = 0;
+	return (i);
+}
+
+int
+VSL_Write(struct VSL_writer *w, const uint32_t *p)
+{
+	struct vslz_block *hd;
+	size_t l;
+	unsigned t, id;
+	uint64_t now;
+
+	CHECK_OBJ_NOTNULL(w, VSL_WRITER_MAGIC);
+	AN(p);
+	l = (VSL_NEXT(p) - p) * 4L;
+	if (w->raw)
+		return (vsl_write_all(w->fd, p, l));
+
+	assert(l <= VSLZ_BLOCK);
+	if (w->len + l > VSLZ_BLOCK && VSL_WriteFlush(w))
+		return (-1);
+	memcpy(w->buf + w->len, p, l);
+	w->len += l;
+
+	hd = &w->hd;
+	t = VSL_TAG(p);
+	VSLZ_TAG_SET(hd, t);
+	if (VSL_CLIENT(p))
+		hd->spec |= VSL_S_CLIENT;
+	if (VSL_BACKEND(p))
+		hd->spec |= VSL_S_BACKEND;
+	id = VSL_ID(p);
+	if (id != 0) {
+		if (hd->vxid_lo == 0 || id < hd->vxid_lo)
+			hd->vxid_lo = id;
+		if (id > hd->vxid_hi)
+			hd->vxid_hi = id;
+	}
+	now = time(NULL);
+	if (hd->nrec++ == 0)
+		hd->t_first = now;
+	hd->t_last = now;
+	return (0);
+}
+
+int
+VSL_WriterDelete(struct VSL_writer *w)
+{
+	int i;
+
+	CHECK_OBJ_NOTNULL(w, VSL_WRITER_MAGIC);
+	i = VSL_WriteFlush(w);
+	if (!w->raw)
+		(void)deflateEnd(&w->z);
+	free(w->buf);
+	free(w->obuf);
+	FREE_OBJ(w);
+	return (i);
+}
@@ -0,0 +1,356 @@
+/*-
+ * Copyright (c) 2013 Varnish Software AS
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * Collect log records into transactions by vxid.
+ *
+ * The records of each open transaction are copied into a buffer of its
+ * own, found through a hash on the identifier word, and the transactions
+ * are kept on a list in the order they were opened, so that the oldest
+ * can be pushed out when the total size goes over VSL_TRANS_BUFSIZE.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "miniobj.h"
+#include "vas.h"
+#include "vdef.h"
+
+#include "vapi/vsl.h"
+#include "vapi/vsm.h"
+#include "vre.h"
+#include "vsl_api.h"
+
+#define VSL_TRANS_NHASH		4096		/* Power of two */
+#define VSL_TRANS_BUFSIZE	(16 * 1024 * 1024)
+#define VSL_TRANS_NFREE		64
+
+struct vsl_tx {
+	unsigned		magic;
+#define VSL_TX_MAGIC		0x2b6e1f53
+	uint32_t		id;		/* vxid + markers */
+	unsigned		flags;
+	uint64_t		bitmap;
+	uint32_t		*buf;
+	unsigned		len;		/* words */
+	unsigned		space;		/* words */
+	VTAILQ_ENTRY(vsl_tx)	hlist;
+	VTAILQ_ENTRY(vsl_tx)	list;
+};
+
+VTAILQ_HEAD(vsl_txhead, vsl_tx);
+
+struct vsl_trans {
+	unsigned		magic;
+#define VSL_TRANS_MAGIC		0x7c0d3a95
+	struct vsl_txhead	hash[VSL_TRANS_NHASH];
+	struct vsl_txhead	open;		/* oldest first */
+	struct vsl_txhead	free;
+	unsigned		nfree;
+	size_t			bytes;
+	unsigned		overruns;
+};
+
+/*--------------------------------------------------------------------*/
+
+static struct vsl_trans *
+vsl_trans_setup(struct vsl *vsl)
+{
+	struct vsl_trans *vt;
+	unsigned u;
+
+	if (vsl->trans == NULL) {
+		ALLOC_OBJ(vt, VSL_TRANS_MAGIC);
+		AN(vt);
+		for (u = 0; u < VSL_TRANS_NHASH; u++)
+			VTAILQ_INIT(&vt->hash[u]);
+		VTAILQ_INIT(&vt->open);
+		VTAILQ_INIT(&vt->free);
+		vt->overruns = vsl->overruns;
+		vsl->trans = vt;
+	}
+	CHECK_OBJ_NOTNULL(vsl->trans, VSL_TRANS_MAGIC);
+	return (vsl->trans);
+}
+
+static void
+vsl_tx_free(struct vsl_tx *tx)
+{
+
+	CHECK_OBJ_NOTNULL(tx, VSL_TX_MAGIC);
+	free(tx->buf);
+	FREE_OBJ(tx);
+}
+
+void
+vsl_trans_delete(struct vsl *vsl)
+{
+	struct vsl_trans *vt;
+	struct vsl_tx *tx;
+
+	vt = vsl->trans;
+	vsl->trans = NULL;
+	if (vt == NULL)
+		return;
+	CHECK_OBJ_NOTNULL(vt, VSL_TRANS_MAGIC);
+	while ((tx = VTAILQ_FIRST(&vt->open)) != NULL) {
+		VTAILQ_REMOVE(&vt->open, tx, list);
+		vsl_tx_free(tx);
+	}
+	while ((tx = VTAILQ_FIRST(&vt->free)) != NULL) {
+		VTAILQ_REMOVE(&vt->free, tx, list);
+		vsl_tx_free(tx);
+	}
+	FREE_OBJ(vt);
+}
+
+/*--------------------------------------------------------------------*/
+
+static struct vsl_txhead *
+vsl_trans_bucket(struct vsl_trans *vt, uint32_t id)
+{
+
+	return (&vt->hash[(id * 2654435761U) >> 20 & (VSL_TRANS_NHASH - 1)]);
+}
+
+static struct vsl_tx *
+vsl_trans_find(struct vsl_trans *vt, uint32_t id)
+{
+	struct vsl_tx *tx;
+
+	VTAILQ_FOREACH(tx, vsl_trans_bucket(vt, id), hlist)
+		if (tx->id == id)
+			return (tx);
+	return (NULL);
+}
+
+static struct vsl_tx *
+vsl_trans_get(struct vsl_trans *vt, uint32_t id)
+{
+	struct vsl_txhead *hp;
+	struct vsl_tx *tx;
+
+	tx = vsl_trans_find(vt, id);
+	if (tx != NULL)
+		return (tx);
+	hp = vsl_trans_bucket(vt, id);
+
+	tx = VTAILQ_FIRST(&vt->free);
+	if (tx != NULL) {
+		VTAILQ_REMOVE(&vt->free, tx, list);
+		vt->nfree--;
+		vt->bytes += tx->space * 4L;
+	} else {
+		ALLOC_OBJ(tx, VSL_TX_MAGIC);
+		AN(tx);
+	}
+	tx->id = id;
+	tx->flags = 0;
+	tx->bitmap = 0;
+	tx->len = 0;
+	VTAILQ_INSERT_HEAD(hp, tx, hlist);
+	VTAILQ_INSERT_TAIL(&vt->open, tx, list);
+	return (tx);
+}
+
+static void
+vsl_trans_add(struct vsl_trans *vt, struct vsl_tx *tx, const uint32_t *p,
+    uint64_t bitmap)
+{
+	unsigned l;
+
+	l = VSL_NEXT(p) - p;
+	if (tx->len + l > tx->space) {
+		vt->bytes -= tx->space * 4L;
+		if (tx->space == 0)
+			tx->space = 256;
+		while (tx->len + l > tx->space)
+			tx->space *= 2;
+		tx->buf = realloc(tx->buf, tx->space * 4L);
+		AN(tx->buf);
+		vt->bytes += tx->space * 4L;
+	}
+	memcpy(tx->buf + tx->len, p, l * 4L);
+	tx->len += l;
+	tx->bitmap |= bitmap;
+}
+
+/*--------------------------------------------------------------------
+ * Hand a transaction to the caller, and retire it.
+ */
+
+static int
+vsl_trans_call(VSL_trans_f *func, void *priv, uint32_t id, unsigned flags,
+    uint64_t bitmap, uint32_t *b, unsigned len)
+{
+	struct VSL_transaction t;
+
+	memset(&t, 0, sizeof t);
+	t.vxid = id & VSL_IDENTMASK;
+	if (id & VSL_CLIENTMARKER)
+		t.spec |= VSL_S_CLIENT;
+	if (id & VSL_BACKENDMARKER)
+		t.spec |= VSL_S_BACKEND;
+	t.flags = flags;
+	t.bitmap = bitmap;
+	t.b = b;
+	t.e = b + len;
+	return (func(priv, &t));
+}
+
+static int
+vsl_trans_deliver(struct vsl_trans *vt, struct vsl_tx *tx, VSL_trans_f *func,
+    void *priv)
+{
+	int i;
+
+	CHECK_OBJ_NOTNULL(tx, VSL_TX_MAGIC);
+	i = vsl_trans_call(func, priv, tx->id, tx->flags, tx->bitmap,
+	    tx->buf, tx->len);
+
+	VTAILQ_REMOVE(vsl_trans_bucket(vt, tx->id), tx, hlist);
+	VTAILQ_REMOVE(&vt->open, tx, list);
+	vt->bytes -= tx->space * 4L;
+	if (vt->nfree < VSL_TRANS_NFREE && tx->space <= 1024) {
+		VTAILQ_INSERT_HEAD(&vt->free, tx, list);
+		vt->nfree++;
+	} else
+		vsl_tx_free(tx);
+	return (i);
+}
+
+static int
+vsl_trans_flush(struct vsl_trans *vt, unsigned flags, VSL_trans_f *func,
+    void *priv)
+{
+	struct vsl_tx *tx;
+	int i, r = 0;
+
+	while ((tx = VTAILQ_FIRST(&vt->open)) != NULL) {
+		tx->flags |= flags;
+		i = vsl_trans_deliver(vt, tx, func, priv);
+		if (r == 0)
+			r = i;
+	}
+	return (r);
+}
+
+/*--------------------------------------------------------------------*/
+
+/*
+ * Does this record end its transaction?  Client transactions can log
+ * backend connections being closed, so go by the kind of transaction.
+ *
+ * These records are seen even when the filters drop them, to end the
+ * transaction with, but they are only added to it if they pass.
+ */
+
+static int
+vsl_trans_end(const uint32_t *p)
+{
+
+	switch (VSL_TAG(p)) {
+	case SLT_ReqEnd:
+	case SLT_SessClose:
+		return (VSL_CLIENT(p) != 0);
+	case SLT_BackendClose:
+	case SLT_BackendReuse:
+		return (VSL_BACKEND(p) != 0);
+	default:
+		return (0);
+	}
+}
+
+int
+VSL_DispatchTrans(struct VSM_data *vd, VSL_trans_f *func, void *priv)
+{
+	struct vsl *vsl = vsl_Setup(vd);
+	struct vsl_trans *vt;
+	struct vsl_tx *tx;
+	uint32_t *p;
+	uint64_t bitmap;
+	int i, j, forced;
+
+	vt = vsl_trans_setup(vsl);
+
+	while (1) {
+		i = vsl_next(vd, &p, &bitmap, vsl_trans_end, &forced);
+		if (vsl->overruns != vt->overruns) {
+			vt->overruns = vsl->overruns;
+			VTAILQ_FOREACH(tx, &vt->open, list)
+				tx->flags |= VSL_T_OVERRUN;
+		}
+		if (i < 0) {
+			j = vsl_trans_flush(vt,
+			    i == -1 ? VSL_T_OVERRUN : 0, func, priv);
+			return (j ? j : i);
+		}
+		if (i == 0)
+			return (i);
+
+		if (forced) {
+			/* Filtered out, but it still ends its transaction */
+			tx = vsl_trans_find(vt, p[1]);
+			if (tx == NULL)
+				continue;
+			tx->flags |= VSL_T_COMPLETE;
+			i = vsl_trans_deliver(vt, tx, func, priv);
+			if (i)
+				return (i);
+			continue;
+		}
+
+		if (VSL_ID(p) == 0) {
+			/* Not part of a transaction, pass it on as is */
+			i = vsl_trans_call(func, priv, p[1], VSL_T_COMPLETE,
+			    bitmap, p, VSL_NEXT(p) - p);
+			if (i)
+				return (i);
+			continue;
+		}
+
+		tx = vsl_trans_get(vt, p[1]);
+		vsl_trans_add(vt, tx, p, bitmap);
+		if (vsl_trans_end(p)) {
+			tx->flags |= VSL_T_COMPLETE;
+			i = vsl_trans_deliver(vt, tx, func, priv);
+			if (i)
+				return (i);
+		}
+
+		while (vt->bytes > VSL_TRANS_BUFSIZE) {
+			tx = VTAILQ_FIRST(&vt->open);
+			AN(tx);
+			tx->flags |= VSL_T_EVICTED;
+			i = vsl_trans_deliver(vt, tx, func, priv);
+			if (i)
+				return (i);
+		}
+	}
+}
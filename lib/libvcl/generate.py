@@ -764,6 +764,11 @@ struct VCL_conf {
 
 	vcl_init_f	*init_vcl;
 	vcl_fini_f	*fini_vcl;
+
+	/* Only if compiled with vcc_profile */
+	struct vrt_prof	**prof;
+	unsigned	nsub;
+	const char	**subname;
 """)
 
 for i in returns:
@@ -415,6 +415,7 @@ vcc_ParseHostDef(struct vcc *tl, int serial, const char *vgcname)
 	    "?connect_timeout",
 	    "?first_byte_timeout",
 	    "?between_bytes_timeout",
+	    "?idle_timeout",
 	    "?probe",
 	    "?max_connections",
 	    "?saintmode_threshold",
@@ -486,6 +487,12 @@ vcc_ParseHostDef(struct vcc *tl, int serial, const char *vgcname)
 			ERRCHK(tl);
 			Fb(tl, 0, "%g,\n", t);
 			SkipToken(tl, ';');
+		} else if (vcc_IdIs(t_field, "idle_timeout")) {
+			Fb(tl, 0, "\t.idle_timeout = ");
+			vcc_TimeVal(tl, &t);
+			ERRCHK(tl);
+			Fb(tl, 0, "%g,\n", t);
+			SkipToken(tl, ';');
 		} else if (vcc_IdIs(t_field, "max_connections")) {
 			u = vcc_UintVal(tl);
 			ERRCHK(tl);
@@ -691,6 +698,9 @@ static const struct dirlist {
 	{ "round-robin",	vcc_ParseRoundRobinDirector },
 	{ "fallback",		vcc_ParseRoundRobinDirector },
 	{ "dns",		vcc_ParseDnsDirector },
+	{ "chash",		vcc_ParseChashDirector },
+	{ "least-conn",		vcc_ParseRoundRobinDirector },
+	{ "least-latency",	vcc_ParseRoundRobinDirector },
 	{ NULL,		NULL }
 };
 
@@ -296,6 +296,61 @@ LocTable(const struct vcc *tl)
 	Fc(tl, 0, "};\n");
 }
 
+/*--------------------------------------------------------------------
+ * With vcc_profile, the subroutines were emitted as VGC_body_*, wrap
+ * them in VGC_function_* which account for the time spent in them.
+ * The counters for the subroutines follow the ones for the ref table,
+ * first the methods, then the rest in order of definition.
+ */
+
+static void
+EmitProfileWrapper(struct vcc *tl, const char *name)
+{
+
+	Fc(tl, 0, "\nstatic int __match_proto__(vcl_func_f)\n");
+	Fc(tl, 0, "VGC_function_%s(struct req *req)\n", name);
+	Fc(tl, 0, "{\n");
+	Fc(tl, 0, "\tstruct vrt_prof_frame vpf;\n");
+	Fc(tl, 0, "\tint retval;\n\n");
+	Fc(tl, 0, "\tVRT_prof_enter(req, &vpf, VGC_prof);\n");
+	Fc(tl, 0, "\tretval = VGC_body_%s(req);\n", name);
+	Fc(tl, 0, "\tVRT_prof_leave(req, &vpf, VGC_prof, VGC_NREFS + %u);\n",
+	    tl->nsub++);
+	Fc(tl, 0, "\treturn (retval);\n");
+	Fc(tl, 0, "}\n");
+}
+
+static void
+EmitProfile(struct vcc *tl)
+{
+	struct symbol *sym;
+	struct vsb *vsb;
+	int i;
+
+	vsb = VSB_new_auto();
+	AN(vsb);
+	Fh(tl, 0, "\nstatic struct vrt_prof *VGC_prof;\n");
+	for (i = 0; i < VCL_MET_MAX; i++) {
+		EmitProfileWrapper(tl, method_tab[i].name);
+		VSB_printf(vsb, "\t\"%s\",\n", method_tab[i].name);
+	}
+	VTAILQ_FOREACH(sym, &tl->symbols, list) {
+		if (sym->kind != SYM_SUB || sym->ndef == 0)
+			continue;
+		for (i = 0; i < VCL_MET_MAX; i++)
+			if (!strcmp(sym->name, method_tab[i].name))
+				break;
+		if (i < VCL_MET_MAX)
+			continue;
+		EmitProfileWrapper(tl, sym->name);
+		VSB_printf(vsb, "\t\"%s\",\n", sym->name);
+	}
+	AZ(VSB_finish(vsb));
+	Fc(tl, 0, "\nstatic const char *VGC_subname[%u] = {\n%s};\n",
+	    tl->nsub, VSB_data(vsb));
+	VSB_delete(vsb);
+}
+
 /*--------------------------------------------------------------------*/
 
 static void
@@ -368,6 +423,11 @@ EmitStruct(const struct vcc *tl)
 	Fc(tl, 0, "\t.nsrc = %u,\n", tl->nsources);
 	Fc(tl, 0, "\t.srcname = srcname,\n");
 	Fc(tl, 0, "\t.srcbody = srcbody,\n");
+	if (tl->profile) {
+		Fc(tl, 0, "\t.prof = &VGC_prof,\n");
+		Fc(tl, 0, "\t.nsub = %u,\n", tl->nsub);
+		Fc(tl, 0, "\t.subname = VGC_subname,\n");
+	}
 #define VCL_MET_MAC(l,u,b) \
 	Fc(tl, 0, "\t." #l "_func = VGC_function_vcl_" #l ",\n");
 #include "tbl/vcl_returns.h"
@@ -493,6 +553,7 @@ vcc_NewVcc(const struct vcc *tl0)
 		tl->err_unref = tl0->err_unref;
 		tl->allow_inline_c = tl0->allow_inline_c;
 		tl->unsafe_path = tl0->unsafe_path;
+		tl->profile = tl0->profile;
 	} else {
 		tl->err_unref = 1;
 	}
@@ -501,6 +562,7 @@ vcc_NewVcc(const struct vcc *tl0)
 	VTAILQ_INIT(&tl->membits);
 	VTAILQ_INIT(&tl->tokens);
 	VTAILQ_INIT(&tl->sources);
+	VTAILQ_INIT(&tl->regexps);
 
 	tl->nsources = 0;
 	tl->ndirector = 1;
@@ -672,7 +734,8 @@ vcc_CompileSource(const struct vcc *tl0, struct vsb *sb, struct source *sp)
 	/* Emit method functions */
 	for (i = 0; i < VCL_MET_MAX; i++) {
 		Fc(tl, 1, "\nstatic int __match_proto__(vcl_func_f)\n");
-		Fc(tl, 1, "VGC_function_%s(struct req *req)\n",
+		Fc(tl, 1, "%s%s(struct req *req)\n",
+		    tl->profile ? "VGC_body_" : "VGC_function_",
 		    method_tab[i].name);
 		AZ(VSB_finish(tl->fm[i]));
 		Fc(tl, 1, "{\n");
@@ -680,6 +743,9 @@ vcc_CompileSource(const struct vcc *tl0, struct vsb *sb, struct source *sp)
 		Fc(tl, 1, "}\n");
 	}
 
+	if (tl->profile)
+		EmitProfile(tl);
+
 	LocTable(tl);
 
 	EmitInitFunc(tl);
@@ -797,3 +863,11 @@ VCC_Unsafe_Path(struct vcc *tl, unsigned u)
 	CHECK_OBJ_NOTNULL(tl, VCC_MAGIC);
 	tl->unsafe_path = u;
 }
+
+void
+VCC_Profile(struct vcc *tl, unsigned u)
+{
+
+	CHECK_OBJ_NOTNULL(tl, VCC_MAGIC);
+	tl->profile = u;
+}
@@ -195,6 +195,27 @@ struct vcc {
 	unsigned		err_unref;
 	unsigned		allow_inline_c;
 	unsigned		unsafe_path;
+	unsigned		profile;
+	unsigned		nsub;
+
+	struct vcc_rechain	*rechain;
+	VTAILQ_HEAD(, vcc_re)	regexps;
+};
+
+/* A regexp, compiled once for the whole VCL */
+struct vcc_re {
+	VTAILQ_ENTRY(vcc_re)	list;
+	const char		*re;
+	unsigned		kind;		/* VRT_RE_* */
+	char			*name;
+};
+
+/* An if/elsif chain of regexp matches against the same variable */
+struct vcc_rechain {
+	unsigned		n;
+	struct token		**re;
+	char			set[32];
+	char			idx[32];
 };
 
 struct var {
@@ -267,6 +288,9 @@ char *TlDupTok(struct vcc *tl, const struct token *tok);
 
 void EncString(struct vsb *sb, const char *b, const char *e, int mode);
 
+/* vcc_dir_chash.c */
+parsedirector_f vcc_ParseChashDirector;
+
 /* vcc_dir_random.c */
 parsedirector_f vcc_ParseRandomDirector;
 
@@ -297,7 +321,8 @@ void vcc_Parse(struct vcc *tl);
 sym_wildcard_t vcc_Stv_Wildcard;
 
 /* vcc_string.c */
-char *vcc_regexp(struct vcc *tl);
+char *vcc_regexp(struct vcc *tl, int match);
+int vcc_regexp_check(struct vcc *tl);
 
 /* vcc_symb.c */
 struct symbol *VCC_AddSymbolStr(struct vcc *tl, const char *name, enum symkind);
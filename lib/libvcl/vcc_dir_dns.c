@@ -44,6 +44,7 @@ static struct vcc_dir_backend_defaults {
 	double connect_timeout;
 	double first_byte_timeout;
 	double between_bytes_timeout;
+	double idle_timeout;
 	unsigned max_connections;
 	unsigned saint;
 } b_defaults;
@@ -56,6 +57,7 @@ vcc_dir_initialize_defaults(void)
 	b_defaults.connect_timeout = -1.0;
 	b_defaults.first_byte_timeout = -1.0;
 	b_defaults.between_bytes_timeout = -1.0;
+	b_defaults.idle_timeout = -1.0;
 	b_defaults.max_connections = UINT_MAX;
 	b_defaults.saint = UINT_MAX;
 }
@@ -105,6 +107,7 @@ print_backend(struct vcc *tl,
 	FB_TIMEOUT(connect_timeout);
 	FB_TIMEOUT(first_byte_timeout);
 	FB_TIMEOUT(between_bytes_timeout);
+	FB_TIMEOUT(idle_timeout);
 
 	Fb(tl, 0, "};\n");
 	tl->fb = NULL;
@@ -172,6 +175,7 @@ vcc_dir_dns_parse_backend_options(struct vcc *tl)
 	    "?connect_timeout",
 	    "?first_byte_timeout",
 	    "?between_bytes_timeout",
+	    "?idle_timeout",
 	    "?max_connections",
 	    "?saintmode_threshold",
 	    NULL);
@@ -208,6 +212,11 @@ vcc_dir_dns_parse_backend_options(struct vcc *tl)
 			ERRCHK(tl);
 			b_defaults.between_bytes_timeout = t;
 			SkipToken(tl, ';');
+		} else if (vcc_IdIs(t_field, "idle_timeout")) {
+			vcc_TimeVal(tl, &t);
+			ERRCHK(tl);
+			b_defaults.idle_timeout = t;
+			SkipToken(tl, ';');
 		} else if (vcc_IdIs(t_field, "max_connections")) {
 			u = vcc_UintVal(tl);
 			ERRCHK(tl);
@@ -463,7 +463,7 @@ vcc_Eval_Regsub(struct vcc *tl, struct expr **e, const struct symbol *sym)
 
 	SkipToken(tl, ',');
 	ExpectErr(tl, CSTR);
-	p = vcc_regexp(tl);
+	p = vcc_regexp(tl, 0);
 	vcc_NextToken(tl);
 
 	bprintf(buf, "VRT_regsub(req, %d,\n\v1,\n%s\n", all, p);
@@ -902,6 +902,26 @@ static const struct cmps {
 
 #undef NUM_REL
 
+/*
+ * Is the regexp after the '~' part of the if/elsif chain being compiled,
+ * see vcc_re_chain() ?  Return its index in the set, or -1.
+ */
+
+static int
+vcc_expr_rechain(const struct vcc *tl)
+{
+	const struct token *t;
+	unsigned u;
+
+	if (tl->rechain == NULL)
+		return (-1);
+	t = VTAILQ_NEXT(tl->t, list);
+	for (u = 0; u < tl->rechain->n; u++)
+		if (tl->rechain->re[u] == t)
+			return (u);
+	return (-1);
+}
+
 static void
 vcc_expr_cmp(struct vcc *tl, struct expr **e, enum var_type fmt)
 {
@@ -911,6 +931,7 @@ vcc_expr_cmp(struct vcc *tl, struct expr **e, enum var_type fmt)
 	char *re;
 	const char *not;
 	struct token *tk;
+	int i;
 
 	*e = NULL;
 
@@ -939,12 +960,27 @@ vcc_expr_cmp(struct vcc *tl, struct expr **e, enum var_type fmt)
 		*e = vcc_expr_edit(BOOL, cp->emit, *e, e2);
 		return;
 	}
+	if ((*e)->fmt == STRING && tl->t->tok == '~' &&
+	    (i = vcc_expr_rechain(tl)) >= 0) {
+		vcc_NextToken(tl);
+		if (vcc_regexp_check(tl))
+			return;
+		vcc_NextToken(tl);
+		if (i == 0)
+			bprintf(buf,
+			    "((%s = VRT_re_set_match(req, \v1, %s)) == 0)",
+			    tl->rechain->idx, tl->rechain->set);
+		else
+			bprintf(buf, "(%s == %d)", tl->rechain->idx, i);
+		*e = vcc_expr_edit(BOOL, buf, *e, NULL);
+		return;
+	}
 	if ((*e)->fmt == STRING &&
 	    (tl->t->tok == '~' || tl->t->tok == T_NOMATCH)) {
 	        not = tl->t->tok == '~' ? "" : "!";
 		vcc_NextToken(tl);
 		ExpectErr(tl, CSTR);
-		re = vcc_regexp(tl);
+		re = vcc_regexp(tl, 1);
 		ERRCHK(tl);
 		vcc_NextToken(tl);
 		bprintf(buf, "%sVRT_re_match(req, \v1, %s)", not, re);
@@ -47,7 +47,11 @@ static void vcc_Compound(struct vcc *tl);
 } while (0)
 
 #define C(tl, sep)	do {					\
-	Fb(tl, 1, "VRT_count(req, %u)%s\n", ++tl->cnt, sep);	\
+	if (tl->profile)					\
+		Fb(tl, 1, "VRT_prof_count(req, VGC_prof, %u)%s\n",	\
+		    ++tl->cnt, sep);				\
+	else							\
+		Fb(tl, 1, "VRT_count(req, %u)%s\n", ++tl->cnt, sep);	\
 	tl->t->cnt = tl->cnt;					\
 } while (0)
 
@@ -69,6 +73,99 @@ vcc_Conditional(struct vcc *tl)
 	SkipToken(tl, ')');
 }
 
+/*--------------------------------------------------------------------
+ * Look ahead for an if/elsif chain where several of the conditionals
+ * are nothing but a regexp match against the same variable:
+ *
+ *	if (req.url ~ "^/a") { ... }
+ *	elsif (req.url ~ "^/b") { ... }
+ *	...
+ *
+ * These are matched as one set, with VRT_re_set_match(), when the
+ * first of them is evaluated, and the rest just compare the index it
+ * returned.  Since a conditional is only evaluated if all before it
+ * were false, the regexp for the n'th of them matches if and only if
+ * it is the first in the set to do so.
+ */
+
+#define VCC_RECHAIN_MIN		3
+
+static struct token *
+vcc_skip_balanced(struct token *t, unsigned open, unsigned close)
+{
+	int depth = 0;
+
+	assert(t->tok == open);
+	for (; t != NULL && t->tok != EOI; t = VTAILQ_NEXT(t, list)) {
+		if (t->tok == open)
+			depth++;
+		else if (t->tok == close && --depth == 0)
+			return (VTAILQ_NEXT(t, list));
+	}
+	return (NULL);
+}
+
+static struct vcc_rechain *
+vcc_re_chain(struct vcc *tl)
+{
+	struct token *t, *t1, *t2, *t3, *t4, *subject = NULL;
+	struct token *re[1024];
+	struct vcc_rechain *rc;
+	unsigned n = 0, u;
+
+	t = tl->t;
+	while (t != NULL && t->tok == '(' && n < 1024) {
+		t1 = VTAILQ_NEXT(t, list);
+		t2 = t1 == NULL ? NULL : VTAILQ_NEXT(t1, list);
+		t3 = t2 == NULL ? NULL : VTAILQ_NEXT(t2, list);
+		t4 = t3 == NULL ? NULL : VTAILQ_NEXT(t3, list);
+		if (t4 != NULL && t1->tok == ID && t2->tok == '~' &&
+		    t3->tok == CSTR && t4->tok == ')') {
+			if (subject == NULL)
+				subject = t1;
+			if (vcc_Teq(t1, subject))
+				re[n++] = t3;
+		}
+		t = vcc_skip_balanced(t, '(', ')');
+		if (t == NULL || t->tok != '{')
+			break;
+		t = vcc_skip_balanced(t, '{', '}');
+		if (t == NULL)
+			break;
+		if (t->tok == T_ELSE) {
+			t = VTAILQ_NEXT(t, list);
+			if (t == NULL || t->tok != T_IF)
+				break;
+		} else if (t->tok != T_ELSIF && t->tok != T_ELSEIF)
+			break;
+		t = VTAILQ_NEXT(t, list);
+	}
+	if (n < VCC_RECHAIN_MIN)
+		return (NULL);
+
+	rc = TlAlloc(tl, sizeof *rc);
+	AN(rc);
+	rc->n = n;
+	rc->re = TlAlloc(tl, n * sizeof *rc->re);
+	AN(rc->re);
+	memcpy(rc->re, re, n * sizeof *rc->re);
+	u = tl->unique++;
+	bprintf(rc->set, "VGC_rs_%u", u);
+	bprintf(rc->idx, "vgc_rs_%u", u);
+
+	Fh(tl, 0, "static void *%s;\n", rc->set);
+	Fh(tl, 0, "static const char * const %s_re[] = {\n", rc->set);
+	for (u = 0; u < n; u++) {
+		Fh(tl, 0, "\t");
+		EncToken(tl->fh, rc->re[u]);
+		Fh(tl, 0, ",\n");
+	}
+	Fh(tl, 0, "\t(void*)0\n};\n");
+	Fi(tl, 0, "\tVRT_re_set_init(&%s, %s_re);\n", rc->set, rc->set);
+	Ff(tl, 0, "\tVRT_re_set_fini(%s);\n", rc->set);
+	return (rc);
+}
+
 /*--------------------------------------------------------------------
  * SYNTAX:
  *    IfStmt:
@@ -80,11 +177,34 @@ vcc_Conditional(struct vcc *tl)
  *	null
  */
 
+static void vcc_IfChain(struct vcc *tl);
+
 static void
 vcc_IfStmt(struct vcc *tl)
 {
+	struct vcc_rechain *rc, *orc;
 
 	SkipToken(tl, T_IF);
+	orc = tl->rechain;
+	rc = vcc_re_chain(tl);
+	if (rc != NULL) {
+		tl->rechain = rc;
+		Fb(tl, 1, "{\n");
+		tl->indent += INDENT;
+		Fb(tl, 1, "int %s;\n", rc->idx);
+	}
+	vcc_IfChain(tl);
+	if (rc != NULL) {
+		tl->indent -= INDENT;
+		Fb(tl, 1, "}\n");
+	}
+	tl->rechain = orc;
+}
+
+static void
+vcc_IfChain(struct vcc *tl)
+{
+
 	Fb(tl, 1, "if ");
 	vcc_Conditional(tl);
 	ERRCHK(tl);
@@ -227,8 +347,8 @@ vcc_Function(struct vcc *tl)
 		Fh(tl, 0, "static int VGC_function_%.*s "
 		    "(struct req *);\n", PF(tl->t));
 		Fc(tl, 1, "\nstatic int __match_proto__(vcl_func_t)\n");
-		Fc(tl, 1, "VGC_function_%.*s(struct req *req)\n",
-		    PF(tl->t));
+		Fc(tl, 1, "%s%.*s(struct req *req)\n",
+		    tl->profile ? "VGC_body_" : "VGC_function_", PF(tl->t));
 	}
 	vcc_NextToken(tl);
 	tl->indent += INDENT;
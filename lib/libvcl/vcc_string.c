@@ -29,6 +29,7 @@
 
 #include "config.h"
 
+#include <ctype.h>
 #include <stdio.h>
 #include <string.h>
 
@@ -39,34 +40,129 @@
 
 /*--------------------------------------------------------------------*/
 
-char *
-vcc_regexp(struct vcc *tl)
+int
+vcc_regexp_check(struct vcc *tl)
 {
-	char buf[BUFSIZ], *p;
 	vre_t *t;
 	const char *error;
 	int erroroffset;
 
 	Expect(tl, CSTR);
 	if (tl->err)
-		return (NULL);
-	memset(&t, 0, sizeof t);
+		return (-1);
 	t = VRE_compile(tl->t->dec, 0, &error, &erroroffset);
 	if (t == NULL) {
 		VSB_printf(tl->sb,
 		    "Regexp compilation error:\n\n%s\n\n", error);
 		vcc_ErrWhere(tl, tl->t);
-		return (NULL);
+		return (-1);
 	}
 	VRE_free(&t);
+	return (0);
+}
+
+/*--------------------------------------------------------------------
+ * Many regexps are just a literal string, maybe anchored at one or both
+ * ends, maybe case insensitive.  Those are matched without PCRE, so find
+ * out if this is one, and if so return the kind and put the literal,
+ * folded to lower case if (?i), in lit.
+ */
+
+static const char * const vcc_re_kinds[] = {
+	[VRT_RE_PCRE] =		"VRT_RE_PCRE",
+	[VRT_RE_SUBSTR] =	"VRT_RE_SUBSTR",
+	[VRT_RE_PREFIX] =	"VRT_RE_PREFIX",
+	[VRT_RE_SUFFIX] =	"VRT_RE_SUFFIX",
+	[VRT_RE_EXACT] =	"VRT_RE_EXACT",
+};
+
+static unsigned
+vcc_regexp_kind(const char *re, char *lit)
+{
+	unsigned kind = 0, l = 0;
+	int start = 0, end = 0;
+	const char *p;
+	char c;
+
+	p = re;
+	if (!strncmp(p, "(?i)", 4)) {
+		kind |= VRT_RE_ICASE;
+		p += 4;
+	}
+	if (*p == '^') {
+		start = 1;
+		p++;
+	}
+	while (*p != '\0') {
+		if (*p == '\\') {
+			/* \d, \w, \1, \Q etc. are not literals */
+			if (p[1] == '\0' || isalnum((unsigned char)p[1]))
+				return (VRT_RE_PCRE);
+			c = p[1];
+			p += 2;
+		} else if (*p == '$' && p[1] == '\0') {
+			end = 1;
+			break;
+		} else if (strchr(".[](){}*+?^$|", *p) != NULL) {
+			return (VRT_RE_PCRE);
+		} else
+			c = *p++;
+		if ((kind & VRT_RE_ICASE) && c >= 'A' && c <= 'Z')
+			c += 'a' - 'A';
+		lit[l++] = c;
+	}
+	lit[l] = '\0';
+	if (start && end)
+		return (kind | VRT_RE_EXACT);
+	if (start)
+		return (kind | VRT_RE_PREFIX);
+	if (end)
+		return (kind | VRT_RE_SUFFIX);
+	return (kind | VRT_RE_SUBSTR);
+}
+
+/*--------------------------------------------------------------------
+ * Return the name of the compiled regexp for the CSTR token, sharing
+ * it with any earlier use of the same regexp in the VCL.
+ *
+ * For VRT_regsub() we need the real thing, for VRT_re_match() it can
+ * be one of the literal kinds.
+ */
+
+char *
+vcc_regexp(struct vcc *tl, int match)
+{
+	char buf[BUFSIZ], *lit;
+	struct vcc_re *vr;
+	unsigned kind;
+
+	if (vcc_regexp_check(tl))
+		return (NULL);
+	lit = TlAlloc(tl, strlen(tl->t->dec) + 1);
+	kind = match ? vcc_regexp_kind(tl->t->dec, lit) : VRT_RE_PCRE;
+
+	VTAILQ_FOREACH(vr, &tl->regexps, list)
+		if (vr->kind == kind && !strcmp(vr->re, tl->t->dec))
+			return (vr->name);
+
 	sprintf(buf, "VGC_re_%u", tl->unique++);
-	p = TlAlloc(tl, strlen(buf) + 1);
-	strcpy(p, buf);
+	vr = TlAlloc(tl, sizeof *vr);
+	AN(vr);
+	vr->re = tl->t->dec;
+	vr->kind = kind;
+	vr->name = TlDup(tl, buf);
+	VTAILQ_INSERT_TAIL(&tl->regexps, vr, list);
 
 	Fh(tl, 0, "static void *%s;\n", buf);
 	Fi(tl, 0, "\tVRT_re_init(&%s, ",buf);
 	EncToken(tl->fi, tl->t);
+	Fi(tl, 0, ", %s%s, ", vcc_re_kinds[kind & VRT_RE_KIND],
+	    kind & VRT_RE_ICASE ? " | VRT_RE_ICASE" : "");
+	if (kind == VRT_RE_PCRE)
+		Fi(tl, 0, "0");
+	else
+		EncString(tl->fi, lit, NULL, 0);
 	Fi(tl, 0, ");\n");
 	Ff(tl, 0, "\tVRT_re_fini(%s);\n", buf);
-	return (p);
+	return (vr->name);
 }
@@ -54,6 +54,22 @@ int main(int argc, char **argv)
 #include "tbl/vsc_fields.h"
 #undef VSC_DO_SMF
 
+	P("");
+	P("PER PERSISTENT STORAGE COUNTERS");
+	P("===============================");
+	P("");
+#define VSC_DO_SMP
+#include "tbl/vsc_fields.h"
+#undef VSC_DO_SMP
+
+	P("");
+	P("PER STEVEDORE ROUTING COUNTERS");
+	P("==============================");
+	P("");
+#define VSC_DO_STV
+#include "tbl/vsc_fields.h"
+#undef VSC_DO_STV
+
 	P("");
 	P("PER BACKEND COUNTERS");
 	P("====================");